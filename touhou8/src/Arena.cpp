@@ -0,0 +1,40 @@
+#include "Arena.h"
+
+#include "utils.h"
+
+namespace th {
+
+	void Arena::Init(size_t _size) {
+		Release();
+
+		base = (uint8_t*) SDL_malloc(_size);
+		if (!base) {
+			LOG("Couldn't allocate a %zu byte arena.", _size);
+			return;
+		}
+		size = _size;
+		used = 0;
+	}
+
+	void Arena::Release() {
+		SDL_free(base);
+		base = nullptr;
+		size = 0;
+		used = 0;
+	}
+
+	void* Arena::Alloc(size_t _size, size_t align) {
+		if (!base) return nullptr;
+
+		// align the address, the block itself only comes with malloc's alignment
+		uintptr_t address = ((uintptr_t) (base + used) + align - 1) & ~(uintptr_t) (align - 1);
+		size_t start = (size_t) (address - (uintptr_t) base);
+		if (start + _size > size) {
+			LOG("Arena out of space, %zu of %zu bytes used, %zu more wanted.", used, size, _size);
+			return nullptr;
+		}
+		used = start + _size;
+		return base + start;
+	}
+
+}
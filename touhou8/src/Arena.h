@@ -0,0 +1,154 @@
+#pragma once
+
+#include <SDL.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <new>
+#include <type_traits>
+
+namespace th {
+
+	// One block allocated up front, handed out front to back and given back
+	// all at once. Nothing in it is ever freed on its own.
+	class Arena {
+	public:
+		Arena() = default;
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+		~Arena() { Release(); }
+
+		void Init(size_t size);
+		void Release();
+
+		// nullptr when the arena is out of space
+		void* Alloc(size_t size, size_t align);
+
+		size_t GetSize() const { return size; }
+		size_t GetUsed() const { return used; }
+
+	private:
+		uint8_t* base = nullptr;
+		size_t size = 0;
+		size_t used = 0;
+	};
+
+	// Fixed-capacity array over arena memory with the parts of the std::vector
+	// interface the pools use, so it never reallocates. Whatever only looks
+	// like std::vector but works differently is PascalCase.
+	//
+	// There is one spare element past the capacity, Spare(): push_back and
+	// emplace_back onto a full array write there instead of growing, so the
+	// caller always gets a valid element to fill in and can check Full()
+	// beforehand to know it won't be kept. size() never counts it.
+	template <typename T>
+	class FixedArray {
+	public:
+		static_assert(std::is_trivially_destructible_v<T>, "FixedArray never runs destructors");
+
+		FixedArray() = default;
+		FixedArray(const FixedArray&) = delete;
+		FixedArray& operator=(const FixedArray&) = delete;
+
+		// the memory is the arena's, Init again after it was released
+		void Init(Arena& arena, size_t _capacity) {
+			items = (T*) arena.Alloc((_capacity + 1) * sizeof(T), alignof(T) > 64 ? alignof(T) : 64);
+			count = 0;
+			cap = items ? _capacity : 0;
+			if (!items) {
+				// still room for the spare
+				items = &fallback;
+			}
+			new (&items[cap]) T();
+		}
+
+		void Reset() {
+			items = &fallback;
+			count = 0;
+			cap = 0;
+		}
+
+		size_t size() const { return count; }
+		bool empty() const { return count == 0; }
+		size_t capacity() const { return cap; }
+		bool Full() const { return count == cap; }
+
+		T* data() { return items; }
+		const T* data() const { return items; }
+		T* begin() { return items; }
+		T* end() { return items + count; }
+		const T* begin() const { return items; }
+		const T* end() const { return items + count; }
+
+		// the spare element is at index capacity()
+		T& operator[](size_t index) { return items[index]; }
+		const T& operator[](size_t index) const { return items[index]; }
+		T& front() { return items[0]; }
+		T& back() { return items[count - 1]; }
+		T& Spare() { return items[cap]; }
+
+		void push_back(const T& value) {
+			if (count < cap) {
+				items[count++] = value;
+			} else {
+				items[cap] = value;
+			}
+		}
+
+		T& EmplaceSpare() {
+			new (&items[cap]) T();
+			return items[cap];
+		}
+
+		T& emplace_back() {
+			if (count < cap) {
+				new (&items[count]) T();
+				return items[count++];
+			}
+			new (&items[cap]) T();
+			return items[cap];
+		}
+
+		// clamped to the capacity
+		void resize(size_t n, const T& value = T()) {
+			if (n > cap) n = cap;
+			for (size_t i = count; i < n; i++) {
+				new (&items[i]) T(value);
+			}
+			count = n;
+		}
+
+		void clear() { count = 0; }
+
+		// same size and contents as other, clamped to the capacity
+		void CopyFrom(const FixedArray& other) {
+			count = (other.count < cap) ? other.count : cap;
+			if (count > 0) memcpy((void*) items, other.items, count * sizeof(T));
+		}
+
+		// n items straight from memory, clamped to the capacity
+		void assign(const T* first, size_t n) {
+			count = (n < cap) ? n : cap;
+			if (count > 0) memcpy((void*) items, first, count * sizeof(T));
+		}
+
+		// n items straight from memory onto the end, whatever doesn't fit is dropped
+		void Append(const T* first, size_t n) {
+			if (n > cap - count) n = cap - count;
+			if (n > 0) memcpy((void*) (items + count), first, n * sizeof(T));
+			count += n;
+		}
+
+		// drops everything from index n on
+		void Truncate(size_t n) {
+			if (n < count) count = n;
+		}
+
+	private:
+		T* items = &fallback;
+		size_t count = 0;
+		size_t cap = 0;
+		T fallback{}; // the spare before Init
+	};
+
+}
@@ -1,7 +1,5 @@
 #include "Assets.h"
 
-#include "Game.h"
-
 #include "utils.h"
 #include "external/stb_sprintf.h"
 #include <lz4.h>
@@ -61,10 +59,7 @@ namespace th {
 
 	Assets* Assets::_instance = nullptr;
 
-	static SDL_Texture* IMG_LoadLZ4Texture(const char* fname) {
-		auto& game = Game::GetInstance();
-		SDL_Renderer* renderer = game.renderer;
-
+	static SDL_Texture* IMG_LoadLZ4Texture(SDL_Renderer* renderer, const char* fname) {
 		SDL_Surface* surface = IMG_LoadLZ4(fname);
 
 		if (!surface) {
@@ -115,12 +110,18 @@ namespace th {
 		return true;
 	}
 
-	bool Assets::LoadAssets() {
+	bool Assets::LoadAssets(SDL_Renderer* _renderer) {
 		bool result = true;
 
+		renderer = _renderer;
+		if (!renderer) {
+			LOG("No renderer, loading metadata only");
+		}
+
 		double t = GetTime();
 		ReadTextFileByLine(ASSETS_FOLDER "All.textures", [this, &result](std::string_view line) {
-			if (!LoadTexture(line)) {
+			// headless, every texture is null
+			if (!LoadTexture(line) && renderer) {
 				result = false;
 			}
 		});
@@ -140,9 +141,9 @@ namespace th {
 
 			std::string_view texture_name = ReadWord(line, &cursor);
 
-			SDL_Texture* texture;
+			SDL_Texture* texture = LoadTexture(texture_name);
 
-			if (!(texture = LoadTexture(texture_name))) {
+			if (!texture && renderer) {
 				result = false;
 				return;
 			}
@@ -205,17 +206,16 @@ namespace th {
 		LOG("Loading scripts took %fms", (GetTime() - t) * 1000.0);
 
 		{
-			auto& game = Game::GetInstance();
-			SDL_Renderer* renderer = game.renderer;
-
-			uint32_t pixels[16 * 16];
-			SDL_memset4(pixels, 0, ArrayLength(pixels));
-			stub_tex_black = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, 16, 16);
-			SDL_UpdateTexture(stub_tex_black, nullptr, pixels, 16 * sizeof(*pixels));
-
-			SDL_memset4(pixels, 0xFFFFFFFFu, ArrayLength(pixels));
-			stub_tex_white = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, 16, 16);
-			SDL_UpdateTexture(stub_tex_white, nullptr, pixels, 16 * sizeof(*pixels));
+			if (renderer) {
+				uint32_t pixels[16 * 16];
+				SDL_memset4(pixels, 0, ArrayLength(pixels));
+				stub_tex_black = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, 16, 16);
+				SDL_UpdateTexture(stub_tex_black, nullptr, pixels, 16 * sizeof(*pixels));
+
+				SDL_memset4(pixels, 0xFFFFFFFFu, ArrayLength(pixels));
+				stub_tex_white = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, 16, 16);
+				SDL_UpdateTexture(stub_tex_white, nullptr, pixels, 16 * sizeof(*pixels));
+			}
 
 			stub_sprite = new Sprite{
 				stub_tex_white,
@@ -254,10 +254,11 @@ namespace th {
 		delete stub_sprite;
 		stub_sprite = nullptr;
 
-		SDL_DestroyTexture(stub_tex_white);
+		// never made without a renderer
+		if (stub_tex_white) SDL_DestroyTexture(stub_tex_white);
 		stub_tex_white = nullptr;
 
-		SDL_DestroyTexture(stub_tex_black);
+		if (stub_tex_black) SDL_DestroyTexture(stub_tex_black);
 		stub_tex_black = nullptr;
 
 		for (auto it = scripts.begin(); it != scripts.end(); ++it) {
@@ -326,9 +327,15 @@ namespace th {
 		char fullPath[64];
 		stb_snprintf(fullPath, sizeof(fullPath), ASSETS_FOLDER "%.*s" ".lz4.hc", (int)name.size(), name.data());
 
+		// headless, only the name is known
+		if (!renderer) {
+			textures.emplace(name_str, nullptr);
+			return nullptr;
+		}
+
 		SDL_Texture* texture;
 
-		if (!(texture = IMG_LoadLZ4Texture(fullPath))) {
+		if (!(texture = IMG_LoadLZ4Texture(renderer, fullPath))) {
 			textures.emplace(name_str, nullptr);
 			return nullptr;
 		}
@@ -347,9 +354,9 @@ namespace th {
 			return lookup->second;
 		}
 
-		SDL_Texture* texture;
+		SDL_Texture* texture = LoadTexture(name);
 
-		if (!(texture = LoadTexture(name))) {
+		if (!texture && renderer) {
 			return nullptr;
 		}
 
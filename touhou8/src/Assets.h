@@ -3,8 +3,6 @@
 #include "Sprite.h"
 #include "Font.h"
 
-#include <SDL_mixer.h>
-
 #include <unordered_map>
 #include <string>
 #include <string_view>
@@ -22,7 +20,9 @@ namespace th {
 
 		static Assets& GetInstance() { return *_instance; }
 
-		bool LoadAssets();
+		// Without a renderer only the metadata loads (sprite tables, glyph
+		// metrics and scripts) and every texture is null, for headless runs.
+		bool LoadAssets(SDL_Renderer* renderer);
 		void UnloadAssets();
 
 		SDL_Texture* FindTexture(const std::string& name);
@@ -37,6 +37,8 @@ namespace th {
 	private:
 		static Assets* _instance;
 
+		SDL_Renderer* renderer = nullptr;
+
 		std::unordered_map<std::string, SDL_Texture*> textures;
 		std::unordered_map<std::string, Sprite*> sprites;
 		std::unordered_map<std::string, Font*> fonts;
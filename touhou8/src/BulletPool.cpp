@@ -0,0 +1,225 @@
+#include "BulletPool.h"
+
+#include "Snapshot.h"
+
+#define BULLET_DEFAULT_LIFESPAN (60.0f * 60.0f)
+
+namespace th {
+
+	template <typename F>
+	void BulletPool::ForEachMember(const F& f) {
+		f(&BulletPool::x);
+		f(&BulletPool::y);
+		f(&BulletPool::x0);
+		f(&BulletPool::y0);
+		f(&BulletPool::spd);
+		f(&BulletPool::dir);
+		f(&BulletPool::dir_x);
+		f(&BulletPool::dir_y);
+		f(&BulletPool::acc);
+		f(&BulletPool::radius);
+		f(&BulletPool::lifetime);
+		f(&BulletPool::lifespan);
+		f(&BulletPool::grazed_by);
+		f(&BulletPool::wake_time);
+
+		f(&BulletPool::start_x);
+		f(&BulletPool::start_y);
+		f(&BulletPool::start_spd);
+		f(&BulletPool::motion_time);
+		f(&BulletPool::exit_time);
+
+		f(&BulletPool::full_id);
+		f(&BulletPool::flags);
+		f(&BulletPool::type);
+		f(&BulletPool::spawn_seq);
+
+		f(&BulletPool::sprite);
+		f(&BulletPool::frame_index);
+
+		f(&BulletPool::coroutine);
+		f(&BulletPool::update_callback);
+
+		if (has_lazer_data) {
+			f(&BulletPool::lazer_length);
+			f(&BulletPool::lazer_target_length);
+			f(&BulletPool::lazer_thickness);
+			f(&BulletPool::lazer_time);
+			f(&BulletPool::lazer_timer);
+
+			f(&BulletPool::box_x);
+			f(&BulletPool::box_y);
+			f(&BulletPool::box_half_width);
+			f(&BulletPool::box_half_length);
+		}
+	}
+
+	template <typename F>
+	void BulletPool::ForEachArray(const F& f) {
+		ForEachMember([this, &f](auto member) {
+			f(this->*member);
+		});
+	}
+
+	void BulletPool::Init(Arena& arena, size_t _capacity) {
+		ForEachArray([&arena, _capacity](auto& array) {
+			array.Init(arena, _capacity);
+		});
+		keep.reserve(_capacity);
+
+		// the spare gets refs released like any other bullet
+		coroutine.Spare() = LUA_REFNIL;
+		update_callback.Spare() = LUA_REFNIL;
+	}
+
+	size_t BulletPool::BytesPerItem() const {
+		size_t result = 0;
+		const_cast<BulletPool*>(this)->ForEachArray([&result](auto& array) {
+			result += sizeof(array[0]);
+		});
+		return result;
+	}
+
+	size_t BulletPool::Add(uint32_t _spawn_seq, bool refuse) {
+		bool spare = refuse || Full();
+		size_t index = spare ? capacity() : size();
+
+		auto put = [spare](auto& array, auto value) {
+			if (spare) {
+				array.Spare() = value;
+			} else {
+				array.push_back(value);
+			}
+		};
+
+		put(x, 0.0f);
+		put(y, 0.0f);
+		put(x0, 0.0f);
+		put(y0, 0.0f);
+		put(spd, 0.0f);
+		put(dir, 0.0f);
+		put(dir_x, 1.0f);
+		put(dir_y, 0.0f);
+		put(acc, 0.0f);
+		put(radius, 0.0f);
+		put(lifetime, 0.0f);
+		put(lifespan, BULLET_DEFAULT_LIFESPAN);
+		put(grazed_by, 0);
+		put(wake_time, 0.0f);
+
+		put(start_x, 0.0f);
+		put(start_y, 0.0f);
+		put(start_spd, 0.0f);
+		put(motion_time, 0.0f);
+		put(exit_time, INFINITY);
+
+		put(full_id, spare ? NULL_INSTANCE_ID : slots->Alloc((uint32_t) index | (spawn_buffer ? SPAWN_INDEX_BIT : 0)));
+		put(flags, 0);
+		put(type, has_lazer_data ? ProjectileType::Lazer : ProjectileType::Bullet);
+		put(spawn_seq, _spawn_seq);
+
+		put(sprite, nullptr);
+		put(frame_index, 0.0f);
+
+		put(coroutine, LUA_REFNIL);
+		put(update_callback, LUA_REFNIL);
+
+		if (has_lazer_data) {
+			put(lazer_length, 0.0f);
+			put(lazer_target_length, 0.0f);
+			put(lazer_thickness, 0.0f);
+			put(lazer_time, 0.0f);
+			put(lazer_timer, 0.0f);
+
+			put(box_x, 0.0f);
+			put(box_y, 0.0f);
+			put(box_half_width, 0.0f);
+			put(box_half_length, 0.0f);
+		}
+
+		return index;
+	}
+
+	void BulletPool::RemoveDead() {
+		size_t n = size();
+
+		size_t first_dead = 0;
+		while (first_dead < n && !(flags[first_dead] & OBJECT_FLAG_DEAD)) {
+			first_dead++;
+		}
+
+		if (first_dead == n) {
+			return;
+		}
+
+		keep.clear();
+		size_t w = first_dead;
+		for (size_t i = first_dead; i < n; i++) {
+			if (flags[i] & OBJECT_FLAG_DEAD) {
+				slots->Free(full_id[i]);
+			} else {
+				slots->Move(full_id[i], (uint32_t) w++);
+				keep.push_back((uint32_t) i);
+			}
+		}
+
+		// one streaming pass per array
+		ForEachArray([this, first_dead](auto& array) {
+			size_t w = first_dead;
+			for (uint32_t r : keep) {
+				array[w++] = array[r];
+			}
+			array.resize(w);
+		});
+	}
+
+	size_t BulletPool::Append(BulletPool& spawns) {
+		size_t first = size();
+		size_t room = capacity() - first;
+
+		size_t dropped = 0;
+		for (size_t i = room; i < spawns.size(); i++) {
+			slots->Free(spawns.full_id[i]);
+			dropped++;
+		}
+
+		ForEachMember([this, &spawns](auto member) {
+			auto& array = this->*member;
+			auto& from = spawns.*member;
+			array.Append(from.data(), from.size());
+			from.clear();
+		});
+
+		for (size_t i = first, n = size(); i < n; i++) {
+			slots->Move(full_id[i], (uint32_t) i);
+		}
+
+		return dropped;
+	}
+
+	void BulletPool::Clear() {
+		if (spawn_buffer) {
+			for (full_instance_id id : full_id) {
+				slots->Free(id);
+			}
+		} else {
+			slots->FreeAll();
+		}
+		ForEachArray([](auto& array) {
+			array.clear();
+		});
+	}
+
+	void BulletPool::Save(SnapshotWriter& writer) const {
+		const_cast<BulletPool*>(this)->ForEachArray([&writer](auto& array) {
+			writer.WriteArray(array);
+		});
+	}
+
+	void BulletPool::Load(SnapshotReader& reader) {
+		ForEachArray([&reader](auto& array) {
+			reader.ReadArray(array);
+		});
+	}
+
+}
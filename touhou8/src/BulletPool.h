@@ -0,0 +1,132 @@
+#pragma once
+
+#include "Objects.h"
+#include "Arena.h"
+#include "SlotMap.h"
+
+#include <vector>
+
+namespace th {
+
+	// Structure-of-arrays storage for enemy bullets.
+	// The physics passes only stream over the hot arrays, the render and
+	// script arrays are touched once per frame. Box-shaped projectiles
+	// (lasers and rects) live in their own pool, which is the only one that
+	// sizes the lazer_* and box_* arrays.
+	//
+	// The slot map belongs to whoever owns the pool. A spawn buffer is a
+	// second pool that hands out ids from the same slot map as its owner,
+	// with SPAWN_INDEX_BIT set in the dense index. New bullets wait there
+	// until Append moves them into the owner, so nothing that iterates the
+	// owner sees its arrays grow.
+	class BulletPool {
+	public:
+		BulletPool(SlotMap& _slots, bool _has_lazer_data) : slots(&_slots), has_lazer_data(_has_lazer_data) {}
+		explicit BulletPool(BulletPool& owner) : slots(owner.slots), has_lazer_data(owner.has_lazer_data), spawn_buffer(true) {}
+
+		size_t size() const { return full_id.size(); }
+		bool empty() const { return full_id.empty(); }
+		size_t capacity() const { return full_id.capacity(); }
+		bool Full() const { return full_id.Full(); }
+		bool HasLazerData() const { return has_lazer_data; }
+		// no id left for another bullet, see SlotMap
+		bool OutOfIds() const { return slots->Full(); }
+
+		// Carves every array out of the arena, empty
+		void Init(Arena& arena, size_t capacity);
+		// arena bytes one bullet takes
+		size_t BytesPerItem() const;
+
+		// Also hands out the full_id. When the pool is full or the add is
+		// refused this sets up the spare bullet at index capacity() instead,
+		// with NULL_INSTANCE_ID.
+		size_t Add(uint32_t spawn_seq, bool refuse = false);
+		void Clear();
+
+		// Stable compaction of every bullet flagged OBJECT_FLAG_DEAD.
+		// Keeps draw order. Lua refs have to be released before this.
+		// Not for spawn buffers.
+		void RemoveDead();
+
+		// Moves everything in the spawn buffer to the end of this pool, one
+		// insert per array, and empties it. What doesn't fit is dropped and
+		// its ids freed, the Lua refs of bullets from index capacity() - size()
+		// on have to be released before. Returns how many were dropped.
+		size_t Append(BulletPool& spawns);
+
+		// The index has SPAWN_INDEX_BIT set when the bullet is still in the spawn buffer
+		bool Find(full_instance_id id, size_t* index) const {
+			uint32_t result;
+			if (!slots->Lookup(id, &result)) return false;
+			*index = result;
+			return true;
+		}
+
+		// Every array. The slot map is saved by its owner.
+		void Save(SnapshotWriter& writer) const;
+		void Load(SnapshotReader& reader);
+
+		// hot
+		FixedArray<float> x;
+		FixedArray<float> y;
+		FixedArray<float> x0; // position at the start of the physics step
+		FixedArray<float> y0;
+		FixedArray<float> spd;
+		FixedArray<float> dir;
+		FixedArray<float> dir_x; // cached unit vector of dir, see Stage::SetDir
+		FixedArray<float> dir_y;
+		FixedArray<float> acc;
+		FixedArray<float> radius;
+		FixedArray<float> lifetime;
+		FixedArray<float> lifespan;
+		FixedArray<uint32_t> grazed_by;
+		FixedArray<float> wake_time; // Stage::physics_time before which no player can be touched
+
+		// closed-form motion of OBJECT_FLAG_ANALYTIC bullets
+		FixedArray<float> start_x; // state when the motion started
+		FixedArray<float> start_y;
+		FixedArray<float> start_spd;
+		FixedArray<float> motion_time; // time since then
+		FixedArray<float> exit_time; // motion_time at which it leaves the cull area
+
+		// identity
+		FixedArray<full_instance_id> full_id;
+		FixedArray<uint32_t> flags;
+		FixedArray<ProjectileType> type;
+		FixedArray<uint32_t> spawn_seq; // creation order across both pools, see Stage::next_spawn_seq
+
+		// render
+		FixedArray<Sprite*> sprite;
+		FixedArray<float> frame_index;
+
+		// script
+		FixedArray<int> coroutine;
+		FixedArray<int> update_callback;
+
+		// lasers only
+		FixedArray<float> lazer_length;
+		FixedArray<float> lazer_target_length;
+		FixedArray<float> lazer_thickness;
+		FixedArray<float> lazer_time;
+		FixedArray<float> lazer_timer;
+
+		// oriented box, recomputed after every move. The axis along the length is dir_x/dir_y.
+		FixedArray<float> box_x;
+		FixedArray<float> box_y;
+		FixedArray<float> box_half_width;
+		FixedArray<float> box_half_length;
+
+	private:
+		// f gets a pointer to each array member, so two pools can be walked together
+		template <typename F>
+		void ForEachMember(const F& f);
+		template <typename F>
+		void ForEachArray(const F& f);
+
+		SlotMap* slots;
+		bool has_lazer_data;
+		bool spawn_buffer = false;
+		std::vector<uint32_t> keep;
+	};
+
+}
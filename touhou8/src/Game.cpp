@@ -1,14 +1,24 @@
 #include "Game.h"
 
+#include "Kernels.h"
 #include "utils.h"
 #include "external/stb_sprintf.h"
 
+#include <SDL_mixer.h>
+
+#include <mutex>
+#include <thread>
+
 namespace th {
 
 	Game* Game::_instance = nullptr;
 
+	// stages stepping on other threads log too
+	static std::mutex log_mutex;
+
 	static void LogOutputFunction(void* userdata, int category, SDL_LogPriority priority, const char* message) {
 		auto& game = Game::GetInstance();
+		std::lock_guard<std::mutex> lock(log_mutex);
 
 		const char* prefix[] = {
 			nullptr,
@@ -43,6 +53,51 @@ namespace th {
 		}
 	}
 
+	// Steps 1, 2, 4... up to stage_count Stages at once, each with its own
+	// context, seed and thread, and logs simulated frames per second.
+	static void BenchStages(Game& game, size_t stage_count, int frames) {
+		for (size_t count = 1; count <= stage_count; count *= 2) {
+			std::vector<std::optional<Stage>> stages(count);
+			std::vector<JobSystem> jobs(count);
+
+			for (size_t i = 0; i < count; i++) {
+				SimContext context;
+				context.assets = &Assets::GetInstance();
+				context.options = &game.options;
+				context.jobs = &jobs[i];
+				context.player_count = 1;
+				context.seed = 123456789 + (uint32_t) i * 2654435761u;
+
+				stages[i].emplace();
+				stages[i]->Init(context);
+			}
+
+			double t = GetTime();
+
+			std::vector<std::thread> threads;
+			for (size_t i = 0; i < count; i++) {
+				threads.emplace_back([&stages, i, frames]() {
+					Stage& stage = *stages[i];
+					for (int frame = 0; frame < frames; frame++) {
+						stage.player_input[0] = INPUT_FIRE | (((size_t) frame / 60 + i) % 2 ? INPUT_LEFT : INPUT_RIGHT);
+						stage.Update(1.0f);
+					}
+				});
+			}
+			for (std::thread& thread : threads) {
+				thread.join();
+			}
+
+			double took = GetTime() - t;
+
+			for (size_t i = 0; i < count; i++) {
+				stages[i]->Quit();
+			}
+
+			LOG("%zu stages: %.0f frames/s", count, (double) count * (double) frames / took);
+		}
+	}
+
 	void Game::Init() {
 		SDL_Init(SDL_INIT_AUDIO
 				 | SDL_INIT_VIDEO
@@ -82,12 +137,17 @@ namespace th {
 
 		LOG("");
 		double t = GetTime();
-		assets.LoadAssets();
+		assets.LoadAssets(renderer);
 		LOG("Loading took %fms", (GetTime() - t) * 1000.0);
 		LOG("");
 
 		FillDataTables();
 
+		size_t thread_count = options.thread_count;
+		if (thread_count == 0) thread_count = (size_t) SDL_GetCPUCount();
+		jobs.Init(thread_count);
+		LOG("Job system: %zu threads", jobs.GetWorkerCount());
+
 		LOG("type help to get a list of commands");
 		LOG("");
 
@@ -110,6 +170,10 @@ namespace th {
 			}
 		}
 
+		replay.Stop();
+
+		jobs.Quit();
+
 		assets.UnloadAssets();
 
 		Mix_Quit();
@@ -219,6 +283,21 @@ namespace th {
 										LOG("exit: exit lua console");
 										LOG("clear: clear the console");
 										LOG("help: show this message");
+										LOG("broadphase: toggle the collision grid");
+										LOG("swept: toggle swept collision");
+										LOG("substeps [n]: physics steps per frame, 5 moves bullets like the old 300 Hz loop");
+										LOG("pickupmerge [n]: merge pickups above n, 0 is off");
+										LOG("cancelwave [n]: frames the phase end cancel wave takes, 0 is instant");
+										LOG("budget <pool> [max] [refuse|oldest|farthest]: entity budget, 0 is the pool size");
+										LOG("threads [n]: job system threads, 0 is one per core");
+										LOG("jobbench [n]: time the parallel kernel passes at 1/2/4/8 threads");
+										LOG("simbench [stages] [frames]: step up to that many stages at once, one thread each");
+										LOG("record [file]: restart the stage and record a replay, again to save it");
+										LOG("replay <file> [fast]: restart the stage and play a replay back, fast is uncapped");
+										LOG("savestate: snapshot the whole stage, Lua included");
+										LOG("loadstate: go back to the last savestate");
+										LOG("netplay <player> <players> [port] [delay]: restart the stage as one of 2-4 peers on localhost");
+										LOG("netplay off: back to playing alone");
 										LOG("");
 									} else {
 										if (console_is_lua) {
@@ -281,6 +360,12 @@ namespace th {
 
 			Update(delta);
 
+			// an uncapped replay steps as many frames as fit in this one and only draws the last
+			while (replay.mode == REPLAY_PLAY && replay.uncapped && GetTime() < frame_end_time) {
+				memset(&key_pressed, 0, sizeof(key_pressed));
+				Update(delta);
+			}
+
 			Draw(delta);
 
 			double current_time = GetTime();
@@ -322,7 +407,7 @@ namespace th {
 			SceneIndex scene_to_create = next_scene;
 			next_scene = (SceneIndex) 0;
 
-			random.seed();
+			random.seed(game_seed);
 
 			switch (scene_to_create) {
 				case GAME_SCENE: {
@@ -400,27 +485,60 @@ namespace th {
 			SDL_Point pos = DrawText(font, buf, x, y);
 			switch (scene.index()) {
 				case GAME_SCENE: {
-					auto& stage = Stage::GetInstance();
-					char buf[200];
+					auto& game_scene = std::get<GAME_SCENE>(scene);
+					auto& stage = *game_scene.stage;
+					const RollbackSession& rollback = game_scene.rollback;
+					const Stage::PoolStats* pools = stage.pool_stats;
+					char buf[2048];
 					stb_snprintf(buf, sizeof(buf),
-								 "next id: %u\n"
+								 "physics: %fms (%s, %s, %s x%d, %zu threads)\n"
+								 "trig: %u\n"
+								 "sleep skipped: %u\n"
+								 "id slots: %zu\n"
 								 "players: %zu\n"
-								 "bosses: %zu\n"
-								 "enemies: %zu\n"
-								 "bullets: %zu\n"
-								 "player bullets: %zu\n"
-								 "pickups: %zu\n"
+								 "bosses: %zu/%zu peak %zu over %zu\n"
+								 "enemies: %zu/%zu peak %zu over %zu\n"
+								 "bullets: %zu/%zu (%zu analytic) peak %zu over %zu\n"
+								 "lasers: %zu/%zu peak %zu over %zu\n"
+								 "player bullets: %zu/%zu peak %zu over %zu\n"
+								 "pickups: %zu/%zu peak %zu over %zu\n"
+								 "arena: %zuKb of %zuKb\n"
+								 "over budget: %u refused, %u oldest, %u farthest\n"
 								 "lua top: %d\n"
-								 "lua mem: %fKb\n",
-								 stage.next_instance_id,
+								 "lua mem: %fKb, heap %zuKb of %zuKb\n"
+								 "netplay: frame %u confirmed %u, %u rollbacks %u frames (last %.2fms), %u stalls%s\n",
+								 stage.pass_took[PASS_PHYSICS],
+								 stage.collision_broadphase ? "grid" : "brute force",
+								 GetKernelPathName(GetKernelPath()),
+								 stage.swept_collision ? "swept" : "discrete",
+								 stage.physics_substeps,
+								 jobs.GetWorkerCount(),
+								 stage.trig_evals,
+								 stage.sleep_skipped,
+								 stage.boss_slots.GetSlotCount() + stage.enemy_slots.GetSlotCount()
+								 + stage.bullet_slots.GetSlotCount() + stage.lazer_slots.GetSlotCount(),
 								 player_count,
-								 stage.bosses.size(),
-								 stage.enemies.size(),
-								 stage.bullets.size(),
-								 stage.player_bullets.size(),
-								 stage.pickups.size(),
+								 stage.bosses.size(), pools[POOL_BOSSES].capacity,
+								 pools[POOL_BOSSES].high_water, pools[POOL_BOSSES].overflows,
+								 stage.enemies.size(), pools[POOL_ENEMIES].capacity,
+								 pools[POOL_ENEMIES].high_water, pools[POOL_ENEMIES].overflows,
+								 stage.bullets.size(), pools[POOL_BULLETS].capacity, stage.analytic_bullets,
+								 pools[POOL_BULLETS].high_water, pools[POOL_BULLETS].overflows,
+								 stage.lazers.size(), pools[POOL_LAZERS].capacity,
+								 pools[POOL_LAZERS].high_water, pools[POOL_LAZERS].overflows,
+								 stage.player_bullets.size(), pools[POOL_PLAYER_BULLETS].capacity,
+								 pools[POOL_PLAYER_BULLETS].high_water, pools[POOL_PLAYER_BULLETS].overflows,
+								 stage.pickups.size(), pools[POOL_PICKUPS].capacity,
+								 pools[POOL_PICKUPS].high_water, pools[POOL_PICKUPS].overflows,
+								 stage.arena.GetUsed() / 1024, stage.arena.GetSize() / 1024,
+								 stage.policy_fired[OVERFLOW_REFUSE], stage.policy_fired[OVERFLOW_RECYCLE_OLDEST],
+								 stage.policy_fired[OVERFLOW_RECYCLE_FARTHEST],
 								 lua_gettop(stage.L),
-								 (double)lua_gc(stage.L, LUA_GCCOUNT) + ((double)lua_gc(stage.L, LUA_GCCOUNTB) / 1024.0));
+								 (double)lua_gc(stage.L, LUA_GCCOUNT) + ((double)lua_gc(stage.L, LUA_GCCOUNTB) / 1024.0),
+								 stage.lua_heap.GetUsed() / 1024, stage.lua_heap.GetSize() / 1024,
+								 rollback.frame, game_scene.netplay ? rollback.GetConfirmedFrame() : rollback.frame,
+								 rollback.rollbacks, rollback.resimulated_frames, rollback.last_rollback_ms, rollback.stalls,
+								 rollback.desynced ? ", DESYNCED" : "");
 					DrawText(font, buf, pos.x, pos.y);
 					break;
 				}
@@ -472,18 +590,230 @@ namespace th {
 		SDL_RenderPresent(renderer);
 	}
 
+	// The replay header holds the simulation settings as they were at the
+	// first frame, changing one later would desync the recording or the
+	// playback. Ends it, like loadstate does. During netplay only this peer
+	// would change, so it's refused there. False when the change can't happen.
+	static bool AllowSettingChange(Game& game, std::string_view command) {
+		if (game.netplay.on) {
+			LOG("%.*s: the peers wouldn't follow, not during netplay", (int) command.size(), command.data());
+			return false;
+		}
+		if (game.replay.mode != REPLAY_OFF) {
+			LOG("%.*s stops the replay", (int) command.size(), command.data());
+			game.replay.Stop();
+		}
+		return true;
+	}
+
 	void Game::HandleCommand() {
 		if (console_command.empty()) return;
 
 		size_t cursor = 0;
 		std::string_view command = ReadWord(console_command, &cursor);
+
+		if (command == "broadphase") {
+			if (scene.index() != GAME_SCENE) return;
+			if (!AllowSettingChange(*this, command)) return;
+
+			Stage& stage = *std::get<GAME_SCENE>(scene).stage;
+			stage.collision_broadphase ^= true;
+			LOG("broadphase %s", stage.collision_broadphase ? "on" : "off");
+		} else if (command == "simd") {
+			std::string_view path = ReadWord(console_command, &cursor);
+
+			if (path == "scalar") {
+				SetKernelPath(KERNEL_PATH_SCALAR);
+			} else if (path == "sse2") {
+				SetKernelPath(KERNEL_PATH_SSE2);
+			} else if (path == "avx2") {
+				SetKernelPath(KERNEL_PATH_AVX2);
+			}
+
+			LOG("simd %s", GetKernelPathName(GetKernelPath()));
+		} else if (command == "bench") {
+			int count = StrToInt(ReadWord(console_command, &cursor), 10'000);
+			BenchKernels((size_t) std::max(count, 1), 1000);
+		} else if (command == "threads") {
+			int count = StrToInt(ReadWord(console_command, &cursor), (int) options.thread_count);
+			options.thread_count = (size_t) std::max(count, 0);
+
+			size_t thread_count = options.thread_count;
+			if (thread_count == 0) thread_count = (size_t) SDL_GetCPUCount();
+			jobs.Init(thread_count);
+			LOG("threads %zu", jobs.GetWorkerCount());
+		} else if (command == "jobbench") {
+			int count = StrToInt(ReadWord(console_command, &cursor), 100'000);
+			BenchKernelsParallel((size_t) std::max(count, 1), 200);
+		} else if (command == "simbench") {
+			int stage_count = StrToInt(ReadWord(console_command, &cursor), (int) std::thread::hardware_concurrency());
+			int frames = StrToInt(ReadWord(console_command, &cursor), 600);
+			BenchStages(*this, (size_t) std::clamp(stage_count, 1, 32), std::max(frames, 1));
+		} else if (command == "record") {
+			if (netplay.on) {
+				LOG("record: not during netplay");
+				return;
+			}
+
+			if (replay.mode == REPLAY_RECORD) {
+				replay.Stop();
+				return;
+			}
+
+			std::string fname(ReadWord(console_command, &cursor));
+			if (fname.empty()) fname = "replay.rpy";
+
+			replay.ArmRecording(fname.c_str());
+			next_scene = GAME_SCENE;
+		} else if (command == "replay") {
+			if (netplay.on) {
+				LOG("replay: not during netplay");
+				return;
+			}
+
+			std::string fname(ReadWord(console_command, &cursor));
+			if (fname.empty()) {
+				replay.Stop();
+				return;
+			}
+
+			if (!replay.ArmPlayback(fname.c_str())) return;
+
+			// the run starts over exactly as it was recorded
+			replay.ApplySettings(options);
+			player_count = replay.header.player_count;
+			std::copy(replay.header.player_character, replay.header.player_character + MAX_PLAYERS, player_character);
+			game_seed = replay.header.game_seed;
+			stage_seed = replay.header.stage_seed;
+
+			replay.uncapped = ReadWord(console_command, &cursor) == "fast";
+			next_scene = GAME_SCENE;
+		} else if (command == "netplay") {
+			std::string_view arg = ReadWord(console_command, &cursor);
+			if (arg.empty() || arg == "off") {
+				if (!netplay.on) return;
+				netplay.on = false;
+				player_count = 1;
+				LOG("netplay off");
+				next_scene = GAME_SCENE;
+				return;
+			}
+
+			int player = StrToInt(arg, 0);
+			int players = StrToInt(ReadWord(console_command, &cursor), 0);
+			if (!(2 <= players && players <= MAX_PLAYERS && 1 <= player && player <= players)) {
+				LOG("netplay: wants a player from 1 to players, and 2 to %d players", MAX_PLAYERS);
+				return;
+			}
+
+			netplay.on = true;
+			netplay.local_player = (size_t) (player - 1);
+			netplay.base_port = (uint16_t) std::clamp(StrToInt(ReadWord(console_command, &cursor), (int) netplay.base_port), 1024, 65535 - MAX_PLAYERS);
+			netplay.input_delay = (uint32_t) std::clamp(StrToInt(ReadWord(console_command, &cursor), (int) netplay.input_delay), 0, ROLLBACK_MAX_INPUT_DELAY);
+			player_count = (size_t) players;
+
+			// every peer has to start from the same stage
+			if (replay.mode != REPLAY_OFF) {
+				replay.Stop();
+			}
+			game_seed = 123456789;
+			stage_seed = 123456789;
+
+			next_scene = GAME_SCENE;
+		} else if (command == "savestate") {
+			if (scene.index() != GAME_SCENE) return;
+
+			GameScene& game_scene = std::get<GAME_SCENE>(scene);
+			double t = GetTime();
+			game_scene.stage->SaveSnapshot(&game_scene.saved_state);
+			LOG("savestate at %.0f, %zuKb from %zuKb in %.2fms", game_scene.saved_state.time,
+				game_scene.saved_state.data.size() / 1024, game_scene.saved_state.raw_size / 1024, (GetTime() - t) * 1000.0);
+		} else if (command == "loadstate") {
+			if (scene.index() != GAME_SCENE) return;
+
+			GameScene& game_scene = std::get<GAME_SCENE>(scene);
+			if (game_scene.netplay) {
+				LOG("loadstate: the peers wouldn't follow, not during netplay");
+				return;
+			}
+			if (game_scene.saved_state.data.empty()) {
+				LOG("loadstate: nothing saved");
+				return;
+			}
+
+			// the inputs wouldn't line up anymore
+			if (replay.mode != REPLAY_OFF) {
+				LOG("loadstate stops the replay");
+				replay.Stop();
+			}
+
+			double t = GetTime();
+			if (game_scene.stage->LoadSnapshot(game_scene.saved_state)) {
+				LOG("loadstate to %.0f in %.2fms", game_scene.saved_state.time, (GetTime() - t) * 1000.0);
+			}
+		} else if (command == "pickupmerge") {
+			if (scene.index() != GAME_SCENE) return;
+			if (!AllowSettingChange(*this, command)) return;
+
+			Stage& stage = *std::get<GAME_SCENE>(scene).stage;
+			int threshold = StrToInt(ReadWord(console_command, &cursor), (int) stage.pickup_merge_threshold);
+			stage.pickup_merge_threshold = (size_t) std::max(threshold, 0);
+			LOG("pickupmerge %zu", stage.pickup_merge_threshold);
+		} else if (command == "budget") {
+			// budget <pool> [max] [refuse|oldest|farthest]
+			static const char* pool_names[POOL_COUNT] = {"bosses", "enemies", "bullets", "lasers", "playerbullets", "pickups"};
+			static const char* policy_names[OVERFLOW_POLICY_COUNT] = {"refuse", "oldest", "farthest"};
+
+			std::string_view pool_name = ReadWord(console_command, &cursor);
+			int pool = 0;
+			while (pool < POOL_COUNT && pool_name != pool_names[pool]) pool++;
+			if (pool == POOL_COUNT) {
+				LOG("budget: pools are bosses, enemies, bullets, lasers, playerbullets, pickups");
+				return;
+			}
+			if (!AllowSettingChange(*this, command)) return;
+
+			PoolBudget& budget = options.pool_budgets[pool];
+			int max = StrToInt(ReadWord(console_command, &cursor), (int) budget.max);
+			budget.max = (size_t) std::max(max, 0);
+
+			std::string_view policy_name = ReadWord(console_command, &cursor);
+			for (int policy = 0; policy < OVERFLOW_POLICY_COUNT; policy++) {
+				if (policy_name == policy_names[policy]) budget.policy = (OverflowPolicy) policy;
+			}
+
+			LOG("budget %s %zu %s", pool_names[pool], budget.max, policy_names[budget.policy]);
+		} else if (command == "cancelwave") {
+			if (scene.index() != GAME_SCENE) return;
+			if (!AllowSettingChange(*this, command)) return;
+
+			Stage& stage = *std::get<GAME_SCENE>(scene).stage;
+			int frames = StrToInt(ReadWord(console_command, &cursor), stage.cancel_wave_frames);
+			stage.cancel_wave_frames = std::max(frames, 0);
+			LOG("cancelwave %d", stage.cancel_wave_frames);
+		} else if (command == "swept") {
+			if (scene.index() != GAME_SCENE) return;
+			if (!AllowSettingChange(*this, command)) return;
+
+			Stage& stage = *std::get<GAME_SCENE>(scene).stage;
+			stage.swept_collision ^= true;
+			LOG("swept %s", stage.swept_collision ? "on" : "off");
+		} else if (command == "substeps") {
+			if (scene.index() != GAME_SCENE) return;
+			if (!AllowSettingChange(*this, command)) return;
+
+			Stage& stage = *std::get<GAME_SCENE>(scene).stage;
+			int substeps = StrToInt(ReadWord(console_command, &cursor), stage.physics_substeps);
+			stage.physics_substeps = std::clamp(substeps, 1, 16);
+			LOG("substeps %d", stage.physics_substeps);
+		}
 	}
 
 	void Game::HandleLuaCommand() {
 		if (console_command.empty()) return;
 		if (scene.index() != GAME_SCENE) return;
 
-		Stage& stage = Stage::GetInstance();
+		Stage& stage = *std::get<GAME_SCENE>(scene).stage;
 		lua_State* L = stage.L;
 		const char* str = console_command.c_str();
 
@@ -6,6 +6,9 @@
 #include "GameScene.h"
 #include "TitleScene.h"
 
+#include "JobSystem.h"
+#include "Replay.h"
+
 #include <variant>
 
 #define GAME_W 640
@@ -23,6 +26,27 @@ namespace th {
 	struct Options {
 		int starting_lives = 2;
 		int master_volume_level = 1;
+		size_t stage_arena_size = 32 * 1024 * 1024; // bytes Stage carves its entity pools from
+		size_t thread_count = 0; // job system threads counting the main one, 0 is one per core
+		size_t lua_heap_size = 64 * 1024 * 1024; // bytes for each Stage's Lua state, every scripted bullet has a coroutine in it
+
+		// per PoolIndex
+		PoolBudget pool_budgets[POOL_COUNT] = {
+			{0, OVERFLOW_REFUSE},         // bosses
+			{0, OVERFLOW_REFUSE},         // enemies
+			{0, OVERFLOW_REFUSE},         // bullets
+			{0, OVERFLOW_REFUSE},         // lasers
+			{0, OVERFLOW_RECYCLE_OLDEST}, // player bullets
+			{0, OVERFLOW_RECYCLE_OLDEST}, // pickups
+		};
+	};
+
+	// Set with the netplay command, the game scene starts a session with it.
+	struct NetplaySettings {
+		bool on = false;
+		size_t local_player = 0;
+		uint16_t base_port = 7000; // player i listens on base_port + i
+		uint32_t input_delay = 2;
 	};
 
 	class Game {
@@ -41,7 +65,12 @@ namespace th {
 		size_t player_count = 1;
 		character_index player_character[MAX_PLAYERS]{};
 		xorshf96 random;
+		uint32_t game_seed = 123456789; // Game::random, on every scene change
+		uint32_t stage_seed = 123456789;
 		Options options{};
+		JobSystem jobs;
+		Replay replay;
+		NetplaySettings netplay;
 
 		std::variant<
 			std::monostate,
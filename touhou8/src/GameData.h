@@ -4,6 +4,8 @@
 
 namespace th {
 
+	class Stage;
+
 	enum character_index {
 		CHARACTER_REIMU,
 		//CHARACTER_MARISA,
@@ -29,8 +31,8 @@ namespace th {
 		float graze_radius;
 		float deathbomb_time;
 		int starting_bombs;
-		void (*shot_type)(size_t player_index, float delta);
-		void (*bomb)(size_t player_index);
+		void (*shot_type)(Stage& stage, size_t player_index, float delta);
+		void (*bomb)(Stage& stage, size_t player_index);
 		Sprite* spr_idle;
 		Sprite* spr_move_right;
 		Sprite* spr_move_left;
@@ -2,6 +2,7 @@
 
 #include "Game.h"
 
+#include "utils.h"
 #include "external/stb_sprintf.h"
 
 #define PLAY_AREA_X 32
@@ -9,32 +10,97 @@
 
 namespace th {
 
-	GameScene* GameScene::_instance = nullptr;
+	static InputState ReadKeyboard() {
+		const Uint8* key = SDL_GetKeyboardState(nullptr);
+		InputState input = 0;
+
+		input |= key[SDL_SCANCODE_RIGHT] * INPUT_RIGHT;
+		input |= key[SDL_SCANCODE_UP]    * INPUT_UP;
+		input |= key[SDL_SCANCODE_LEFT]  * INPUT_LEFT;
+		input |= key[SDL_SCANCODE_DOWN]  * INPUT_DOWN;
+
+		input |= key[SDL_SCANCODE_Z]      * INPUT_FIRE;
+		input |= key[SDL_SCANCODE_X]      * INPUT_BOMB;
+		input |= key[SDL_SCANCODE_LSHIFT] * INPUT_FOCUS;
+
+		return input;
+	}
 
 	void GameScene::Init() {
 		auto& game = Game::GetInstance();
 
-		for (size_t player_index = 0; player_index < game.player_count; player_index++) {
-			ResetStats(player_index);
-		}
+		SimContext context;
+		context.assets = &Assets::GetInstance();
+		context.options = &game.options;
+		context.jobs = &game.jobs;
+		context.renderer = game.renderer;
+		context.seed = game.stage_seed;
+		context.player_count = game.player_count;
+		std::copy(game.player_character, game.player_character + MAX_PLAYERS, context.player_character);
 
 		stage.emplace();
-		stage->Init();
+		stage->Init(context);
+
+		game.replay.Begin(*stage, game.game_seed);
+		replay_start_t = GetTime();
+
+		if (game.netplay.on) {
+			const NetplaySettings& settings = game.netplay;
+			netplay = transport.Init(settings.local_player, game.player_count, settings.base_port);
+			if (netplay) {
+				rollback.Init(&*stage, &transport, settings.local_player, game.player_count, settings.input_delay);
+				LOG("Netplay as player %zu of %zu on port %d", settings.local_player + 1, game.player_count,
+					settings.base_port + (int) settings.local_player);
+			}
+		}
 	}
 
 	void GameScene::Quit() {
+		auto& game = Game::GetInstance();
+
+		game.replay.End();
+
+		transport.Quit();
+
 		stage->Quit();
 	}
 
 	void GameScene::Update(float delta) {
 		auto& game = Game::GetInstance();
 
-		if (game.key_pressed[SDL_SCANCODE_ESCAPE]) {
+		// the peers wouldn't wait
+		if (game.key_pressed[SDL_SCANCODE_ESCAPE] && !netplay) {
 			paused ^= true;
 		}
 
 		if (!game.skip_frame) {
-			if (!paused) {
+			if (netplay) {
+				// a stall skips the frame until the peers catch up, a desync for good
+				rollback.AdvanceFrame(game.console_on_screen ? 0 : ReadKeyboard());
+			} else if (!paused) {
+				InputState& input = stage->player_input[0];
+
+				input = 0;
+
+				if (game.replay.mode == REPLAY_PLAY) {
+					if (!game.replay.Next(stage->player_input, stage->context.player_count)) {
+						double took = GetTime() - replay_start_t;
+						LOG("Replay finished, %u frames in %.2fs, %.0f frames/s",
+							game.replay.frame, took, (double) game.replay.frame / took);
+						game.replay.Stop();
+					}
+				}
+
+				if (game.replay.mode != REPLAY_PLAY && !game.console_on_screen) {
+					input |= ReadKeyboard();
+				}
+
+				if (game.key_pressed[SDL_SCANCODE_B] && game.replay.mode != REPLAY_PLAY) {
+					input |= INPUT_SKIP_PHASE;
+				}
+
+				game.replay.Record(stage->player_input, stage->context.player_count);
+
 				stage->Update(delta);
 			}
 		}
@@ -81,7 +147,7 @@ namespace th {
 				int x = PLAY_AREA_X + PLAY_AREA_W + 1 * 16;
 				int y = PLAY_AREA_Y + 2 * 16;
 				Font* font = assets.FindFont("Mincho");
-				Stats& s = stats[0];
+				Stats& s = stage->stats[0];
 
 				{
 					char buf[20];
@@ -139,90 +205,4 @@ namespace th {
 		}
 	}
 
-	void GameScene::GetScore(size_t player_index, int score) {
-		Stats& s = stats[player_index];
-		s.score += score;
-	}
-
-	void GameScene::GetLives(size_t player_index, int lives) {
-		Stats& s = stats[player_index];
-		while (lives--) {
-			if (s.lives < 8) {
-				s.lives++;
-				//PlaySound("se_extend.wav");
-			} else {
-				GetBombs(player_index, 1);
-			}
-		}
-	}
-
-	void GameScene::GetBombs(size_t player_index, int bombs) {
-		Stats& s = stats[player_index];
-		while (bombs--) {
-			if (s.bombs < 8) {
-				s.bombs++;
-			}
-		}
-	}
-
-	void GameScene::GetPower(size_t player_index, int power) {
-		Stats& s = stats[player_index];
-		while (power--) {
-			if (s.power < MAX_POWER) {
-				s.power++;
-				switch (s.power) {
-					case 8:
-					case 16:
-					case 32:
-					case 48:
-					case 64:
-					case 80:
-					case 96:
-					case 128: {
-						//PlaySound("se_powerup.wav");
-						break;
-					}
-				}
-			}
-		}
-	}
-
-	void GameScene::GetGraze(size_t player_index, int graze) {
-		Stats& s = stats[player_index];
-		s.graze += graze;
-	}
-
-	void GameScene::GetPoints(size_t player_index, int points) {
-		Stats& s = stats[player_index];
-		while (points--) {
-			s.points++;
-			if (s.points >= 800) {
-				if (s.points % 200 == 0) {
-					GetLives(player_index, 1);
-				}
-			} else {
-				switch (s.points) {
-					case 50:
-					case 125:
-					case 200:
-					case 300:
-					case 450: {
-						GetLives(player_index, 1);
-						break;
-					}
-				}
-			}
-		}
-	}
-
-	void GameScene::ResetStats(size_t player_index) {
-		auto& game = Game::GetInstance();
-		Stats& s = stats[player_index];
-		CharacterData* char_data = GetCharacterData(game.player_character[player_index]);
-
-		s = {};
-		s.lives = game.options.starting_lives;
-		s.bombs = char_data->starting_bombs;
-	}
-
 }
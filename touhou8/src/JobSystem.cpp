@@ -0,0 +1,113 @@
+#include "JobSystem.h"
+
+namespace th {
+
+	void JobSystem::Init(size_t thread_count) {
+		Quit();
+
+		worker_count = std::clamp(thread_count, (size_t) 1, (size_t) MAX_WORKERS);
+		quit = false;
+
+		// worker 0 is whoever calls ParallelFor
+		for (size_t worker = 1; worker < worker_count; worker++) {
+			threads[worker] = std::thread(&JobSystem::WorkerMain, this, worker);
+		}
+	}
+
+	void JobSystem::Quit() {
+		{
+			std::lock_guard<std::mutex> lock(wake_mutex);
+			quit = true;
+		}
+		wake.notify_all();
+
+		for (size_t worker = 1; worker < worker_count; worker++) {
+			if (threads[worker].joinable()) threads[worker].join();
+		}
+		worker_count = 1;
+	}
+
+	void JobSystem::Run(size_t count, size_t grain, RangeFunc func, void* ctx) {
+		if (count == 0) return;
+		if (grain == 0) grain = 1;
+
+		size_t job_count = (count + grain - 1) / grain;
+
+		if (worker_count == 1 || job_count == 1) {
+			for (size_t begin = 0; begin < count; begin += grain) {
+				func(ctx, begin, std::min(begin + grain, count), 0);
+			}
+			return;
+		}
+
+		// nobody reads these before taking a range under a worker's lock below
+		run_func = func;
+		run_ctx = ctx;
+		run_count = count;
+		run_grain = grain;
+		pending.store(job_count, std::memory_order_relaxed);
+
+		// neighbouring ranges go to the same worker, so a worker that keeps to
+		// its own walks memory in order
+		for (size_t worker = 0; worker < worker_count; worker++) {
+			std::lock_guard<std::mutex> lock(workers[worker].mutex);
+			workers[worker].first = job_count * worker / worker_count;
+			workers[worker].last = job_count * (worker + 1) / worker_count;
+			queued.fetch_add(workers[worker].last - workers[worker].first, std::memory_order_relaxed);
+		}
+
+		// taking the lock orders this against a worker that is about to wait
+		{
+			std::lock_guard<std::mutex> lock(wake_mutex);
+		}
+		wake.notify_all();
+
+		// the frame waits here, helping out until the last range is done
+		while (pending.load(std::memory_order_acquire) > 0) {
+			if (!RunOne(0)) std::this_thread::yield();
+		}
+	}
+
+	bool JobSystem::RunOne(size_t worker) {
+		size_t job = 0;
+		bool found = false;
+
+		{
+			Worker& own = workers[worker];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (own.first < own.last) {
+				job = own.first++;
+				found = true;
+			}
+		}
+
+		for (size_t i = 1; !found && i < worker_count; i++) {
+			Worker& victim = workers[(worker + i) % worker_count];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (victim.first < victim.last) {
+				job = --victim.last;
+				found = true;
+			}
+		}
+
+		if (!found) return false;
+
+		queued.fetch_sub(1, std::memory_order_relaxed);
+
+		size_t begin = job * run_grain;
+		run_func(run_ctx, begin, std::min(begin + run_grain, run_count), worker);
+		pending.fetch_sub(1, std::memory_order_release);
+		return true;
+	}
+
+	void JobSystem::WorkerMain(size_t worker) {
+		for (;;) {
+			if (RunOne(worker)) continue;
+
+			std::unique_lock<std::mutex> lock(wake_mutex);
+			wake.wait(lock, [&]() { return quit || queued.load(std::memory_order_relaxed) > 0; });
+			if (quit) return;
+		}
+	}
+
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+#define MAX_WORKERS 16
+
+namespace th {
+
+	// Fixed set of worker threads that run index ranges. ParallelFor hands
+	// every worker a run of neighbouring ranges, [first, last) in range
+	// numbers. A worker takes its own from the front and steals from the back
+	// of the others' once it runs dry. Nothing is allocated per call. The calling thread is worker 0 and works
+	// through the queue too until all of it is done, so nothing outlives the
+	// ParallelFor call that queued it.
+	//
+	// Which worker runs which range changes from run to run. Anything that
+	// has to come out the same every time writes into disjoint parts of the
+	// output, or into per-worker buffers that get merged in a fixed order.
+	class JobSystem {
+	public:
+		typedef void (*RangeFunc)(void* ctx, size_t begin, size_t end, size_t worker);
+
+		JobSystem() = default;
+		JobSystem(const JobSystem&) = delete;
+		JobSystem& operator=(const JobSystem&) = delete;
+		~JobSystem() { Quit(); }
+
+		// thread_count counts the calling thread, 1 runs everything inline.
+		// Clamped to [1, MAX_WORKERS].
+		void Init(size_t thread_count);
+		void Quit();
+
+		size_t GetWorkerCount() const { return worker_count; }
+
+		// f(begin, end, worker) for [0, count) cut into ranges of grain,
+		// the last one shorter. Returns once every range ran. Not reentrant.
+		template <typename F>
+		void ParallelFor(size_t count, size_t grain, F&& f) {
+			typedef std::remove_reference_t<F> Func;
+			Run(count, grain, [](void* ctx, size_t begin, size_t end, size_t worker) {
+				(*(Func*) ctx)(begin, end, worker);
+			}, (void*) &f);
+		}
+
+	private:
+		struct Worker {
+			std::mutex mutex;
+			size_t first = 0; // ranges of the current ParallelFor not taken yet
+			size_t last = 0;
+		};
+
+		void Run(size_t count, size_t grain, RangeFunc func, void* ctx);
+		bool RunOne(size_t worker);
+		void WorkerMain(size_t worker);
+
+		Worker workers[MAX_WORKERS];
+		std::thread threads[MAX_WORKERS];
+		size_t worker_count = 1;
+
+		std::mutex wake_mutex;
+		std::condition_variable wake;
+		bool quit = false;
+
+		// the current ParallelFor, written before any range is handed out
+		RangeFunc run_func = nullptr;
+		void* run_ctx = nullptr;
+		size_t run_count = 0;
+		size_t run_grain = 1;
+
+		std::atomic<size_t> queued{0};  // handed out, not taken yet
+		std::atomic<size_t> pending{0}; // handed out by this ParallelFor and not finished
+	};
+
+}
@@ -0,0 +1,910 @@
+#include "Kernels.h"
+
+#include "JobSystem.h"
+#include "Objects.h"
+#include "cpml.h"
+#include "utils.h"
+
+#include <atomic>
+#include <mutex>
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+#define BENCH_DELTA (60.0f / 300.0f) // one physics substep
+
+namespace th {
+
+	// Scalar
+
+	static void MoveBullets_Scalar(float* x, float* y, float* spd,
+								   const float* dir_x, const float* dir_y, const float* acc,
+								   const float* lazer_timer, const float* lazer_time, const uint32_t* flags,
+								   size_t count, float delta) {
+		for (size_t i = 0; i < count; i++) {
+			// lasers stay in place until they are fully stretched
+			if (lazer_timer && lazer_timer[i] < lazer_time[i]) {
+				continue;
+			}
+
+			// evaluated in closed form instead, or waiting for the cancel wave where they are
+			if (flags[i] & (OBJECT_FLAG_ANALYTIC | OBJECT_FLAG_CANCELED)) {
+				continue;
+			}
+
+			x[i] += spd[i] * dir_x[i] * delta;
+			y[i] += spd[i] * dir_y[i] * delta;
+			spd[i] += acc[i] * delta;
+
+			if (spd[i] < 0.0f) {
+				spd[i] = 0.0f;
+			}
+		}
+	}
+
+	static void CullBullets_Scalar(const float* x, const float* y, float* lifetime, const float* lifespan,
+								   uint32_t* flags, size_t count, float delta,
+								   float x1, float y1, float x2, float y2) {
+		for (size_t i = 0; i < count; i++) {
+			// canceled ones only go when the cancel wave turns them into pickups
+			if (flags[i] & (OBJECT_FLAG_DEAD | OBJECT_FLAG_CANCELED)) {
+				continue;
+			}
+
+			// analytic bullets are culled by their precomputed exit time
+			bool in_bounds = (flags[i] & OBJECT_FLAG_ANALYTIC)
+				|| ((x1 <= x[i]) && (x[i] < x2) && (y1 <= y[i]) && (y[i] < y2));
+			if (lifetime[i] >= lifespan[i] || !in_bounds) {
+				flags[i] |= OBJECT_FLAG_DEAD;
+				continue;
+			}
+
+			lifetime[i] += delta;
+		}
+	}
+
+	static void UpdatePickups_Scalar(const float* x, const float* y, float* hsp, float* vsp,
+									 const int32_t* homing, size_t count,
+									 const float* target_x, const float* target_y, size_t target_count,
+									 float homing_spd, float gravity, float max_fall, float delta) {
+		for (size_t i = 0; i < count; i++) {
+			int32_t h = homing[i];
+			if (h >= 0 && (size_t) h < target_count) {
+				float dx = target_x[h] - x[i];
+				float dy = target_y[h] - y[i];
+				float len = sqrtf(dx * dx + dy * dy);
+				if (len > 0.0f) {
+					float k = homing_spd / len;
+					hsp[i] = dx * k;
+					vsp[i] = dy * k;
+				} else {
+					hsp[i] = homing_spd;
+					vsp[i] = 0.0f;
+				}
+			} else {
+				hsp[i] = 0.0f;
+				vsp[i] = std::min(vsp[i] + gravity * delta, max_fall);
+			}
+		}
+	}
+
+	static void CollideCirclesRange(float player_x, float player_y, float graze_radius, float hit_radius,
+									const float* x, const float* y, const float* radius, size_t first, size_t count,
+									uint32_t* graze_bits, uint32_t* hit_bits) {
+		for (size_t i = first; i < count; i++) {
+			// same expression as cpml::circle_vs_circle(player_x, player_y, r, x, y, radius)
+			float dx = x[i] - player_x;
+			float dy = y[i] - player_y;
+			float dist_sqr = dx * dx + dy * dy;
+
+			float graze = graze_radius + radius[i];
+			float hit   = hit_radius   + radius[i];
+
+			uint32_t bit = 1u << (i % 32);
+			if (dist_sqr < graze * graze) graze_bits[i / 32] |= bit;
+			if (dist_sqr < hit   * hit)   hit_bits[i / 32]   |= bit;
+		}
+	}
+
+	static void CollideCircles_Scalar(float player_x, float player_y, float graze_radius, float hit_radius,
+									  const float* x, const float* y, const float* radius, size_t count,
+									  uint32_t* graze_bits, uint32_t* hit_bits) {
+		CollideCirclesRange(player_x, player_y, graze_radius, hit_radius, x, y, radius, 0, count, graze_bits, hit_bits);
+	}
+
+	static void CollideBoxesRange(float player_x, float player_y, float graze_radius, float hit_radius,
+								  const float* x, const float* y, const float* axis_x, const float* axis_y,
+								  const float* half_width, const float* half_length, size_t first, size_t count,
+								  uint32_t* graze_bits, uint32_t* hit_bits) {
+		for (size_t i = first; i < count; i++) {
+			float dist_sqr = cpml::point_vs_box_dist_sqr(player_x, player_y, x[i], y[i], axis_x[i], axis_y[i],
+														 half_width[i], half_length[i]);
+
+			uint32_t bit = 1u << (i % 32);
+			if (dist_sqr < graze_radius * graze_radius) graze_bits[i / 32] |= bit;
+			if (dist_sqr < hit_radius   * hit_radius)   hit_bits[i / 32]   |= bit;
+		}
+	}
+
+	static void CollideBoxes_Scalar(float player_x, float player_y, float graze_radius, float hit_radius,
+									const float* x, const float* y, const float* axis_x, const float* axis_y,
+									const float* half_width, const float* half_length, size_t count,
+									uint32_t* graze_bits, uint32_t* hit_bits) {
+		CollideBoxesRange(player_x, player_y, graze_radius, hit_radius, x, y, axis_x, axis_y,
+						  half_width, half_length, 0, count, graze_bits, hit_bits);
+	}
+
+	// SSE2, 4 bullets at a time
+
+	// Notes on matching the scalar code:
+	// max(0, v) returns v when v is NaN or -0, same as "if (v < 0) v = 0".
+	// "not less than" is true for NaN, same as "if (timer < time) continue" not skipping.
+
+	static void MoveBullets_SSE2(float* x, float* y, float* spd,
+								 const float* dir_x, const float* dir_y, const float* acc,
+								 const float* lazer_timer, const float* lazer_time, const uint32_t* flags,
+								 size_t count, float delta) {
+		__m128 vdelta = _mm_set1_ps(delta);
+		__m128 zero = _mm_setzero_ps();
+		__m128i still_bits = _mm_set1_epi32(OBJECT_FLAG_ANALYTIC | OBJECT_FLAG_CANCELED);
+
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4) {
+			__m128 vx   = _mm_loadu_ps(x + i);
+			__m128 vy   = _mm_loadu_ps(y + i);
+			__m128 vspd = _mm_loadu_ps(spd + i);
+
+			__m128 nx   = _mm_add_ps(vx, _mm_mul_ps(_mm_mul_ps(vspd, _mm_loadu_ps(dir_x + i)), vdelta));
+			__m128 ny   = _mm_add_ps(vy, _mm_mul_ps(_mm_mul_ps(vspd, _mm_loadu_ps(dir_y + i)), vdelta));
+			__m128 nspd = _mm_max_ps(zero, _mm_add_ps(vspd, _mm_mul_ps(_mm_loadu_ps(acc + i), vdelta)));
+
+			__m128i vflags = _mm_loadu_si128((const __m128i*) (flags + i));
+			__m128 moves = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(vflags, still_bits), _mm_setzero_si128()));
+			__m128 stay = _mm_andnot_ps(moves, _mm_castsi128_ps(_mm_set1_epi32(-1)));
+			if (lazer_timer) {
+				// ordered, NaN timers move like in the scalar path
+				stay = _mm_or_ps(stay, _mm_cmplt_ps(_mm_loadu_ps(lazer_timer + i), _mm_loadu_ps(lazer_time + i)));
+			}
+
+			nx   = _mm_or_ps(_mm_andnot_ps(stay, nx),   _mm_and_ps(stay, vx));
+			ny   = _mm_or_ps(_mm_andnot_ps(stay, ny),   _mm_and_ps(stay, vy));
+			nspd = _mm_or_ps(_mm_andnot_ps(stay, nspd), _mm_and_ps(stay, vspd));
+
+			_mm_storeu_ps(x + i, nx);
+			_mm_storeu_ps(y + i, ny);
+			_mm_storeu_ps(spd + i, nspd);
+		}
+
+		MoveBullets_Scalar(x + i, y + i, spd + i, dir_x + i, dir_y + i, acc + i,
+						   lazer_timer ? lazer_timer + i : nullptr, lazer_time ? lazer_time + i : nullptr, flags + i,
+						   count - i, delta);
+	}
+
+	static void CullBullets_SSE2(const float* x, const float* y, float* lifetime, const float* lifespan,
+								 uint32_t* flags, size_t count, float delta,
+								 float x1, float y1, float x2, float y2) {
+		__m128 vdelta = _mm_set1_ps(delta);
+		__m128 vx1 = _mm_set1_ps(x1);
+		__m128 vy1 = _mm_set1_ps(y1);
+		__m128 vx2 = _mm_set1_ps(x2);
+		__m128 vy2 = _mm_set1_ps(y2);
+		__m128i dead_bit = _mm_set1_epi32(OBJECT_FLAG_DEAD);
+		__m128i skip_bits = _mm_set1_epi32(OBJECT_FLAG_DEAD | OBJECT_FLAG_CANCELED);
+		__m128i analytic_bit = _mm_set1_epi32(OBJECT_FLAG_ANALYTIC);
+
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4) {
+			__m128 vx = _mm_loadu_ps(x + i);
+			__m128 vy = _mm_loadu_ps(y + i);
+			__m128 vlifetime = _mm_loadu_ps(lifetime + i);
+			__m128i vflags = _mm_loadu_si128((const __m128i*) (flags + i));
+
+			// dead or canceled, left alone
+			__m128 live = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(vflags, skip_bits), _mm_setzero_si128()));
+			__m128 dead = _mm_andnot_ps(live, _mm_castsi128_ps(_mm_set1_epi32(-1)));
+
+			// ordered compares are false for NaN, same as the scalar ones
+			__m128 in_bounds = _mm_and_ps(_mm_and_ps(_mm_cmple_ps(vx1, vx), _mm_cmplt_ps(vx, vx2)),
+										  _mm_and_ps(_mm_cmple_ps(vy1, vy), _mm_cmplt_ps(vy, vy2)));
+			in_bounds = _mm_or_ps(in_bounds, _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(vflags, analytic_bit), analytic_bit)));
+			__m128 expired = _mm_cmpge_ps(vlifetime, _mm_loadu_ps(lifespan + i));
+			__m128 cull = _mm_or_ps(expired, _mm_andnot_ps(in_bounds, _mm_castsi128_ps(_mm_set1_epi32(-1))));
+
+			__m128 newly_dead = _mm_andnot_ps(dead, cull);
+			__m128 advance = _mm_andnot_ps(_mm_or_ps(dead, cull), _mm_castsi128_ps(_mm_set1_epi32(-1)));
+
+			vflags = _mm_or_si128(vflags, _mm_and_si128(_mm_castps_si128(newly_dead), dead_bit));
+			vlifetime = _mm_or_ps(_mm_and_ps(advance, _mm_add_ps(vlifetime, vdelta)), _mm_andnot_ps(advance, vlifetime));
+
+			_mm_storeu_si128((__m128i*) (flags + i), vflags);
+			_mm_storeu_ps(lifetime + i, vlifetime);
+		}
+
+		CullBullets_Scalar(x + i, y + i, lifetime + i, lifespan + i, flags + i, count - i, delta, x1, y1, x2, y2);
+	}
+
+	static void UpdatePickups_SSE2(const float* x, const float* y, float* hsp, float* vsp,
+								   const int32_t* homing, size_t count,
+								   const float* target_x, const float* target_y, size_t target_count,
+								   float homing_spd, float gravity, float max_fall, float delta) {
+		__m128 vspd = _mm_set1_ps(homing_spd);
+		__m128 vfall = _mm_set1_ps(gravity * delta);
+		__m128 vmax = _mm_set1_ps(max_fall);
+		__m128 zero = _mm_setzero_ps();
+
+		__m128i ids[8];
+		__m128 txs[8];
+		__m128 tys[8];
+		size_t targets = std::min(target_count, (size_t) 8);
+		for (size_t t = 0; t < targets; t++) {
+			ids[t] = _mm_set1_epi32((int32_t) t);
+			txs[t] = _mm_set1_ps(target_x[t]);
+			tys[t] = _mm_set1_ps(target_y[t]);
+		}
+
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4) {
+			__m128i h = _mm_loadu_si128((const __m128i*) (homing + i));
+
+			// no gather in SSE2, pick the target out of the few players instead
+			__m128 homes = zero;
+			__m128 tx = zero;
+			__m128 ty = zero;
+			for (size_t t = 0; t < targets; t++) {
+				__m128 is = _mm_castsi128_ps(_mm_cmpeq_epi32(h, ids[t]));
+				homes = _mm_or_ps(homes, is);
+				tx = _mm_or_ps(tx, _mm_and_ps(is, txs[t]));
+				ty = _mm_or_ps(ty, _mm_and_ps(is, tys[t]));
+			}
+
+			__m128 dx = _mm_sub_ps(tx, _mm_loadu_ps(x + i));
+			__m128 dy = _mm_sub_ps(ty, _mm_loadu_ps(y + i));
+			__m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+			__m128 k = _mm_div_ps(vspd, len);
+			__m128 moving = _mm_cmpgt_ps(len, zero);
+			__m128 home_hsp = _mm_or_ps(_mm_and_ps(moving, _mm_mul_ps(dx, k)), _mm_andnot_ps(moving, vspd));
+			__m128 home_vsp = _mm_and_ps(moving, _mm_mul_ps(dy, k));
+
+			// min(max, v) picks v unless max < v, same as std::min(v, max)
+			__m128 fall_vsp = _mm_min_ps(vmax, _mm_add_ps(_mm_loadu_ps(vsp + i), vfall));
+
+			_mm_storeu_ps(hsp + i, _mm_and_ps(homes, home_hsp));
+			_mm_storeu_ps(vsp + i, _mm_or_ps(_mm_and_ps(homes, home_vsp), _mm_andnot_ps(homes, fall_vsp)));
+		}
+
+		UpdatePickups_Scalar(x + i, y + i, hsp + i, vsp + i, homing + i, count - i,
+							 target_x, target_y, target_count, homing_spd, gravity, max_fall, delta);
+	}
+
+	static void CollideCircles_SSE2(float player_x, float player_y, float graze_radius, float hit_radius,
+									const float* x, const float* y, const float* radius, size_t count,
+									uint32_t* graze_bits, uint32_t* hit_bits) {
+		__m128 px = _mm_set1_ps(player_x);
+		__m128 py = _mm_set1_ps(player_y);
+		__m128 gr = _mm_set1_ps(graze_radius);
+		__m128 hr = _mm_set1_ps(hit_radius);
+
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4) {
+			__m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), px);
+			__m128 dy = _mm_sub_ps(_mm_loadu_ps(y + i), py);
+			__m128 dist_sqr = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+
+			__m128 r = _mm_loadu_ps(radius + i);
+			__m128 graze = _mm_add_ps(gr, r);
+			__m128 hit   = _mm_add_ps(hr, r);
+
+			uint32_t shift = (uint32_t) (i % 32);
+			graze_bits[i / 32] |= (uint32_t) _mm_movemask_ps(_mm_cmplt_ps(dist_sqr, _mm_mul_ps(graze, graze))) << shift;
+			hit_bits[i / 32]   |= (uint32_t) _mm_movemask_ps(_mm_cmplt_ps(dist_sqr, _mm_mul_ps(hit, hit))) << shift;
+		}
+
+		CollideCirclesRange(player_x, player_y, graze_radius, hit_radius, x, y, radius, i, count, graze_bits, hit_bits);
+	}
+
+	static void CollideBoxes_SSE2(float player_x, float player_y, float graze_radius, float hit_radius,
+								  const float* x, const float* y, const float* axis_x, const float* axis_y,
+								  const float* half_width, const float* half_length, size_t count,
+								  uint32_t* graze_bits, uint32_t* hit_bits) {
+		__m128 px = _mm_set1_ps(player_x);
+		__m128 py = _mm_set1_ps(player_y);
+		__m128 graze = _mm_set1_ps(graze_radius * graze_radius);
+		__m128 hit   = _mm_set1_ps(hit_radius * hit_radius);
+		__m128 sign  = _mm_set1_ps(-0.0f);
+
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4) {
+			__m128 dx = _mm_sub_ps(px, _mm_loadu_ps(x + i));
+			__m128 dy = _mm_sub_ps(py, _mm_loadu_ps(y + i));
+			__m128 ax = _mm_loadu_ps(axis_x + i);
+			__m128 ay = _mm_loadu_ps(axis_y + i);
+			__m128 along  = _mm_add_ps(_mm_mul_ps(dx, ax), _mm_mul_ps(dy, ay));
+			__m128 across = _mm_sub_ps(_mm_mul_ps(dx, ay), _mm_mul_ps(dy, ax));
+
+			__m128 hw = _mm_loadu_ps(half_width + i);
+			__m128 hl = _mm_loadu_ps(half_length + i);
+			__m128 closest_across = _mm_min_ps(hw, _mm_max_ps(_mm_xor_ps(hw, sign), across));
+			__m128 closest_along  = _mm_min_ps(hl, _mm_max_ps(_mm_xor_ps(hl, sign), along));
+
+			__m128 du = _mm_sub_ps(closest_across, across);
+			__m128 dv = _mm_sub_ps(closest_along, along);
+			__m128 dist_sqr = _mm_add_ps(_mm_mul_ps(du, du), _mm_mul_ps(dv, dv));
+
+			uint32_t shift = (uint32_t) (i % 32);
+			graze_bits[i / 32] |= (uint32_t) _mm_movemask_ps(_mm_cmplt_ps(dist_sqr, graze)) << shift;
+			hit_bits[i / 32]   |= (uint32_t) _mm_movemask_ps(_mm_cmplt_ps(dist_sqr, hit)) << shift;
+		}
+
+		CollideBoxesRange(player_x, player_y, graze_radius, hit_radius, x, y, axis_x, axis_y,
+						  half_width, half_length, i, count, graze_bits, hit_bits);
+	}
+
+	// AVX2, 8 bullets at a time
+
+	TARGET_AVX2
+	static void MoveBullets_AVX2(float* x, float* y, float* spd,
+								 const float* dir_x, const float* dir_y, const float* acc,
+								 const float* lazer_timer, const float* lazer_time, const uint32_t* flags,
+								 size_t count, float delta) {
+		__m256 vdelta = _mm256_set1_ps(delta);
+		__m256 zero = _mm256_setzero_ps();
+		__m256i still_bits = _mm256_set1_epi32(OBJECT_FLAG_ANALYTIC | OBJECT_FLAG_CANCELED);
+
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m256 vx   = _mm256_loadu_ps(x + i);
+			__m256 vy   = _mm256_loadu_ps(y + i);
+			__m256 vspd = _mm256_loadu_ps(spd + i);
+
+			// separate mul and add, an FMA would round differently from the scalar path
+			__m256 nx   = _mm256_add_ps(vx, _mm256_mul_ps(_mm256_mul_ps(vspd, _mm256_loadu_ps(dir_x + i)), vdelta));
+			__m256 ny   = _mm256_add_ps(vy, _mm256_mul_ps(_mm256_mul_ps(vspd, _mm256_loadu_ps(dir_y + i)), vdelta));
+			__m256 nspd = _mm256_max_ps(zero, _mm256_add_ps(vspd, _mm256_mul_ps(_mm256_loadu_ps(acc + i), vdelta)));
+
+			__m256i vflags = _mm256_loadu_si256((const __m256i*) (flags + i));
+			__m256 moves = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(vflags, still_bits), _mm256_setzero_si256()));
+			__m256 stay = _mm256_xor_ps(moves, _mm256_castsi256_ps(_mm256_set1_epi32(-1)));
+			if (lazer_timer) {
+				stay = _mm256_or_ps(stay, _mm256_cmp_ps(_mm256_loadu_ps(lazer_timer + i), _mm256_loadu_ps(lazer_time + i), _CMP_LT_OQ));
+			}
+
+			nx   = _mm256_blendv_ps(nx, vx, stay);
+			ny   = _mm256_blendv_ps(ny, vy, stay);
+			nspd = _mm256_blendv_ps(nspd, vspd, stay);
+
+			_mm256_storeu_ps(x + i, nx);
+			_mm256_storeu_ps(y + i, ny);
+			_mm256_storeu_ps(spd + i, nspd);
+		}
+
+		MoveBullets_Scalar(x + i, y + i, spd + i, dir_x + i, dir_y + i, acc + i,
+						   lazer_timer ? lazer_timer + i : nullptr, lazer_time ? lazer_time + i : nullptr, flags + i,
+						   count - i, delta);
+	}
+
+	TARGET_AVX2
+	static void CullBullets_AVX2(const float* x, const float* y, float* lifetime, const float* lifespan,
+								 uint32_t* flags, size_t count, float delta,
+								 float x1, float y1, float x2, float y2) {
+		__m256 vdelta = _mm256_set1_ps(delta);
+		__m256 vx1 = _mm256_set1_ps(x1);
+		__m256 vy1 = _mm256_set1_ps(y1);
+		__m256 vx2 = _mm256_set1_ps(x2);
+		__m256 vy2 = _mm256_set1_ps(y2);
+		__m256i dead_bit = _mm256_set1_epi32(OBJECT_FLAG_DEAD);
+		__m256i skip_bits = _mm256_set1_epi32(OBJECT_FLAG_DEAD | OBJECT_FLAG_CANCELED);
+		__m256i analytic_bit = _mm256_set1_epi32(OBJECT_FLAG_ANALYTIC);
+
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m256 vx = _mm256_loadu_ps(x + i);
+			__m256 vy = _mm256_loadu_ps(y + i);
+			__m256 vlifetime = _mm256_loadu_ps(lifetime + i);
+			__m256i vflags = _mm256_loadu_si256((const __m256i*) (flags + i));
+
+			// dead or canceled, left alone
+			__m256 live = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(vflags, skip_bits), _mm256_setzero_si256()));
+			__m256 dead = _mm256_xor_ps(live, _mm256_castsi256_ps(_mm256_set1_epi32(-1)));
+
+			__m256 in_bounds = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(vx1, vx, _CMP_LE_OQ), _mm256_cmp_ps(vx, vx2, _CMP_LT_OQ)),
+											 _mm256_and_ps(_mm256_cmp_ps(vy1, vy, _CMP_LE_OQ), _mm256_cmp_ps(vy, vy2, _CMP_LT_OQ)));
+			in_bounds = _mm256_or_ps(in_bounds, _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(vflags, analytic_bit), analytic_bit)));
+			__m256 expired = _mm256_cmp_ps(vlifetime, _mm256_loadu_ps(lifespan + i), _CMP_GE_OQ);
+			__m256 cull = _mm256_or_ps(expired, _mm256_xor_ps(in_bounds, _mm256_castsi256_ps(_mm256_set1_epi32(-1))));
+
+			__m256 newly_dead = _mm256_andnot_ps(dead, cull);
+			__m256 keep = _mm256_or_ps(dead, cull);
+
+			vflags = _mm256_or_si256(vflags, _mm256_and_si256(_mm256_castps_si256(newly_dead), dead_bit));
+			vlifetime = _mm256_blendv_ps(_mm256_add_ps(vlifetime, vdelta), vlifetime, keep);
+
+			_mm256_storeu_si256((__m256i*) (flags + i), vflags);
+			_mm256_storeu_ps(lifetime + i, vlifetime);
+		}
+
+		CullBullets_Scalar(x + i, y + i, lifetime + i, lifespan + i, flags + i, count - i, delta, x1, y1, x2, y2);
+	}
+
+	TARGET_AVX2
+	static void UpdatePickups_AVX2(const float* x, const float* y, float* hsp, float* vsp,
+								   const int32_t* homing, size_t count,
+								   const float* target_x, const float* target_y, size_t target_count,
+								   float homing_spd, float gravity, float max_fall, float delta) {
+		__m256 vspd = _mm256_set1_ps(homing_spd);
+		__m256 vfall = _mm256_set1_ps(gravity * delta);
+		__m256 vmax = _mm256_set1_ps(max_fall);
+		__m256 zero = _mm256_setzero_ps();
+
+		// targets padded to 8 lanes, picked with a permute by the homing index
+		float tx_table[8] = {};
+		float ty_table[8] = {};
+		for (size_t t = 0; t < target_count && t < 8; t++) {
+			tx_table[t] = target_x[t];
+			ty_table[t] = target_y[t];
+		}
+		__m256 vtx_table = _mm256_loadu_ps(tx_table);
+		__m256 vty_table = _mm256_loadu_ps(ty_table);
+		__m256i vcount = _mm256_set1_epi32((int32_t) target_count);
+
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m256i h = _mm256_loadu_si256((const __m256i*) (homing + i));
+
+			// 0 <= h < target_count
+			__m256i valid = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), h), _mm256_cmpgt_epi32(vcount, h));
+			__m256 homes = _mm256_castsi256_ps(valid);
+
+			__m256 tx = _mm256_permutevar8x32_ps(vtx_table, h);
+			__m256 ty = _mm256_permutevar8x32_ps(vty_table, h);
+
+			__m256 dx = _mm256_sub_ps(tx, _mm256_loadu_ps(x + i));
+			__m256 dy = _mm256_sub_ps(ty, _mm256_loadu_ps(y + i));
+			__m256 len = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+			__m256 k = _mm256_div_ps(vspd, len);
+			__m256 moving = _mm256_cmp_ps(len, zero, _CMP_GT_OQ);
+			__m256 home_hsp = _mm256_blendv_ps(vspd, _mm256_mul_ps(dx, k), moving);
+			__m256 home_vsp = _mm256_and_ps(moving, _mm256_mul_ps(dy, k));
+
+			__m256 fall_vsp = _mm256_min_ps(vmax, _mm256_add_ps(_mm256_loadu_ps(vsp + i), vfall));
+
+			_mm256_storeu_ps(hsp + i, _mm256_and_ps(homes, home_hsp));
+			_mm256_storeu_ps(vsp + i, _mm256_blendv_ps(fall_vsp, home_vsp, homes));
+		}
+
+		UpdatePickups_Scalar(x + i, y + i, hsp + i, vsp + i, homing + i, count - i,
+							 target_x, target_y, target_count, homing_spd, gravity, max_fall, delta);
+	}
+
+	TARGET_AVX2
+	static void CollideCircles_AVX2(float player_x, float player_y, float graze_radius, float hit_radius,
+									const float* x, const float* y, const float* radius, size_t count,
+									uint32_t* graze_bits, uint32_t* hit_bits) {
+		__m256 px = _mm256_set1_ps(player_x);
+		__m256 py = _mm256_set1_ps(player_y);
+		__m256 gr = _mm256_set1_ps(graze_radius);
+		__m256 hr = _mm256_set1_ps(hit_radius);
+
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m256 dx = _mm256_sub_ps(_mm256_loadu_ps(x + i), px);
+			__m256 dy = _mm256_sub_ps(_mm256_loadu_ps(y + i), py);
+			__m256 dist_sqr = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+
+			__m256 r = _mm256_loadu_ps(radius + i);
+			__m256 graze = _mm256_add_ps(gr, r);
+			__m256 hit   = _mm256_add_ps(hr, r);
+
+			uint32_t shift = (uint32_t) (i % 32);
+			graze_bits[i / 32] |= (uint32_t) _mm256_movemask_ps(_mm256_cmp_ps(dist_sqr, _mm256_mul_ps(graze, graze), _CMP_LT_OQ)) << shift;
+			hit_bits[i / 32]   |= (uint32_t) _mm256_movemask_ps(_mm256_cmp_ps(dist_sqr, _mm256_mul_ps(hit, hit), _CMP_LT_OQ)) << shift;
+		}
+
+		CollideCirclesRange(player_x, player_y, graze_radius, hit_radius, x, y, radius, i, count, graze_bits, hit_bits);
+	}
+
+	TARGET_AVX2
+	static void CollideBoxes_AVX2(float player_x, float player_y, float graze_radius, float hit_radius,
+								  const float* x, const float* y, const float* axis_x, const float* axis_y,
+								  const float* half_width, const float* half_length, size_t count,
+								  uint32_t* graze_bits, uint32_t* hit_bits) {
+		__m256 px = _mm256_set1_ps(player_x);
+		__m256 py = _mm256_set1_ps(player_y);
+		__m256 graze = _mm256_set1_ps(graze_radius * graze_radius);
+		__m256 hit   = _mm256_set1_ps(hit_radius * hit_radius);
+		__m256 sign  = _mm256_set1_ps(-0.0f);
+
+		size_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m256 dx = _mm256_sub_ps(px, _mm256_loadu_ps(x + i));
+			__m256 dy = _mm256_sub_ps(py, _mm256_loadu_ps(y + i));
+			__m256 ax = _mm256_loadu_ps(axis_x + i);
+			__m256 ay = _mm256_loadu_ps(axis_y + i);
+			__m256 along  = _mm256_add_ps(_mm256_mul_ps(dx, ax), _mm256_mul_ps(dy, ay));
+			__m256 across = _mm256_sub_ps(_mm256_mul_ps(dx, ay), _mm256_mul_ps(dy, ax));
+
+			__m256 hw = _mm256_loadu_ps(half_width + i);
+			__m256 hl = _mm256_loadu_ps(half_length + i);
+			__m256 closest_across = _mm256_min_ps(hw, _mm256_max_ps(_mm256_xor_ps(hw, sign), across));
+			__m256 closest_along  = _mm256_min_ps(hl, _mm256_max_ps(_mm256_xor_ps(hl, sign), along));
+
+			__m256 du = _mm256_sub_ps(closest_across, across);
+			__m256 dv = _mm256_sub_ps(closest_along, along);
+			__m256 dist_sqr = _mm256_add_ps(_mm256_mul_ps(du, du), _mm256_mul_ps(dv, dv));
+
+			uint32_t shift = (uint32_t) (i % 32);
+			graze_bits[i / 32] |= (uint32_t) _mm256_movemask_ps(_mm256_cmp_ps(dist_sqr, graze, _CMP_LT_OQ)) << shift;
+			hit_bits[i / 32]   |= (uint32_t) _mm256_movemask_ps(_mm256_cmp_ps(dist_sqr, hit, _CMP_LT_OQ)) << shift;
+		}
+
+		CollideBoxesRange(player_x, player_y, graze_radius, hit_radius, x, y, axis_x, axis_y,
+						  half_width, half_length, i, count, graze_bits, hit_bits);
+	}
+
+	// Dispatch
+
+	typedef decltype(&MoveBullets_Scalar) MoveBulletsFunc;
+	typedef decltype(&CullBullets_Scalar) CullBulletsFunc;
+
+	static MoveBulletsFunc move_bullets_funcs[KERNEL_PATH_COUNT] = {
+		MoveBullets_Scalar,
+		MoveBullets_SSE2,
+		MoveBullets_AVX2
+	};
+
+	static CullBulletsFunc cull_bullets_funcs[KERNEL_PATH_COUNT] = {
+		CullBullets_Scalar,
+		CullBullets_SSE2,
+		CullBullets_AVX2
+	};
+
+	typedef decltype(&CollideCircles_Scalar) CollideCirclesFunc;
+
+	static CollideCirclesFunc collide_circles_funcs[KERNEL_PATH_COUNT] = {
+		CollideCircles_Scalar,
+		CollideCircles_SSE2,
+		CollideCircles_AVX2
+	};
+
+	typedef decltype(&CollideBoxes_Scalar) CollideBoxesFunc;
+
+	static CollideBoxesFunc collide_boxes_funcs[KERNEL_PATH_COUNT] = {
+		CollideBoxes_Scalar,
+		CollideBoxes_SSE2,
+		CollideBoxes_AVX2
+	};
+
+	typedef decltype(&UpdatePickups_Scalar) UpdatePickupsFunc;
+
+	static UpdatePickupsFunc update_pickups_funcs[KERNEL_PATH_COUNT] = {
+		UpdatePickups_Scalar,
+		UpdatePickups_SSE2,
+		UpdatePickups_AVX2
+	};
+
+	// -1 until the first GetKernelPath picks the best one. Workers read it in
+	// every kernel call while the console can set it.
+	static std::atomic<int> kernel_path{-1};
+	static std::once_flag kernel_path_detected;
+
+	bool IsKernelPathSupported(KernelPath path) {
+		switch (path) {
+			case KERNEL_PATH_SCALAR: return true;
+			case KERNEL_PATH_SSE2:   return SDL_HasSSE2();
+			case KERNEL_PATH_AVX2:   return SDL_HasAVX2();
+			default:                 return false;
+		}
+	}
+
+	static int GetSupportedPath(KernelPath path) {
+		int result = std::clamp((int) path, 0, KERNEL_PATH_COUNT - 1);
+		while (result > 0 && !IsKernelPathSupported((KernelPath) result)) {
+			result--;
+		}
+		return result;
+	}
+
+	KernelPath GetKernelPath() {
+		int path = kernel_path.load(std::memory_order_relaxed);
+		if (path < 0) {
+			// a SetKernelPath that got there first wins
+			std::call_once(kernel_path_detected, []() {
+				int none = -1;
+				kernel_path.compare_exchange_strong(none, GetSupportedPath(KERNEL_PATH_AVX2));
+			});
+			path = kernel_path.load(std::memory_order_relaxed);
+		}
+		return (KernelPath) path;
+	}
+
+	void SetKernelPath(KernelPath path) {
+		kernel_path.store(GetSupportedPath(path), std::memory_order_relaxed);
+	}
+
+	const char* GetKernelPathName(KernelPath path) {
+		switch (path) {
+			case KERNEL_PATH_SCALAR: return "scalar";
+			case KERNEL_PATH_SSE2:   return "sse2";
+			case KERNEL_PATH_AVX2:   return "avx2";
+			default:                 return "unknown";
+		}
+	}
+
+	void MoveBulletsKernel(float* x, float* y, float* spd,
+						   const float* dir_x, const float* dir_y, const float* acc,
+						   const float* lazer_timer, const float* lazer_time, const uint32_t* flags,
+						   size_t count, float delta) {
+		move_bullets_funcs[GetKernelPath()](x, y, spd, dir_x, dir_y, acc, lazer_timer, lazer_time, flags, count, delta);
+	}
+
+	void CullBulletsKernel(const float* x, const float* y, float* lifetime, const float* lifespan,
+						   uint32_t* flags, size_t count, float delta,
+						   float x1, float y1, float x2, float y2) {
+		cull_bullets_funcs[GetKernelPath()](x, y, lifetime, lifespan, flags, count, delta, x1, y1, x2, y2);
+	}
+
+	void CollideCirclesKernel(float player_x, float player_y, float graze_radius, float hit_radius,
+							  const float* x, const float* y, const float* radius, size_t count,
+							  uint32_t* graze_bits, uint32_t* hit_bits) {
+		size_t words = (count + 31) / 32;
+		std::fill(graze_bits, graze_bits + words, 0);
+		std::fill(hit_bits, hit_bits + words, 0);
+
+		collide_circles_funcs[GetKernelPath()](player_x, player_y, graze_radius, hit_radius,
+											   x, y, radius, count, graze_bits, hit_bits);
+	}
+
+	void CollideBoxesKernel(float player_x, float player_y, float graze_radius, float hit_radius,
+							const float* x, const float* y, const float* axis_x, const float* axis_y,
+							const float* half_width, const float* half_length, size_t count,
+							uint32_t* graze_bits, uint32_t* hit_bits) {
+		size_t words = (count + 31) / 32;
+		std::fill(graze_bits, graze_bits + words, 0);
+		std::fill(hit_bits, hit_bits + words, 0);
+
+		collide_boxes_funcs[GetKernelPath()](player_x, player_y, graze_radius, hit_radius,
+											 x, y, axis_x, axis_y, half_width, half_length, count,
+											 graze_bits, hit_bits);
+	}
+
+	void UpdatePickupsKernel(const float* x, const float* y, float* hsp, float* vsp,
+							 const int32_t* homing, size_t count,
+							 const float* target_x, const float* target_y, size_t target_count,
+							 float homing_spd, float gravity, float max_fall, float delta) {
+		update_pickups_funcs[GetKernelPath()](x, y, hsp, vsp, homing, count, target_x, target_y, target_count,
+											  homing_spd, gravity, max_fall, delta);
+	}
+
+	// Benchmark
+
+	struct BenchData {
+		std::vector<float> x, y, spd, dir_x, dir_y, acc, timer, time, lifetime, lifespan, hsp, vsp;
+		std::vector<uint32_t> flags;
+		std::vector<int32_t> homing;
+		uint32_t collide_hash = 0;
+	};
+
+	static void FillBenchData(BenchData& data, size_t count) {
+		// deterministic, with some NaN, -0 and negative speeds thrown in
+		uint32_t state = 12345;
+		auto next = [&state]() {
+			state = state * 1664525u + 1013904223u;
+			return (float) (state >> 8) / (float) (1 << 24);
+		};
+
+		auto fill = [&](std::vector<float>& v, float a, float b) {
+			v.resize(count);
+			for (float& f : v) f = a + (b - a) * next();
+		};
+
+		fill(data.x, -100.0f, 484.0f);
+		fill(data.y, -100.0f, 548.0f);
+		fill(data.spd, -1.0f, 8.0f);
+		fill(data.dir_x, -1.0f, 1.0f);
+		fill(data.dir_y, -1.0f, 1.0f);
+		fill(data.acc, -0.1f, 0.1f);
+		fill(data.timer, 0.0f, 60.0f);
+		fill(data.time, 0.0f, 60.0f);
+		fill(data.lifetime, 0.0f, 3600.0f);
+		fill(data.lifespan, 3000.0f, 3600.0f);
+		fill(data.hsp, -8.0f, 8.0f);
+		fill(data.vsp, -8.0f, 8.0f);
+
+		data.homing.resize(count);
+		for (int32_t& homing : data.homing) homing = (int32_t) (next() * 6.0f) - 2; // -2 to 3
+
+		data.flags.resize(count);
+		for (uint32_t& flags : data.flags) {
+			flags = (next() < 0.1f) ? OBJECT_FLAG_DEAD : 0;
+			if (next() < 0.5f) flags |= OBJECT_FLAG_ANALYTIC;
+		}
+
+		for (size_t i = 0; i < count; i += 97) {
+			data.x[i] = NAN;
+			data.spd[(i + 13) % count] = -0.0f;
+			data.timer[(i + 29) % count] = NAN;
+		}
+	}
+
+	static void HashBits(uint32_t& hash, const std::vector<uint32_t>& graze_bits, const std::vector<uint32_t>& hit_bits) {
+		for (size_t i = 0; i < graze_bits.size(); i++) {
+			hash = hash * 31u + graze_bits[i] * 7u + hit_bits[i];
+		}
+	}
+
+	void BenchKernels(size_t count, int iterations) {
+		BenchData reference;
+		bool have_reference = false;
+
+		for (int path = 0; path < KERNEL_PATH_COUNT; path++) {
+			if (!IsKernelPathSupported((KernelPath) path)) {
+				LOG("%s: not supported", GetKernelPathName((KernelPath) path));
+				continue;
+			}
+
+			BenchData data;
+			FillBenchData(data, count);
+
+			double move_time = 0.0;
+			double cull_time = 0.0;
+			double collide_time = 0.0;
+			double boxes_time = 0.0;
+			double pickups_time = 0.0;
+			float target_x[4] = {192.0f, 100.0f, 300.0f, 192.0f};
+			float target_y[4] = {400.0f, 420.0f, 380.0f, 0.0f};
+
+			std::vector<uint32_t> graze_bits((count + 31) / 32);
+			std::vector<uint32_t> hit_bits((count + 31) / 32);
+			std::vector<float> radius(count, 4.0f);
+
+			for (int i = 0; i < iterations; i++) {
+				double t = GetTime();
+				move_bullets_funcs[path](data.x.data(), data.y.data(), data.spd.data(),
+										 data.dir_x.data(), data.dir_y.data(), data.acc.data(),
+										 data.timer.data(), data.time.data(), data.flags.data(),
+										 count, BENCH_DELTA);
+				move_time += GetTime() - t;
+
+				t = GetTime();
+				cull_bullets_funcs[path](data.x.data(), data.y.data(), data.lifetime.data(), data.lifespan.data(),
+										 data.flags.data(), count, BENCH_DELTA,
+										 -50.0f, -50.0f, 434.0f, 498.0f);
+				cull_time += GetTime() - t;
+
+				t = GetTime();
+				std::fill(graze_bits.begin(), graze_bits.end(), 0);
+				std::fill(hit_bits.begin(), hit_bits.end(), 0);
+				collide_circles_funcs[path](192.0f, 400.0f, 16.0f, 2.0f,
+											data.x.data(), data.y.data(), radius.data(), count,
+											graze_bits.data(), hit_bits.data());
+				collide_time += GetTime() - t;
+				HashBits(data.collide_hash, graze_bits, hit_bits);
+
+				t = GetTime();
+				std::fill(graze_bits.begin(), graze_bits.end(), 0);
+				std::fill(hit_bits.begin(), hit_bits.end(), 0);
+				collide_boxes_funcs[path](192.0f, 400.0f, 16.0f, 2.0f,
+										  data.x.data(), data.y.data(), data.dir_x.data(), data.dir_y.data(),
+										  radius.data(), data.time.data(), count,
+										  graze_bits.data(), hit_bits.data());
+				boxes_time += GetTime() - t;
+				HashBits(data.collide_hash, graze_bits, hit_bits);
+
+				t = GetTime();
+				update_pickups_funcs[path](data.x.data(), data.y.data(), data.hsp.data(), data.vsp.data(),
+										   data.homing.data(), count, target_x, target_y, 4,
+										   8.0f, 0.025f, 2.0f, BENCH_DELTA);
+				pickups_time += GetTime() - t;
+			}
+
+			double per_bullet = 1'000'000'000.0 / (double) count / (double) iterations;
+
+			bool matches = true;
+			if (have_reference) {
+				auto same = [](const std::vector<float>& a, const std::vector<float>& b) {
+					return memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+				};
+				matches = same(data.x, reference.x) && same(data.y, reference.y) && same(data.spd, reference.spd)
+					&& same(data.lifetime, reference.lifetime) && data.flags == reference.flags
+					&& same(data.hsp, reference.hsp) && same(data.vsp, reference.vsp)
+					&& data.collide_hash == reference.collide_hash;
+			} else {
+				reference = std::move(data);
+				have_reference = true;
+			}
+
+			LOG("%s: move %.3f ns/bullet, cull %.3f ns/bullet, circles %.3f ns/bullet, boxes %.3f ns/bullet, pickups %.3f ns/pickup%s",
+				GetKernelPathName((KernelPath) path),
+				move_time * per_bullet,
+				cull_time * per_bullet,
+				collide_time * per_bullet,
+				boxes_time * per_bullet,
+				pickups_time * per_bullet,
+				matches ? "" : " (MISMATCH)");
+		}
+	}
+
+	void BenchKernelsParallel(size_t count, int iterations) {
+		static const size_t thread_counts[] = {1, 2, 4, 8};
+
+		BenchData reference;
+		double reference_time = 0.0;
+
+		for (size_t thread_count : thread_counts) {
+			JobSystem jobs;
+			jobs.Init(thread_count);
+
+			BenchData data;
+			FillBenchData(data, count);
+
+			double move_time = 0.0;
+			double cull_time = 0.0;
+			double collide_time = 0.0;
+
+			std::vector<uint32_t> graze_bits((count + 31) / 32);
+			std::vector<uint32_t> hit_bits((count + 31) / 32);
+			std::vector<float> radius(count, 4.0f);
+
+			for (int i = 0; i < iterations; i++) {
+				double t = GetTime();
+				jobs.ParallelFor(count, KERNEL_GRAIN, [&](size_t begin, size_t end, size_t) {
+					MoveBulletsKernel(data.x.data() + begin, data.y.data() + begin, data.spd.data() + begin,
+									  data.dir_x.data() + begin, data.dir_y.data() + begin, data.acc.data() + begin,
+									  data.timer.data() + begin, data.time.data() + begin, data.flags.data() + begin,
+									  end - begin, BENCH_DELTA);
+				});
+				move_time += GetTime() - t;
+
+				t = GetTime();
+				jobs.ParallelFor(count, KERNEL_GRAIN, [&](size_t begin, size_t end, size_t) {
+					CullBulletsKernel(data.x.data() + begin, data.y.data() + begin,
+									  data.lifetime.data() + begin, data.lifespan.data() + begin,
+									  data.flags.data() + begin, end - begin, BENCH_DELTA,
+									  -50.0f, -50.0f, 434.0f, 498.0f);
+				});
+				cull_time += GetTime() - t;
+
+				t = GetTime();
+				jobs.ParallelFor(count, KERNEL_GRAIN, [&](size_t begin, size_t end, size_t) {
+					CollideCirclesKernel(192.0f, 400.0f, 16.0f, 2.0f,
+										 data.x.data() + begin, data.y.data() + begin, radius.data() + begin, end - begin,
+										 graze_bits.data() + begin / 32, hit_bits.data() + begin / 32);
+				});
+				collide_time += GetTime() - t;
+				HashBits(data.collide_hash, graze_bits, hit_bits);
+			}
+
+			double per_pass = 1000.0 / (double) iterations;
+			double total = move_time + cull_time + collide_time;
+
+			bool matches = true;
+			if (thread_count == thread_counts[0]) {
+				reference = std::move(data);
+				reference_time = total;
+			} else {
+				auto same = [](const std::vector<float>& a, const std::vector<float>& b) {
+					return memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+				};
+				matches = same(data.x, reference.x) && same(data.y, reference.y) && same(data.spd, reference.spd)
+					&& same(data.lifetime, reference.lifetime) && data.flags == reference.flags
+					&& data.collide_hash == reference.collide_hash;
+			}
+
+			// past the core count the threads only take turns, that's overhead and not scaling
+			LOG("%zu threads: move %.3fms, cull %.3fms, circles %.3fms, %.2fx%s%s",
+				jobs.GetWorkerCount(),
+				move_time * per_pass,
+				cull_time * per_pass,
+				collide_time * per_pass,
+				reference_time / total,
+				(int) thread_count > SDL_GetCPUCount() ? ", more threads than cores" : "",
+				matches ? "" : " (MISMATCH)");
+		}
+	}
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// bullets per job when a pass is split across the JobSystem. A multiple of 32,
+// so every range starts on a whole word of collision bits and on a 64 byte line.
+#define KERNEL_GRAIN 4096
+
+namespace th {
+
+	enum KernelPath {
+		KERNEL_PATH_SCALAR,
+		KERNEL_PATH_SSE2,
+		KERNEL_PATH_AVX2,
+
+		KERNEL_PATH_COUNT
+	};
+
+	// Straight-line per-bullet passes over the BulletPool arrays.
+	// The SIMD paths give bit-identical results to the scalar one: there is
+	// no FMA, and every compare sends NaNs the same way the scalar code does,
+	// so replays don't depend on the CPU.
+
+	// x += spd * dir * delta, then spd += acc * delta clamped at 0.
+	// With lazer_timer/lazer_time, bullets whose timer hasn't reached the time stay in place.
+	// Bullets flagged OBJECT_FLAG_ANALYTIC are skipped.
+	void MoveBulletsKernel(float* x, float* y, float* spd,
+						   const float* dir_x, const float* dir_y, const float* acc,
+						   const float* lazer_timer, const float* lazer_time, const uint32_t* flags,
+						   size_t count, float delta);
+
+	// Flags bullets outside [x1, x2) x [y1, y2) or past their lifespan with
+	// OBJECT_FLAG_DEAD and advances lifetime on the rest. Already dead ones are left alone.
+	// OBJECT_FLAG_ANALYTIC bullets skip the bounds test, they die at their exit time.
+	void CullBulletsKernel(const float* x, const float* y, float* lifetime, const float* lifespan,
+						   uint32_t* flags, size_t count, float delta,
+						   float x1, float y1, float x2, float y2);
+
+	// Graze and hit tests of one player against a batch of round bullets.
+	// The distance is computed once per bullet. Bit i%32 of word i/32 is
+	// circle_vs_circle against graze_radius / hit_radius, both arrays need (count+31)/32 words.
+	void CollideCirclesKernel(float player_x, float player_y, float graze_radius, float hit_radius,
+							  const float* x, const float* y, const float* radius, size_t count,
+							  uint32_t* graze_bits, uint32_t* hit_bits);
+
+	// Same as CollideCirclesKernel, for oriented boxes given by center, unit
+	// axis along the length and half extents across/along it.
+	void CollideBoxesKernel(float player_x, float player_y, float graze_radius, float hit_radius,
+							const float* x, const float* y, const float* axis_x, const float* axis_y,
+							const float* half_width, const float* half_length, size_t count,
+							uint32_t* graze_bits, uint32_t* hit_bits);
+
+	// Velocity of every pickup for one frame. Pickups with homing >= 0 fly at
+	// (target_x, target_y)[homing] at homing_spd, the rest stop sideways and
+	// fall with gravity up to max_fall. target_count is at most 8.
+	void UpdatePickupsKernel(const float* x, const float* y, float* hsp, float* vsp,
+							 const int32_t* homing, size_t count,
+							 const float* target_x, const float* target_y, size_t target_count,
+							 float homing_spd, float gravity, float max_fall, float delta);
+
+	KernelPath GetKernelPath();
+	// falls back to the best path the CPU supports
+	void SetKernelPath(KernelPath path);
+	bool IsKernelPathSupported(KernelPath path);
+	const char* GetKernelPathName(KernelPath path);
+
+	// logs ns/bullet for every supported path and checks them against the scalar one
+	void BenchKernels(size_t count, int iterations);
+
+	// logs ms per pass of move, cull and circles on the current path split
+	// into KERNEL_GRAIN ranges at 1, 2, 4 and 8 threads, checked against 1 thread
+	void BenchKernelsParallel(size_t count, int iterations);
+
+}
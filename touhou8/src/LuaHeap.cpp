@@ -0,0 +1,119 @@
+#include "LuaHeap.h"
+
+#include "Snapshot.h"
+
+#include "utils.h"
+
+namespace th {
+
+	static int GetSizeClass(size_t nsize) {
+		int result = 0;
+		while (((size_t) 16 << result) < nsize) result++;
+		return result;
+	}
+
+	void LuaHeap::Init(size_t _size) {
+		Release();
+
+		base = (uint8_t*) SDL_malloc(_size);
+		if (!base) {
+			LOG("Couldn't allocate a %zu byte Lua heap.", _size);
+			return;
+		}
+		size = _size;
+		used = 0;
+	}
+
+	void LuaHeap::Release() {
+		SDL_free(base);
+		base = nullptr;
+		size = 0;
+		used = 0;
+		for (void*& head : free_list) head = nullptr;
+	}
+
+	void* LuaHeap::Alloc(void* ud, void* ptr, size_t osize, size_t nsize) {
+		LuaHeap* heap = (LuaHeap*) ud;
+
+		if (nsize == 0) {
+			if (ptr) heap->Free(ptr, osize);
+			return nullptr;
+		}
+
+		// osize is a type tag when there is no block yet
+		if (!ptr) {
+			return heap->Allocate(nsize);
+		}
+
+		if (GetSizeClass(nsize) == GetSizeClass(osize)) {
+			return ptr;
+		}
+
+		void* result = heap->Allocate(nsize);
+		if (!result) {
+			// a shrink may not fail, keep the bigger block. Freeing it later
+			// files it under the smaller class, which it still covers.
+			return (nsize < osize) ? ptr : nullptr;
+		}
+
+		memcpy(result, ptr, (osize < nsize) ? osize : nsize);
+		heap->Free(ptr, osize);
+		return result;
+	}
+
+	void* LuaHeap::Allocate(size_t nsize) {
+		int size_class = GetSizeClass(nsize);
+		if (size_class >= LUA_HEAP_CLASS_COUNT) return nullptr;
+
+		if (void* result = free_list[size_class]) {
+			memcpy(&free_list[size_class], result, sizeof(void*));
+			return result;
+		}
+
+		size_t block_size = (size_t) 16 << size_class;
+		if (!base || block_size > size - used) {
+			// Lua collects and tries again, then raises a memory error
+			return nullptr;
+		}
+
+		void* result = base + used;
+		used += block_size;
+		return result;
+	}
+
+	void LuaHeap::Free(void* ptr, size_t osize) {
+		int size_class = GetSizeClass(osize);
+		memcpy(ptr, &free_list[size_class], sizeof(void*));
+		free_list[size_class] = ptr;
+	}
+
+	void LuaHeap::Save(SnapshotWriter& writer) const {
+		writer.Write(base);
+		writer.Write(used);
+		writer.Write(free_list);
+		writer.Write(base, used);
+	}
+
+	bool LuaHeap::Load(SnapshotReader& reader) {
+		uint8_t* saved_base = nullptr;
+		size_t saved_used = 0;
+		reader.Read(saved_base);
+		reader.Read(saved_used);
+
+		if (!reader.ok || saved_base != base || saved_used > size) {
+			LOG("Lua heap snapshot is from another heap.");
+			return false;
+		}
+
+		// nothing changes unless all of it is there
+		void* saved_free_list[LUA_HEAP_CLASS_COUNT];
+		reader.Read(saved_free_list);
+		reader.Read(base, saved_used);
+		if (!reader.ok) return false;
+
+		used = saved_used;
+		memcpy(free_list, saved_free_list, sizeof(free_list));
+		return true;
+	}
+
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LUA_HEAP_CLASS_COUNT 28 // blocks of 16 bytes up to 2Gb
+
+namespace th {
+
+	class SnapshotWriter;
+	class SnapshotReader;
+
+	// One block allocated up front that a Lua state does all its allocations
+	// in, passed to lua_newstate as the lua_Alloc. Every pointer the state
+	// holds then points into the block or at code and assets that don't
+	// move, so copying the used part of the block out and back in later puts
+	// the whole VM back as it was, coroutines and all. That only works for
+	// the same state in the same process, the block never moves.
+	//
+	// Blocks come in power of two size classes with a free list each. Lua
+	// always passes the old size back in, so blocks need no header.
+	//
+	// Freed blocks never coalesce or split: a block only ever comes back
+	// for its own size class. A script that first fills the heap with small
+	// tables and then wants large strings runs out at Options::lua_heap_size
+	// even with most of it free, and Lua raises a memory error. Stage scripts
+	// allocate the same few sizes over and over, so the free lists settle
+	// early; size the heap for the peak of every class added up.
+	class LuaHeap {
+	public:
+		LuaHeap() = default;
+		LuaHeap(const LuaHeap&) = delete;
+		LuaHeap& operator=(const LuaHeap&) = delete;
+		~LuaHeap() { Release(); }
+
+		void Init(size_t size);
+		void Release();
+
+		// lua_Alloc, ud is the LuaHeap
+		static void* Alloc(void* ud, void* ptr, size_t osize, size_t nsize);
+
+		size_t GetSize() const { return size; }
+		size_t GetUsed() const { return used; }
+		const uint8_t* GetBase() const { return base; }
+
+		void Save(SnapshotWriter& writer) const;
+		bool Load(SnapshotReader& reader);
+
+	private:
+		void* Allocate(size_t nsize);
+		void Free(void* ptr, size_t osize);
+
+		uint8_t* base = nullptr;
+		size_t size = 0;
+		size_t used = 0; // everything past it was never handed out
+		void* free_list[LUA_HEAP_CLASS_COUNT]{};
+	};
+
+}
@@ -4,13 +4,17 @@
 
 #include <lua.hpp>
 
-// first byte is object type, then id
+// 4 bits object type, 12 bits slot generation, 16 bits slot index
 #define _TYPE_PART_SHIFT 28u
-#define _ID_PART_MASK 0x0FFF'FFFFu
+#define _GENERATION_PART_SHIFT 16u
+#define _GENERATION_PART_MASK 0x0FFFu
+#define _INDEX_PART_MASK 0xFFFFu
 
-#define MAKE_INSTANCE_ID(id, type)    ((full_instance_id) (((instance_id_id) (id)) | ((type) << _TYPE_PART_SHIFT)))
-#define INSTANCE_ID_GET_TYPE(full_id) ((object_type) ((full_id) >> _TYPE_PART_SHIFT))
-#define INSTANCE_ID_GET_ID(full_id)   ((instance_id_id) ((full_id) & _ID_PART_MASK))
+#define MAKE_INSTANCE_ID(index, generation, type) \
+	((full_instance_id) (((instance_id_id) (index)) | ((uint32_t) (generation) << _GENERATION_PART_SHIFT) | ((uint32_t) (type) << _TYPE_PART_SHIFT)))
+#define INSTANCE_ID_GET_TYPE(full_id)       ((object_type) ((full_id) >> _TYPE_PART_SHIFT))
+#define INSTANCE_ID_GET_GENERATION(full_id) ((uint32_t) (((full_id) >> _GENERATION_PART_SHIFT) & _GENERATION_PART_MASK))
+#define INSTANCE_ID_GET_INDEX(full_id)      ((instance_id_id) ((full_id) & _INDEX_PART_MASK))
 
 #define NULL_INSTANCE_ID ((full_instance_id)(-1))
 
@@ -24,6 +28,7 @@ namespace th {
 		TYPE_BOSS,
 		TYPE_ENEMY,
 		TYPE_BULLET,
+		TYPE_LAZER,
 
 		TYPE_COUNT
 	};
@@ -68,7 +73,10 @@ namespace th {
 	// flags
 
 	enum ObjectFlags {
-		OBJECT_FLAG_DEAD = 1
+		OBJECT_FLAG_DEAD = 1,
+		OBJECT_FLAG_ANALYTIC = 1 << 1, // bullet moves in closed form, see Stage::StartAnalyticMotion
+		OBJECT_FLAG_ASLEEP = 1 << 2, // bullet can't reach a player this step, see Stage::ScheduleBulletTests
+		OBJECT_FLAG_CANCELED = 1 << 3 // bullet waits for the cancel wave to turn it into a pickup, harmless
 	};
 
 	enum BulletFlags {
@@ -101,6 +109,10 @@ namespace th {
 		float acc;
 		float radius;
 
+		// unit vector of dir, written together with it by Stage::SetDir
+		float dir_x = 1.0f;
+		float dir_y = 0.0f;
+
 		Sprite* sprite;
 		float frame_index;
 		float xscale = 1.0f;
@@ -140,12 +152,15 @@ namespace th {
 	};
 
 	struct PlayerBullet {
+		uint32_t flags;
 		float x;
 		float y;
 		float spd;
 		float dir;
 		float acc;
 		float radius;
+		float dir_x = 1.0f;
+		float dir_y = 0.0f;
 		Sprite* sprite;
 		float frame_index;
 		float dmg;
@@ -155,26 +170,6 @@ namespace th {
 		};
 	};
 
-	struct Bullet : Object {
-		ProjectileType type;
-		union {
-			struct {
-				float lazer_length;
-				float lazer_target_length;
-				float lazer_thickness;
-				float lazer_time;
-				float lazer_timer;
-			};
-		};
-
-		float lifetime;
-		float lifespan = 60.0f * 60.0f;
-		uint32_t grazed_by;
-
-		int coroutine = LUA_REFNIL;
-		int update_callback = LUA_REFNIL;
-	};
-
 	struct Enemy : Object {
 		float hp;
 		int drops;
@@ -184,16 +179,4 @@ namespace th {
 		int death_callback = LUA_REFNIL;
 	};
 
-	struct Pickup {
-		float x;
-		float y;
-		float hsp;
-		float vsp;
-		float radius;
-		Sprite* sprite;
-		float frame_index;
-		PickupType type;
-		full_instance_id homing_target = NULL_INSTANCE_ID;
-	};
-
 }
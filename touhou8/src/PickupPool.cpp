@@ -0,0 +1,154 @@
+#include "PickupPool.h"
+
+#include "Snapshot.h"
+
+namespace th {
+
+	template <typename F>
+	void PickupPool::ForEachMember(const F& f) {
+		f(&PickupPool::x);
+		f(&PickupPool::y);
+		f(&PickupPool::x0);
+		f(&PickupPool::y0);
+		f(&PickupPool::hsp);
+		f(&PickupPool::vsp);
+		f(&PickupPool::homing);
+		f(&PickupPool::flags);
+
+		f(&PickupPool::type);
+		f(&PickupPool::count);
+	}
+
+	template <typename F>
+	void PickupPool::ForEachArray(const F& f) {
+		ForEachMember([this, &f](auto member) {
+			f(this->*member);
+		});
+	}
+
+	void PickupPool::Init(Arena& arena, size_t _capacity) {
+		ForEachArray([&arena, _capacity](auto& array) {
+			array.Init(arena, _capacity);
+		});
+		keep.reserve(_capacity);
+	}
+
+	size_t PickupPool::BytesPerItem() const {
+		size_t result = 0;
+		const_cast<PickupPool*>(this)->ForEachArray([&result](auto& array) {
+			result += sizeof(array[0]);
+		});
+		return result;
+	}
+
+	size_t PickupPool::Add(float _x, float _y, PickupType _type, bool refuse) {
+		bool spare = refuse || Full();
+		size_t index = spare ? capacity() : size();
+
+		auto put = [spare](auto& array, auto value) {
+			if (spare) {
+				array.Spare() = value;
+			} else {
+				array.push_back(value);
+			}
+		};
+
+		put(x, _x);
+		put(y, _y);
+		put(x0, _x);
+		put(y0, _y);
+		put(hsp, 0.0f);
+		put(vsp, -1.5f);
+		put(homing, PICKUP_NO_TARGET);
+		put(flags, 0);
+
+		put(type, _type);
+		put(count, 1);
+
+		return index;
+	}
+
+	size_t PickupPool::AddBulk(const float* _x, const float* _y, size_t _count, PickupType _type) {
+		size_t dropped = 0;
+		if (_count > capacity() - size()) {
+			dropped = _count - (capacity() - size());
+			_count -= dropped;
+		}
+
+		x.Append(_x, _count);
+		y.Append(_y, _count);
+		x0.Append(_x, _count);
+		y0.Append(_y, _count);
+		hsp.resize(hsp.size() + _count, 0.0f);
+		vsp.resize(vsp.size() + _count, -1.5f);
+		homing.resize(homing.size() + _count, PICKUP_NO_TARGET);
+		flags.resize(flags.size() + _count, 0);
+
+		type.resize(type.size() + _count, _type);
+		count.resize(count.size() + _count, 1);
+
+		return dropped;
+	}
+
+	void PickupPool::Clear() {
+		ForEachArray([](auto& array) {
+			array.clear();
+		});
+	}
+
+	size_t PickupPool::Append(PickupPool& other) {
+		size_t room = capacity() - size();
+		size_t dropped = (other.size() > room) ? other.size() - room : 0;
+
+		ForEachMember([this, &other](auto member) {
+			auto& array = this->*member;
+			auto& from = other.*member;
+			array.Append(from.data(), from.size());
+			from.clear();
+		});
+
+		return dropped;
+	}
+
+	void PickupPool::RemoveDead() {
+		size_t n = size();
+
+		size_t first_dead = 0;
+		while (first_dead < n && !(flags[first_dead] & OBJECT_FLAG_DEAD)) {
+			first_dead++;
+		}
+
+		if (first_dead == n) {
+			return;
+		}
+
+		keep.clear();
+		for (size_t i = first_dead; i < n; i++) {
+			if (!(flags[i] & OBJECT_FLAG_DEAD)) {
+				keep.push_back((uint32_t) i);
+			}
+		}
+
+		// one streaming pass per array
+		ForEachArray([this, first_dead](auto& array) {
+			size_t w = first_dead;
+			for (uint32_t r : keep) {
+				array[w++] = array[r];
+			}
+			array.resize(w);
+		});
+	}
+
+	void PickupPool::Save(SnapshotWriter& writer) const {
+		const_cast<PickupPool*>(this)->ForEachArray([&writer](auto& array) {
+			writer.WriteArray(array);
+		});
+	}
+
+	void PickupPool::Load(SnapshotReader& reader) {
+		ForEachArray([&reader](auto& array) {
+			reader.ReadArray(array);
+		});
+	}
+
+}
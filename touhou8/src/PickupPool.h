@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Objects.h"
+#include "Arena.h"
+
+#include <vector>
+
+#define PICKUP_NO_TARGET (-1)
+
+namespace th {
+
+	class SnapshotWriter;
+	class SnapshotReader;
+
+	// Structure-of-arrays storage for pickups. They have no ids and no
+	// scripts, so this is just the arrays and a stable compaction.
+	// Every pickup uses the same sprite, its frame is the pickup type.
+	class PickupPool {
+	public:
+		size_t size() const { return x.size(); }
+		bool empty() const { return x.empty(); }
+
+		size_t capacity() const { return x.capacity(); }
+		bool Full() const { return x.Full(); }
+
+		void Init(Arena& arena, size_t capacity);
+		size_t BytesPerItem() const;
+
+		// when full or refused this sets up the spare pickup at index capacity(), which is never kept
+		size_t Add(float x, float y, PickupType type, bool refuse = false);
+		// count pickups of one type at once, same initial state as Add. Returns how many didn't fit.
+		size_t AddBulk(const float* x, const float* y, size_t count, PickupType type);
+		void Clear();
+
+		// Moves every pickup of other to the end of this pool and empties it.
+		// Returns how many didn't fit.
+		size_t Append(PickupPool& other);
+
+		// Stable compaction of every pickup flagged OBJECT_FLAG_DEAD, keeps draw order.
+		void RemoveDead();
+
+		void Save(SnapshotWriter& writer) const;
+		void Load(SnapshotReader& reader);
+
+		// hot
+		FixedArray<float> x;
+		FixedArray<float> y;
+		FixedArray<float> x0; // position at the start of the physics step
+		FixedArray<float> y0;
+		FixedArray<float> hsp;
+		FixedArray<float> vsp;
+		FixedArray<int32_t> homing; // player index it flies to, or PICKUP_NO_TARGET
+		FixedArray<uint32_t> flags;
+
+		FixedArray<PickupType> type;
+		FixedArray<uint32_t> count; // how many pickups were merged into this one, see Stage::CoalescePickups
+
+	private:
+		template <typename F>
+		void ForEachMember(const F& f);
+		template <typename F>
+		void ForEachArray(const F& f);
+
+		std::vector<uint32_t> keep;
+	};
+
+}
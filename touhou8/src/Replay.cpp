@@ -0,0 +1,371 @@
+#include "Replay.h"
+
+#include "Assets.h"
+#include "Game.h"
+
+#include "utils.h"
+
+#define REPLAY_MAGIC 0x52385448u // "TH8R"
+
+// what a replay may ask for, a bad file gets refused instead of allocating whatever it says
+#define REPLAY_MIN_ARENA_SIZE (1024 * 1024)
+#define REPLAY_MAX_ARENA_SIZE (1024 * 1024 * 1024)
+
+namespace th {
+
+	static void Put8(std::vector<uint8_t>& out, uint8_t value) {
+		out.push_back(value);
+	}
+
+	static void Put32(std::vector<uint8_t>& out, uint32_t value) {
+		for (int i = 0; i < 4; i++) out.push_back((uint8_t) (value >> (i * 8)));
+	}
+
+	static void Put64(std::vector<uint8_t>& out, uint64_t value) {
+		for (int i = 0; i < 8; i++) out.push_back((uint8_t) (value >> (i * 8)));
+	}
+
+	// 7 bits at a time, most runs fit in a byte
+	static void PutVarint(std::vector<uint8_t>& out, uint32_t value) {
+		while (value >= 0x80) {
+			out.push_back((uint8_t) (value | 0x80));
+			value >>= 7;
+		}
+		out.push_back((uint8_t) value);
+	}
+
+	// Reads past the end come back as zeroes and clear ok.
+	struct ReplayReader {
+		const uint8_t* data;
+		size_t size;
+		size_t cursor = 0;
+		bool ok = true;
+
+		uint8_t Get8() {
+			if (cursor + 1 > size) {
+				ok = false;
+				return 0;
+			}
+			return data[cursor++];
+		}
+
+		uint32_t Get32() {
+			uint32_t result = 0;
+			for (int i = 0; i < 4; i++) result |= (uint32_t) Get8() << (i * 8);
+			return result;
+		}
+
+		uint64_t Get64() {
+			uint64_t result = 0;
+			for (int i = 0; i < 8; i++) result |= (uint64_t) Get8() << (i * 8);
+			return result;
+		}
+
+		uint32_t GetVarint() {
+			uint32_t result = 0;
+			for (int shift = 0; shift < 35; shift += 7) {
+				uint8_t byte = Get8();
+				result |= (uint32_t) (byte & 0x7F) << shift;
+				if (!(byte & 0x80)) return result;
+			}
+			ok = false;
+			return 0;
+		}
+	};
+
+	uint64_t HashScripts(const Assets& assets) {
+		// FNV-1a over the names and contents, sorted by name since the map isn't
+		std::vector<const std::pair<const std::string, Script>*> sorted;
+		for (const auto& script : assets.GetScripts()) {
+			sorted.push_back(&script);
+		}
+		std::sort(sorted.begin(), sorted.end(), [](auto a, auto b) { return a->first < b->first; });
+
+		uint64_t hash = 0xCBF29CE484222325ull;
+		auto add = [&hash](const char* data, size_t size) {
+			for (size_t i = 0; i < size; i++) {
+				hash ^= (uint8_t) data[i];
+				hash *= 0x100000001B3ull;
+			}
+		};
+
+		for (auto* script : sorted) {
+			add(script->first.c_str(), script->first.size() + 1);
+			add(script->second.data, script->second.size);
+		}
+
+		return hash;
+	}
+
+	void Replay::ArmRecording(const char* _fname) {
+		Stop();
+
+		fname = _fname;
+		mode = REPLAY_RECORD;
+		uncapped = false;
+	}
+
+	bool Replay::ArmPlayback(const char* _fname) {
+		Stop();
+
+		fname = _fname;
+		if (!Load()) {
+			return false;
+		}
+
+		mode = REPLAY_PLAY;
+		return true;
+	}
+
+	void Replay::Begin(Stage& stage, uint32_t game_seed) {
+		frame = 0;
+		begun = mode != REPLAY_OFF;
+
+		switch (mode) {
+			case REPLAY_RECORD: {
+				header = {};
+				header.game_seed = game_seed;
+				header.stage_seed = stage.context.seed;
+
+				header.player_count = (uint32_t) stage.context.player_count;
+				std::copy(stage.context.player_character, stage.context.player_character + MAX_PLAYERS, header.player_character);
+
+				const Options& options = *stage.context.options;
+				header.starting_lives = options.starting_lives;
+				header.stage_arena_size = options.stage_arena_size;
+				std::copy(options.pool_budgets, options.pool_budgets + POOL_COUNT, header.pool_budgets);
+
+				header.collision_broadphase = stage.collision_broadphase;
+				header.swept_collision = stage.swept_collision;
+				header.physics_substeps = stage.physics_substeps;
+				header.pickup_merge_threshold = stage.pickup_merge_threshold;
+				header.cancel_wave_frames = stage.cancel_wave_frames;
+
+				header.script_hash = HashScripts(*stage.context.assets);
+
+				runs.clear();
+
+				LOG("Recording to %s", fname.c_str());
+				break;
+			}
+
+			case REPLAY_PLAY: {
+				if (header.script_hash != HashScripts(*stage.context.assets)) {
+					LOG("%s was recorded with other scripts, it will likely desync", fname.c_str());
+				}
+
+				stage.collision_broadphase = header.collision_broadphase;
+				stage.swept_collision = header.swept_collision;
+				stage.physics_substeps = header.physics_substeps;
+				stage.pickup_merge_threshold = header.pickup_merge_threshold;
+				stage.cancel_wave_frames = header.cancel_wave_frames;
+
+				run_cursor = 0;
+				run_frame = 0;
+
+				LOG("Playing %s, %u frames", fname.c_str(), header.frame_count);
+				break;
+			}
+
+			case REPLAY_OFF: break;
+		}
+	}
+
+	void Replay::Record(const InputState* input, size_t player_count) {
+		if (mode != REPLAY_RECORD) return;
+
+		if (runs.empty() || !std::equal(input, input + player_count, runs.back().input)) {
+			ReplayRun& run = runs.emplace_back();
+			run.frames = 0;
+			std::copy(input, input + player_count, run.input);
+		}
+
+		runs.back().frames++;
+		frame++;
+	}
+
+	bool Replay::Next(InputState* input, size_t player_count) {
+		if (mode != REPLAY_PLAY) return false;
+
+		if (run_cursor >= runs.size()) {
+			return false;
+		}
+
+		const ReplayRun& run = runs[run_cursor];
+		std::copy(run.input, run.input + player_count, input);
+
+		if (++run_frame >= run.frames) {
+			run_cursor++;
+			run_frame = 0;
+		}
+
+		frame++;
+		return true;
+	}
+
+	void Replay::Stop() {
+		if (mode == REPLAY_RECORD && begun) {
+			header.frame_count = frame;
+			if (Save()) {
+				LOG("Saved %u frames in %zu runs to %s", frame, runs.size(), fname.c_str());
+			}
+		}
+
+		RestoreSettings();
+
+		mode = REPLAY_OFF;
+		uncapped = false;
+		begun = false;
+	}
+
+	void Replay::End() {
+		if (begun) Stop();
+	}
+
+	void Replay::ApplySettings(Options& options) {
+		RestoreSettings();
+
+		applied_to = &options;
+		saved_starting_lives = options.starting_lives;
+		saved_stage_arena_size = options.stage_arena_size;
+		std::copy(options.pool_budgets, options.pool_budgets + POOL_COUNT, saved_pool_budgets);
+
+		options.starting_lives = header.starting_lives;
+		options.stage_arena_size = header.stage_arena_size;
+		std::copy(header.pool_budgets, header.pool_budgets + POOL_COUNT, options.pool_budgets);
+	}
+
+	void Replay::RestoreSettings() {
+		if (!applied_to) return;
+
+		applied_to->starting_lives = saved_starting_lives;
+		applied_to->stage_arena_size = saved_stage_arena_size;
+		std::copy(saved_pool_budgets, saved_pool_budgets + POOL_COUNT, applied_to->pool_budgets);
+		applied_to = nullptr;
+	}
+
+	bool Replay::Save() const {
+		std::vector<uint8_t> out;
+
+		Put32(out, REPLAY_MAGIC);
+		Put32(out, REPLAY_VERSION);
+
+		Put32(out, header.game_seed);
+		Put32(out, header.stage_seed);
+
+		Put32(out, header.player_count);
+		for (size_t i = 0; i < header.player_count; i++) {
+			Put8(out, (uint8_t) header.player_character[i]);
+		}
+
+		Put32(out, (uint32_t) header.starting_lives);
+		Put64(out, header.stage_arena_size);
+		for (int pool = 0; pool < POOL_COUNT; pool++) {
+			Put64(out, header.pool_budgets[pool].max);
+			Put8(out, header.pool_budgets[pool].policy);
+		}
+
+		Put8(out, header.collision_broadphase);
+		Put8(out, header.swept_collision);
+		Put32(out, (uint32_t) header.physics_substeps);
+		Put64(out, header.pickup_merge_threshold);
+		Put32(out, (uint32_t) header.cancel_wave_frames);
+
+		Put64(out, header.script_hash);
+		Put32(out, header.frame_count);
+
+		// INPUT_COUNT bits fit in a byte per player
+		Put32(out, (uint32_t) runs.size());
+		for (const ReplayRun& run : runs) {
+			PutVarint(out, run.frames);
+			for (size_t i = 0; i < header.player_count; i++) {
+				Put8(out, (uint8_t) run.input[i]);
+			}
+		}
+
+		SDL_RWops* file = SDL_RWFromFile(fname.c_str(), "wb");
+		if (!file) {
+			LOG("Couldn't open %s: %s", fname.c_str(), SDL_GetError());
+			return false;
+		}
+
+		bool result = SDL_RWwrite(file, out.data(), 1, out.size()) == out.size();
+		SDL_RWclose(file);
+
+		if (!result) {
+			LOG("Couldn't write %s", fname.c_str());
+		}
+		return result;
+	}
+
+	bool Replay::Load() {
+		size_t filesize;
+		uint8_t* filedata = (uint8_t*) SDL_LoadFile(fname.c_str(), &filesize);
+
+		if (!filedata) {
+			LOG("Couldn't open %s: %s", fname.c_str(), SDL_GetError());
+			return false;
+		}
+
+		ReplayReader in{filedata, filesize};
+		bool result = false;
+
+		if (in.Get32() != REPLAY_MAGIC) {
+			LOG("%s isn't a replay", fname.c_str());
+		} else if (uint32_t version = in.Get32(); version != REPLAY_VERSION) {
+			LOG("%s is version %u, this build reads %u", fname.c_str(), version, REPLAY_VERSION);
+		} else {
+			header = {};
+
+			header.game_seed = in.Get32();
+			header.stage_seed = in.Get32();
+
+			uint32_t player_count = in.Get32();
+			header.player_count = std::clamp(player_count, 1u, (uint32_t) MAX_PLAYERS);
+			for (size_t i = 0; i < header.player_count; i++) {
+				header.player_character[i] = (character_index) std::min(in.Get8(), (uint8_t) (CHARACTER_COUNT - 1));
+			}
+
+			header.starting_lives = (int) in.Get32();
+			header.stage_arena_size = (size_t) in.Get64();
+			for (int pool = 0; pool < POOL_COUNT; pool++) {
+				header.pool_budgets[pool].max = (size_t) in.Get64();
+				header.pool_budgets[pool].policy = (OverflowPolicy) std::min(in.Get8(), (uint8_t) (OVERFLOW_POLICY_COUNT - 1));
+			}
+
+			header.collision_broadphase = in.Get8() != 0;
+			header.swept_collision = in.Get8() != 0;
+			header.physics_substeps = std::clamp((int) in.Get32(), 1, 16); // as the substeps command
+			header.pickup_merge_threshold = (size_t) in.Get64();
+			header.cancel_wave_frames = std::max((int) in.Get32(), 0);
+
+			header.script_hash = in.Get64();
+			header.frame_count = in.Get32();
+
+			uint32_t run_count = in.Get32();
+			runs.clear();
+			for (uint32_t i = 0; i < run_count && in.ok; i++) {
+				ReplayRun& run = runs.emplace_back();
+				run.frames = in.GetVarint();
+				for (size_t p = 0; p < MAX_PLAYERS; p++) {
+					run.input[p] = (p < header.player_count) ? in.Get8() : 0;
+				}
+			}
+
+			if (!in.ok) {
+				LOG("%s is cut short", fname.c_str());
+			} else if (player_count != header.player_count) {
+				LOG("%s has %u players, this build plays 1 to %d", fname.c_str(), player_count, MAX_PLAYERS);
+			} else if (header.stage_arena_size < REPLAY_MIN_ARENA_SIZE || header.stage_arena_size > REPLAY_MAX_ARENA_SIZE) {
+				LOG("%s wants a %zuKb stage arena, refusing it", fname.c_str(), header.stage_arena_size / 1024);
+			} else {
+				result = true;
+			}
+		}
+
+		SDL_free(filedata);
+
+		return result;
+	}
+
+}
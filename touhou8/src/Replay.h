@@ -0,0 +1,105 @@
+#pragma once
+
+#include "Stage.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define REPLAY_VERSION 1
+
+namespace th {
+
+	struct Options;
+
+	enum ReplayMode {
+		REPLAY_OFF,
+		REPLAY_RECORD,
+		REPLAY_PLAY
+	};
+
+	// Everything besides the inputs that decides how a run goes.
+	struct ReplayHeader {
+		uint32_t game_seed;
+		uint32_t stage_seed;
+
+		uint32_t player_count;
+		character_index player_character[MAX_PLAYERS];
+
+		// the Options that change the simulation
+		int starting_lives;
+		size_t stage_arena_size;
+		PoolBudget pool_budgets[POOL_COUNT];
+
+		// Stage settings as they were at the first frame
+		bool collision_broadphase;
+		bool swept_collision;
+		int physics_substeps;
+		size_t pickup_merge_threshold;
+		int cancel_wave_frames;
+
+		uint64_t script_hash; // of every loaded script, see HashScripts
+		uint32_t frame_count;
+	};
+
+	// A run of frames with the same input for every player.
+	struct ReplayRun {
+		uint32_t frames;
+		InputState input[MAX_PLAYERS];
+	};
+
+	// A run is its seeds and settings plus one InputState per player per
+	// frame. The file is the header followed by the inputs run-length
+	// encoded, all little endian.
+	//
+	// Recording or playback is armed first and starts with Begin, which the
+	// game scene calls right after its Stage::Init. Record and Next go with
+	// every Stage::Update after that.
+	class Replay {
+	public:
+		void ArmRecording(const char* fname);
+		bool ArmPlayback(const char* fname);
+
+		// Recording takes the header from the stage, playback puts the
+		// recorded Stage settings back.
+		void Begin(Stage& stage, uint32_t game_seed);
+
+		void Record(const InputState* input, size_t player_count);
+		bool Next(InputState* input, size_t player_count); // false once every frame was played
+
+		// Saves a recording.
+		void Stop();
+		// The stage from Begin is going away, stops whatever ran on it.
+		void End();
+
+		// the Options in the header, for before the stage is created. Stop
+		// puts back the ones they replaced.
+		void ApplySettings(Options& options);
+
+		ReplayMode mode = REPLAY_OFF;
+		bool uncapped = false; // playback skips the frame limiter
+		ReplayHeader header{};
+		uint32_t frame = 0;
+
+	private:
+		bool Save() const;
+		bool Load();
+
+		void RestoreSettings();
+
+		std::string fname;
+		bool begun = false;
+
+		// what ApplySettings overwrote, and where
+		Options* applied_to = nullptr;
+		int saved_starting_lives = 0;
+		size_t saved_stage_arena_size = 0;
+		PoolBudget saved_pool_budgets[POOL_COUNT]{};
+		std::vector<ReplayRun> runs;
+		size_t run_cursor = 0;
+		uint32_t run_frame = 0;
+	};
+
+	uint64_t HashScripts(const Assets& assets);
+
+}
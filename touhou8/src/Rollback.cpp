@@ -0,0 +1,272 @@
+#include "Rollback.h"
+
+#include "utils.h"
+
+#include <string.h>
+
+#define ROLLBACK_MAGIC 0x42525448u // "THRB"
+
+// magic, from, ack, first, count, checksum frame, checksum, then count inputs of a byte each
+#define PACKET_HEADER_SIZE (4 + 1 + 4 + 4 + 1 + 4 + 8)
+
+namespace th {
+
+	static_assert(INPUT_COUNT <= 8, "packets send inputs as a byte");
+	static_assert(PACKET_HEADER_SIZE + ROLLBACK_PACKET_INPUTS <= MAX_PACKET_SIZE, "");
+	// a checksum is confirmed before the next one is taken, and stays around until peers behind get to it
+	static_assert(ROLLBACK_CHECKSUM_INTERVAL > ROLLBACK_MAX_FRAMES + ROLLBACK_MAX_INPUT_DELAY, "");
+
+	static void Put32(uint8_t* out, uint32_t value) {
+		for (int i = 0; i < 4; i++) out[i] = (uint8_t) (value >> (i * 8));
+	}
+
+	static uint32_t Get32(const uint8_t* in) {
+		uint32_t result = 0;
+		for (int i = 0; i < 4; i++) result |= (uint32_t) in[i] << (i * 8);
+		return result;
+	}
+
+	static void Put64(uint8_t* out, uint64_t value) {
+		for (int i = 0; i < 8; i++) out[i] = (uint8_t) (value >> (i * 8));
+	}
+
+	static uint64_t Get64(const uint8_t* in) {
+		uint64_t result = 0;
+		for (int i = 0; i < 8; i++) result |= (uint64_t) in[i] << (i * 8);
+		return result;
+	}
+
+	void RollbackSession::Init(Stage* _stage, Transport* _transport, size_t _local_player, size_t _player_count, uint32_t _input_delay) {
+		stage = _stage;
+		transport = _transport;
+		local_player = _local_player;
+		player_count = _player_count;
+		input_delay = std::min(_input_delay, (uint32_t) ROLLBACK_MAX_INPUT_DELAY);
+
+		frame = 0;
+		rollbacks = 0;
+		resimulated_frames = 0;
+		stalls = 0;
+		last_rollback_ms = 0.0;
+		rollback_from = UINT32_MAX;
+
+		desynced = false;
+		desync_frame = 0;
+		checksum_frame = 0;
+		memset(checksums, 0, sizeof(checksums));
+		memset(peer_checksums, 0, sizeof(peer_checksums));
+		memset(peer_checksum_frames, 0, sizeof(peer_checksum_frames));
+		memset(peer_checksum_checked, 0, sizeof(peer_checksum_checked));
+
+		// nobody presses anything for the first input_delay frames
+		memset(inputs, 0, sizeof(inputs));
+		for (size_t i = 0; i < MAX_PLAYERS; i++) {
+			confirmed[i] = input_delay;
+			acked[i] = input_delay;
+		}
+	}
+
+	uint32_t RollbackSession::GetConfirmedFrame() const {
+		uint32_t result = UINT32_MAX;
+		for (size_t i = 0; i < player_count; i++) {
+			result = std::min(result, confirmed[i]);
+		}
+		return result;
+	}
+
+	bool RollbackSession::AdvanceFrame(InputState local_input) {
+		if (desynced) return false;
+
+		Poll();
+
+		if (rollback_from < frame) {
+			Rollback();
+		}
+
+		CheckSync();
+		if (desynced) return false;
+
+		// a late input further back than the snapshots go couldn't be fixed
+		if (frame >= GetConfirmedFrame() + ROLLBACK_MAX_FRAMES) {
+			stalls++;
+			SendInputs();
+			return false;
+		}
+
+		uint32_t input_frame = frame + input_delay;
+		Input(local_player, input_frame) = local_input;
+		confirmed[local_player] = input_frame + 1;
+
+		SendInputs();
+
+		Step();
+		return true;
+	}
+
+	void RollbackSession::Idle() {
+		if (desynced) return;
+
+		Poll();
+
+		if (rollback_from < frame) {
+			Rollback();
+		}
+
+		CheckSync();
+		if (desynced) return;
+
+		SendInputs();
+	}
+
+	void RollbackSession::Poll() {
+		uint8_t packet[MAX_PACKET_SIZE];
+		size_t from;
+		while (size_t size = transport->Receive(&from, packet, sizeof(packet))) {
+			if (size < PACKET_HEADER_SIZE
+				|| Get32(packet) != ROLLBACK_MAGIC
+				|| packet[4] != from
+				|| from >= player_count
+				|| from == local_player) {
+				continue;
+			}
+
+			uint32_t ack = Get32(packet + 5);
+			uint32_t first = Get32(packet + 9);
+			uint32_t count = packet[13];
+			if (count > ROLLBACK_PACKET_INPUTS || size != PACKET_HEADER_SIZE + count) {
+				continue;
+			}
+
+			acked[from] = std::max(acked[from], std::min(ack, confirmed[local_player]));
+
+			uint32_t peer_checksum_frame = Get32(packet + 14);
+			if (peer_checksum_frame > peer_checksum_frames[from]) {
+				peer_checksum_frames[from] = peer_checksum_frame;
+				peer_checksums[from] = Get64(packet + 18);
+				peer_checksum_checked[from] = false;
+			}
+
+			// only the next ones in line, a gap waits for the resend
+			uint32_t oldest = GetConfirmedFrame();
+			for (uint32_t i = 0; i < count; i++) {
+				uint32_t at_frame = first + i;
+				if (at_frame != confirmed[from]) continue;
+				if (at_frame - oldest >= ROLLBACK_HISTORY) break;
+
+				InputState input = packet[PACKET_HEADER_SIZE + i];
+				if (at_frame < frame && Input(from, at_frame) != input) {
+					rollback_from = std::min(rollback_from, at_frame);
+				}
+				Input(from, at_frame) = input;
+				confirmed[from]++;
+			}
+		}
+	}
+
+	void RollbackSession::Rollback() {
+		double t = GetTime();
+
+		uint32_t target = frame;
+		uint32_t from = rollback_from;
+		rollback_from = UINT32_MAX;
+
+		// going on from whatever state the stage is in would desync for sure
+		if (!stage->LoadSnapshot(snapshots[from % (ROLLBACK_MAX_FRAMES + 1)])) {
+			LOG("Couldn't roll back to frame %u, the session is over.", from);
+			Desync(from);
+			return;
+		}
+
+		frame = from;
+		while (frame < target) {
+			Step();
+		}
+
+		rollbacks++;
+		resimulated_frames += target - from;
+		last_rollback_ms = (GetTime() - t) * 1000.0;
+	}
+
+	void RollbackSession::SendInputs() {
+		uint32_t last = confirmed[local_player];
+
+		for (size_t peer = 0; peer < player_count; peer++) {
+			if (peer == local_player) continue;
+
+			// older ones are gone from the ring, a peer that far behind is lost anyway
+			uint32_t first = std::max(acked[peer], (last > ROLLBACK_HISTORY) ? last - ROLLBACK_HISTORY : 0);
+			uint32_t count = std::min(last - first, (uint32_t) ROLLBACK_PACKET_INPUTS);
+
+			uint8_t packet[PACKET_HEADER_SIZE + ROLLBACK_PACKET_INPUTS];
+			Put32(packet, ROLLBACK_MAGIC);
+			packet[4] = (uint8_t) local_player;
+			Put32(packet + 5, confirmed[peer]);
+			Put32(packet + 9, first);
+			packet[13] = (uint8_t) count;
+			Put32(packet + 14, checksum_frame);
+			Put64(packet + 18, checksums[(checksum_frame / ROLLBACK_CHECKSUM_INTERVAL) % ROLLBACK_CHECKSUM_RING]);
+			for (uint32_t i = 0; i < count; i++) {
+				packet[PACKET_HEADER_SIZE + i] = (uint8_t) Input(local_player, first + i);
+			}
+
+			// even with nothing new, the ack has to get there
+			transport->Send(peer, packet, PACKET_HEADER_SIZE + count);
+		}
+	}
+
+	void RollbackSession::Step() {
+		for (size_t i = 0; i < player_count; i++) {
+			if (frame >= confirmed[i]) {
+				// the player keeps doing what they did last
+				Input(i, frame) = (confirmed[i] > 0) ? Input(i, confirmed[i] - 1) : 0;
+			}
+			stage->player_input[i] = Input(i, frame);
+		}
+
+		stage->SaveSnapshot(&snapshots[frame % (ROLLBACK_MAX_FRAMES + 1)], false);
+
+		// taken again if a rollback goes past it, so it ends up of the confirmed inputs
+		if (frame % ROLLBACK_CHECKSUM_INTERVAL == 0) {
+			checksums[(frame / ROLLBACK_CHECKSUM_INTERVAL) % ROLLBACK_CHECKSUM_RING] = stage->GetChecksum();
+		}
+
+		stage->Update(1.0f);
+		frame++;
+	}
+
+	// After any rollback, so no checksum taken with a prediction counts.
+	void RollbackSession::CheckSync() {
+		// the state at a frame comes from the inputs before it, and its checksum is taken when it steps
+		if (frame > 0) {
+			uint32_t latest = std::min(GetConfirmedFrame(), frame - 1);
+			checksum_frame = std::max(checksum_frame, latest - latest % ROLLBACK_CHECKSUM_INTERVAL);
+		}
+
+		for (size_t peer = 0; peer < player_count; peer++) {
+			uint32_t peer_frame = peer_checksum_frames[peer];
+			if (peer == local_player || peer_frame == 0 || peer_checksum_checked[peer] || peer_frame > checksum_frame) {
+				continue;
+			}
+			peer_checksum_checked[peer] = true;
+
+			// overwritten already, the next one will be checked. One slot is
+			// always the unconfirmed checksum past checksum_frame.
+			if (checksum_frame - peer_frame >= ROLLBACK_CHECKSUM_INTERVAL * (ROLLBACK_CHECKSUM_RING - 1)) {
+				continue;
+			}
+
+			uint64_t checksum = checksums[(peer_frame / ROLLBACK_CHECKSUM_INTERVAL) % ROLLBACK_CHECKSUM_RING];
+			if (checksum != peer_checksums[peer]) {
+				LOG("Netplay desynced at frame %u, player %zu has another state. The session is over.", peer_frame, peer + 1);
+				Desync(peer_frame);
+				return;
+			}
+		}
+	}
+
+	void RollbackSession::Desync(uint32_t at_frame) {
+		desynced = true;
+		desync_frame = at_frame;
+	}
+
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "Stage.h"
+#include "Snapshot.h"
+#include "Transport.h"
+
+#include <stdint.h>
+
+#define ROLLBACK_MAX_FRAMES 8      // how far a late input can take the simulation back
+#define ROLLBACK_HISTORY 64        // inputs kept per player, covers rollback, delay and what's in flight
+#define ROLLBACK_PACKET_INPUTS 32  // inputs per packet at most
+#define ROLLBACK_MAX_INPUT_DELAY 4
+#define ROLLBACK_CHECKSUM_INTERVAL 30 // frames between the confirmed states peers compare
+#define ROLLBACK_CHECKSUM_RING 4      // local checksums kept for peers that are behind
+
+namespace th {
+
+	// Peer to peer rollback netplay for 2 to 4 players. Every peer runs the
+	// whole Stage and only inputs go over the Transport.
+	//
+	// Each frame the local input goes out to every peer, the inputs that
+	// haven't arrived yet are predicted to be the last ones that did, and the
+	// Stage is saved before it steps. When a real input turns out to differ
+	// from its prediction the Stage loads the snapshot of that frame and
+	// simulates back up to the present, at most ROLLBACK_MAX_FRAMES. Past
+	// that the session stalls and waits for the peers.
+	//
+	// Packets carry every input the peer hasn't acknowledged, so losing a
+	// few costs nothing but time. The local input can be delayed a few
+	// frames, which hides that much latency without rolling back at all.
+	//
+	// Every ROLLBACK_CHECKSUM_INTERVAL frames, once all inputs before it are
+	// confirmed, the Stage checksum of that frame goes out with the packets.
+	// A peer whose checksum differs has desynced, and so has a session whose
+	// rollback couldn't load its snapshot. Either ends the session, nothing
+	// more is simulated.
+	class RollbackSession {
+	public:
+		// player_count counts the local player, the stage has to be Init'ed
+		// with the same player_count
+		void Init(Stage* stage, Transport* transport, size_t local_player, size_t player_count, uint32_t input_delay);
+
+		// false when the peers are too far behind or the session desynced,
+		// the frame didn't happen
+		bool AdvanceFrame(InputState local_input);
+		// takes in what arrived and sends, without advancing
+		void Idle();
+
+		// every frame below it is the same for every peer
+		uint32_t GetConfirmedFrame() const;
+
+		uint32_t frame = 0; // the next frame to simulate
+
+		bool desynced = false;
+		uint32_t desync_frame = 0; // the frame whose state differed, or couldn't be loaded
+
+		uint32_t rollbacks = 0;
+		uint32_t resimulated_frames = 0;
+		uint32_t stalls = 0;
+		double last_rollback_ms = 0.0;
+
+	private:
+		void Poll();
+		void Rollback();
+		void SendInputs();
+		void Step();
+		void CheckSync();
+		void Desync(uint32_t at_frame);
+
+		InputState& Input(size_t player, uint32_t at_frame) { return inputs[player][at_frame % ROLLBACK_HISTORY]; }
+
+		Stage* stage = nullptr;
+		Transport* transport = nullptr;
+		size_t local_player = 0;
+		size_t player_count = 0;
+		uint32_t input_delay = 0;
+
+		// confirmed inputs, or the predictions frames were simulated with
+		InputState inputs[MAX_PLAYERS][ROLLBACK_HISTORY]{};
+		uint32_t confirmed[MAX_PLAYERS]{}; // every input below it arrived
+		uint32_t acked[MAX_PLAYERS]{};     // local inputs the peer has
+
+		uint32_t rollback_from = UINT32_MAX; // earliest misprediction
+
+		// the Stage before each of the last frames, uncompressed
+		StageSnapshot snapshots[ROLLBACK_MAX_FRAMES + 1];
+
+		// Stage checksums at multiples of the interval, the ones up to
+		// checksum_frame are of confirmed inputs only (0 for none yet)
+		uint64_t checksums[ROLLBACK_CHECKSUM_RING]{};
+		uint32_t checksum_frame = 0;
+		uint64_t peer_checksums[MAX_PLAYERS]{}; // the latest each peer sent
+		uint32_t peer_checksum_frames[MAX_PLAYERS]{};
+		bool peer_checksum_checked[MAX_PLAYERS]{};
+	};
+
+}
@@ -4,6 +4,12 @@
 
 namespace th {
 
+	// The Stage that owns L sits in its extra space, which coroutines copy
+	// from the main state, so every binding finds its own stage.
+	static Stage& LuaStage(lua_State* L) {
+		return **(Stage**) lua_getextraspace(L);
+	}
+
 	static void LuaUnref(int* ref, lua_State* L) {
 		if (*ref != LUA_REFNIL) {
 			luaL_unref(L, LUA_REGISTRYINDEX, *ref);
@@ -123,66 +129,105 @@ namespace th {
 	static void LuaPush(lua_State* L, T value);
 
 	template <>
-	static void LuaPush<float>(lua_State* L, float value) { lua_pushnumber(L, value); }
+	void LuaPush<float>(lua_State* L, float value) { lua_pushnumber(L, value); }
 
 	template <>
-	static void LuaPush<void*>(lua_State* L, void* value) { lua_pushlightuserdata(L, value); }
+	void LuaPush<void*>(lua_State* L, void* value) { lua_pushlightuserdata(L, value); }
 
 	template <typename T>
 	static T LuaGet(lua_State* L, int idx);
 
 	template <>
-	static float LuaGet<float>(lua_State* L, int idx) { return (float) luaL_checknumber(L, idx); }
+	float LuaGet<float>(lua_State* L, int idx) { return (float) luaL_checknumber(L, idx); }
 
 	template <>
-	static void* LuaGet<void*>(lua_State* L, int idx) { return lua_touserdata(L, idx); }
+	void* LuaGet<void*>(lua_State* L, int idx) { return lua_touserdata(L, idx); }
 
 	template <
 		typename T,
-		T (*GetFromObj)(Object* object)
+		T (*GetFromObj)(Stage& stage, Object* object),
+		T (*GetFromBullet)(Stage& stage, BulletPool& pool, size_t index)
 	> static int lua_GetObjectVar(lua_State* L) {
-		Stage& stage = Stage::GetInstance();
+		Stage& stage = LuaStage(L);
 
 		lua_checkargc(L, 1, 1);
 		full_instance_id full_id = (full_instance_id) luaL_checkinteger(L, 1);
 		T result{};
-		Object* object = stage.FindObject(full_id);
-		if (object) result = GetFromObj(object);
+		BulletPool* pool;
+		size_t index;
+		if (stage.FindBullet(full_id, &pool, &index)) {
+			result = GetFromBullet(stage, *pool, index);
+		} else {
+			Object* object = stage.FindObject(full_id);
+			if (object) result = GetFromObj(stage, object);
+		}
 		LuaPush<T>(L, result);
 		return 1;
 	}
 
 	template <
 		typename T,
-		void (*SetForObj)(Object* object, T value)
+		void (*SetForObj)(Stage& stage, Object* object, T value),
+		void (*SetForBullet)(Stage& stage, BulletPool& pool, size_t index, T value)
 	> static int lua_SetObjectVar(lua_State* L) {
-		Stage& stage = Stage::GetInstance();
+		Stage& stage = LuaStage(L);
 
 		lua_checkargc(L, 2, 2);
 		full_instance_id full_id = (full_instance_id) luaL_checkinteger(L, 1);
 		T value = LuaGet<T>(L, 2);
-		Object* object = stage.FindObject(full_id);
-		if (object) SetForObj(object, value);
+		BulletPool* pool;
+		size_t index;
+		if (stage.FindBullet(full_id, &pool, &index)) {
+			SetForBullet(stage, *pool, index, value);
+		} else {
+			Object* object = stage.FindObject(full_id);
+			if (object) SetForObj(stage, object, value);
+		}
 		return 0;
 	}
 
-	static float GetXFromObject(Object* object) { return object->x; }
-	static float GetYFromObject(Object* object) { return object->y; }
-	static float GetSpdFromObject(Object* object) { return object->spd; }
-	static float GetDirFromObject(Object* object) { return object->dir; }
-	static float GetAccFromObject(Object* object) { return object->acc; }
+	static float GetXFromObject(Stage& /*stage*/, Object* object) { return object->x; }
+	static float GetYFromObject(Stage& /*stage*/, Object* object) { return object->y; }
+	static float GetSpdFromObject(Stage& /*stage*/, Object* object) { return object->spd; }
+	static float GetDirFromObject(Stage& /*stage*/, Object* object) { return object->dir; }
+	static float GetAccFromObject(Stage& /*stage*/, Object* object) { return object->acc; }
+
+	static void* GetSprFromObject(Stage& /*stage*/, Object* object) { return object->sprite; }
+	static float GetImgFromObject(Stage& /*stage*/, Object* object) { return object->frame_index; }
+
+	static void WakeBulletsIfPlayer(Stage& stage, Object* object) {
+		if (INSTANCE_ID_GET_TYPE(object->full_id) == TYPE_PLAYER) {
+			stage.WakeAllBullets();
+		}
+	}
+
+	static void SetXForObject(Stage& stage, Object* object, float value) { object->x = value; WakeBulletsIfPlayer(stage, object); }
+	static void SetYForObject(Stage& stage, Object* object, float value) { object->y = value; WakeBulletsIfPlayer(stage, object); }
+	static void SetSpdForObject(Stage& /*stage*/, Object* object, float value) { object->spd = value; }
+	static void SetDirForObject(Stage& stage, Object* object, float value) { stage.SetDir(*object, cpml::angle_wrap(value)); }
+	static void SetAccForObject(Stage& /*stage*/, Object* object, float value) { object->acc = value; }
+
+	static void SetSprForObject(Stage& /*stage*/, Object* object, void* value) { object->sprite = (Sprite*) value; }
+	static void SetImgForObject(Stage& /*stage*/, Object* object, float value) { object->frame_index = value; }
+
+	static float GetXFromBullet(Stage& /*stage*/, BulletPool& pool, size_t i) { return pool.x[i]; }
+	static float GetYFromBullet(Stage& /*stage*/, BulletPool& pool, size_t i) { return pool.y[i]; }
+	static float GetSpdFromBullet(Stage& /*stage*/, BulletPool& pool, size_t i) { return pool.spd[i]; }
+	static float GetDirFromBullet(Stage& /*stage*/, BulletPool& pool, size_t i) { return pool.dir[i]; }
+	static float GetAccFromBullet(Stage& /*stage*/, BulletPool& pool, size_t i) { return pool.acc[i]; }
 
-	static void* GetSprFromObject(Object* object) { return object->sprite; }
-	static float GetImgFromObject(Object* object) { return object->frame_index; }
+	static void* GetSprFromBullet(Stage& /*stage*/, BulletPool& pool, size_t i) { return pool.sprite[i]; }
+	static float GetImgFromBullet(Stage& /*stage*/, BulletPool& pool, size_t i) { return pool.frame_index[i]; }
 
-	static void SetXForObject(Object* object, float value) { object->x = value; }
-	static void SetYForObject(Object* object, float value) { object->y = value; }
-	static void SetSpdForObject(Object* object, float value) { object->spd = value; }
-	static void SetDirForObject(Object* object, float value) { object->dir = cpml::angle_wrap(value); }
-	static void SetAccForObject(Object* object, float value) { object->acc = value; }
+	// a script touching the motion puts the bullet back on integration and wakes it up
+	static void SetXForBullet(Stage& stage, BulletPool& pool, size_t i, float value) { stage.BulletMotionChanged(pool, i); pool.x[i] = value; }
+	static void SetYForBullet(Stage& stage, BulletPool& pool, size_t i, float value) { stage.BulletMotionChanged(pool, i); pool.y[i] = value; }
+	static void SetSpdForBullet(Stage& stage, BulletPool& pool, size_t i, float value) { stage.BulletMotionChanged(pool, i); pool.spd[i] = value; }
+	static void SetDirForBullet(Stage& stage, BulletPool& pool, size_t i, float value) { stage.BulletMotionChanged(pool, i); stage.SetDir(pool, i, cpml::angle_wrap(value)); }
+	static void SetAccForBullet(Stage& stage, BulletPool& pool, size_t i, float value) { stage.BulletMotionChanged(pool, i); pool.acc[i] = value; }
 
-	static void SetSprForObject(Object* object, void* value) { object->sprite = (Sprite*) value; }
-	static void SetImgForObject(Object* object, float value) { object->frame_index = value; }
+	static void SetSprForBullet(Stage& /*stage*/, BulletPool& pool, size_t i, void* value) { pool.sprite[i] = (Sprite*) value; }
+	static void SetImgForBullet(Stage& /*stage*/, BulletPool& pool, size_t i, float value) { pool.frame_index[i] = value; }
 
 
 
@@ -201,7 +246,7 @@ namespace th {
 			}
 		}
 
-		Stage& stage = Stage::GetInstance();
+		Stage& stage = LuaStage(L);
 		float r = stage.random.range(a, b);
 
 		lua_pushnumber(L, (lua_Number) r);
@@ -233,6 +278,13 @@ namespace th {
 		return 0;
 	}
 
+	// same message as the panic function luaL_newstate sets
+	static int lua_panic(lua_State* L) {
+		const char* msg = lua_tostring(L, -1);
+		LOG("PANIC: unprotected error in call to Lua API (%s)", msg ? msg : "error object is not a string");
+		return 0;
+	}
+
 	static int lua_log(lua_State* L) {
 		int n = lua_gettop(L);
 		for (int i = 1; i <= n; i++) {
@@ -248,7 +300,7 @@ namespace th {
 	}
 
 	static int lua_FindSprite(lua_State* L) {
-		Assets& assets = Assets::GetInstance();
+		Assets& assets = *LuaStage(L).context.assets;
 
 		lua_checkargc(L, 1, 1);
 		const char* name = luaL_checkstring(L, 1);
@@ -259,20 +311,21 @@ namespace th {
 
 	static int lua_GetTime(lua_State* L) {
 		lua_checkargc(L, 0, 0);
-		Stage& stage = Stage::GetInstance();
+		Stage& stage = LuaStage(L);
 		lua_pushnumber(L, (lua_Number) stage.time);
 		return 1;
 	}
 
 	static int lua_GetTarget(lua_State* L) {
 		lua_checkargc(L, 1, 1);
-		full_instance_id result = MAKE_INSTANCE_ID(0, TYPE_PLAYER);
+		Stage& stage = LuaStage(L);
+		full_instance_id result = stage.players[0].full_id;
 		lua_pushinteger(L, result);
 		return 1;
 	}
 
 	static int lua_CreateBoss(lua_State* L) {
-		auto& stage = Stage::GetInstance();
+		Stage& stage = LuaStage(L);
 		lua_checkargc(L, 1, 1);
 
 		int boss_index = (int) luaL_checkinteger(L, 1);
@@ -283,67 +336,71 @@ namespace th {
 	}
 
 	static int lua_CreateBullet(lua_State* L) {
-		auto& stage = Stage::GetInstance();
+		Stage& stage = LuaStage(L);
 
 		lua_checkargc(L, 8, 9);
 
-		Bullet& result = stage.CreateBullet();
+		BulletPool& pool = stage.bullet_spawns;
+		size_t result = stage.CreateBullet();
 
 		int i = 1;
-		result.x   = (float) luaL_checknumber(L, i++);
-		result.y   = (float) luaL_checknumber(L, i++);
-		result.spd = (float) luaL_checknumber(L, i++);
-		result.dir = (float) luaL_checknumber(L, i++);
-		result.acc = (float) luaL_checknumber(L, i++);
-		result.radius = (float) luaL_checknumber(L, i++);
-		result.sprite = (Sprite*) lua_touserdata(L, i++);
-		result.flags = (uint32_t) luaL_checkinteger(L, i++);
+		pool.x[result]   = (float) luaL_checknumber(L, i++);
+		pool.y[result]   = (float) luaL_checknumber(L, i++);
+		pool.spd[result] = (float) luaL_checknumber(L, i++);
+		float dir = (float) luaL_checknumber(L, i++);
+		pool.acc[result] = (float) luaL_checknumber(L, i++);
+		pool.radius[result] = (float) luaL_checknumber(L, i++);
+		pool.sprite[result] = (Sprite*) lua_touserdata(L, i++);
+		pool.flags[result] = (uint32_t) luaL_checkinteger(L, i++);
 
-		result.dir = cpml::angle_wrap(result.dir);
+		stage.SetDir(pool, result, cpml::angle_wrap(dir));
 
 		if (!lua_isnoneornil(L, i)) {
 			if (lua_isfunction(L, i)) {
 				lua_copy(L, i, -1);
-				result.coroutine = CreateCoroutine(L, stage.L);
+				pool.coroutine[result] = CreateCoroutine(L, stage.L);
 			} else {
 				LOG("CreateBullet: 9th arg (script) is not a function");
 			}
 		}
 		i++;
 
-		lua_pushinteger(L, result.full_id);
+		stage.StartAnalyticMotion(pool, result);
+
+		lua_pushinteger(L, pool.full_id[result]);
 		return 1;
 	}
 
 	static int lua_CreateLazer(lua_State* L) {
-		auto& stage = Stage::GetInstance();
+		Stage& stage = LuaStage(L);
 
 		lua_checkargc(L, 8, 9);
 
-		Bullet& result = stage.CreateBullet();
+		BulletPool& pool = stage.lazer_spawns;
+		size_t result = stage.CreateLazer();
 
 		int i = 1;
-		result.x   = (float) luaL_checknumber(L, i++);
-		result.y   = (float) luaL_checknumber(L, i++);
-		result.spd = (float) luaL_checknumber(L, i++);
-		result.dir = (float) luaL_checknumber(L, i++);
-		result.sprite = (Sprite*) lua_touserdata(L, i++);
-		result.lazer_target_length = (float) luaL_checknumber(L, i++);
-		result.lazer_thickness = (float) luaL_checknumber(L, i++);
-		result.flags = (uint32_t) luaL_checkinteger(L, i++);
+		pool.x[result]   = (float) luaL_checknumber(L, i++);
+		pool.y[result]   = (float) luaL_checknumber(L, i++);
+		pool.spd[result] = (float) luaL_checknumber(L, i++);
+		float dir = (float) luaL_checknumber(L, i++);
+		pool.sprite[result] = (Sprite*) lua_touserdata(L, i++);
+		pool.lazer_target_length[result] = (float) luaL_checknumber(L, i++);
+		pool.lazer_thickness[result] = (float) luaL_checknumber(L, i++);
+		pool.flags[result] = (uint32_t) luaL_checkinteger(L, i++);
 
-		result.dir = cpml::angle_wrap(result.dir);
+		stage.SetDir(pool, result, cpml::angle_wrap(dir));
 
-		if (result.spd < 0.01f) result.spd = 0.01f;
-		if (result.lazer_target_length < 1.0f) result.lazer_target_length = 1.0f;
+		if (pool.spd[result] < 0.01f) pool.spd[result] = 0.01f;
+		if (pool.lazer_target_length[result] < 1.0f) pool.lazer_target_length[result] = 1.0f;
 
-		result.lazer_time = result.lazer_target_length / result.spd;
-		result.type = ProjectileType::Lazer;
+		pool.lazer_time[result] = pool.lazer_target_length[result] / pool.spd[result];
+		pool.type[result] = ProjectileType::Lazer;
 
 		if (!lua_isnoneornil(L, i)) {
 			if (lua_isfunction(L, i)) {
 				lua_copy(L, i, -1);
-				result.coroutine = CreateCoroutine(L, stage.L);
+				pool.coroutine[result] = CreateCoroutine(L, stage.L);
 			} else {
 				LOG("CreateLazer: 9th arg (script) is not a function");
 			}
@@ -351,14 +408,61 @@ namespace th {
 		i++;
 
 		//PlaySound("se_lazer.wav");
-		lua_pushinteger(L, result.full_id);
+		lua_pushinteger(L, pool.full_id[result]);
+		return 1;
+	}
+
+
+
+	static int lua_CreateRect(lua_State* L) {
+		Stage& stage = LuaStage(L);
+
+		lua_checkargc(L, 9, 10);
+
+		// rects share the laser pool, as a box that is fully stretched from the start
+		BulletPool& pool = stage.lazer_spawns;
+		size_t result = stage.CreateLazer();
+
+		int i = 1;
+		pool.x[result]   = (float) luaL_checknumber(L, i++);
+		pool.y[result]   = (float) luaL_checknumber(L, i++);
+		pool.spd[result] = (float) luaL_checknumber(L, i++);
+		float dir = (float) luaL_checknumber(L, i++);
+		pool.acc[result] = (float) luaL_checknumber(L, i++);
+		pool.lazer_thickness[result] = (float) luaL_checknumber(L, i++);
+		pool.lazer_target_length[result] = (float) luaL_checknumber(L, i++);
+		pool.sprite[result] = (Sprite*) lua_touserdata(L, i++);
+		pool.flags[result] = (uint32_t) luaL_checkinteger(L, i++);
+
+		stage.SetDir(pool, result, cpml::angle_wrap(dir));
+
+		pool.lazer_length[result] = pool.lazer_target_length[result];
+		pool.type[result] = ProjectileType::Rect;
+
+		if (!lua_isnoneornil(L, i)) {
+			if (lua_isfunction(L, i)) {
+				lua_copy(L, i, -1);
+				pool.coroutine[result] = CreateCoroutine(L, stage.L);
+			} else {
+				LOG("CreateRect: 10th arg (script) is not a function");
+			}
+		}
+		i++;
+
+		stage.StartAnalyticMotion(pool, result);
+
+		lua_pushinteger(L, pool.full_id[result]);
 		return 1;
 	}
 
 
 
 	void Stage::InitLua() {
-		L = luaL_newstate();
+		// all of it in one block, so snapshots can copy the VM
+		lua_heap.Init(context.options->lua_heap_size);
+		L = lua_newstate(LuaHeap::Alloc, &lua_heap);
+		lua_atpanic(L, lua_panic);
+		*(Stage**) lua_getextraspace(L) = this;
 
 		{
 			luaL_Reg loadedlibs[] = {
@@ -401,28 +505,29 @@ namespace th {
 			_lua_register(L, "CreateBoss", lua_CreateBoss);
 			_lua_register(L, "CreateBullet", lua_CreateBullet);
 			_lua_register(L, "CreateLazer", lua_CreateLazer);
+			_lua_register(L, "CreateRect", lua_CreateRect);
 
-			_lua_register(L, "GetX", lua_GetObjectVar<float, GetXFromObject>);
-			_lua_register(L, "GetY", lua_GetObjectVar<float, GetYFromObject>);
-			_lua_register(L, "GetSpd", lua_GetObjectVar<float, GetSpdFromObject>);
-			_lua_register(L, "GetDir", lua_GetObjectVar<float, GetDirFromObject>);
-			_lua_register(L, "GetAcc", lua_GetObjectVar<float, GetAccFromObject>);
+			_lua_register(L, "GetX", lua_GetObjectVar<float, GetXFromObject, GetXFromBullet>);
+			_lua_register(L, "GetY", lua_GetObjectVar<float, GetYFromObject, GetYFromBullet>);
+			_lua_register(L, "GetSpd", lua_GetObjectVar<float, GetSpdFromObject, GetSpdFromBullet>);
+			_lua_register(L, "GetDir", lua_GetObjectVar<float, GetDirFromObject, GetDirFromBullet>);
+			_lua_register(L, "GetAcc", lua_GetObjectVar<float, GetAccFromObject, GetAccFromBullet>);
 
-			_lua_register(L, "GetSpr", lua_GetObjectVar<void*, GetSprFromObject>);
-			_lua_register(L, "GetImg", lua_GetObjectVar<float, GetImgFromObject>);
+			_lua_register(L, "GetSpr", lua_GetObjectVar<void*, GetSprFromObject, GetSprFromBullet>);
+			_lua_register(L, "GetImg", lua_GetObjectVar<float, GetImgFromObject, GetImgFromBullet>);
 
-			_lua_register(L, "SetX", lua_SetObjectVar<float, SetXForObject>);
-			_lua_register(L, "SetY", lua_SetObjectVar<float, SetYForObject>);
-			_lua_register(L, "SetSpd", lua_SetObjectVar<float, SetSpdForObject>);
-			_lua_register(L, "SetDir", lua_SetObjectVar<float, SetDirForObject>);
-			_lua_register(L, "SetAcc", lua_SetObjectVar<float, SetAccForObject>);
+			_lua_register(L, "SetX", lua_SetObjectVar<float, SetXForObject, SetXForBullet>);
+			_lua_register(L, "SetY", lua_SetObjectVar<float, SetYForObject, SetYForBullet>);
+			_lua_register(L, "SetSpd", lua_SetObjectVar<float, SetSpdForObject, SetSpdForBullet>);
+			_lua_register(L, "SetDir", lua_SetObjectVar<float, SetDirForObject, SetDirForBullet>);
+			_lua_register(L, "SetAcc", lua_SetObjectVar<float, SetAccForObject, SetAccForBullet>);
 
-			_lua_register(L, "SetSpr", lua_SetObjectVar<void*, SetSprForObject>);
-			_lua_register(L, "SetImg", lua_SetObjectVar<float, SetImgForObject>);
+			_lua_register(L, "SetSpr", lua_SetObjectVar<void*, SetSprForObject, SetSprForBullet>);
+			_lua_register(L, "SetImg", lua_SetObjectVar<float, SetImgForObject, SetImgForBullet>);
 		}
 
 		{
-			auto& assets = Assets::GetInstance();
+			Assets& assets = *context.assets;
 
 			auto& scripts = assets.GetScripts();
 
@@ -450,22 +555,33 @@ namespace th {
 		}
 	}
 
+	// UpdateCoroutine writes the ref back after the script ran. Anything the
+	// script creates goes to the spawn buffers, so the ref stays where it was.
 	void Stage::CallCoroutines() {
 		UpdateCoroutine(L, &coroutine, -1);
 
+		// what the stage script spawned starts running this frame
+		FlushSpawns();
+
 		for (size_t i = 0, n = bosses.size(); i < n; i++) {
 			Boss& boss = bosses[i];
+			if (boss.flags & OBJECT_FLAG_DEAD) continue;
 			UpdateCoroutine(L, &boss.coroutine, boss.full_id);
 		}
 
 		for (size_t i = 0, n = enemies.size(); i < n; i++) {
 			Enemy& enemy = enemies[i];
+			if (enemy.flags & OBJECT_FLAG_DEAD) continue;
 			UpdateCoroutine(L, &enemy.coroutine, enemy.full_id);
 		}
 
-		for (size_t i = 0, n = bullets.size(); i < n; i++) {
-			Bullet& bullet = bullets[i];
-			UpdateCoroutine(L, &bullet.coroutine, bullet.full_id);
+		FlushSpawns();
+
+		for (BulletPool* pool : {&bullets, &lazers}) {
+			for (size_t i = 0, n = pool->size(); i < n; i++) {
+				if (pool->flags[i] & OBJECT_FLAG_DEAD) continue;
+				UpdateCoroutine(L, &pool->coroutine[i], pool->full_id[i]);
+			}
 		}
 	}
 
@@ -0,0 +1,88 @@
+#include "SlotMap.h"
+
+#include "Snapshot.h"
+
+#include "utils.h"
+
+namespace th {
+
+	full_instance_id SlotMap::Alloc(uint32_t dense_index) {
+		uint32_t index;
+		if (free_head < free_slots.size()) {
+			index = free_slots[free_head++];
+
+			// drop the taken ones once they are half of it, so the queue
+			// doesn't grow forever and the copy is paid for by the pops
+			if (free_head == free_slots.size()) {
+				free_slots.clear();
+				free_head = 0;
+			} else if (2 * free_head >= free_slots.size()) {
+				free_slots.erase(free_slots.begin(), free_slots.begin() + free_head);
+				free_head = 0;
+			}
+		} else {
+			if (slots.size() > _INDEX_PART_MASK) {
+				LOG("Out of instance ids for object type %u.", (unsigned) type);
+				return NULL_INSTANCE_ID;
+			}
+			index = (uint32_t) slots.size();
+			slots.push_back({});
+		}
+
+		Slot& slot = slots[index];
+		slot.dense_index = dense_index;
+		slot.used = true;
+		return MAKE_INSTANCE_ID(index, slot.generation, type);
+	}
+
+	void SlotMap::Reserve(size_t n) {
+		n = std::min(n, (size_t) _INDEX_PART_MASK + 1);
+		slots.reserve(n);
+		free_slots.reserve(n);
+	}
+
+	void SlotMap::Free(full_instance_id full_id) {
+		Slot* slot = (Slot*) GetSlot(full_id);
+		if (!slot) return;
+
+		Release(INSTANCE_ID_GET_INDEX(full_id));
+	}
+
+	void SlotMap::Release(uint32_t index) {
+		Slot& slot = slots[index];
+		slot.used = false;
+
+		// out of generations, it stays unused for good
+		if (slot.generation == _GENERATION_PART_MASK) return;
+
+		slot.generation++;
+		free_slots.push_back(index);
+	}
+
+	void SlotMap::Move(full_instance_id full_id, uint32_t dense_index) {
+		Slot* slot = (Slot*) GetSlot(full_id);
+		if (!slot) return;
+
+		slot->dense_index = dense_index;
+	}
+
+	void SlotMap::FreeAll() {
+		for (uint32_t index = 0, n = (uint32_t) slots.size(); index < n; index++) {
+			if (slots[index].used) Release(index);
+		}
+	}
+
+	void SlotMap::Save(SnapshotWriter& writer) const {
+		writer.WriteVector(slots);
+		writer.WriteVector(free_slots);
+		writer.Write(free_head);
+	}
+
+	void SlotMap::Load(SnapshotReader& reader) {
+		reader.ReadVector(slots);
+		reader.ReadVector(free_slots);
+		reader.Read(free_head);
+		if (free_head > free_slots.size()) reader.ok = false;
+	}
+
+}
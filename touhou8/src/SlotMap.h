@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Objects.h"
+
+#include <vector>
+
+// Dense index of an entity that still sits in a spawn buffer, see Stage::FlushSpawns.
+#define SPAWN_INDEX_BIT 0x8000'0000u
+
+namespace th {
+
+	class SnapshotWriter;
+	class SnapshotReader;
+
+	// Handle -> dense index table for one object type.
+	// A handle packs the slot index and the slot's generation. Freeing a slot
+	// bumps its generation, so old handles stop resolving instead of pointing
+	// at whatever reuses the slot. Freed slots are reused oldest first, so a
+	// slot goes through its generations as slowly as it can, and one that has
+	// been through all 4096 is retired rather than starting over at 0, where
+	// a handle a script still holds from back then would find it again.
+	// The dense arrays can move entities around freely as long as they
+	// report it with Move.
+	//
+	// The index part of a handle is 16 bits, so one type can't have more than
+	// 65536 entities alive at once, whatever the arena has room for.
+	class SlotMap {
+	public:
+		explicit SlotMap(object_type _type) : type(_type) {}
+
+		// NULL_INSTANCE_ID when every slot is taken
+		full_instance_id Alloc(uint32_t dense_index);
+		void Free(full_instance_id full_id);
+		void Move(full_instance_id full_id, uint32_t dense_index);
+		void FreeAll();
+		// room for n handles without growing, n is capped at the 65536 there can be
+		void Reserve(size_t n);
+
+		bool Lookup(full_instance_id full_id, uint32_t* dense_index) const {
+			const Slot* slot = GetSlot(full_id);
+			if (!slot) return false;
+			*dense_index = slot->dense_index;
+			return true;
+		}
+
+		size_t GetSlotCount() const { return slots.size(); }
+		// the next Alloc would fail
+		bool Full() const { return free_head == free_slots.size() && slots.size() > _INDEX_PART_MASK; }
+
+		void Save(SnapshotWriter& writer) const;
+		void Load(SnapshotReader& reader);
+
+	private:
+		struct Slot {
+			uint32_t dense_index;
+			uint16_t generation;
+			bool used;
+		};
+
+		const Slot* GetSlot(full_instance_id full_id) const {
+			uint32_t index = INSTANCE_ID_GET_INDEX(full_id);
+			if (INSTANCE_ID_GET_TYPE(full_id) != type) return nullptr;
+			if (index >= slots.size()) return nullptr;
+			const Slot* slot = &slots[index];
+			if (!slot->used || slot->generation != INSTANCE_ID_GET_GENERATION(full_id)) return nullptr;
+			return slot;
+		}
+
+		void Release(uint32_t index);
+
+		object_type type;
+		std::vector<Slot> slots;
+		// a queue, the next Alloc takes free_slots[free_head]
+		std::vector<uint32_t> free_slots;
+		size_t free_head = 0;
+	};
+
+}
@@ -0,0 +1,41 @@
+#include "Snapshot.h"
+
+#include "utils.h"
+
+#include <lz4.h>
+
+namespace th {
+
+	bool CompressSnapshot(const std::vector<uint8_t>& raw, StageSnapshot* snapshot) {
+		if (raw.size() > (size_t) LZ4_MAX_INPUT_SIZE) {
+			LOG("Snapshot too big to compress, %zu bytes.", raw.size());
+			return false;
+		}
+
+		snapshot->data.resize((size_t) LZ4_compressBound((int) raw.size()));
+		int compressed = LZ4_compress_default((const char*) raw.data(), (char*) snapshot->data.data(),
+											  (int) raw.size(), (int) snapshot->data.size());
+		if (compressed <= 0) {
+			LOG("LZ4_compress_default failed.");
+			snapshot->data.clear();
+			return false;
+		}
+
+		snapshot->data.resize((size_t) compressed);
+		snapshot->raw_size = raw.size();
+		snapshot->compressed = true;
+		return true;
+	}
+
+	bool DecompressSnapshot(const StageSnapshot& snapshot, std::vector<uint8_t>* raw) {
+		raw->resize(snapshot.raw_size);
+		int decompressed = LZ4_decompress_safe((const char*) snapshot.data.data(), (char*) raw->data(),
+											   (int) snapshot.data.size(), (int) raw->size());
+		if (decompressed < 0 || (size_t) decompressed != snapshot.raw_size) {
+			LOG("Snapshot is corrupted.");
+			return false;
+		}
+		return true;
+	}
+
+}
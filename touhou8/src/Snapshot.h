@@ -0,0 +1,120 @@
+#pragma once
+
+#include "Arena.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+#include <vector>
+
+namespace th {
+
+	// Raw bytes of trivially copyable state, pointers included. A snapshot is
+	// only ever read back by the process and the objects that wrote it.
+	class SnapshotWriter {
+	public:
+		void Write(const void* src, size_t size) {
+			data.insert(data.end(), (const uint8_t*) src, (const uint8_t*) src + size);
+		}
+
+		template <typename T>
+		void Write(const T& value) {
+			static_assert(std::is_trivially_copyable_v<T>, "snapshots are raw bytes");
+			Write(&value, sizeof(T));
+		}
+
+		// The live items and the spare, not the whole capacity. Refused
+		// creates leave their Lua refs in the spare.
+		template <typename T>
+		void WriteArray(const FixedArray<T>& array) {
+			Write(array.size());
+			Write(array.data(), array.size() * sizeof(T));
+			Write(array[array.capacity()]);
+		}
+
+		// fills in a value that was only known once the rest was written
+		template <typename T>
+		void Overwrite(size_t offset, const T& value) {
+			static_assert(std::is_trivially_copyable_v<T>, "snapshots are raw bytes");
+			memcpy(data.data() + offset, &value, sizeof(T));
+		}
+
+		template <typename T>
+		void WriteVector(const std::vector<T>& vector) {
+			static_assert(std::is_trivially_copyable_v<T>, "snapshots are raw bytes");
+			Write(vector.size());
+			Write(vector.data(), vector.size() * sizeof(T));
+		}
+
+		std::vector<uint8_t> data;
+	};
+
+	// Reads that would run past the end copy nothing and clear ok, so
+	// everything read after the first failure can be thrown away.
+	class SnapshotReader {
+	public:
+		SnapshotReader(const uint8_t* _data, size_t _size) : data(_data), size(_size) {}
+
+		void Read(void* dest, size_t bytes) {
+			if (!ok || bytes > size - cursor) {
+				ok = false;
+				return;
+			}
+			memcpy(dest, data + cursor, bytes);
+			cursor += bytes;
+		}
+
+		template <typename T>
+		void Read(T& value) {
+			static_assert(std::is_trivially_copyable_v<T>, "snapshots are raw bytes");
+			Read(&value, sizeof(T));
+		}
+
+		// fails when the array was saved with more items than it can hold now
+		template <typename T>
+		void ReadArray(FixedArray<T>& array) {
+			size_t count = 0;
+			Read(count);
+			if (!ok || count > array.capacity() || count * sizeof(T) > size - cursor) {
+				ok = false;
+				return;
+			}
+			array.assign((const T*) (data + cursor), count);
+			cursor += count * sizeof(T);
+			Read(array.Spare());
+		}
+
+		template <typename T>
+		void ReadVector(std::vector<T>& vector) {
+			size_t count = 0;
+			Read(count);
+			if (!ok || count > (size - cursor) / sizeof(T)) {
+				ok = false;
+				return;
+			}
+			vector.resize(count);
+			Read(vector.data(), count * sizeof(T));
+		}
+
+		bool ok = true;
+
+	private:
+		const uint8_t* data;
+		size_t size;
+		size_t cursor = 0;
+	};
+
+	// What Stage::SaveSnapshot hands out. Rollback keeps a few of them per
+	// frame and skips the compression, everything else keeps them LZ4 compressed.
+	struct StageSnapshot {
+		std::vector<uint8_t> data;
+		size_t raw_size = 0;
+		bool compressed = false;
+		float time = 0.0f; // Stage::time when it was taken
+	};
+
+	bool CompressSnapshot(const std::vector<uint8_t>& raw, StageSnapshot* snapshot);
+	// raw is resized to fit
+	bool DecompressSnapshot(const StageSnapshot& snapshot, std::vector<uint8_t>* raw);
+
+}
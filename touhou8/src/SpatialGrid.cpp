@@ -0,0 +1,159 @@
+#include "SpatialGrid.h"
+
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+namespace th {
+
+	void SpatialGrid::Init(float x, float y, float w, float h, float _cell_size) {
+		grid_x = x;
+		grid_y = y;
+		cell_size = _cell_size;
+		inv_cell_size = 1.0f / _cell_size;
+		cols = std::max((int) ceilf(w * inv_cell_size), 1);
+		rows = std::max((int) ceilf(h * inv_cell_size), 1);
+
+		cell_start.assign((size_t)(cols * rows) + 1, 0);
+		Clear();
+	}
+
+	void SpatialGrid::Reserve(size_t count) {
+		entries.reserve(count);
+		items.reserve(count);
+	}
+
+	void SpatialGrid::Clear() {
+		entries.clear();
+	}
+
+	int SpatialGrid::CellX(float x) const {
+		float f = floorf((x - grid_x) * inv_cell_size);
+		if (!(f >= 0.0f)) return 0; // also catches NaN
+		if (f >= (float)(cols - 1)) return cols - 1;
+		return (int) f;
+	}
+
+	int SpatialGrid::CellY(float y) const {
+		float f = floorf((y - grid_y) * inv_cell_size);
+		if (!(f >= 0.0f)) return 0;
+		if (f >= (float)(rows - 1)) return rows - 1;
+		return (int) f;
+	}
+
+	void SpatialGrid::InsertBox(uint32_t item, float x1, float y1, float x2, float y2) {
+		int cx1 = CellX(x1);
+		int cy1 = CellY(y1);
+		int cx2 = CellX(x2);
+		int cy2 = CellY(y2);
+
+		for (int cy = cy1; cy <= cy2; cy++) {
+			for (int cx = cx1; cx <= cx2; cx++) {
+				entries.push_back({(uint32_t)(cy * cols + cx), item});
+			}
+		}
+	}
+
+	void SpatialGrid::InsertPolygon(uint32_t item, const float* xs, const float* ys, int count) {
+		const float inf = std::numeric_limits<float>::infinity();
+
+		float ymin = ys[0];
+		float ymax = ys[0];
+		for (int i = 1; i < count; i++) {
+			ymin = std::min(ymin, ys[i]);
+			ymax = std::max(ymax, ys[i]);
+		}
+
+		int cy1 = CellY(ymin);
+		int cy2 = CellY(ymax);
+
+		for (int cy = cy1; cy <= cy2; cy++) {
+			// border rows reach to infinity, same as the clamping in CellY
+			float band_y1 = (cy == 0)        ? -inf : grid_y + (float)cy       * cell_size;
+			float band_y2 = (cy == rows - 1) ?  inf : grid_y + (float)(cy + 1) * cell_size;
+
+			float xmin = inf;
+			float xmax = -inf;
+
+			for (int i = 0; i < count; i++) {
+				int j = (i + 1) % count;
+				float ax = xs[i];
+				float ay = ys[i];
+				float bx = xs[j];
+				float by = ys[j];
+
+				float t1 = 0.0f;
+				float t2 = 1.0f;
+				if (ay == by) {
+					if (ay < band_y1 || ay > band_y2) continue;
+				} else {
+					float inv = 1.0f / (by - ay);
+					float ta = (band_y1 - ay) * inv;
+					float tb = (band_y2 - ay) * inv;
+					if (ta > tb) std::swap(ta, tb);
+					t1 = std::max(ta, 0.0f);
+					t2 = std::min(tb, 1.0f);
+					if (t1 > t2) continue;
+				}
+
+				float x_at_t1 = ax + (bx - ax) * t1;
+				float x_at_t2 = ax + (bx - ax) * t2;
+				xmin = std::min(xmin, std::min(x_at_t1, x_at_t2));
+				xmax = std::max(xmax, std::max(x_at_t1, x_at_t2));
+			}
+
+			if (xmin > xmax) continue;
+
+			int cx1 = CellX(xmin);
+			int cx2 = CellX(xmax);
+			for (int cx = cx1; cx <= cx2; cx++) {
+				entries.push_back({(uint32_t)(cy * cols + cx), item});
+			}
+		}
+	}
+
+	void SpatialGrid::Build() {
+		size_t cell_count = (size_t)(cols * rows);
+
+		std::fill(cell_start.begin(), cell_start.end(), 0);
+
+		for (const Entry& entry : entries) {
+			cell_start[entry.cell + 1]++;
+		}
+
+		for (size_t i = 0; i < cell_count; i++) {
+			cell_start[i + 1] += cell_start[i];
+		}
+
+		items.resize(entries.size());
+
+		// entries come in item order, so every cell ends up sorted
+		std::vector<uint32_t>& cursor = scratch_cursor;
+		cursor.assign(cell_start.begin(), cell_start.end() - 1);
+		for (const Entry& entry : entries) {
+			items[cursor[entry.cell]++] = entry.item;
+		}
+	}
+
+	void SpatialGrid::Query(float x1, float y1, float x2, float y2, std::vector<uint32_t>& out) const {
+		int cx1 = CellX(x1);
+		int cy1 = CellY(y1);
+		int cx2 = CellX(x2);
+		int cy2 = CellY(y2);
+
+		size_t first = out.size();
+
+		for (int cy = cy1; cy <= cy2; cy++) {
+			for (int cx = cx1; cx <= cx2; cx++) {
+				size_t cell = (size_t)(cy * cols + cx);
+				out.insert(out.end(), items.begin() + cell_start[cell], items.begin() + cell_start[cell + 1]);
+			}
+		}
+
+		if (cx1 != cx2 || cy1 != cy2) {
+			std::sort(out.begin() + first, out.end());
+			out.erase(std::unique(out.begin() + first, out.end()), out.end());
+		}
+	}
+
+}
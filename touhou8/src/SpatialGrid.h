@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+
+namespace th {
+
+	// Uniform grid over the play area plus the culling margin.
+	// Items are inserted by bounding box (or by convex polygon) and stored
+	// per cell with a counting sort, so a rebuild is two linear passes.
+	// Anything outside the grid is clamped into the border cells.
+	class SpatialGrid {
+	public:
+		void Init(float x, float y, float w, float h, float cell_size);
+		// room for this many single-cell inserts without growing
+		void Reserve(size_t count);
+
+		void Clear();
+
+		void InsertBox(uint32_t item, float x1, float y1, float x2, float y2);
+
+		// convex polygon, only the cells it actually overlaps
+		void InsertPolygon(uint32_t item, const float* xs, const float* ys, int count);
+
+		void Build();
+
+		// appends items whose cells overlap the box, sorted and without duplicates
+		void Query(float x1, float y1, float x2, float y2, std::vector<uint32_t>& out) const;
+
+	private:
+		struct Entry {
+			uint32_t cell;
+			uint32_t item;
+		};
+
+		int CellX(float x) const;
+		int CellY(float y) const;
+
+		float grid_x = 0.0f;
+		float grid_y = 0.0f;
+		float cell_size = 1.0f;
+		float inv_cell_size = 1.0f;
+		int cols = 0;
+		int rows = 0;
+
+		std::vector<Entry> entries;
+		std::vector<uint32_t> cell_start; // cols * rows + 1
+		std::vector<uint32_t> items;
+		std::vector<uint32_t> scratch_cursor;
+	};
+
+}
@@ -1,6 +1,8 @@
 #include "Stage.h"
 
 #include "Game.h"
+#include "Kernels.h"
+#include "Snapshot.h"
 
 #include "cpml.h"
 #include "utils.h"
@@ -22,28 +24,58 @@
 
 #define POINT_OF_COLLECTION 96.0f
 
-#define PHYSICS_DELTA (60.0f / 300.0f) // 300 fps
 #define CORO_DELTA 1.0f
 
+#define CULL_MARGIN    50.0f
+#define GRID_CELL_SIZE 32.0f
+#define GRID_LAZER_BIT 0x8000'0000u
+
+// homing target items are enemy indices, or boss indices with this bit
+#define TARGET_BOSS_BIT 0x8000'0000u
+#define NO_TARGET       0xFFFF'FFFFu
+
+#define PICKUP_RADIUS     8.0f
+#define PICKUP_HOMING_SPD 8.0f
+#define PICKUP_GRAVITY    0.025f
+#define PICKUP_MAX_FALL   2.0f
+#define PICKUP_MERGE_CELL 16.0f
+
+#define ARENA_SLACK (64 * 1024) // alignment padding and the spare element of every array
+
+#define CANCEL_BUDGET 2048 // bullets the cancel wave turns into pickups per frame
+#define UNREF_BUDGET  4096 // Lua refs of canceled bullets released per frame
+
+#define NO_CONTACT 2.0f // later than any time of impact, which is in [0, 1]
+
+#define SNAPSHOT_MAGIC 0x50414E53u // "SNAP"
+#define SNAPSHOT_END_MAGIC 0x444E4553u // "SEND"
+
+#define COLLIDE_CHUNK 1024 // bullets per chunk of the multi-player pass, a multiple of 32
+#define SWEPT_GRAIN 256 // grid candidates per job of the swept narrowphase
+#define CONTACT_RESERVE 256 // contacts per player reserved up front, more than a frame sees
+
 #include "ScriptGlue.h"
 
+#ifndef TH_HEADLESS
 #include "bg_spellcard_cirno.h"
+#endif
 
 namespace th {
 
-	Stage* Stage::_instance = nullptr;
+#ifndef TH_HEADLESS
+	void stage0_draw_background(Stage& stage, float delta);
+#endif
 
-	void stage0_draw_background(float delta);
-
-	static bool is_in_bounds(float x, float y, float off = 50.0f) {
+	static bool is_in_bounds(float x, float y, float off = CULL_MARGIN) {
 		return (-off <= x) && (x < (float)PLAY_AREA_W + off)
 			&& (-off <= y) && (y < (float)PLAY_AREA_H + off);
 	}
 
 	template <typename Object>
 	static void MoveObject(Object& object, float delta) {
-		object.x += cpml::lengthdir_x(object.spd, object.dir) * delta;
-		object.y += cpml::lengthdir_y(object.spd, object.dir) * delta;
+		// same as lengthdir_x/y, without the trig
+		object.x += object.spd * object.dir_x * delta;
+		object.y += object.spd * object.dir_y * delta;
 		object.spd += object.acc * delta;
 
 		if (object.spd < 0.0f) {
@@ -51,6 +83,74 @@ namespace th {
 		}
 	}
 
+	// one range of the pool, x0/y0 have to be saved already
+	static void MoveBullets(BulletPool& pool, size_t begin, size_t end, float delta) {
+		bool lazers = pool.HasLazerData();
+
+		MoveBulletsKernel(pool.x.data() + begin, pool.y.data() + begin, pool.spd.data() + begin,
+						  pool.dir_x.data() + begin, pool.dir_y.data() + begin, pool.acc.data() + begin,
+						  lazers ? pool.lazer_timer.data() + begin : nullptr,
+						  lazers ? pool.lazer_time.data() + begin : nullptr,
+						  pool.flags.data() + begin,
+						  end - begin, delta);
+	}
+
+	// The bullets in the range the kernel skipped, straight from their start
+	// state, landing where delta sized steps would have. Returns how many there were.
+	static size_t MoveAnalyticBullets(BulletPool& pool, size_t begin, size_t end, float delta) {
+		size_t result = 0;
+
+		for (size_t i = begin; i < end; i++) {
+			if (!(pool.flags[i] & OBJECT_FLAG_ANALYTIC)) continue;
+
+			float t = (pool.motion_time[i] += delta);
+			float dist = cpml::accel_distance(pool.start_spd[i], pool.acc[i], t, delta);
+			pool.x[i] = pool.start_x[i] + pool.dir_x[i] * dist;
+			pool.y[i] = pool.start_y[i] + pool.dir_y[i] * dist;
+			pool.spd[i] = cpml::accel_speed(pool.start_spd[i], pool.acc[i], t);
+
+			// past the cull margin by now, so this can't take a graze or a hit from anything
+			if (t >= pool.exit_time[i]) {
+				pool.flags[i] |= OBJECT_FLAG_DEAD;
+			}
+
+			result++;
+		}
+
+		return result;
+	}
+
+	template <typename Object>
+	static void SaveStartPositions(const FixedArray<Object>& storage, FixedArray<float>& xs, FixedArray<float>& ys) {
+		xs.resize(storage.size());
+		ys.resize(storage.size());
+		for (size_t i = 0, n = storage.size(); i < n; i++) {
+			xs[i] = storage[i].x;
+			ys[i] = storage[i].y;
+		}
+	}
+
+	// objects created during the step didn't move yet
+	static float StartPosition(const FixedArray<float>& positions, size_t index, float current) {
+		return (index < positions.size()) ? positions[index] : current;
+	}
+
+	// Circle vs circle at the end of the step, or along both paths through the
+	// step when swept. t is the time of impact, always 0 when not swept.
+	static bool CirclesTouch(bool swept,
+							 float ax0, float ay0, float ax, float ay, float ar,
+							 float bx0, float by0, float bx, float by, float br,
+							 float* t) {
+		if (!swept) {
+			*t = 0.0f;
+			return cpml::circle_vs_circle(ax, ay, ar, bx, by, br);
+		}
+
+		return cpml::point_vs_circle_toi(bx0 - ax0, by0 - ay0,
+										 (bx - bx0) - (ax - ax0), (by - by0) - (ay - ay0),
+										 ar + br, t);
+	}
+
 	template <typename Object>
 	static void AnimateObject(Object& object, float delta) {
 		int frame_count = object.sprite->frame_count;
@@ -63,62 +163,105 @@ namespace th {
 		}
 	}
 
-	template <typename Object>
-	static Object* FindClosest(std::vector<Object>& storage, float x, float y) {
-		float closest_dist = 1'000'000.0f;
-		Object* result = nullptr;
-		for (Object& object : storage) {
-			float dist = cpml::point_distance(x, y, object.x, object.y);
-			if (dist < closest_dist) {
-				result = &object;
-				closest_dist = dist;
+	// Stable single pass over the container, so draw order doesn't change.
+	// Replaces erasing from the middle, which was O(n) per removal.
+	template <typename T, typename Remove, typename Move>
+	static void RemoveDead(FixedArray<T>& storage, const Remove& on_remove, const Move& on_move) {
+		size_t w = 0;
+		for (size_t r = 0, n = storage.size(); r < n; r++) {
+			if (storage[r].flags & OBJECT_FLAG_DEAD) {
+				on_remove(storage[r]);
+				continue;
 			}
+			if (w != r) {
+				storage[w] = std::move(storage[r]);
+				on_move(storage[w], w);
+			}
+			w++;
 		}
-		return result;
+		storage.Truncate(w);
 	}
 
-	typedef ptrdiff_t ssize;
+	template <typename T>
+	static void RemoveDead(FixedArray<T>& storage) {
+		RemoveDead(storage, [](T&) {}, [](T&, size_t) {});
+	}
+
+	// for containers that hand out ids
+	template <typename T, typename Remove>
+	static void RemoveDead(FixedArray<T>& storage, SlotMap& slots, const Remove& on_remove) {
+		RemoveDead(storage,
+				   [&](T& object) { on_remove(object); slots.Free(object.full_id); },
+				   [&](T& object, size_t index) { slots.Move(object.full_id, (uint32_t) index); });
+	}
 
 	template <typename T>
-	static T* BinarySearch(std::vector<T>& storage, full_instance_id full_id) {
-		ssize left = 0;
-		ssize right = (ssize)storage.size() - 1;
-
-		while (left <= right) {
-			ssize middle = (left + right) / 2;
-			if (storage[middle].full_id < full_id) {
-				left = middle + 1;
-			} else if (storage[middle].full_id > full_id) {
-				right = middle - 1;
-			} else {
-				return &storage[middle];
+	static T* LookupObject(FixedArray<T>& storage, FixedArray<T>& spawns, const SlotMap& slots, full_instance_id full_id) {
+		uint32_t index;
+		if (!slots.Lookup(full_id, &index)) return nullptr;
+		if (index & SPAWN_INDEX_BIT) return &spawns[index & ~SPAWN_INDEX_BIT];
+		return &storage[index];
+	}
+
+	// Appends a spawn buffer to its container. What doesn't fit is dropped,
+	// returns how many.
+	template <typename T, typename Move, typename Drop>
+	static size_t AppendSpawns(FixedArray<T>& storage, FixedArray<T>& spawns, const Move& on_move, const Drop& on_drop) {
+		size_t dropped = 0;
+		for (T& object : spawns) {
+			if (storage.Full()) {
+				on_drop(object);
+				dropped++;
+				continue;
 			}
+			on_move(object, storage.size());
+			storage.push_back(object);
 		}
+		spawns.clear();
+		return dropped;
+	}
 
-		return nullptr;
+	template <typename T>
+	static size_t AppendSpawns(FixedArray<T>& storage, FixedArray<T>& spawns) {
+		return AppendSpawns(storage, spawns, [](T&, size_t) {}, [](T&) {});
+	}
+
+	// for containers that hand out ids
+	template <typename T, typename Remove>
+	static size_t AppendSpawns(FixedArray<T>& storage, FixedArray<T>& spawns, SlotMap& slots, const Remove& on_remove) {
+		return AppendSpawns(storage, spawns,
+							[&](T& object, size_t index) { slots.Move(object.full_id, (uint32_t) index); },
+							[&](T& object) { on_remove(object); slots.Free(object.full_id); });
 	}
 
-	static void LaunchTowardsPoint(Object& object, float target_x, float target_y, float acc) {
+	static void LaunchTowardsPoint(Stage& stage, Object& object, float target_x, float target_y, float acc) {
 		acc = fabsf(acc);
 		float dist = cpml::point_distance(object.x, object.y, target_x, target_y);
 		object.spd = sqrtf(dist * acc * 2.0f);
 		object.acc = -acc;
-		object.dir = cpml::point_direction(object.x, object.y, target_x, target_y);
+		stage.SetDir(object, cpml::point_direction(object.x, object.y, target_x, target_y));
 	}
 
-	static bool PlayerVsBullet(Player& player, float player_radius, Bullet& bullet) {
-		switch (bullet.type) {
-			case ProjectileType::Bullet: {
-				return cpml::circle_vs_circle(player.x, player.y, player_radius, bullet.x, bullet.y, bullet.radius);
-			}
-			case ProjectileType::Lazer:
-			case ProjectileType::SLazer: {
-				float rect_center_x = bullet.x + cpml::lengthdir_x(bullet.lazer_length / 2.0f, bullet.dir);
-				float rect_center_y = bullet.y + cpml::lengthdir_y(bullet.lazer_length / 2.0f, bullet.dir);
-				return cpml::circle_vs_rotated_rect(player.x, player.y, player_radius, rect_center_x, rect_center_y, bullet.lazer_thickness, bullet.lazer_length, bullet.dir);
+	// Boxes for everything in the laser pool. Cheap enough to redo after every
+	// move, and then the grid and every player share them instead of redoing
+	// the transform per test.
+	static void UpdateBoxes(BulletPool& pool, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			float half_length = pool.lazer_length[i] / 2.0f;
+
+			if (pool.type[i] == ProjectileType::Rect) {
+				// rects are centered on their position
+				pool.box_x[i] = pool.x[i];
+				pool.box_y[i] = pool.y[i];
+			} else {
+				// lasers extend forward from it
+				pool.box_x[i] = pool.x[i] + half_length * pool.dir_x[i];
+				pool.box_y[i] = pool.y[i] + half_length * pool.dir_y[i];
 			}
+
+			pool.box_half_width[i] = pool.lazer_thickness[i] / 2.0f;
+			pool.box_half_length[i] = half_length;
 		}
-		return false;
 	}
 
 	static void PlayerGetHit(Player& player) {
@@ -127,118 +270,409 @@ namespace th {
 		//PlaySound("se_pichuun.wav");
 	}
 
-	static Pickup& DropPickup(float x, float y, PickupType type) {
-		auto& stage = Stage::GetInstance();
-		auto& assets = Assets::GetInstance();
+	// Serial numbers wrap around, the bullets alive are never 2^31 spawns apart.
+	static bool SpawnedBefore(uint32_t a, uint32_t b) {
+		return (int32_t) (a - b) < 0;
+	}
+
+	// The bullets of one pool with a graze or a hit bit set, in pool order.
+	// indices maps the bits back into the pool when the batch was gathered from grid candidates.
+	struct ContactCursor {
+		BulletPool* pool;
+		const uint32_t* indices;
+		size_t count;
+		const uint32_t* graze_bits;
+		const uint32_t* hit_bits;
+		size_t j = 0;
+
+		// on the next bit set from j on, false once there is none
+		bool Seek() {
+			for (; j < count; j++) {
+				uint32_t bits = graze_bits[j / 32] | hit_bits[j / 32];
+				if (bits == 0) {
+					j |= 31;
+					continue;
+				}
+				if (bits & (1u << (j % 32))) return true;
+			}
+			return false;
+		}
 
-		Pickup& result = stage.CreatePickup();
-		result.x = x;
-		result.y = y;
-		result.vsp = -1.5f;
-		result.radius = 8.0f;
-		result.sprite = assets.FindSprite("pickup");
-		result.frame_index = (float) type;
-		result.type = type;
+		size_t Index() const { return indices ? (indices[j] & ~GRID_LAZER_BIT) : j; }
+		uint32_t SpawnSeq() const { return pool->spawn_seq[Index()]; }
+	};
+
+	// Applies graze, then hit, for every bullet and laser with a bit set, in
+	// the order they were created.
+	// Returns true once the player got hit, nothing after that can have an effect.
+	static bool ResolvePlayerVsBullets(Stage& stage, Player& player, size_t player_index,
+									   ContactCursor& bullets, ContactCursor& lazers) {
+		bool more_bullets = bullets.Seek();
+		bool more_lazers = lazers.Seek();
+
+		while (more_bullets || more_lazers) {
+			bool take_bullet = more_bullets && (!more_lazers || SpawnedBefore(bullets.SpawnSeq(), lazers.SpawnSeq()));
+			ContactCursor& cursor = take_bullet ? bullets : lazers;
+
+			BulletPool& pool = *cursor.pool;
+			size_t i = cursor.Index();
+			uint32_t word = (uint32_t) (cursor.j / 32);
+			uint32_t mask = 1u << (cursor.j % 32);
+
+			if (!(pool.flags[i] & (OBJECT_FLAG_DEAD | OBJECT_FLAG_CANCELED))) {
+				if (cursor.graze_bits[word] & mask) {
+					if (!(pool.grazed_by[i] & (1u << player_index))) {
+						stage.GetGraze(player_index, 1);
+						//PlaySound("se_graze.wav");
+						pool.grazed_by[i] |= (1u << player_index);
+					}
+				}
 
-		return result;
+				if (cursor.hit_bits[word] & mask) {
+					if (player.iframes == 0.0f) {
+						PlayerGetHit(player);
+						pool.flags[i] |= OBJECT_FLAG_DEAD;
+						return true;
+					}
+				}
+			}
+
+			cursor.j++;
+			(take_bullet ? more_bullets : more_lazers) = cursor.Seek();
+		}
+
+		return false;
 	}
 
 
 
-	void Stage::Init() {
-		auto& game = Game::GetInstance();
-		auto& assets = Assets::GetInstance();
+	void Stage::Init(const SimContext& _context) {
+		context = _context;
+		Assets& assets = *context.assets;
 
-		for (size_t player_index = 0; player_index < game.player_count; player_index++) {
+		random.seed(context.seed);
+
+		InitPools();
+
+		for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+			ResetStats(player_index);
 			ResetPlayer(player_index, false);
 		}
 
+		pickup_sprite = assets.FindSprite("pickup");
+
+		bullet_grid.Init(-CULL_MARGIN, -CULL_MARGIN,
+						 (float)PLAY_AREA_W + 2.0f * CULL_MARGIN, (float)PLAY_AREA_H + 2.0f * CULL_MARGIN,
+						 GRID_CELL_SIZE);
+		bullet_grid.Reserve(bullets.capacity() + lazers.capacity());
+
 		InitLua();
 	}
 
 	void Stage::Quit() {
-		for (Bullet& bullet : bullets) {
-			FreeBullet(bullet);
+		FlushSpawns();
+		ReleaseCanceledRefs(cancel_refs.size());
+		cancel_wave = {};
+
+		for (BulletPool* pool : {&bullets, &lazers}) {
+			for (size_t i = 0, n = pool->size(); i < n; i++) {
+				FreeBullet(*pool, i);
+			}
+			pool->Clear();
 		}
-		bullets.clear();
 
 		for (Enemy& enemy : enemies) {
 			FreeEnemy(enemy);
 		}
 		enemies.clear();
+		enemy_slots.FreeAll();
 
 		for (Boss& boss : bosses) {
 			FreeBoss(boss);
 		}
 		bosses.clear();
+		boss_slots.FreeAll();
+
+		// refused creates leave their refs in the spares
+		FreeBullet(bullet_spawns, bullet_spawns.capacity());
+		FreeBullet(lazer_spawns, lazer_spawns.capacity());
+		FreeBoss(boss_spawns.Spare());
+		FreeEnemy(enemy_spawns.Spare());
+
+		// every pool points into the arena, Init carves them out again
+		player_bullets.clear();
+		pickups.Clear();
+		arena.Release();
 
 		lua_close(L);
 		L = nullptr;
+		lua_heap.Release();
 	}
 
-	void Stage::Update(float delta) {
-		auto& game = Game::GetInstance();
+	// LoadSnapshot reads it all back in this order
+	void Stage::SaveSnapshot(StageSnapshot* snapshot, bool compress) {
+		// uncompressed goes straight into the snapshot
+		SnapshotWriter writer;
+		writer.data.swap(compress ? snapshot_scratch : snapshot->data);
+		writer.data.clear();
+
+		writer.Write(SNAPSHOT_MAGIC);
+		writer.Write(this);
+		writer.Write(L);
+		writer.Write(arena.GetSize());
+		size_t size_offset = writer.data.size();
+		writer.Write((uint64_t) 0);
+
+		writer.Write(time);
+		writer.Write(random);
+		writer.Write(coroutine);
+		writer.Write(coro_update_timer);
+		writer.Write(spellcard_bg_alpha);
+		writer.Write(physics_time);
+		writer.Write(next_spawn_seq);
+
+		writer.Write(player_input);
+		writer.Write(players);
+		writer.Write(stats);
+		writer.Write(pickup_gains);
+
+		writer.Write(cancel_wave);
+		writer.WriteVector(cancel_refs);
+		writer.WriteVector(cancel_x);
+		writer.WriteVector(cancel_y);
+		writer.Write(recycle_cursor);
+		writer.Write(recycled_pending);
+
+		writer.WriteArray(bosses);
+		writer.WriteArray(enemies);
+		writer.WriteArray(player_bullets);
+		writer.WriteArray(boss_spawns);
+		writer.WriteArray(enemy_spawns);
+		writer.WriteArray(player_bullet_spawns);
+		for (FixedArray<float>* array : {&boss_x0, &boss_y0, &enemy_x0, &enemy_y0, &player_bullet_x0, &player_bullet_y0}) {
+			writer.WriteArray(*array);
+		}
+		bullets.Save(writer);
+		lazers.Save(writer);
+		pickups.Save(writer);
+		bullet_spawns.Save(writer);
+		lazer_spawns.Save(writer);
+		pickup_spawns.Save(writer);
+		boss_slots.Save(writer);
+		enemy_slots.Save(writer);
+		bullet_slots.Save(writer);
+		lazer_slots.Save(writer);
+
+		lua_heap.Save(writer);
+
+		writer.Write(SNAPSHOT_END_MAGIC);
+		writer.Overwrite(size_offset, (uint64_t) writer.data.size());
+
+		snapshot->time = time;
+
+		if (compress) {
+			CompressSnapshot(writer.data, snapshot);
+			snapshot_scratch.swap(writer.data);
+		} else {
+			snapshot->raw_size = writer.data.size();
+			snapshot->compressed = false;
+			snapshot->data.swap(writer.data);
+		}
+	}
 
-		{
-			const Uint8* key = SDL_GetKeyboardState(nullptr);
+	bool Stage::LoadSnapshot(const StageSnapshot& snapshot) {
+		const std::vector<uint8_t>* raw = &snapshot.data;
+		if (snapshot.compressed) {
+			if (!DecompressSnapshot(snapshot, &snapshot_scratch)) {
+				return false;
+			}
+			raw = &snapshot_scratch;
+		}
+
+		SnapshotReader reader(raw->data(), raw->size());
+
+		// Checked before anything is read into the stage, so a snapshot
+		// that was cut short or isn't ours leaves the stage as it was. The
+		// pools have the capacities they had when it was taken, so every
+		// count in it fits.
+		uint32_t magic = 0;
+		Stage* stage = nullptr;
+		lua_State* state = nullptr;
+		size_t arena_size = 0;
+		uint64_t total_size = 0;
+		uint32_t end_magic = 0;
+		reader.Read(magic);
+		reader.Read(stage);
+		reader.Read(state);
+		reader.Read(arena_size);
+		reader.Read(total_size);
+		if (raw->size() >= sizeof(end_magic)) {
+			memcpy(&end_magic, raw->data() + raw->size() - sizeof(end_magic), sizeof(end_magic));
+		}
+		if (!reader.ok || magic != SNAPSHOT_MAGIC || stage != this || state != L || arena_size != arena.GetSize()) {
+			LOG("Snapshot is from another stage.");
+			return false;
+		}
+		if (total_size != raw->size() || end_magic != SNAPSHOT_END_MAGIC) {
+			LOG("Snapshot is cut short or corrupted, %zu bytes of %llu.", raw->size(), (unsigned long long) total_size);
+			return false;
+		}
 
-			player_input[0] = 0;
+		reader.Read(time);
+		reader.Read(random);
+		reader.Read(coroutine);
+		reader.Read(coro_update_timer);
+		reader.Read(spellcard_bg_alpha);
+		reader.Read(physics_time);
+		reader.Read(next_spawn_seq);
+
+		reader.Read(player_input);
+		reader.Read(players);
+		reader.Read(stats);
+		reader.Read(pickup_gains);
+
+		reader.Read(cancel_wave);
+		reader.ReadVector(cancel_refs);
+		reader.ReadVector(cancel_x);
+		reader.ReadVector(cancel_y);
+		reader.Read(recycle_cursor);
+		reader.Read(recycled_pending);
+
+		reader.ReadArray(bosses);
+		reader.ReadArray(enemies);
+		reader.ReadArray(player_bullets);
+		reader.ReadArray(boss_spawns);
+		reader.ReadArray(enemy_spawns);
+		reader.ReadArray(player_bullet_spawns);
+		for (FixedArray<float>* array : {&boss_x0, &boss_y0, &enemy_x0, &enemy_y0, &player_bullet_x0, &player_bullet_y0}) {
+			reader.ReadArray(*array);
+		}
+		bullets.Load(reader);
+		lazers.Load(reader);
+		pickups.Load(reader);
+		bullet_spawns.Load(reader);
+		lazer_spawns.Load(reader);
+		pickup_spawns.Load(reader);
+		boss_slots.Load(reader);
+		enemy_slots.Load(reader);
+		bullet_slots.Load(reader);
+		lazer_slots.Load(reader);
+
+		if (!reader.ok || !lua_heap.Load(reader)) {
+			LOG("Snapshot is cut short, the stage is in a broken state.");
+			return false;
+		}
 
-			if (!game.console_on_screen) {
-				player_input[0] |= key[SDL_SCANCODE_RIGHT] * INPUT_RIGHT;
-				player_input[0] |= key[SDL_SCANCODE_UP]    * INPUT_UP;
-				player_input[0] |= key[SDL_SCANCODE_LEFT]  * INPUT_LEFT;
-				player_input[0] |= key[SDL_SCANCODE_DOWN]  * INPUT_DOWN;
+		std::fill(recycle_order_valid, recycle_order_valid + POOL_COUNT, false);
+		return true;
+	}
 
-				player_input[0] |= key[SDL_SCANCODE_Z]      * INPUT_FIRE;
-				player_input[0] |= key[SDL_SCANCODE_X]      * INPUT_BOMB;
-				player_input[0] |= key[SDL_SCANCODE_LSHIFT] * INPUT_FOCUS;
+	uint64_t Stage::GetChecksum() const {
+		uint64_t hash = 14695981039346656037ull;
+		auto add = [&hash](const void* data, size_t size) {
+			for (size_t i = 0; i < size; i++) {
+				hash ^= ((const uint8_t*) data)[i];
+				hash *= 1099511628211ull;
 			}
+		};
+
+		add(&time, sizeof(time));
+		add(&random, sizeof(random));
+		for (size_t i = 0; i < context.player_count; i++) {
+			add(&players[i].x, sizeof(float));
+			add(&players[i].y, sizeof(float));
+			add(&stats[i], sizeof(Stats));
 		}
 
+		size_t counts[] = {bosses.size(), enemies.size(), bullets.size(), lazers.size(),
+						   player_bullets.size(), pickups.size()};
+		add(counts, sizeof(counts));
+		add(bullets.x.data(), bullets.size() * sizeof(float));
+		add(bullets.y.data(), bullets.size() * sizeof(float));
+
+		return hash;
+	}
+
+	void Stage::Update(float delta) {
+		trig_evals = 0;
+		sleep_skipped = 0;
+		std::fill(policy_fired, policy_fired + OVERFLOW_POLICY_COUNT, 0);
+		std::fill(recycle_order_valid, recycle_order_valid + POOL_COUNT, false);
+
+		// whatever the console or Init spawned
+		FlushSpawns();
+
+		double pass_start_t = GetTime();
+		auto end_pass = [&](StagePass pass) {
+			double t = GetTime();
+			pass_took[pass] = (t - pass_start_t) * 1000.0;
+			pass_start_t = t;
+		};
+
 		// Update
 		{
-			for (size_t player_index = 0; player_index < game.player_count; player_index++) {
+			for (size_t player_index = 0; player_index < context.player_count; player_index++) {
 				UpdatePlayer(player_index, delta);
 			}
 
-			for (auto boss_it = bosses.begin(); boss_it != bosses.end();) {
-				Boss& boss = *boss_it;
+			// new shots home and move this frame
+			FlushSpawns();
 
+			for (Boss& boss : bosses) {
 				if (!UpdateBoss(boss, delta)) {
-					boss_it = bosses.erase(boss_it);
-					FreeBoss(boss);
+					boss.flags |= OBJECT_FLAG_DEAD;
 					continue;
 				}
 
 				AnimateObject(boss, delta);
-
-				++boss_it;
 			}
 
-			for (Bullet& bullet : bullets) {
-				switch (bullet.type) {
-					case ProjectileType::Lazer:
-					case ProjectileType::SLazer: {
-						if (bullet.lazer_timer < bullet.lazer_time) {
-							bullet.lazer_timer += delta;
+			for (size_t i = 0, n = lazers.size(); i < n; i++) {
+				if (lazers.lazer_timer[i] < lazers.lazer_time[i]) {
+					lazers.lazer_timer[i] += delta;
 
-							if (bullet.type == ProjectileType::SLazer) {
-								bullet.lazer_length = 0.0f;
-								if (bullet.lazer_timer >= bullet.lazer_time) {
-									//PlaySound("se_lazer.wav");
-								}
-							} else {
-								bullet.lazer_length = cpml::lerp(0.0f, bullet.lazer_target_length, bullet.lazer_timer / bullet.lazer_time);
-							}
-						} else {
-							bullet.lazer_length = bullet.lazer_target_length;
+					if (lazers.type[i] == ProjectileType::SLazer) {
+						lazers.lazer_length[i] = 0.0f;
+						if (lazers.lazer_timer[i] >= lazers.lazer_time[i]) {
+							//PlaySound("se_lazer.wav");
 						}
-						break;
+					} else {
+						lazers.lazer_length[i] = cpml::lerp(0.0f, lazers.lazer_target_length[i], lazers.lazer_timer[i] / lazers.lazer_time[i]);
 					}
+				} else {
+					lazers.lazer_length[i] = lazers.lazer_target_length[i];
+				}
+			}
+
+			// one batched nearest-target query for every homing shot
+			{
+				homing_targets.Clear();
+				for (size_t i = 0; i < enemies.size(); i++) {
+					if (enemies[i].flags & OBJECT_FLAG_DEAD) continue;
+					homing_targets.Add((uint32_t) i, enemies[i].x, enemies[i].y);
+				}
+				for (size_t i = 0; i < bosses.size(); i++) {
+					if (bosses[i].flags & OBJECT_FLAG_DEAD) continue;
+					homing_targets.Add((uint32_t) i | TARGET_BOSS_BIT, bosses[i].x, bosses[i].y);
+				}
+				homing_targets.Build();
+
+				homing_query[0].clear();
+				homing_query[1].clear();
+				for (PlayerBullet& player_bullet : player_bullets) {
+					if (player_bullet.type != PLAYER_BULLET_REIMU_ORB_SHOT) continue;
+					homing_query[0].push_back(player_bullet.x);
+					homing_query[1].push_back(player_bullet.y);
 				}
+
+				homing_result.resize(homing_query[0].size());
+				homing_targets.FindNearest(homing_query[0].data(), homing_query[1].data(), homing_query[0].size(),
+										   homing_result.data(), NO_TARGET);
 			}
 
+			// homing shots take their results in the same order they were queried
+			size_t homing_cursor = 0;
+
 			for (PlayerBullet& player_bullet : player_bullets) {
 				switch (player_bullet.type) {
 					case PLAYER_BULLET_REIMU_CARD: {
@@ -248,32 +682,23 @@ namespace th {
 					case PLAYER_BULLET_REIMU_ORB_SHOT: {
 						float target_x = 0.0f;
 						float target_y = 0.0f;
-						float target_dist = 1'000'000.0f;
 						bool home = false;
 
-						Enemy* enemy = FindClosest(enemies, player_bullet.x, player_bullet.y);
-						if (enemy) {
-							target_x = enemy->x;
-							target_y = enemy->y;
-							target_dist = cpml::point_distance(player_bullet.x, player_bullet.y, enemy->x, enemy->y);
+						// enemies win ties against bosses, same as the old two searches
+						uint32_t item = homing_result[homing_cursor++];
+						if (item != NO_TARGET) {
+							Object& target = (item & TARGET_BOSS_BIT)
+								? (Object&) bosses[item & ~TARGET_BOSS_BIT]
+								: (Object&) enemies[item];
+							target_x = target.x;
+							target_y = target.y;
 							home = true;
 						}
 
-						Boss* boss = FindClosest(bosses, player_bullet.x, player_bullet.y);
-						if (boss) {
-							float dist = cpml::point_distance(player_bullet.x, player_bullet.y, boss->x, boss->y);
-							if (dist < target_dist) {
-								target_x = boss->x;
-								target_y = boss->y;
-								target_dist = dist;
-								home = true;
-							}
-						}
-
 						// @goofy
 						if (home) {
-							float hsp = cpml::lengthdir_x(player_bullet.spd, player_bullet.dir);
-							float vsp = cpml::lengthdir_y(player_bullet.spd, player_bullet.dir);
+							float hsp = player_bullet.spd * player_bullet.dir_x;
+							float vsp = player_bullet.spd * player_bullet.dir_y;
 							float dx = target_x - player_bullet.x;
 							float dy = target_y - player_bullet.y;
 							dx = std::clamp(dx, -12.0f, 12.0f);
@@ -281,7 +706,7 @@ namespace th {
 							hsp = cpml::approach(hsp, dx, 1.5f * delta);
 							vsp = cpml::approach(vsp, dy, 1.5f * delta);
 							player_bullet.spd = cpml::point_distance(0.0f, 0.0f, hsp, vsp);
-							player_bullet.dir = cpml::point_direction(0.0f, 0.0f, hsp, vsp);
+							SetDir(player_bullet, cpml::point_direction(0.0f, 0.0f, hsp, vsp));
 						} else {
 							if (player_bullet.spd < 10.0f) {
 								player_bullet.spd += 1.0f * delta;
@@ -292,45 +717,26 @@ namespace th {
 				}
 			}
 
-			for (Pickup& pickup : pickups) {
-				if (pickup.homing_target != NULL_INSTANCE_ID) {
-					Object* target = FindObject(pickup.homing_target);
-					if (!target) {
-						pickup.homing_target = NULL_INSTANCE_ID;
-						continue;
-					}
-
-					float spd = 8.0f;
-					float dir = cpml::point_direction(pickup.x, pickup.y, target->x, target->y);
-					pickup.hsp = cpml::lengthdir_x(spd, dir);
-					pickup.vsp = cpml::lengthdir_y(spd, dir);
+			UpdateCancelWave(delta);
+			CoalescePickups();
+			UpdatePickups(delta);
 
-					if (INSTANCE_ID_GET_TYPE(pickup.homing_target) != TYPE_PLAYER) {
-						continue;
-					}
+			FlushSpawns();
 
-					Player* player = (Player*) target;
-					if (player->state == PlayerState::Dying) {
-						pickup.hsp = 0.0f;
-						pickup.vsp = -1.5f;
-						pickup.homing_target = NULL_INSTANCE_ID;
-					}
-				} else {
-					pickup.hsp = 0.0f;
-					pickup.vsp += 0.025f * delta;
-					pickup.vsp = std::min(pickup.vsp, 2.0f);
-				}
-			}
+			end_pass(PASS_UPDATE);
 		}
 
 		// Physics
 		{
-			float physics_timer = delta * /*g_stage->gameplay_delta*/1.0f;
-			while (physics_timer > 0.0f) {
-				float pdelta = std::min(physics_timer, PHYSICS_DELTA);
+			int substeps = std::max(physics_substeps, 1);
+			float pdelta = delta * /*g_stage->gameplay_delta*/1.0f / (float) substeps;
+			for (int i = 0; i < substeps; i++) {
 				PhysicsUpdate(pdelta);
-				physics_timer -= pdelta;
 			}
+
+			ApplyPickupGains();
+
+			end_pass(PASS_PHYSICS);
 		}
 
 		// Scripts
@@ -346,67 +752,25 @@ namespace th {
 
 			for (size_t enemy_idx = 0; enemy_idx < enemies.size(); enemy_idx++) {
 				Enemy& enemy = enemies[enemy_idx];
+				if (enemy.flags & OBJECT_FLAG_DEAD) continue;
 				CallLuaFunction(L, enemy.update_callback, enemy.full_id);
 			}
-		}
-
-		// Cleanup
-		{
-			for (size_t player_index = 0; player_index < game.player_count; player_index++) {
-				Player& player = players[player_index];
-
-				if (player.flags & OBJECT_FLAG_DEAD) {
-					PlayerGetHit(player);
-					player.flags &= ~OBJECT_FLAG_DEAD;
-				}
-			}
-
-			for (auto boss_it = bosses.begin(); boss_it != bosses.end();) {
-				Boss& boss = *boss_it;
-
-				if (boss.flags & OBJECT_FLAG_DEAD) {
-					FreeBoss(boss);
-					boss_it = bosses.erase(boss_it);
-					continue;
-				}
-
-				++boss_it;
-			}
-
-			for (auto enemy_it = enemies.begin(); enemy_it != enemies.end();) {
-				Enemy& enemy = *enemy_it;
-
-				if (enemy.flags & OBJECT_FLAG_DEAD) {
-					FreeEnemy(enemy);
-					enemy_it = enemies.erase(enemy_it);
-					continue;
-				}
-
-				++enemy_it;
-			}
-
-			for (auto bullet_it = bullets.begin(); bullet_it != bullets.end();) {
-				Bullet& bullet = *bullet_it;
 
-				if (bullet.flags & OBJECT_FLAG_DEAD) {
-					FreeBullet(bullet);
-					bullet_it = bullets.erase(bullet_it);
-					continue;
-				}
+			// culled and compacted like everything else
+			FlushSpawns();
 
-				++bullet_it;
-			}
+			end_pass(PASS_SCRIPTS);
 		}
 
 		// Late Update
 		{
-			for (size_t player_index = 0; player_index < game.player_count; player_index++) {
+			for (size_t player_index = 0; player_index < context.player_count; player_index++) {
 				Player& player = players[player_index];
 
 				player.x = std::clamp(player.x, 0.0f, (float) (PLAY_AREA_W - 1));
 				player.y = std::clamp(player.y, 0.0f, (float) (PLAY_AREA_H - 1));
 
-				switch (game.player_character[player_index]) {
+				switch (context.player_character[player_index]) {
 					case CHARACTER_REIMU: {
 						player.reimu.orb_x[0] = player.x - 24.0f;
 						player.reimu.orb_y[0] = player.y;
@@ -415,62 +779,59 @@ namespace th {
 						player.reimu.orb_y[1] = player.y;
 						break;
 					}
+					default: break;
 				}
 			}
 
-			for (auto enemy_it = enemies.begin(); enemy_it != enemies.end();) {
-				Enemy& enemy = *enemy_it;
-
+			for (Enemy& enemy : enemies) {
 				if (!is_in_bounds(enemy.x, enemy.y)) {
-					FreeEnemy(enemy);
-					enemy_it = enemies.erase(enemy_it);
-					continue;
+					enemy.flags |= OBJECT_FLAG_DEAD;
 				}
-
-				++enemy_it;
 			}
 
-			for (auto bullet_it = bullets.begin(); bullet_it != bullets.end();) {
-				Bullet& bullet = *bullet_it;
-
-				if (bullet.lifetime >= bullet.lifespan) {
-					FreeBullet(bullet);
-					bullet_it = bullets.erase(bullet_it);
-					continue;
-				}
-
-				if (!is_in_bounds(bullet.x, bullet.y)) {
-					FreeBullet(bullet);
-					bullet_it = bullets.erase(bullet_it);
-					continue;
-				}
-
-				bullet.lifetime += delta;
-
-				++bullet_it;
+			// same test as is_in_bounds
+			for (BulletPool* pool : {&bullets, &lazers}) {
+				context.jobs->ParallelFor(pool->size(), KERNEL_GRAIN, [&](size_t begin, size_t end, size_t) {
+					CullBulletsKernel(pool->x.data() + begin, pool->y.data() + begin,
+									  pool->lifetime.data() + begin, pool->lifespan.data() + begin,
+									  pool->flags.data() + begin, end - begin, delta,
+									  -CULL_MARGIN, -CULL_MARGIN,
+									  (float)PLAY_AREA_W + CULL_MARGIN, (float)PLAY_AREA_H + CULL_MARGIN);
+				});
 			}
 
-			for (auto player_bullet_it = player_bullets.begin(); player_bullet_it != player_bullets.end();) {
-				PlayerBullet& player_bullet = *player_bullet_it;
-
+			for (PlayerBullet& player_bullet : player_bullets) {
 				if (!is_in_bounds(player_bullet.x, player_bullet.y)) {
-					player_bullet_it = player_bullets.erase(player_bullet_it);
-					continue;
+					player_bullet.flags |= OBJECT_FLAG_DEAD;
 				}
+			}
 
-				++player_bullet_it;
+			for (size_t i = 0, n = pickups.size(); i < n; i++) {
+				if (!is_in_bounds(pickups.x[i], pickups.y[i])) {
+					pickups.flags[i] |= OBJECT_FLAG_DEAD;
+				}
 			}
 
-			for (auto pickup_it = pickups.begin(); pickup_it != pickups.end();) {
-				Pickup& pickup = *pickup_it;
+			end_pass(PASS_LATE_UPDATE);
+		}
 
-				if (!is_in_bounds(pickup.x, pickup.y)) {
-					pickup_it = pickups.erase(pickup_it);
-					continue;
+		// Cleanup
+		// Everything that died this frame was only flagged, remove it all in one pass per container.
+		{
+			for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+				Player& player = players[player_index];
+
+				if (player.flags & OBJECT_FLAG_DEAD) {
+					PlayerGetHit(player);
+					player.flags &= ~OBJECT_FLAG_DEAD;
 				}
+			}
 
-				++pickup_it;
+			for (int pool = 0; pool < POOL_COUNT; pool++) {
+				CompactPool((PoolIndex) pool);
 			}
+
+			end_pass(PASS_CLEANUP);
 		}
 
 		{
@@ -501,13 +862,10 @@ namespace th {
 	}
 
 	void Stage::UpdatePlayer(size_t player_index, float delta) {
-		auto& game = Game::GetInstance();
-		auto& scene = GameScene::GetInstance();
-
 		Player& player = players[player_index];
 		InputState input = player_input[player_index];
-		CharacterData* char_data = GetCharacterData(game.player_character[player_index]);
-		Stats& stats = scene.stats[player_index];
+		CharacterData* char_data = GetCharacterData(context.player_character[player_index]);
+		Stats& player_stats = stats[player_index];
 
 		player.hsp = 0.0f;
 		player.vsp = 0.0f;
@@ -536,16 +894,16 @@ namespace th {
 				player.vsp = ymove * spd;
 
 				if (char_data->shot_type) {
-					(*char_data->shot_type)(player_index, delta);
+					(*char_data->shot_type)(*this, player_index, delta);
 				}
 
 				if (input & INPUT_BOMB) {
 					if (player.bomb_timer == 0.0f) {
-						if (stats.bombs > 0) {
+						if (player_stats.bombs > 0) {
 							if (char_data->bomb) {
-								(*char_data->bomb)(player_index);
+								(*char_data->bomb)(*this, player_index);
 							}
-							stats.bombs--;
+							player_stats.bombs--;
 							player.bomb_timer = PLAYER_BOMB_TIME;
 						}
 					}
@@ -591,9 +949,7 @@ namespace th {
 				}
 
 				if (player.y < POINT_OF_COLLECTION) {
-					for (Pickup& pickup : pickups) {
-						pickup.homing_target = player.full_id;
-					}
+					HomeAllPickups((int32_t) player_index);
 				}
 				break;
 			}
@@ -602,11 +958,11 @@ namespace th {
 				if (input & INPUT_BOMB) {
 					if ((PLAYER_DEATH_TIME - player.timer) < char_data->deathbomb_time) {
 						if (player.bomb_timer == 0.0f) {
-							if (stats.bombs > 0) {
+							if (player_stats.bombs > 0) {
 								if (char_data->bomb) {
-									(*char_data->bomb)(player_index);
+									(*char_data->bomb)(*this, player_index);
 								}
-								stats.bombs--;
+								player_stats.bombs--;
 								player.bomb_timer = PLAYER_BOMB_TIME;
 								player.state = PlayerState::Normal;
 								player.iframes = PLAYER_RESPAWN_IFRAMES;
@@ -617,11 +973,11 @@ namespace th {
 
 				player.timer = std::max(player.timer - delta, 0.0f);
 				if (player.timer == 0.0f) {
-					if (stats.lives > 0) {
-						stats.lives--;
+					if (player_stats.lives > 0) {
+						player_stats.lives--;
 				
-						int drop = std::min(stats.power, 16);
-						stats.power -= drop;
+						int drop = std::min(player_stats.power, 16);
+						player_stats.power -= drop;
 						drop = std::min(drop, 12);
 						while (drop > 0) {
 							PickupType type;
@@ -634,11 +990,11 @@ namespace th {
 							}
 							float x = player.x + random.range(-50.0f, 50.0f);
 							float y = player.y + random.range(-50.0f, 50.0f);
-							DropPickup(x, y, type);
+							CreatePickup(x, y, type);
 						}
 					} else {
 						//g_screen->GameOver();
-						DropPickup(player.x, player.y, PICKUP_FULL_POWER);
+						CreatePickup(player.x, player.y, PICKUP_FULL_POWER);
 					}
 					ResetPlayer(player_index, true);
 					return;
@@ -704,8 +1060,7 @@ namespace th {
 			}
 		}
 
-		auto& game = Game::GetInstance();
-		if (game.key_pressed[SDL_SCANCODE_B]) {
+		if (player_input[0] & INPUT_SKIP_PHASE) {
 			if (!EndBossPhase(boss)) return false;
 			if (boss.state == BossState::WaitingEnd) {
 				boss.wait_timer = 0.0f;
@@ -725,7 +1080,7 @@ namespace th {
 		boss.state = BossState::WaitingStart;
 
 		if (boss.phase_index > 0) {
-			LaunchTowardsPoint(boss, BOSS_STARTING_X, BOSS_STARTING_Y, 0.05f);
+			LaunchTowardsPoint(*this, boss, BOSS_STARTING_X, BOSS_STARTING_Y, 0.05f);
 		}
 
 		if (phase_data->type == PHASE_SPELLCARD) {
@@ -734,15 +1089,9 @@ namespace th {
 	}
 
 	bool Stage::EndBossPhase(Boss& boss) {
-		for (Bullet& bullet : bullets) {
-			DropPickup(bullet.x, bullet.y, PICKUP_SCORE);
-			FreeBullet(bullet);
-		}
-		bullets.clear();
+		CancelAllBullets(boss.x, boss.y);
 
-		for (Pickup& pickup : pickups) {
-			pickup.homing_target = MAKE_INSTANCE_ID(0, TYPE_PLAYER);
-		}
+		HomeAllPickups(0);
 
 		LuaUnref(&boss.coroutine, L);
 
@@ -755,7 +1104,7 @@ namespace th {
 				float x = boss.x + random.range(-50.0f, 50.0f);
 				float y = boss.y + random.range(-50.0f, 50.0f);
 				PickupType type = (i == 4) ? PICKUP_BIGP : PICKUP_POWER;
-				DropPickup(x, y, type);
+				CreatePickup(x, y, type);
 			}
 		}
 
@@ -769,9 +1118,7 @@ namespace th {
 			}
 			//PlaySound("se_enemy_die.wav");
 		} else {
-			for (Pickup& pickup : pickups) {
-				pickup.homing_target = MAKE_INSTANCE_ID(0, TYPE_PLAYER);
-			}
+			HomeAllPickups(0);
 
 			if (boss_data->type == BOSS_BOSS) {
 				//PlaySound("se_boss_die.wav");
@@ -787,12 +1134,22 @@ namespace th {
 	}
 
 	void Stage::PhysicsUpdate(float delta) {
-		auto& game = Game::GetInstance();
-		auto& scene = GameScene::GetInstance();
+		physics_time += delta;
 
 		// Move
 		{
-			for (size_t player_index = 0; player_index < game.player_count; player_index++) {
+			if (swept_collision) {
+				for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+					player_x0[player_index] = players[player_index].x;
+					player_y0[player_index] = players[player_index].y;
+				}
+
+				SaveStartPositions(bosses, boss_x0, boss_y0);
+				SaveStartPositions(enemies, enemy_x0, enemy_y0);
+				SaveStartPositions(player_bullets, player_bullet_x0, player_bullet_y0);
+			}
+
+			for (size_t player_index = 0; player_index < context.player_count; player_index++) {
 				Player& player = players[player_index];
 
 				player.x += player.hsp * delta;
@@ -807,199 +1164,866 @@ namespace th {
 				MoveObject(enemy, delta);
 			}
 
-			for (Bullet& bullet : bullets) {
-				switch (bullet.type) {
-					case ProjectileType::Lazer:
-					case ProjectileType::SLazer: {
-						if (bullet.lazer_timer >= bullet.lazer_time) {
-							MoveObject(bullet, delta);
-						}
-						break;
-					}
-					default: {
-						MoveObject(bullet, delta);
-						break;
-					}
-				}
+			// every bullet on its own, so the ranges can run on any worker.
+			// The analytic counts are per worker and only ever summed.
+			size_t worker_analytic[MAX_WORKERS]{};
+			for (BulletPool* pool : {&bullets, &lazers}) {
+				bool boxes = (pool == &lazers);
+
+				pool->x0.CopyFrom(pool->x);
+				pool->y0.CopyFrom(pool->y);
+				context.jobs->ParallelFor(pool->size(), KERNEL_GRAIN, [&](size_t begin, size_t end, size_t worker) {
+					MoveBullets(*pool, begin, end, delta);
+					worker_analytic[worker] += MoveAnalyticBullets(*pool, begin, end, delta);
+					if (boxes) UpdateBoxes(*pool, begin, end);
+				});
+			}
+
+			analytic_bullets = 0;
+			for (size_t count : worker_analytic) {
+				analytic_bullets += count;
 			}
 
 			for (PlayerBullet& player_bullet : player_bullets) {
 				MoveObject(player_bullet, delta);
 			}
 
-			for (Pickup& pickup : pickups) {
-				pickup.x += pickup.hsp * delta;
-				pickup.y += pickup.vsp * delta;
+			pickups.x0.CopyFrom(pickups.x);
+			pickups.y0.CopyFrom(pickups.y);
+			for (size_t i = 0, n = pickups.size(); i < n; i++) {
+				pickups.x[i] += pickups.hsp[i] * delta;
+				pickups.y[i] += pickups.vsp[i] * delta;
 			}
 		}
 
 		// Collide
 		{
-			for (size_t player_index = 0; player_index < game.player_count; player_index++) {
-				Player& player = players[player_index];
-				CharacterData* char_data = GetCharacterData(game.player_character[player_index]);
-
-				// player vs bullet
-				for (auto bullet_it = bullets.begin(); bullet_it != bullets.end();) {
-					Bullet& bullet = *bullet_it;
-					if (PlayerVsBullet(player, char_data->graze_radius, bullet)) {
-						if (player.state == PlayerState::Normal) {
-							if (!(bullet.grazed_by & (1u << player_index))) {
-								scene.GetGraze(player_index, 1);
-								//PlaySound("se_graze.wav");
-								bullet.grazed_by |= (1u << player_index);
-							}
-						}
-					}
+			ScheduleBulletTests(delta);
 
-					if (PlayerVsBullet(player, player.radius, bullet)) {
-						if (player.state == PlayerState::Normal) {
-							if (player.iframes == 0.0f) {
-								PlayerGetHit(player);
-								bullet_it = bullets.erase(bullet_it);
-								continue;
-							}
-						}
-					}
+			if (collision_broadphase) {
+				BuildBulletGrid();
+			}
+
+			GatherPlayerBlock();
+
+			float hit_t[MAX_PLAYERS];
+			if (swept_collision) {
+				CollidePlayersWithBulletsSwept(hit_t);
+			} else {
+				CollidePlayersWithBullets();
 
-					++bullet_it;
+				// a hit anywhere in the step stops pickups for the whole step
+				for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+					hit_t[player_index] = (players[player_index].state == PlayerState::Normal) ? NO_CONTACT : -1.0f;
 				}
+			}
 
-				// player vs pickup
-				for (auto pickup_it = pickups.begin(); pickup_it != pickups.end();) {
-					Pickup& pickup = *pickup_it;
-					if (cpml::circle_vs_circle(player.x, player.y, char_data->graze_radius, pickup.x, pickup.y, pickup.radius)) {
-						if (player.state == PlayerState::Normal) {
-							switch (pickup.type) {
-								case PICKUP_POWER:
-									scene.GetPower(player_index, 1);
-									scene.GetScore(player_index, 10);
-									break;
-								case PICKUP_POINT:      scene.GetPoints(player_index, 1);        break;
-								case PICKUP_BIGP:       scene.GetPower(player_index, 8);         break;
-								case PICKUP_BOMB:       scene.GetBombs(player_index, 1);         break;
-								case PICKUP_FULL_POWER: scene.GetPower(player_index, MAX_POWER); break;
-								case PICKUP_1UP:        scene.GetLives(player_index, 1);         break;
-								case PICKUP_SCORE:      scene.GetScore(player_index, 10);        break;
-							}
-							//PlaySound("se_item.wav");
-							pickup_it = pickups.erase(pickup_it);
-							continue;
-						}
+			// player vs pickup, one pass. A pickup goes to the first player in order
+			// that can take it, same as when each player had its own pass.
+			for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+				player_contacts[player_index].pickups.clear();
+			}
+
+			for (size_t pickup_index = 0; pickup_index < pickups.size(); pickup_index++) {
+				if (pickups.flags[pickup_index] & OBJECT_FLAG_DEAD) continue;
+
+				for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+					// only what was touched before getting hit
+					if (!player_block.normal[player_index]) continue;
+
+					float t;
+					if (CirclesTouch(swept_collision,
+									 player_block.x0[player_index], player_block.y0[player_index],
+									 player_block.x[player_index], player_block.y[player_index],
+									 player_block.graze_radius[player_index],
+									 pickups.x0[pickup_index], pickups.y0[pickup_index],
+									 pickups.x[pickup_index], pickups.y[pickup_index], PICKUP_RADIUS,
+									 &t)
+						&& t < hit_t[player_index]) {
+						player_contacts[player_index].pickups.push_back((uint32_t) pickup_index);
+						pickups.flags[pickup_index] |= OBJECT_FLAG_DEAD;
+						break;
+					}
+				}
+			}
+
+			for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+				PickupGains& gains = pickup_gains[player_index];
+				for (uint32_t pickup_index : player_contacts[player_index].pickups) {
+					int n = (int) pickups.count[pickup_index];
+					switch (pickups.type[pickup_index]) {
+						case PICKUP_POWER:
+							gains.power += n;
+							gains.score += 10 * n;
+							break;
+						case PICKUP_POINT:      gains.points += n;             break;
+						case PICKUP_BIGP:       gains.power  += 8 * n;         break;
+						case PICKUP_BOMB:       gains.bombs  += n;             break;
+						case PICKUP_FULL_POWER: gains.power  += MAX_POWER * n; break;
+						case PICKUP_1UP:        gains.lives  += n;             break;
+						case PICKUP_SCORE:      gains.score  += 10 * n;        break;
+						case PICKUP_CHERRY:     /* no cherry gauge yet */      break;
+						default:                                               break;
 					}
-					++pickup_it;
+					//PlaySound("se_item.wav");
 				}
 			}
 
-			for (auto boss_it = bosses.begin(); boss_it != bosses.end();) {
-				Boss& boss = *boss_it;
+			auto player_bullet_touches = [&](size_t player_bullet_index, float x0, float y0, float x, float y, float radius) {
+				PlayerBullet& player_bullet = player_bullets[player_bullet_index];
+				float t;
+				return CirclesTouch(swept_collision,
+									x0, y0, x, y, radius,
+									StartPosition(player_bullet_x0, player_bullet_index, player_bullet.x),
+									StartPosition(player_bullet_y0, player_bullet_index, player_bullet.y),
+									player_bullet.x, player_bullet.y, player_bullet.radius,
+									&t);
+			};
+
+			for (size_t boss_index = 0; boss_index < bosses.size(); boss_index++) {
+				Boss& boss = bosses[boss_index];
+				if (boss.flags & OBJECT_FLAG_DEAD) continue;
+
+				float boss_x0 = StartPosition(this->boss_x0, boss_index, boss.x);
+				float boss_y0 = StartPosition(this->boss_y0, boss_index, boss.y);
 
 				// boss vs bullet
-				for (auto player_bullet_it = player_bullets.begin(); player_bullet_it != player_bullets.end();) {
-					PlayerBullet& player_bullet = *player_bullet_it;
+				for (size_t player_bullet_index = 0; player_bullet_index < player_bullets.size(); player_bullet_index++) {
+					PlayerBullet& player_bullet = player_bullets[player_bullet_index];
+					if (player_bullet.flags & OBJECT_FLAG_DEAD) continue;
+
+					if (player_bullet_touches(player_bullet_index, boss_x0, boss_y0, boss.x, boss.y, boss.radius)) {
+						//PlaySound("se_enemy_hit.wav");
+						player_bullet.flags |= OBJECT_FLAG_DEAD;
 
-					if (cpml::circle_vs_circle(boss.x, boss.y, boss.radius, player_bullet.x, player_bullet.y, player_bullet.radius)) {
 						if (boss.state == BossState::Normal) {
 							boss.hp -= player_bullet.dmg;
 							if (boss.hp <= 0.0f) {
 								if (!EndBossPhase(boss)) {
-									boss_it = bosses.erase(boss_it);
-									goto l_boss_out;
+									boss.flags |= OBJECT_FLAG_DEAD;
+									break;
 								}
 							}
 						}
-
-						//PlaySound("se_enemy_hit.wav");
-						player_bullet_it = player_bullets.erase(player_bullet_it);
-						continue;
 					}
-
-					++player_bullet_it;
 				}
-
-				++boss_it;
-
-				l_boss_out:;
 			}
 
-			for (size_t enemy_idx = 0; enemy_idx < enemies.size();) {
+			for (size_t enemy_idx = 0; enemy_idx < enemies.size(); enemy_idx++) {
 				Enemy& enemy = enemies[enemy_idx];
+				if (enemy.flags & OBJECT_FLAG_DEAD) continue;
+
+				float enemy_x0 = StartPosition(this->enemy_x0, enemy_idx, enemy.x);
+				float enemy_y0 = StartPosition(this->enemy_y0, enemy_idx, enemy.y);
 
 				// enemy vs bullet
-				for (auto player_bullet_it = player_bullets.begin(); player_bullet_it != player_bullets.end();) {
-					PlayerBullet& player_bullet = *player_bullet_it;
+				for (size_t player_bullet_index = 0; player_bullet_index < player_bullets.size(); player_bullet_index++) {
+					PlayerBullet& player_bullet = player_bullets[player_bullet_index];
+					if (player_bullet.flags & OBJECT_FLAG_DEAD) continue;
 
-					if (cpml::circle_vs_circle(enemy.x, enemy.y, enemy.radius, player_bullet.x, player_bullet.y, player_bullet.radius)) {
+					if (player_bullet_touches(player_bullet_index, enemy_x0, enemy_y0, enemy.x, enemy.y, enemy.radius)) {
 						enemy.hp -= player_bullet.dmg;
-						player_bullet_it = player_bullets.erase(player_bullet_it);
+						player_bullet.flags |= OBJECT_FLAG_DEAD;
 						//PlaySound("se_enemy_hit.wav");
 						if (enemy.hp <= 0.0f) {
 							switch (enemy.drops) {
 								case 1: {
 									// power or point
 									PickupType type = (random.range(0.0f, 1.0f) > 0.5f) ? PICKUP_POWER : PICKUP_POINT;
-									DropPickup(enemy.x, enemy.y, type);
+									CreatePickup(enemy.x, enemy.y, type);
 									break;
 								}
 								case 2: {
 									// power or point at chance
 									if (random.range(0.0f, 1.0f) > 0.5f) {
 										PickupType type = (random.range(0.0f, 1.0f) > 0.5f) ? PICKUP_POWER : PICKUP_POINT;
-										DropPickup(enemy.x, enemy.y, type);
+										CreatePickup(enemy.x, enemy.y, type);
 									}
 									break;
 								}
 							}
 
+							enemy.flags |= OBJECT_FLAG_DEAD;
+
+							// the callback can create enemies, don't touch the reference after it
 							CallLuaFunction(L, enemy.death_callback, enemy.full_id);
 
 							//PlaySound("se_enemy_die.wav");
-							FreeEnemy(enemy);
-							enemies.erase(enemies.begin() + enemy_idx);
-							goto l_enemy_out;
+							break;
 						}
-						continue;
 					}
-
-					++player_bullet_it;
 				}
-
-				enemy_idx++;
-
-				l_enemy_out:;
 			}
 		}
 	}
 
-	Player& Stage::ResetPlayer(size_t player_index, bool from_death) {
-		auto& game = Game::GetInstance();
+	void Stage::GatherPlayerBlock() {
+		for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+			Player& player = players[player_index];
+			CharacterData* char_data = GetCharacterData(context.player_character[player_index]);
+
+			player_block.x[player_index] = player.x;
+			player_block.y[player_index] = player.y;
+			player_block.x0[player_index] = player_x0[player_index];
+			player_block.y0[player_index] = player_y0[player_index];
+			player_block.graze_radius[player_index] = char_data->graze_radius;
+			player_block.hit_radius[player_index] = player.radius;
+			player_block.normal[player_index] = (player.state == PlayerState::Normal);
+		}
+	}
 
-		Player& player = players[player_index];
-		CharacterData* char_data = GetCharacterData(game.player_character[player_index]);
+	// Tests every player first, then applies the results in player order, so
+	// a bullet that hit player 0 is already dead when player 1's turn comes.
+	void Stage::CollidePlayersWithBullets() {
+		const PlayerBlock& block = player_block;
 
-		player = {};
-		instance_id_id id = (instance_id_id) player_index;
-		player.full_id = MAKE_INSTANCE_ID(id, TYPE_PLAYER);
-		player.x = PLAYER_STARTING_X;
-		player.y = PLAYER_STARTING_Y;
-		player.radius = char_data->radius;
-		player.sprite = char_data->spr_idle;
+		if (collision_broadphase) {
+			for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+				if (!block.normal[player_index]) continue;
 
-		player.iframes = PLAYER_RESPAWN_IFRAMES;
-		if (from_death) {
-			player.state = PlayerState::Appearing;
-			player.timer = PLAYER_APPEAR_TIME;
-		}
+				PlayerContacts& contacts = player_contacts[player_index];
+				float x = block.x[player_index];
+				float y = block.y[player_index];
+				float graze_radius = block.graze_radius[player_index];
+				float hit_radius = block.hit_radius[player_index];
 
-		return player;
+				// +1 so that rounding in the narrowphase can never reach past the queried cells
+				float r = std::max(graze_radius, hit_radius) + 1.0f;
+
+				contacts.candidates.clear();
+				bullet_grid.Query(x - r, y - r, x + r, y + r, contacts.candidates);
+
+				// candidates are sorted, so bullets come first and in pool order, then lasers
+				size_t first = 0;
+				while (first < contacts.candidates.size() && !(contacts.candidates[first] & GRID_LAZER_BIT)) {
+					first++;
+				}
+				contacts.bullet_count = first;
+				contacts.lazer_count = contacts.candidates.size() - first;
+
+				// round bullets
+				for (std::vector<float>& array : narrow) {
+					array.clear();
+				}
+				for (size_t k = 0; k < first; k++) {
+					uint32_t item = contacts.candidates[k];
+					narrow[0].push_back(bullets.x[item]);
+					narrow[1].push_back(bullets.y[item]);
+					narrow[2].push_back(bullets.radius[item]);
+				}
+
+				contacts.bullet_graze_bits.resize((first + 31) / 32);
+				contacts.bullet_hit_bits.resize((first + 31) / 32);
+				CollideCirclesKernel(x, y, graze_radius, hit_radius,
+									 narrow[0].data(), narrow[1].data(), narrow[2].data(), first,
+									 contacts.bullet_graze_bits.data(), contacts.bullet_hit_bits.data());
+
+				// lasers and rects
+				for (std::vector<float>& array : narrow) {
+					array.clear();
+				}
+				for (size_t k = first; k < contacts.candidates.size(); k++) {
+					size_t i = contacts.candidates[k] & ~GRID_LAZER_BIT;
+					narrow[0].push_back(lazers.box_x[i]);
+					narrow[1].push_back(lazers.box_y[i]);
+					narrow[2].push_back(lazers.dir_x[i]);
+					narrow[3].push_back(lazers.dir_y[i]);
+					narrow[4].push_back(lazers.box_half_width[i]);
+					narrow[5].push_back(lazers.box_half_length[i]);
+				}
+
+				size_t count = contacts.lazer_count;
+				contacts.lazer_graze_bits.resize((count + 31) / 32);
+				contacts.lazer_hit_bits.resize((count + 31) / 32);
+				CollideBoxesKernel(x, y, graze_radius, hit_radius,
+								   narrow[0].data(), narrow[1].data(), narrow[2].data(), narrow[3].data(),
+								   narrow[4].data(), narrow[5].data(), count,
+								   contacts.lazer_graze_bits.data(), contacts.lazer_hit_bits.data());
+			}
+		} else {
+			for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+				PlayerContacts& contacts = player_contacts[player_index];
+				contacts.bullet_count = bullets.size();
+				contacts.lazer_count = lazers.size();
+				contacts.bullet_graze_bits.resize((bullets.size() + 31) / 32);
+				contacts.bullet_hit_bits.resize((bullets.size() + 31) / 32);
+				contacts.lazer_graze_bits.resize((lazers.size() + 31) / 32);
+				contacts.lazer_hit_bits.resize((lazers.size() + 31) / 32);
+			}
+
+			// One pass over the pools, in chunks that stay in cache while every player is tested.
+			// Chunks are a multiple of 32, so every chunk writes its own words of bits
+			// and they can run on any worker.
+			context.jobs->ParallelFor(bullets.size(), COLLIDE_CHUNK, [&](size_t first, size_t end, size_t) {
+				size_t count = end - first;
+
+				for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+					if (!block.normal[player_index]) continue;
+
+					PlayerContacts& contacts = player_contacts[player_index];
+					CollideCirclesKernel(block.x[player_index], block.y[player_index],
+										 block.graze_radius[player_index], block.hit_radius[player_index],
+										 bullets.x.data() + first, bullets.y.data() + first, bullets.radius.data() + first, count,
+										 contacts.bullet_graze_bits.data() + first / 32, contacts.bullet_hit_bits.data() + first / 32);
+				}
+			});
+
+			context.jobs->ParallelFor(lazers.size(), COLLIDE_CHUNK, [&](size_t first, size_t end, size_t) {
+				size_t count = end - first;
+
+				for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+					if (!block.normal[player_index]) continue;
+
+					PlayerContacts& contacts = player_contacts[player_index];
+					CollideBoxesKernel(block.x[player_index], block.y[player_index],
+									   block.graze_radius[player_index], block.hit_radius[player_index],
+									   lazers.box_x.data() + first, lazers.box_y.data() + first,
+									   lazers.dir_x.data() + first, lazers.dir_y.data() + first,
+									   lazers.box_half_width.data() + first, lazers.box_half_length.data() + first, count,
+									   contacts.lazer_graze_bits.data() + first / 32, contacts.lazer_hit_bits.data() + first / 32);
+				}
+			});
+		}
+
+		for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+			if (!block.normal[player_index]) continue;
+
+			Player& player = players[player_index];
+			PlayerContacts& contacts = player_contacts[player_index];
+			const uint32_t* indices = collision_broadphase ? contacts.candidates.data() : nullptr;
+
+			ContactCursor bullet_cursor{&bullets, indices, contacts.bullet_count,
+										contacts.bullet_graze_bits.data(), contacts.bullet_hit_bits.data()};
+			ContactCursor lazer_cursor{&lazers, indices ? indices + contacts.bullet_count : nullptr, contacts.lazer_count,
+									   contacts.lazer_graze_bits.data(), contacts.lazer_hit_bits.data()};
+			ResolvePlayerVsBullets(*this, player, player_index, bullet_cursor, lazer_cursor);
+		}
+	}
+
+	// Writes each player's time of hit into hit_t, NO_CONTACT if there was none.
+	void Stage::CollidePlayersWithBulletsSwept(float* hit_t) {
+		const PlayerBlock& block = player_block;
+
+		// times of impact of one player and one grid item, into swept.
+		// Only reads the pools, so workers can run it side by side.
+		auto test = [&](std::vector<SweptContact>& swept, size_t player_index, uint32_t item) {
+			bool is_lazer = (item & GRID_LAZER_BIT) != 0;
+			size_t i = item & ~GRID_LAZER_BIT;
+			BulletPool& pool = is_lazer ? lazers : bullets;
+			if (pool.flags[i] & (OBJECT_FLAG_DEAD | OBJECT_FLAG_CANCELED)) return;
+			float graze_radius = block.graze_radius[player_index];
+			float hit_radius = block.hit_radius[player_index];
+			float px0 = block.x0[player_index];
+			float py0 = block.y0[player_index];
+			float pdx = block.x[player_index] - px0;
+			float pdy = block.y[player_index] - py0;
+
+			bool grazed = (pool.grazed_by[i] & (1u << player_index)) != 0;
+			float move_x = pool.x[i] - pool.x0[i];
+			float move_y = pool.y[i] - pool.y0[i];
+			float t;
+
+			if (!is_lazer) {
+				// the bullet stands still, the player moves relative to it
+				float qx = px0 - pool.x0[i];
+				float qy = py0 - pool.y0[i];
+				float vx = pdx - move_x;
+				float vy = pdy - move_y;
+				float r = pool.radius[i];
+
+				if (!grazed && cpml::point_vs_circle_toi(qx, qy, vx, vy, graze_radius + r, &t)) {
+					swept.push_back({t, item, false});
+				}
+				if (cpml::point_vs_circle_toi(qx, qy, vx, vy, hit_radius + r, &t)) {
+					swept.push_back({t, item, true});
+				}
+			} else {
+				// the box translates with its origin, growth during the step is ignored
+				float ax = pool.dir_x[i];
+				float ay = pool.dir_y[i];
+				float qx = px0 - (pool.box_x[i] - move_x);
+				float qy = py0 - (pool.box_y[i] - move_y);
+				float vx = pdx - move_x;
+				float vy = pdy - move_y;
+
+				// into box space, x is across and y is along the axis
+				float local_x  = qx * ay - qy * ax;
+				float local_y  = qx * ax + qy * ay;
+				float local_vx = vx * ay - vy * ax;
+				float local_vy = vx * ax + vy * ay;
+				float half_width = pool.box_half_width[i];
+				float half_length = pool.box_half_length[i];
+
+				if (!grazed && cpml::point_vs_rect_toi(local_x, local_y, local_vx, local_vy, half_width, half_length, graze_radius, &t)) {
+					swept.push_back({t, item, false});
+				}
+				if (cpml::point_vs_rect_toi(local_x, local_y, local_vx, local_vy, half_width, half_length, hit_radius, &t)) {
+					swept.push_back({t, item, true});
+				}
+			}
+		};
+
+		for (size_t worker = 0; worker < MAX_WORKERS; worker++) {
+			for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+				worker_swept[worker][player_index].clear();
+			}
+		}
+
+		if (collision_broadphase) {
+			for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+				if (!block.normal[player_index]) continue;
+
+				PlayerContacts& contacts = player_contacts[player_index];
+				float px0 = block.x0[player_index];
+				float py0 = block.y0[player_index];
+				float px = block.x[player_index];
+				float py = block.y[player_index];
+
+				// the whole path of the player, the grid holds the whole paths of the bullets
+				float r = std::max(block.graze_radius[player_index], block.hit_radius[player_index]) + 1.0f;
+				contacts.candidates.clear();
+				bullet_grid.Query(std::min(px0, px) - r, std::min(py0, py) - r,
+								  std::max(px0, px) + r, std::max(py0, py) + r,
+								  contacts.candidates);
+
+				context.jobs->ParallelFor(contacts.candidates.size(), SWEPT_GRAIN, [&](size_t begin, size_t end, size_t worker) {
+					for (size_t k = begin; k < end; k++) {
+						test(worker_swept[worker][player_index], player_index, contacts.candidates[k]);
+					}
+				});
+			}
+		} else {
+			// one pass over the pools, every player per bullet
+			context.jobs->ParallelFor(bullets.size(), COLLIDE_CHUNK, [&](size_t begin, size_t end, size_t worker) {
+				for (size_t i = begin; i < end; i++) {
+					if (bullets.flags[i] & OBJECT_FLAG_ASLEEP) continue;
+
+					for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+						if (block.normal[player_index]) test(worker_swept[worker][player_index], player_index, (uint32_t) i);
+					}
+				}
+			});
+
+			context.jobs->ParallelFor(lazers.size(), COLLIDE_CHUNK, [&](size_t begin, size_t end, size_t worker) {
+				for (size_t i = begin; i < end; i++) {
+					for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+						if (block.normal[player_index]) test(worker_swept[worker][player_index], player_index, (uint32_t) i | GRID_LAZER_BIT);
+					}
+				}
+			});
+		}
+
+		// Which worker found a contact depends on the run, the sort below doesn't:
+		// no two contacts of one player share a key.
+		for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+			std::vector<SweptContact>& swept = player_contacts[player_index].swept;
+			swept.clear();
+			for (size_t worker = 0; worker < MAX_WORKERS; worker++) {
+				swept.insert(swept.end(), worker_swept[worker][player_index].begin(), worker_swept[worker][player_index].end());
+			}
+		}
+
+		for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+			hit_t[player_index] = NO_CONTACT;
+			if (!block.normal[player_index]) continue;
+
+			Player& player = players[player_index];
+			std::vector<SweptContact>& swept = player_contacts[player_index].swept;
+
+			// earliest first, ties in the order the bullets and lasers were
+			// created, grazes before hits
+			auto spawn_seq = [this](uint32_t item) {
+				const BulletPool& pool = (item & GRID_LAZER_BIT) ? lazers : bullets;
+				return pool.spawn_seq[item & ~GRID_LAZER_BIT];
+			};
+			std::sort(swept.begin(), swept.end(), [&spawn_seq](const SweptContact& a, const SweptContact& b) {
+				if (a.t != b.t) return a.t < b.t;
+				if (a.item != b.item) return SpawnedBefore(spawn_seq(a.item), spawn_seq(b.item));
+				return a.hit < b.hit;
+			});
+
+			for (const SweptContact& contact : swept) {
+				BulletPool& pool = (contact.item & GRID_LAZER_BIT) ? lazers : bullets;
+				size_t i = contact.item & ~GRID_LAZER_BIT;
+				if (pool.flags[i] & (OBJECT_FLAG_DEAD | OBJECT_FLAG_CANCELED)) continue;
+
+				if (!contact.hit) {
+					if (!(pool.grazed_by[i] & (1u << player_index))) {
+						GetGraze(player_index, 1);
+						//PlaySound("se_graze.wav");
+						pool.grazed_by[i] |= (1u << player_index);
+					}
+				} else if (player.iframes == 0.0f) {
+					PlayerGetHit(player);
+					pool.flags[i] |= OBJECT_FLAG_DEAD;
+					hit_t[player_index] = contact.t;
+					break;
+				}
+			}
+		}
+	}
+
+	// Bullets far from every player can't touch one for a while. The bound
+	// assumes the player moves at full speed straight at the bullet and the
+	// bullet keeps speeding up, so it never wakes a bullet too late.
+	// The brute force discrete path still tests everything, as the reference.
+	void Stage::ScheduleBulletTests(float delta) {
+		float player_x[MAX_PLAYERS];
+		float player_y[MAX_PLAYERS];
+		float player_reach[MAX_PLAYERS]; // graze radius
+		float player_spd[MAX_PLAYERS];
+		size_t player_count = 0;
+
+		for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+			Player& player = players[player_index];
+			CharacterData* char_data = GetCharacterData(context.player_character[player_index]);
+
+			player_x[player_count] = player.x;
+			player_y[player_count] = player.y;
+			player_reach[player_count] = std::max(char_data->graze_radius, player.radius);
+			player_spd[player_count] = std::max(char_data->move_spd, char_data->focus_spd);
+			player_count++;
+		}
+
+		bool skips = collision_broadphase || swept_collision;
+		uint32_t asleep = 0;
+
+		for (size_t i = 0, n = bullets.size(); i < n; i++) {
+			if (bullets.flags[i] & OBJECT_FLAG_DEAD) continue;
+
+			// this step ends before the bound
+			if (physics_time < bullets.wake_time[i]) {
+				bullets.flags[i] |= OBJECT_FLAG_ASLEEP;
+				asleep++;
+				continue;
+			}
+			bullets.flags[i] &= ~OBJECT_FLAG_ASLEEP;
+
+			float spd = bullets.spd[i];
+			float acc = std::max(bullets.acc[i], 0.0f);
+			float soonest = INFINITY;
+			for (size_t p = 0; p < player_count; p++) {
+				float gap = cpml::point_distance(bullets.x[i], bullets.y[i], player_x[p], player_y[p])
+					- player_reach[p] - bullets.radius[i];
+				soonest = std::min(soonest, cpml::accel_time(spd + player_spd[p], acc, gap, 0.0f));
+			}
+
+			// tested this step and every step until then. A step of slack for rounding
+			bullets.wake_time[i] = physics_time + soonest - delta;
+		}
+
+		if (skips) {
+			sleep_skipped += asleep * (uint32_t) player_count;
+		}
+	}
+
+	// Merges pickups of the same type and homing target that share a cell into
+	// the first of them. Collecting a merged pickup counts as collecting every
+	// pickup in it, so the stats come out the same as without merging.
+	void Stage::CoalescePickups() {
+		if (pickup_merge_threshold == 0 || pickups.size() <= pickup_merge_threshold) {
+			return;
+		}
+
+		// sorted (cell key, index) pairs instead of a hash map, so no node allocations
+		pickup_merge_keys.clear();
+		for (size_t i = 0, n = pickups.size(); i < n; i++) {
+			if (pickups.flags[i] & OBJECT_FLAG_DEAD) continue;
+
+			uint32_t cell_x = (uint32_t) (int32_t) floorf(pickups.x[i] / PICKUP_MERGE_CELL);
+			uint32_t cell_y = (uint32_t) (int32_t) floorf(pickups.y[i] / PICKUP_MERGE_CELL);
+			uint64_t key = ((uint64_t) (cell_x & 0xFFFF) << 48)
+				| ((uint64_t) (cell_y & 0xFFFF) << 32)
+				| ((uint64_t) pickups.type[i] << 8)
+				| (uint64_t) (uint8_t) pickups.homing[i];
+
+			pickup_merge_keys.push_back({key, (uint32_t) i});
+		}
+
+		std::sort(pickup_merge_keys.begin(), pickup_merge_keys.end());
+
+		// The first index of every key survives and takes the others' counts.
+		// It moves to their centre of mass, weighted by count, so a merged
+		// pile doesn't jump towards whichever pickup happened to come first.
+		for (size_t first = 0, n = pickup_merge_keys.size(); first < n;) {
+			uint32_t into = pickup_merge_keys[first].second;
+			float weight = (float) pickups.count[into];
+			float x = pickups.x[into] * weight;
+			float y = pickups.y[into] * weight;
+			float hsp = pickups.hsp[into] * weight;
+			float vsp = pickups.vsp[into] * weight;
+
+			size_t i = first + 1;
+			for (; i < n && pickup_merge_keys[i].first == pickup_merge_keys[first].first; i++) {
+				uint32_t from = pickup_merge_keys[i].second;
+				float w = (float) pickups.count[from];
+				x += pickups.x[from] * w;
+				y += pickups.y[from] * w;
+				hsp += pickups.hsp[from] * w;
+				vsp += pickups.vsp[from] * w;
+				weight += w;
+				pickups.count[into] += pickups.count[from];
+				pickups.flags[from] |= OBJECT_FLAG_DEAD;
+			}
+
+			if (i > first + 1) {
+				pickups.x[into] = x / weight;
+				pickups.y[into] = y / weight;
+				pickups.hsp[into] = hsp / weight;
+				pickups.vsp[into] = vsp / weight;
+			}
+			first = i;
+		}
+
+		pickups.RemoveDead();
+	}
+
+	void Stage::UpdatePickups(float delta) {
+		// player positions resolved once for the whole pool
+		float target_x[MAX_PLAYERS];
+		float target_y[MAX_PLAYERS];
+		for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+			target_x[player_index] = players[player_index].x;
+			target_y[player_index] = players[player_index].y;
+		}
+
+		UpdatePickupsKernel(pickups.x.data(), pickups.y.data(), pickups.hsp.data(), pickups.vsp.data(),
+							pickups.homing.data(), pickups.size(),
+							target_x, target_y, context.player_count,
+							PICKUP_HOMING_SPD, PICKUP_GRAVITY, PICKUP_MAX_FALL, delta);
+
+		// pickups flying at a player that just died bounce off instead
+		for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+			if (players[player_index].state != PlayerState::Dying) continue;
+
+			for (size_t i = 0, n = pickups.size(); i < n; i++) {
+				if (pickups.homing[i] == (int32_t) player_index) {
+					pickups.hsp[i] = 0.0f;
+					pickups.vsp[i] = -1.5f;
+					pickups.homing[i] = PICKUP_NO_TARGET;
+				}
+			}
+		}
+	}
+
+	void Stage::ApplyPickupGains() {
+		// every Get* adds one at a time with caps and thresholds, so sums give the same stats
+		for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+			PickupGains& gains = pickup_gains[player_index];
+			if (gains.power)  GetPower(player_index, gains.power);
+			if (gains.score)  GetScore(player_index, gains.score);
+			if (gains.points) GetPoints(player_index, gains.points);
+			if (gains.bombs)  GetBombs(player_index, gains.bombs);
+			if (gains.lives)  GetLives(player_index, gains.lives);
+			gains = {};
+		}
+	}
+
+	// Turns every bullet and laser into a score pickup. With a cancel wave the
+	// bullets are only flagged here and their scripts dropped, UpdateCancelWave
+	// converts them as the wave spreads out from (x, y).
+	void Stage::CancelAllBullets(float x, float y) {
+		// bullets spawned this frame get canceled too. Bosses are being iterated, so only these
+		FlushBulletSpawns();
+
+		size_t total = bullets.size() + lazers.size();
+
+		if (cancel_wave_frames <= 0) {
+			for (BulletPool* pool : {&bullets, &lazers}) {
+				for (size_t i = 0, n = pool->size(); i < n; i++) {
+					FreeBullet(*pool, i);
+				}
+				size_t admitted = AdmitBulk(POOL_PICKUPS, pool->size());
+				pool_stats[POOL_PICKUPS].overflows += pickups.AddBulk(pool->x.data(), pool->y.data(), admitted, PICKUP_SCORE);
+				pool->Clear();
+			}
+
+			// a wave still running from an earlier phase went with the pools
+			ReleaseCanceledRefs(cancel_refs.size());
+			cancel_wave = {};
+			return;
+		}
+
+		cancel_refs.reserve(cancel_refs.size() + 2 * total);
+		for (BulletPool* pool : {&bullets, &lazers}) {
+			for (size_t i = 0, n = pool->size(); i < n; i++) {
+				// frozen where they are, the move and cull kernels skip them
+				StopAnalyticMotion(*pool, i);
+				pool->flags[i] |= OBJECT_FLAG_CANCELED;
+
+				for (int* ref : {&pool->coroutine[i], &pool->update_callback[i]}) {
+					if (*ref != LUA_REFNIL) {
+						cancel_refs.push_back(*ref);
+						*ref = LUA_REFNIL;
+					}
+				}
+			}
+		}
+
+		float far_x = std::max(x + CULL_MARGIN, (float)PLAY_AREA_W + CULL_MARGIN - x);
+		float far_y = std::max(y + CULL_MARGIN, (float)PLAY_AREA_H + CULL_MARGIN - y);
+		float end_radius = cpml::point_distance(0.0f, 0.0f, far_x, far_y);
+
+		cancel_wave.active = true;
+		cancel_wave.x = x;
+		cancel_wave.y = y;
+		cancel_wave.radius = 0.0f;
+		cancel_wave.spd = end_radius / (float) cancel_wave_frames;
+		cancel_wave.end_radius = end_radius;
+	}
+
+	void Stage::UpdateCancelWave(float delta) {
+		ReleaseCanceledRefs(UNREF_BUDGET);
+
+		if (!cancel_wave.active) {
+			return;
+		}
+
+		cancel_wave.radius += cancel_wave.spd * delta;
+
+		// once it covers the whole cull area, only the budget holds it back
+		float r2 = (cancel_wave.radius < cancel_wave.end_radius) ? cpml::sqr(cancel_wave.radius) : INFINITY;
+		size_t budget = CANCEL_BUDGET;
+		bool done = true;
+
+		for (BulletPool* pool : {&bullets, &lazers}) {
+			cancel_x.clear();
+			cancel_y.clear();
+
+			for (size_t i = 0, n = pool->size(); i < n; i++) {
+				if ((pool->flags[i] & (OBJECT_FLAG_CANCELED | OBJECT_FLAG_DEAD)) != OBJECT_FLAG_CANCELED) continue;
+
+				float dist_sqr = cpml::sqr(pool->x[i] - cancel_wave.x) + cpml::sqr(pool->y[i] - cancel_wave.y);
+				if (dist_sqr >= r2 || budget == 0) {
+					done = false;
+					continue;
+				}
+
+				cancel_x.push_back(pool->x[i]);
+				cancel_y.push_back(pool->y[i]);
+				pool->flags[i] |= OBJECT_FLAG_DEAD;
+				budget--;
+			}
+
+			// phase end pickups all fly to the player
+			size_t admitted = AdmitBulk(POOL_PICKUPS, cancel_x.size());
+			size_t first = pickups.size();
+			pool_stats[POOL_PICKUPS].overflows += pickups.AddBulk(cancel_x.data(), cancel_y.data(), admitted, PICKUP_SCORE);
+			std::fill(pickups.homing.begin() + first, pickups.homing.end(), 0);
+		}
+
+		if (done && r2 == INFINITY) {
+			cancel_wave.active = false;
+		}
+	}
+
+	void Stage::ReleaseCanceledRefs(size_t budget) {
+		size_t n = std::min(budget, cancel_refs.size());
+		for (size_t i = cancel_refs.size() - n; i < cancel_refs.size(); i++) {
+			luaL_unref(L, LUA_REGISTRYINDEX, cancel_refs[i]);
+		}
+		cancel_refs.resize(cancel_refs.size() - n);
+	}
+
+	void Stage::BuildBulletGrid() {
+		bullet_grid.Clear();
+
+		for (size_t i = 0, n = bullets.size(); i < n; i++) {
+			if (bullets.flags[i] & (OBJECT_FLAG_DEAD | OBJECT_FLAG_ASLEEP | OBJECT_FLAG_CANCELED)) continue;
+
+			float x = bullets.x[i];
+			float y = bullets.y[i];
+			float r = bullets.radius[i];
+			if (swept_collision) {
+				// the whole path through the step
+				float x0 = bullets.x0[i];
+				float y0 = bullets.y0[i];
+				bullet_grid.InsertBox((uint32_t) i,
+									  std::min(x0, x) - r, std::min(y0, y) - r,
+									  std::max(x0, x) + r, std::max(y0, y) + r);
+			} else {
+				bullet_grid.InsertBox((uint32_t) i, x - r, y - r, x + r, y + r);
+			}
+		}
+
+		for (size_t i = 0, n = lazers.size(); i < n; i++) {
+			if (lazers.flags[i] & (OBJECT_FLAG_DEAD | OBJECT_FLAG_CANCELED)) continue;
+
+			// the box from UpdateBoxes, 1px bigger on every side
+			float dir_x = lazers.dir_x[i];
+			float dir_y = lazers.dir_y[i];
+			float center_x = lazers.box_x[i];
+			float center_y = lazers.box_y[i];
+
+			// when swept, also grow it by the distance moved in any direction
+			float pad = 1.0f;
+			if (swept_collision) {
+				pad += std::abs(lazers.x[i] - lazers.x0[i]) + std::abs(lazers.y[i] - lazers.y0[i]);
+			}
+
+			// side is dir rotated by 90 degrees
+			float along_x = (lazers.box_half_length[i] + pad) * dir_x;
+			float along_y = (lazers.box_half_length[i] + pad) * dir_y;
+			float side_x  = (lazers.box_half_width[i] + pad) * dir_y;
+			float side_y  = (lazers.box_half_width[i] + pad) * -dir_x;
+
+			float xs[4] = {
+				center_x + along_x + side_x,
+				center_x + along_x - side_x,
+				center_x - along_x - side_x,
+				center_x - along_x + side_x
+			};
+			float ys[4] = {
+				center_y + along_y + side_y,
+				center_y + along_y - side_y,
+				center_y - along_y - side_y,
+				center_y - along_y + side_y
+			};
+
+			bullet_grid.InsertPolygon((uint32_t) i | GRID_LAZER_BIT, xs, ys, 4);
+		}
+
+		bullet_grid.Build();
+	}
+
+	Player& Stage::ResetPlayer(size_t player_index, bool from_death) {
+		Player& player = players[player_index];
+		CharacterData* char_data = GetCharacterData(context.player_character[player_index]);
+
+		player = {};
+		// players never go away, their slot is the player index
+		player.full_id = MAKE_INSTANCE_ID(player_index, 0, TYPE_PLAYER);
+		player.x = PLAYER_STARTING_X;
+		player.y = PLAYER_STARTING_Y;
+		player.radius = char_data->radius;
+
+		// the sleep bounds assumed the player could only get here by moving
+		WakeAllBullets();
+		player.sprite = char_data->spr_idle;
+
+		player.iframes = PLAYER_RESPAWN_IFRAMES;
+		if (from_death) {
+			player.state = PlayerState::Appearing;
+			player.timer = PLAYER_APPEAR_TIME;
+		}
+
+		return player;
 	}
 
 	Boss& Stage::CreateBoss(int boss_index) {
 		BossData* boss_data = GetBossData(boss_index);
 
-		Boss& result = bosses.emplace_back();
+		if (!AdmitSpawn(POOL_BOSSES)) {
+			LOG("Refused boss %s, over budget", boss_data->name);
+			Boss& spare = boss_spawns.EmplaceSpare();
+			spare.full_id = NULL_INSTANCE_ID;
+			spare.sprite = boss_data->spr_idle;
+			return spare;
+		}
+
+		Boss& result = boss_spawns.emplace_back();
 
-		result.full_id = GenFullInstanceID(TYPE_BOSS);
+		result.full_id = boss_slots.Alloc((uint32_t) (boss_spawns.size() - 1) | SPAWN_INDEX_BIT);
 		result.boss_index = boss_index;
 		result.x = BOSS_STARTING_X;
 		result.y = BOSS_STARTING_Y;
@@ -1014,25 +2038,403 @@ namespace th {
 	}
 
 	Enemy& Stage::CreateEnemy() {
-		Enemy& result = enemies.emplace_back();
-		result.full_id = GenFullInstanceID(TYPE_ENEMY);
+		bool refuse = !AdmitSpawn(POOL_ENEMIES);
+		if (refuse) {
+			FreeEnemy(enemy_spawns.Spare());
+		}
+
+		Enemy& result = refuse ? enemy_spawns.EmplaceSpare() : enemy_spawns.emplace_back();
+		result.full_id = refuse ? NULL_INSTANCE_ID : enemy_slots.Alloc((uint32_t) (enemy_spawns.size() - 1) | SPAWN_INDEX_BIT);
 		return result;
 	}
 
-	Bullet& Stage::CreateBullet() {
-		Bullet& result = bullets.emplace_back();
-		result.full_id = GenFullInstanceID(TYPE_BULLET);
-		return result;
+	size_t Stage::CreateBullet() {
+		bool refuse = !AdmitSpawn(POOL_BULLETS);
+		if (refuse) {
+			FreeBullet(bullet_spawns, bullet_spawns.capacity());
+		}
+		return bullet_spawns.Add(next_spawn_seq++, refuse);
+	}
+
+	size_t Stage::CreateLazer() {
+		bool refuse = !AdmitSpawn(POOL_LAZERS);
+		if (refuse) {
+			FreeBullet(lazer_spawns, lazer_spawns.capacity());
+		}
+		return lazer_spawns.Add(next_spawn_seq++, refuse);
 	}
 
 	PlayerBullet& Stage::CreatePlayerBullet() {
-		PlayerBullet& result = player_bullets.emplace_back();
+		bool refuse = !AdmitSpawn(POOL_PLAYER_BULLETS);
+		PlayerBullet& result = refuse ? player_bullet_spawns.EmplaceSpare() : player_bullet_spawns.emplace_back();
 		return result;
 	}
 
-	Pickup& Stage::CreatePickup() {
-		Pickup& result = pickups.emplace_back();
-		return result;
+	size_t Stage::CreatePickup(float x, float y, PickupType type) {
+		bool refuse = !AdmitSpawn(POOL_PICKUPS);
+		return pickup_spawns.Add(x, y, type, refuse);
+	}
+
+	bool Stage::AdmitSpawn(PoolIndex pool) {
+		// recycling frees ids only at the cleanup, too late for this one
+		if (IsSpawnBufferFull(pool) || IsOutOfIds(pool)) {
+			pool_stats[pool].overflows++;
+			policy_fired[OVERFLOW_REFUSE]++;
+			return false;
+		}
+
+		// whatever else died this frame still counts until the cleanup
+		size_t count = GetPoolSize(pool) + GetSpawnCount(pool) - recycled_pending[pool];
+		if (count < GetPoolLimit(pool) || RecycleForBudget(pool)) {
+			return true;
+		}
+
+		policy_fired[OVERFLOW_REFUSE]++;
+		return false;
+	}
+
+	// AdmitSpawn for n at once, for what goes straight into the pool and not
+	// through its spawn buffer. Returns how many of them may go in.
+	size_t Stage::AdmitBulk(PoolIndex pool, size_t n) {
+		size_t count = GetPoolSize(pool) + GetSpawnCount(pool) - recycled_pending[pool];
+		size_t limit = GetPoolLimit(pool);
+		size_t admitted = (count < limit) ? std::min(n, limit - count) : 0;
+
+		while (admitted < n && RecycleForBudget(pool)) {
+			admitted++;
+		}
+
+		policy_fired[OVERFLOW_REFUSE] += (uint32_t) (n - admitted);
+
+		// the recycled ones still take up room until they are compacted away
+		if (GetPoolSize(pool) + admitted > pool_stats[pool].capacity) {
+			CompactPool(pool);
+		}
+		return admitted;
+	}
+
+	size_t Stage::GetPoolLimit(PoolIndex pool) const {
+		const PoolBudget& budget = context.options->pool_budgets[pool];
+		size_t limit = pool_stats[pool].capacity;
+		if (budget.max != 0) {
+			limit = std::min(limit, budget.max);
+		}
+		return limit;
+	}
+
+	// Kills one by the pool's overflow policy to make room for another.
+	// False under OVERFLOW_REFUSE or when there is nothing left to kill.
+	bool Stage::RecycleForBudget(PoolIndex pool) {
+		OverflowPolicy policy = context.options->pool_budgets[pool].policy;
+
+		bool recycled = false;
+		switch (policy) {
+			case OVERFLOW_RECYCLE_OLDEST:   recycled = RecycleOldest(pool);   break;
+			case OVERFLOW_RECYCLE_FARTHEST: recycled = RecycleFarthest(pool); break;
+			default:                                                          break; // refuse
+		}
+
+		if (!recycled) {
+			return false;
+		}
+
+		policy_fired[policy]++;
+		recycled_pending[pool]++;
+		return true;
+	}
+
+	// the pools keep creation order, so the first one alive is the oldest
+	bool Stage::RecycleOldest(PoolIndex pool) {
+		size_t n = GetPoolSize(pool);
+		for (size_t i = recycle_cursor[pool]; i < n; i++) {
+			uint32_t& flags = GetPoolFlags(pool, i);
+			if (flags & OBJECT_FLAG_DEAD) continue;
+
+			flags |= OBJECT_FLAG_DEAD;
+			recycle_cursor[pool] = i + 1;
+			return true;
+		}
+
+		recycle_cursor[pool] = n;
+		return false;
+	}
+
+	// Sorted at most once per frame, things don't move far enough in between to matter.
+	bool Stage::RecycleFarthest(PoolIndex pool) {
+		std::vector<std::pair<float, uint32_t>>& order = recycle_order[pool];
+
+		if (!recycle_order_valid[pool]) {
+			order.clear();
+			for (size_t i = 0, n = GetPoolSize(pool); i < n; i++) {
+				if (GetPoolFlags(pool, i) & OBJECT_FLAG_DEAD) continue;
+
+				float x, y;
+				GetPoolPosition(pool, i, &x, &y);
+
+				float closest = INFINITY;
+				for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+					Player& player = players[player_index];
+					closest = std::min(closest, cpml::sqr(x - player.x) + cpml::sqr(y - player.y));
+				}
+				order.push_back({closest, (uint32_t) i});
+			}
+
+			// farthest first, ties by index to keep replays the same
+			std::sort(order.begin(), order.end(), [](const auto& a, const auto& b) {
+				if (a.first != b.first) return a.first > b.first;
+				return a.second < b.second;
+			});
+			recycle_order_cursor[pool] = 0;
+			recycle_order_valid[pool] = true;
+		}
+
+		while (recycle_order_cursor[pool] < order.size()) {
+			uint32_t& flags = GetPoolFlags(pool, order[recycle_order_cursor[pool]++].second);
+			if (flags & OBJECT_FLAG_DEAD) continue;
+
+			flags |= OBJECT_FLAG_DEAD;
+			return true;
+		}
+
+		return false;
+	}
+
+	size_t Stage::GetPoolSize(PoolIndex pool) const {
+		switch (pool) {
+			case POOL_BOSSES:         return bosses.size();
+			case POOL_ENEMIES:        return enemies.size();
+			case POOL_BULLETS:        return bullets.size();
+			case POOL_LAZERS:         return lazers.size();
+			case POOL_PLAYER_BULLETS: return player_bullets.size();
+			case POOL_PICKUPS:        return pickups.size();
+			default:                  return 0;
+		}
+	}
+
+	size_t Stage::GetSpawnCount(PoolIndex pool) const {
+		switch (pool) {
+			case POOL_BOSSES:         return boss_spawns.size();
+			case POOL_ENEMIES:        return enemy_spawns.size();
+			case POOL_BULLETS:        return bullet_spawns.size();
+			case POOL_LAZERS:         return lazer_spawns.size();
+			case POOL_PLAYER_BULLETS: return player_bullet_spawns.size();
+			case POOL_PICKUPS:        return pickup_spawns.size();
+			default:                  return 0;
+		}
+	}
+
+	bool Stage::IsSpawnBufferFull(PoolIndex pool) const {
+		switch (pool) {
+			case POOL_BOSSES:         return boss_spawns.Full();
+			case POOL_ENEMIES:        return enemy_spawns.Full();
+			case POOL_BULLETS:        return bullet_spawns.Full();
+			case POOL_LAZERS:         return lazer_spawns.Full();
+			case POOL_PLAYER_BULLETS: return player_bullet_spawns.Full();
+			case POOL_PICKUPS:        return pickup_spawns.Full();
+			default:                  return true;
+		}
+	}
+
+	bool Stage::IsOutOfIds(PoolIndex pool) const {
+		switch (pool) {
+			case POOL_BOSSES:  return boss_slots.Full();
+			case POOL_ENEMIES: return enemy_slots.Full();
+			case POOL_BULLETS: return bullets.OutOfIds();
+			case POOL_LAZERS:  return lazers.OutOfIds();
+			default:           return false; // player bullets and pickups have no ids
+		}
+	}
+
+	uint32_t& Stage::GetPoolFlags(PoolIndex pool, size_t index) {
+		switch (pool) {
+			case POOL_BOSSES:         return bosses[index].flags;
+			case POOL_ENEMIES:        return enemies[index].flags;
+			case POOL_BULLETS:        return bullets.flags[index];
+			case POOL_LAZERS:         return lazers.flags[index];
+			case POOL_PLAYER_BULLETS: return player_bullets[index].flags;
+			case POOL_PICKUPS:        return pickups.flags[index];
+			default:                  return pickups.flags.Spare();
+		}
+	}
+
+	void Stage::GetPoolPosition(PoolIndex pool, size_t index, float* x, float* y) const {
+		switch (pool) {
+			case POOL_BOSSES:         *x = bosses[index].x;         *y = bosses[index].y;         break;
+			case POOL_ENEMIES:        *x = enemies[index].x;        *y = enemies[index].y;        break;
+			case POOL_BULLETS:        *x = bullets.x[index];        *y = bullets.y[index];        break;
+			case POOL_LAZERS:         *x = lazers.x[index];         *y = lazers.y[index];         break;
+			case POOL_PLAYER_BULLETS: *x = player_bullets[index].x; *y = player_bullets[index].y; break;
+			case POOL_PICKUPS:        *x = pickups.x[index];        *y = pickups.y[index];        break;
+			default:                  *x = 0.0f;                    *y = 0.0f;                    break;
+		}
+	}
+
+	// Removes everything flagged dead, releasing its Lua refs and ids
+	void Stage::CompactPool(PoolIndex pool) {
+		switch (pool) {
+			case POOL_BOSSES: {
+				RemoveDead(bosses, boss_slots, [this](Boss& boss) { FreeBoss(boss); });
+				break;
+			}
+			case POOL_ENEMIES: {
+				RemoveDead(enemies, enemy_slots, [this](Enemy& enemy) { FreeEnemy(enemy); });
+				break;
+			}
+			case POOL_BULLETS:
+			case POOL_LAZERS: {
+				BulletPool& bullet_pool = (pool == POOL_BULLETS) ? bullets : lazers;
+				for (size_t i = 0, n = bullet_pool.size(); i < n; i++) {
+					if (bullet_pool.flags[i] & OBJECT_FLAG_DEAD) {
+						FreeBullet(bullet_pool, i);
+					}
+				}
+				bullet_pool.RemoveDead();
+				break;
+			}
+			case POOL_PLAYER_BULLETS: {
+				RemoveDead(player_bullets);
+				break;
+			}
+			case POOL_PICKUPS: {
+				pickups.RemoveDead();
+				break;
+			}
+			default: {
+				break;
+			}
+		}
+
+		recycle_cursor[pool] = 0;
+		recycled_pending[pool] = 0;
+		recycle_order_valid[pool] = false;
+	}
+
+	void Stage::HomeAllPickups(int32_t player_index) {
+		std::fill(pickups.homing.begin(), pickups.homing.end(), player_index);
+		std::fill(pickup_spawns.homing.begin(), pickup_spawns.homing.end(), player_index);
+	}
+
+	void Stage::FlushSpawns() {
+		// compact first when the spawns wouldn't fit, recycled entities are still in there
+		for (PoolIndex pool : {POOL_BOSSES, POOL_ENEMIES, POOL_PLAYER_BULLETS, POOL_PICKUPS}) {
+			if (GetPoolSize(pool) + GetSpawnCount(pool) > pool_stats[pool].capacity) {
+				CompactPool(pool);
+			}
+		}
+
+		pool_stats[POOL_BOSSES].overflows += AppendSpawns(bosses, boss_spawns, boss_slots,
+														  [this](Boss& boss) { FreeBoss(boss); });
+		pool_stats[POOL_ENEMIES].overflows += AppendSpawns(enemies, enemy_spawns, enemy_slots,
+														   [this](Enemy& enemy) { FreeEnemy(enemy); });
+		FlushBulletSpawns();
+		pool_stats[POOL_PLAYER_BULLETS].overflows += AppendSpawns(player_bullets, player_bullet_spawns);
+		pool_stats[POOL_PICKUPS].overflows += pickups.Append(pickup_spawns);
+
+		UpdatePoolStats();
+	}
+
+	void Stage::FlushBulletSpawns() {
+		for (BulletPool* pool : {&bullets, &lazers}) {
+			BulletPool& spawns = (pool == &bullets) ? bullet_spawns : lazer_spawns;
+			PoolIndex pool_index = (pool == &bullets) ? POOL_BULLETS : POOL_LAZERS;
+
+			if (pool->size() + spawns.size() > pool->capacity()) {
+				CompactPool(pool_index);
+			}
+
+			// the ones that won't fit
+			for (size_t i = pool->capacity() - pool->size(); i < spawns.size(); i++) {
+				FreeBullet(spawns, i);
+			}
+			pool_stats[pool_index].overflows += pool->Append(spawns);
+		}
+	}
+
+	void Stage::UpdatePoolStats() {
+		size_t sizes[POOL_COUNT] = {
+			bosses.size(), enemies.size(), bullets.size(), lazers.size(), player_bullets.size(), pickups.size()
+		};
+		for (int i = 0; i < POOL_COUNT; i++) {
+			pool_stats[i].high_water = std::max(pool_stats[i].high_water, sizes[i]);
+		}
+	}
+
+	// Splits the arena between the pools by a fixed share each. Every spawn
+	// buffer holds a quarter of its pool.
+	void Stage::InitPools() {
+		const char* names[POOL_COUNT] = {"bosses", "enemies", "bullets", "lasers", "player bullets", "pickups"};
+		const float shares[POOL_COUNT] = {0.005f, 0.045f, 0.5f, 0.15f, 0.05f, 0.25f};
+		// objects also have their start positions for swept collision
+		size_t item_bytes[POOL_COUNT] = {
+			sizeof(Boss) + 2 * sizeof(float), sizeof(Enemy) + 2 * sizeof(float), bullets.BytesPerItem(), lazers.BytesPerItem(),
+			sizeof(PlayerBullet) + 2 * sizeof(float), pickups.BytesPerItem()
+		};
+
+		arena.Init(context.options->stage_arena_size);
+		size_t usable = arena.GetSize() - std::min(arena.GetSize(), (size_t) ARENA_SLACK);
+
+		size_t capacity[POOL_COUNT];
+		for (int i = 0; i < POOL_COUNT; i++) {
+			capacity[i] = std::max((size_t) ((double) usable * shares[i] / (1.25 * (double) item_bytes[i])), (size_t) 4);
+			pool_stats[i] = {names[i], capacity[i], 0, 0};
+			recycle_order[i].reserve(capacity[i]);
+		}
+
+		bosses.Init(arena, capacity[POOL_BOSSES]);
+		enemies.Init(arena, capacity[POOL_ENEMIES]);
+		bullets.Init(arena, capacity[POOL_BULLETS]);
+		lazers.Init(arena, capacity[POOL_LAZERS]);
+		player_bullets.Init(arena, capacity[POOL_PLAYER_BULLETS]);
+		pickups.Init(arena, capacity[POOL_PICKUPS]);
+
+		boss_spawns.Init(arena, capacity[POOL_BOSSES] / 4);
+		enemy_spawns.Init(arena, capacity[POOL_ENEMIES] / 4);
+		bullet_spawns.Init(arena, capacity[POOL_BULLETS] / 4);
+		lazer_spawns.Init(arena, capacity[POOL_LAZERS] / 4);
+		player_bullet_spawns.Init(arena, capacity[POOL_PLAYER_BULLETS] / 4);
+		pickup_spawns.Init(arena, capacity[POOL_PICKUPS] / 4);
+		pickup_merge_keys.reserve(capacity[POOL_PICKUPS]);
+
+		// ids for a full pool and a full spawn buffer
+		boss_slots.Reserve(capacity[POOL_BOSSES] + capacity[POOL_BOSSES] / 4);
+		enemy_slots.Reserve(capacity[POOL_ENEMIES] + capacity[POOL_ENEMIES] / 4);
+		bullet_slots.Reserve(capacity[POOL_BULLETS] + capacity[POOL_BULLETS] / 4);
+		lazer_slots.Reserve(capacity[POOL_LAZERS] + capacity[POOL_LAZERS] / 4);
+
+		// The scratch that grows with the pools, at full size so no frame
+		// allocates. Contact lists only ever hold a handful, they get a guess.
+		size_t projectiles = capacity[POOL_BULLETS] + capacity[POOL_LAZERS];
+		size_t bit_words = (std::max(capacity[POOL_BULLETS], capacity[POOL_LAZERS]) + 31) / 32;
+		for (std::vector<float>& array : narrow) {
+			array.reserve(std::max(capacity[POOL_BULLETS], capacity[POOL_LAZERS]));
+		}
+		for (size_t player_index = 0; player_index < context.player_count; player_index++) {
+			PlayerContacts& contacts = player_contacts[player_index];
+			contacts.candidates.reserve(projectiles);
+			for (std::vector<uint32_t>* bits : {&contacts.bullet_graze_bits, &contacts.bullet_hit_bits,
+												&contacts.lazer_graze_bits, &contacts.lazer_hit_bits}) {
+				bits->reserve(bit_words);
+			}
+			contacts.swept.reserve(CONTACT_RESERVE);
+			contacts.pickups.reserve(CONTACT_RESERVE);
+			for (size_t worker = 0; worker < context.jobs->GetWorkerCount(); worker++) {
+				worker_swept[worker][player_index].reserve(CONTACT_RESERVE);
+			}
+		}
+		homing_query[0].reserve(capacity[POOL_PLAYER_BULLETS]);
+		homing_query[1].reserve(capacity[POOL_PLAYER_BULLETS]);
+		homing_result.reserve(capacity[POOL_PLAYER_BULLETS]);
+
+		boss_x0.Init(arena, capacity[POOL_BOSSES]);
+		boss_y0.Init(arena, capacity[POOL_BOSSES]);
+		enemy_x0.Init(arena, capacity[POOL_ENEMIES]);
+		enemy_y0.Init(arena, capacity[POOL_ENEMIES]);
+		player_bullet_x0.Init(arena, capacity[POOL_PLAYER_BULLETS]);
+		player_bullet_y0.Init(arena, capacity[POOL_PLAYER_BULLETS]);
+
+		LOG("Stage arena: %zuKb of %zuKb, %zu bullets, %zu lasers, %zu pickups.",
+			arena.GetUsed() / 1024, arena.GetSize() / 1024,
+			capacity[POOL_BULLETS], capacity[POOL_LAZERS], capacity[POOL_PICKUPS]);
 	}
 
 	void Stage::FreeBoss(Boss& boss) {
@@ -1045,9 +2447,73 @@ namespace th {
 		LuaUnref(&enemy.death_callback, L);
 	}
 
-	void Stage::FreeBullet(Bullet& bullet) {
-		LuaUnref(&bullet.coroutine, L);
-		LuaUnref(&bullet.update_callback, L);
+	void Stage::FreeBullet(BulletPool& pool, size_t index) {
+		LuaUnref(&pool.coroutine[index], L);
+		LuaUnref(&pool.update_callback[index], L);
+	}
+
+	void Stage::SetDir(Object& object, float dir) {
+		object.dir = dir;
+		object.dir_x = cpml::dcos(dir);
+		object.dir_y = -cpml::dsin(dir);
+		trig_evals += 2;
+	}
+
+	void Stage::SetDir(PlayerBullet& player_bullet, float dir) {
+		player_bullet.dir = dir;
+		player_bullet.dir_x = cpml::dcos(dir);
+		player_bullet.dir_y = -cpml::dsin(dir);
+		trig_evals += 2;
+	}
+
+	void Stage::SetDir(BulletPool& pool, size_t index, float dir) {
+		pool.dir[index] = dir;
+		pool.dir_x[index] = cpml::dcos(dir);
+		pool.dir_y[index] = -cpml::dsin(dir);
+		trig_evals += 2;
+	}
+
+	void Stage::StartAnalyticMotion(BulletPool& pool, size_t index) {
+		// lasers hold still while they stretch, and scripts can change anything every frame
+		if (pool.type[index] == ProjectileType::Lazer) return;
+		if (pool.coroutine[index] != LUA_REFNIL || pool.update_callback[index] != LUA_REFNIL) return;
+
+		// the integrated movement takes one step backwards before clamping
+		if (!(pool.spd[index] >= 0.0f)) return;
+
+		float x = pool.x[index];
+		float y = pool.y[index];
+		float dir_x = pool.dir_x[index];
+		float dir_y = pool.dir_y[index];
+
+		// distance along the direction to the edge of the cull area
+		float dist = INFINITY;
+		if (dir_x > 0.0f) dist = std::min(dist, ((float)PLAY_AREA_W + CULL_MARGIN - x) / dir_x);
+		if (dir_x < 0.0f) dist = std::min(dist, (-CULL_MARGIN - x) / dir_x);
+		if (dir_y > 0.0f) dist = std::min(dist, ((float)PLAY_AREA_H + CULL_MARGIN - y) / dir_y);
+		if (dir_y < 0.0f) dist = std::min(dist, (-CULL_MARGIN - y) / dir_y);
+
+		pool.start_x[index] = x;
+		pool.start_y[index] = y;
+		pool.start_spd[index] = pool.spd[index];
+		pool.motion_time[index] = 0.0f;
+		float step = 1.0f / (float) std::max(physics_substeps, 1);
+		pool.exit_time[index] = cpml::accel_time(pool.spd[index], pool.acc[index], dist, step);
+		pool.flags[index] |= OBJECT_FLAG_ANALYTIC;
+	}
+
+	void Stage::StopAnalyticMotion(BulletPool& pool, size_t index) {
+		// x, y and spd are written out every step, so integration just picks up from there
+		pool.flags[index] &= ~OBJECT_FLAG_ANALYTIC;
+	}
+
+	void Stage::BulletMotionChanged(BulletPool& pool, size_t index) {
+		StopAnalyticMotion(pool, index);
+		pool.wake_time[index] = 0.0f;
+	}
+
+	void Stage::WakeAllBullets() {
+		std::fill(bullets.wake_time.begin(), bullets.wake_time.end(), 0.0f);
 	}
 
 	Object* Stage::FindObject(full_instance_id full_id) {
@@ -1055,30 +2521,42 @@ namespace th {
 		Object* result = nullptr;
 		switch (type) {
 			case TYPE_PLAYER: {
-				instance_id_id id = INSTANCE_ID_GET_ID(full_id);
-				size_t player_index = (size_t) id;
-				auto& game = Game::GetInstance();
-				if (player_index < game.player_count) {
+				size_t player_index = (size_t) INSTANCE_ID_GET_INDEX(full_id);
+				if (player_index < context.player_count && players[player_index].full_id == full_id) {
 					result = &players[player_index];
 				}
 				break;
 			}
 			case TYPE_BOSS: {
-				result = BinarySearch(bosses, full_id);
+				result = LookupObject(bosses, boss_spawns, boss_slots, full_id);
 				break;
 			}
 			case TYPE_ENEMY: {
-				result = BinarySearch(enemies, full_id);
-				break;
-			}
-			case TYPE_BULLET: {
-				result = BinarySearch(bullets, full_id);
+				result = LookupObject(enemies, enemy_spawns, enemy_slots, full_id);
 				break;
 			}
+			default: break;
 		}
 		return result;
 	}
 
+	bool Stage::FindBullet(full_instance_id full_id, BulletPool** pool, size_t* index) {
+		switch (INSTANCE_ID_GET_TYPE(full_id)) {
+			case TYPE_BULLET: *pool = &bullets; break;
+			case TYPE_LAZER:  *pool = &lazers;  break;
+			default: return false;
+		}
+
+		if (!(*pool)->Find(full_id, index)) return false;
+
+		if (*index & SPAWN_INDEX_BIT) {
+			*pool = (*pool == &bullets) ? &bullet_spawns : &lazer_spawns;
+			*index &= ~SPAWN_INDEX_BIT;
+		}
+		return true;
+	}
+
+#ifndef TH_HEADLESS
 	// DRAWING
 
 	static void DrawObject(Object& object) {
@@ -1090,18 +2568,17 @@ namespace th {
 	}
 
 	void Stage::Draw(float delta) {
-		auto& game = Game::GetInstance();
-		auto& assets = Assets::GetInstance();
-		SDL_Renderer* renderer = game.renderer;
+		Assets& assets = *context.assets;
+		SDL_Renderer* renderer = context.renderer;
 
 		// stage bg
 		if (spellcard_bg_alpha < 1.0f) {
-			stage0_draw_background(delta);
+			stage0_draw_background(*this, delta);
 		}
 
 		// spellcard bg
 		if (spellcard_bg_alpha > 0.0f) {
-			cirno_draw_spellcard_background(delta, spellcard_bg_alpha);
+			cirno_draw_spellcard_background(*this, delta, spellcard_bg_alpha);
 		}
 
 		for (Enemy& enemy : enemies) {
@@ -1112,7 +2589,7 @@ namespace th {
 			DrawObject(boss);
 		}
 
-		for (size_t player_index = 0; player_index < game.player_count; player_index++) {
+		for (size_t player_index = 0; player_index < context.player_count; player_index++) {
 			Player& player = players[player_index];
 
 			SDL_Color color = {255, 255, 255, 255};
@@ -1153,9 +2630,15 @@ namespace th {
 			}
 		}
 
-		for (Pickup& pickup : pickups) {
-			DrawSprite(pickup.sprite, (int) pickup.frame_index,
-					   pickup.x, pickup.y);
+		for (size_t i = 0, n = pickups.size(); i < n; i++) {
+			if (pickups.count[i] > 1) {
+				// merged, bigger and tinted. The sheet has no frame of its own for it
+				DrawSprite(pickup_sprite, (int) pickups.type[i],
+						   pickups.x[i], pickups.y[i], 0.0f, 1.5f, 1.5f, {255, 224, 128, 255});
+			} else {
+				DrawSprite(pickup_sprite, (int) pickups.type[i],
+						   pickups.x[i], pickups.y[i]);
+			}
 		}
 
 		for (PlayerBullet& player_bullet : player_bullets) {
@@ -1180,44 +2663,48 @@ namespace th {
 			}
 		}
 
-		for (Bullet& bullet : bullets) {
-			switch (bullet.type) {
-				case ProjectileType::Lazer:
-				case ProjectileType::SLazer: {
-					float angle = bullet.dir + 90.0f;
-					float xscale = (bullet.lazer_thickness + 2.0f) / 16.0f;
-					float yscale = bullet.lazer_length / 16.0f;
-					if (bullet.type == ProjectileType::SLazer) {
-						if (bullet.lazer_timer < bullet.lazer_time) {
-							xscale = 2.0f / 16.0f;
-						}
-					}
-					DrawSprite(bullet.sprite, (int) bullet.frame_index,
-							   bullet.x, bullet.y,
-							   angle, xscale, yscale);
-					break;
-				}
-				default: {
-					float angle = 0.0f;
-					if (bullet.flags & BULLET_FLAG_ROTATE) {
-						angle = bullet.dir - 90.0f;
-					}
-					DrawSprite(bullet.sprite, (int) bullet.frame_index,
-							   bullet.x, bullet.y,
-							   angle);
-					break;
+		for (size_t i = 0, n = lazers.size(); i < n; i++) {
+			if (lazers.type[i] == ProjectileType::Rect) {
+				Sprite* sprite = lazers.sprite[i];
+				float xscale = lazers.lazer_thickness[i] / (float) sprite->width;
+				float yscale = lazers.lazer_length[i] / (float) sprite->height;
+				DrawSprite(sprite, (int) lazers.frame_index[i],
+						   lazers.x[i], lazers.y[i],
+						   lazers.dir[i] - 90.0f, xscale, yscale);
+				continue;
+			}
+
+			float angle = lazers.dir[i] + 90.0f;
+			float xscale = (lazers.lazer_thickness[i] + 2.0f) / 16.0f;
+			float yscale = lazers.lazer_length[i] / 16.0f;
+			if (lazers.type[i] == ProjectileType::SLazer) {
+				if (lazers.lazer_timer[i] < lazers.lazer_time[i]) {
+					xscale = 2.0f / 16.0f;
 				}
 			}
+			DrawSprite(lazers.sprite[i], (int) lazers.frame_index[i],
+					   lazers.x[i], lazers.y[i],
+					   angle, xscale, yscale);
+		}
+
+		for (size_t i = 0, n = bullets.size(); i < n; i++) {
+			float angle = 0.0f;
+			if (bullets.flags[i] & BULLET_FLAG_ROTATE) {
+				angle = bullets.dir[i] - 90.0f;
+			}
+			DrawSprite(bullets.sprite[i], (int) bullets.frame_index[i],
+					   bullets.x[i], bullets.y[i],
+					   angle);
 		}
 
 		// ui
 		{
 			// pickup labels
-			for (Pickup& pickup : pickups) {
-				if (pickup.y < 0.0f) {
-					Sprite* sprite = pickup.sprite;
-					int frame_index = pickup.type + PICKUP_COUNT;
-					float x = pickup.x;
+			for (size_t i = 0, n = pickups.size(); i < n; i++) {
+				if (pickups.y[i] < 0.0f) {
+					Sprite* sprite = pickup_sprite;
+					int frame_index = pickups.type[i] + PICKUP_COUNT;
+					float x = pickups.x[i];
 					float y = 8.0f;
 					SDL_Color color{255, 255, 255, 192};
 					DrawSprite(sprite, frame_index, x, y, 0.0f, 1.0f, 1.0f, color);
@@ -1286,5 +2773,91 @@ namespace th {
 			}
 		}
 	}
+#endif
+
+	void Stage::GetScore(size_t player_index, int score) {
+		Stats& s = stats[player_index];
+		s.score += score;
+	}
+
+	void Stage::GetLives(size_t player_index, int lives) {
+		Stats& s = stats[player_index];
+		while (lives--) {
+			if (s.lives < 8) {
+				s.lives++;
+				//PlaySound("se_extend.wav");
+			} else {
+				GetBombs(player_index, 1);
+			}
+		}
+	}
+
+	void Stage::GetBombs(size_t player_index, int bombs) {
+		Stats& s = stats[player_index];
+		while (bombs--) {
+			if (s.bombs < 8) {
+				s.bombs++;
+			}
+		}
+	}
+
+	void Stage::GetPower(size_t player_index, int power) {
+		Stats& s = stats[player_index];
+		while (power--) {
+			if (s.power < MAX_POWER) {
+				s.power++;
+				switch (s.power) {
+					case 8:
+					case 16:
+					case 32:
+					case 48:
+					case 64:
+					case 80:
+					case 96:
+					case 128: {
+						//PlaySound("se_powerup.wav");
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	void Stage::GetGraze(size_t player_index, int graze) {
+		Stats& s = stats[player_index];
+		s.graze += graze;
+	}
+
+	void Stage::GetPoints(size_t player_index, int points) {
+		Stats& s = stats[player_index];
+		while (points--) {
+			s.points++;
+			if (s.points >= 800) {
+				if (s.points % 200 == 0) {
+					GetLives(player_index, 1);
+				}
+			} else {
+				switch (s.points) {
+					case 50:
+					case 125:
+					case 200:
+					case 300:
+					case 450: {
+						GetLives(player_index, 1);
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	void Stage::ResetStats(size_t player_index) {
+		Stats& s = stats[player_index];
+		CharacterData* char_data = GetCharacterData(context.player_character[player_index]);
+
+		s = {};
+		s.lives = context.options->starting_lives;
+		s.bombs = char_data->starting_bombs;
+	}
 
 }
@@ -1,6 +1,15 @@
 #pragma once
 
 #include "Objects.h"
+#include "GameData.h"
+#include "Arena.h"
+#include "BulletPool.h"
+#include "JobSystem.h"
+#include "LuaHeap.h"
+#include "PickupPool.h"
+#include "SlotMap.h"
+#include "SpatialGrid.h"
+#include "TargetIndex.h"
 
 #include "xorshf96.h"
 
@@ -25,38 +34,151 @@ namespace th {
 		INPUT_FIRE  = 1 << 4,
 		INPUT_BOMB  = 1 << 5,
 		INPUT_FOCUS = 1 << 6,
+		INPUT_SKIP_PHASE = 1 << 7, // debug, ends the boss phase
 
-		INPUT_COUNT = 7
+		INPUT_COUNT = 8
 	};
 
-	class Stage {
-	public:
-		Stage() { _instance = this; }
+	enum PoolIndex {
+		POOL_BOSSES,
+		POOL_ENEMIES,
+		POOL_BULLETS,
+		POOL_LAZERS,
+		POOL_PLAYER_BULLETS,
+		POOL_PICKUPS,
+
+		POOL_COUNT
+	};
+
+	// what a create does once its pool is at its budget
+	enum OverflowPolicy : uint8_t {
+		OVERFLOW_REFUSE, // NULL_INSTANCE_ID to Lua
+		OVERFLOW_RECYCLE_OLDEST,
+		OVERFLOW_RECYCLE_FARTHEST, // the one farthest from every player
+
+		OVERFLOW_POLICY_COUNT
+	};
 
-		static Stage& GetInstance() { return *_instance; }
+	// the blocks of Stage::Update, in order
+	enum StagePass {
+		PASS_UPDATE,
+		PASS_PHYSICS,
+		PASS_SCRIPTS,
+		PASS_LATE_UPDATE,
+		PASS_CLEANUP,
+
+		PASS_COUNT
+	};
+
+	struct PoolBudget {
+		size_t max; // 0 is as many as the pool holds
+		OverflowPolicy policy;
+	};
+
+	class Assets;
+	struct Options;
+	struct StageSnapshot;
+
+	struct Stats {
+		int score;
+		int lives;
+		int bombs;
+		int power;
+		int graze;
+		int points;
+	};
 
-		void Init();
+	// Everything a Stage uses from outside of itself. Stages with their own
+	// contexts share nothing they write to, so they can step on separate
+	// threads at once. Assets and the data tables are only read once loaded.
+	struct SimContext {
+		Assets* assets = nullptr;
+		const Options* options = nullptr;
+		JobSystem* jobs = nullptr; // only ever used by one stage at a time
+		SDL_Renderer* renderer = nullptr; // for Draw, headless stages leave it null
+		uint32_t seed = 123456789; // for Stage::random
+
+		size_t player_count = 1;
+		character_index player_character[MAX_PLAYERS]{};
+	};
+
+	class Stage {
+	public:
+		// player_input is filled in by whoever runs the stage, before every Update
+		void Init(const SimContext& context);
 		void Quit();
 
 		void Update(float delta);
 		void Draw(float delta);
 
+		// The whole simulation state between two Updates: every entity, the
+		// players and their stats, the random state, the timers and the Lua
+		// VM with all its coroutines. Settings and per-frame scratch stay as
+		// they are. A snapshot only loads back into the stage that took it,
+		// in the same run, since the Lua heap is restored in place (see
+		// LuaHeap). Load fails without touching anything when it's from
+		// another stage or damaged.
+		void SaveSnapshot(StageSnapshot* snapshot, bool compress = true);
+		bool LoadSnapshot(const StageSnapshot& snapshot);
+
+		// FNV-1a over what tells two runs apart soonest: the time, the random
+		// state, the players and their stats, the entity counts and every
+		// bullet position. Same on every peer that simulated the same inputs.
+		uint64_t GetChecksum() const;
+
 		Player& ResetPlayer(size_t player_index, bool from_death);
+
+		// These put the new entity into its spawn buffer. Its id resolves right
+		// away, the returned reference and index are into the buffer and only
+		// good until the next create of the same type. FlushSpawns moves
+		// everything into the live containers at the sync points of Update, so
+		// no pass over them ever sees them grow.
 		Boss& CreateBoss(int boss_index);
 		Enemy& CreateEnemy();
-		Bullet& CreateBullet();
+		size_t CreateBullet(); // index into bullet_spawns
+		size_t CreateLazer(); // index into lazer_spawns
 		PlayerBullet& CreatePlayerBullet();
-		Pickup& CreatePickup();
+		size_t CreatePickup(float x, float y, PickupType type); // index into pickup_spawns
+
+		void FlushSpawns();
 
 		void FreeBoss(Boss& boss);
 		void FreeEnemy(Enemy& enemy);
-		void FreeBullet(Bullet& bullet);
+		void FreeBullet(BulletPool& pool, size_t index);
+
+		// Every write to a direction goes through these, so the movement
+		// passes can use the cached dir_x/dir_y instead of doing trig.
+		void SetDir(Object& object, float dir);
+		void SetDir(PlayerBullet& player_bullet, float dir);
+		void SetDir(BulletPool& pool, size_t index, float dir);
+
+		// Bullets with no script and no later writes to their motion follow a
+		// closed-form path from their start state. Call Start once a new bullet
+		// is set up, and Stop before anything writes to x, y, spd, dir or acc.
+		void StartAnalyticMotion(BulletPool& pool, size_t index);
+		void StopAnalyticMotion(BulletPool& pool, size_t index);
+
+		// For writes to a bullet's motion from outside the physics step:
+		// stops the analytic motion and drops the collision sleep bound.
+		void BulletMotionChanged(BulletPool& pool, size_t index);
+		// after a player moved by other means than its speed
+		void WakeAllBullets();
 
 		Object* FindObject(full_instance_id full_id);
+		bool FindBullet(full_instance_id full_id, BulletPool** pool, size_t* index);
 
 		void StartBossPhase(Boss& boss);
 		bool EndBossPhase(Boss& boss);
 
+		void GetScore(size_t player_index, int score);
+		void GetLives(size_t player_index, int lives);
+		void GetBombs(size_t player_index, int bombs);
+		void GetPower(size_t player_index, int power);
+		void GetGraze(size_t player_index, int graze);
+		void GetPoints(size_t player_index, int points);
+
+		SimContext context;
+
 		float time = 0.0f;
 		xorshf96 random;
 		lua_State* L = nullptr;
@@ -64,34 +186,218 @@ namespace th {
 
 		InputState player_input[MAX_PLAYERS]{};
 		Player players[MAX_PLAYERS]{};
-		std::vector<Boss> bosses;
-		std::vector<Enemy> enemies;
-		std::vector<Bullet> bullets;
-		std::vector<PlayerBullet> player_bullets;
-		std::vector<Pickup> pickups;
+		Stats stats[MAX_PLAYERS]{};
 
-	private:
-		static Stage* _instance;
+		// Every pool has a fixed capacity, carved out of arena at Init from
+		// Options::stage_arena_size. Creates past it are counted and dropped.
+		Arena arena;
+		FixedArray<Boss> bosses;
+		FixedArray<Enemy> enemies;
+		SlotMap bullet_slots{TYPE_BULLET};
+		SlotMap lazer_slots{TYPE_LAZER};
+		BulletPool bullets{bullet_slots, false};
+		BulletPool lazers{lazer_slots, true};
+		FixedArray<PlayerBullet> player_bullets;
+		PickupPool pickups;
+
+		FixedArray<Boss> boss_spawns;
+		FixedArray<Enemy> enemy_spawns;
+		BulletPool bullet_spawns{bullets};
+		BulletPool lazer_spawns{lazers};
+		FixedArray<PlayerBullet> player_bullet_spawns;
+		PickupPool pickup_spawns;
+
+		struct PoolStats {
+			const char* name;
+			size_t capacity;
+			size_t high_water; // most live at once since Init
+			size_t overflows; // creates dropped because the pool or its spawn buffer was full
+		};
+		PoolStats pool_stats[POOL_COUNT]{};
+
+		// how often each overflow policy fired this frame, all pools together
+		uint32_t policy_fired[OVERFLOW_POLICY_COUNT]{};
+
+		// false = test every bullet against every player, for A/B timing
+		bool collision_broadphase = true;
+
+		// Swept collision tests everything along its whole path through the
+		// physics step, so one step per frame is enough. The discrete tests
+		// need about 5 to keep fast bullets from tunnelling through the hitbox.
+		//
+		// The step count also changes where accelerating bullets end up, the
+		// movement is explicit Euler. After t frames one step per frame leaves
+		// one acc * t * 0.4 further back than the 5 steps the game used to run,
+		// 2.4 pixels after 2 seconds at acc 0.05. Script-less bullets move in
+		// closed form, but the one for these steps, so they stay on the same
+		// path as scripted ones. Set it to 5 for the old trajectories, replays
+		// record it.
+		bool swept_collision = true;
+		int physics_substeps = 1;
 
+		// Above this many pickups, nearby ones of the same type merge into one
+		// that counts for all of them. 0 turns merging off.
+		size_t pickup_merge_threshold = 1000;
+
+		// Frames the cancel wave at the end of a boss phase takes to sweep the
+		// play area. 0 cancels every bullet in the frame the phase ends.
+		int cancel_wave_frames = 30;
+
+		double pass_took[PASS_COUNT]{}; // ms each block of Update took last frame
+		uint32_t trig_evals = 0; // sin/cos calls for directions this frame
+		size_t analytic_bullets = 0; // OBJECT_FLAG_ANALYTIC bullets and rects in the last step
+		uint32_t sleep_skipped = 0; // bullet vs player tests skipped by ScheduleBulletTests this frame
+
+		float physics_time = 0.0f; // end of the current physics step
+
+		// Bullets and lasers live in two pools, this numbers them together so
+		// collisions resolve in the order they were created, as when they
+		// shared one.
+		uint32_t next_spawn_seq = 0;
+
+	private:
+		void ResetStats(size_t player_index);
 		void UpdatePlayer(size_t player_index, float delta);
 		bool UpdateBoss(Boss& boss, float delta);
 
 		void PhysicsUpdate(float delta);
+		void GatherPlayerBlock();
+		void CollidePlayersWithBullets();
+		void CollidePlayersWithBulletsSwept(float* hit_t);
+		void BuildBulletGrid();
+		void InitPools();
+		void FlushBulletSpawns();
+		void CompactPool(PoolIndex pool);
+
+		// Budget checks for the Create functions, see Options::pool_budgets.
+		// False when the create has to be refused.
+		bool AdmitSpawn(PoolIndex pool);
+		size_t AdmitBulk(PoolIndex pool, size_t n);
+		size_t GetPoolLimit(PoolIndex pool) const;
+		bool RecycleForBudget(PoolIndex pool);
+		bool RecycleOldest(PoolIndex pool);
+		bool RecycleFarthest(PoolIndex pool);
+		size_t GetPoolSize(PoolIndex pool) const;
+		size_t GetSpawnCount(PoolIndex pool) const;
+		bool IsSpawnBufferFull(PoolIndex pool) const;
+		bool IsOutOfIds(PoolIndex pool) const;
+		uint32_t& GetPoolFlags(PoolIndex pool, size_t index);
+		void GetPoolPosition(PoolIndex pool, size_t index, float* x, float* y) const;
+		void UpdatePoolStats();
+		void HomeAllPickups(int32_t player_index);
+		void CoalescePickups();
+		void UpdatePickups(float delta);
+		void ApplyPickupGains();
+		void ScheduleBulletTests(float delta);
+		void CancelAllBullets(float x, float y);
+		void UpdateCancelWave(float delta);
+		void ReleaseCanceledRefs(size_t budget);
 
 		void InitLua();
 		void CallCoroutines();
 
-		full_instance_id GenFullInstanceID(object_type type) {
-			instance_id_id id = next_instance_id++;
-			return MAKE_INSTANCE_ID(id, type);
-		}
+		LuaHeap lua_heap;
+		std::vector<uint8_t> snapshot_scratch;
 
-		instance_id_id next_instance_id = 0;
+		SlotMap boss_slots{TYPE_BOSS};
+		SlotMap enemy_slots{TYPE_ENEMY};
 
 		float coro_update_timer = 0.0f;
 		float spellcard_bg_alpha = 0.0f;
 
-		friend class Game; // to show next_instance_id
+		SpatialGrid bullet_grid;
+
+		// Recycling state, valid until the pool is compacted. Recycled entities
+		// are only flagged dead and still take up room until then.
+		size_t recycle_cursor[POOL_COUNT]{}; // everything before it is dead
+		size_t recycled_pending[POOL_COUNT]{};
+		std::vector<std::pair<float, uint32_t>> recycle_order[POOL_COUNT]; // distance to the closest player, index
+		size_t recycle_order_cursor[POOL_COUNT]{};
+		bool recycle_order_valid[POOL_COUNT]{};
+
+		Sprite* pickup_sprite = nullptr;
+		std::vector<std::pair<uint64_t, uint32_t>> pickup_merge_keys; // cell key, pickup index
+
+		// Bullets canceled by a boss phase end turn into pickups when the wave
+		// reaches them, a bounded number per frame.
+		struct CancelWave {
+			bool active;
+			float x;
+			float y;
+			float radius;
+			float spd;
+			float end_radius; // reaches every corner of the cull area
+		};
+		CancelWave cancel_wave{};
+		std::vector<int> cancel_refs; // Lua refs of canceled bullets, released a batch per frame
+		std::vector<float> cancel_x;
+		std::vector<float> cancel_y;
+
+		// collected this frame, handed to GameScene once after the physics steps
+		struct PickupGains {
+			int power;
+			int score;
+			int points;
+			int bombs;
+			int lives;
+		};
+		PickupGains pickup_gains[MAX_PLAYERS]{};
+
+		// enemies and bosses for homing shots, rebuilt every frame
+		TargetIndex homing_targets;
+		std::vector<float> homing_query[2]; // x, y of each homing shot
+		std::vector<uint32_t> homing_result; // target item of each homing shot
+
+		// narrowphase scratch, grid candidates gathered into arrays for the kernels
+		std::vector<float> narrow[6];
+
+		// The players as the collision passes see them, indexed by player index.
+		// One pass over the projectiles tests all of them.
+		struct PlayerBlock {
+			float x[MAX_PLAYERS];
+			float y[MAX_PLAYERS];
+			float x0[MAX_PLAYERS];
+			float y0[MAX_PLAYERS];
+			float graze_radius[MAX_PLAYERS];
+			float hit_radius[MAX_PLAYERS];
+			bool normal[MAX_PLAYERS]; // grazing, getting hit and collecting all need the Normal state
+		};
+		PlayerBlock player_block{};
+
+		struct SweptContact {
+			float t;
+			uint32_t item; // grid item
+			bool hit;
+		};
+
+		// What the test pass found for one player, applied afterwards in player order
+		struct PlayerContacts {
+			// grid items, bullets then lasers. Brute force leaves it empty and the bits index the pools.
+			std::vector<uint32_t> candidates;
+			size_t bullet_count = 0;
+			size_t lazer_count = 0;
+			std::vector<uint32_t> bullet_graze_bits;
+			std::vector<uint32_t> bullet_hit_bits;
+			std::vector<uint32_t> lazer_graze_bits;
+			std::vector<uint32_t> lazer_hit_bits;
+
+			std::vector<SweptContact> swept;
+			std::vector<uint32_t> pickups;
+		};
+		PlayerContacts player_contacts[MAX_PLAYERS];
+		std::vector<SweptContact> worker_swept[MAX_WORKERS][MAX_PLAYERS]; // found by each worker, merged into swept
+
+		// positions at the start of the physics step, for swept collision
+		float player_x0[MAX_PLAYERS]{};
+		float player_y0[MAX_PLAYERS]{};
+		FixedArray<float> boss_x0;
+		FixedArray<float> boss_y0;
+		FixedArray<float> enemy_x0;
+		FixedArray<float> enemy_y0;
+		FixedArray<float> player_bullet_x0;
+		FixedArray<float> player_bullet_y0;
+
+		friend class Game; // to show slot counts
 	};
 
 }
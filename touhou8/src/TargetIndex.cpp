@@ -0,0 +1,87 @@
+#include "TargetIndex.h"
+
+#include <algorithm>
+
+namespace th {
+
+	void TargetIndex::Clear() {
+		points.clear();
+	}
+
+	void TargetIndex::Add(uint32_t item, float x, float y) {
+		points.push_back({x, y, item, (uint32_t) points.size()});
+	}
+
+	void TargetIndex::Build() {
+		std::sort(points.begin(), points.end(), [](const Point& a, const Point& b) {
+			if (a.x != b.x) return a.x < b.x;
+			return a.order < b.order;
+		});
+	}
+
+	bool TargetIndex::FindNearest(float x, float y, uint32_t* item) const {
+		if (points.empty()) return false;
+
+		// first point at or right of x
+		size_t right = std::lower_bound(points.begin(), points.end(), x, [](const Point& p, float x) {
+			return p.x < x;
+		}) - points.begin();
+		size_t left = right;
+
+		const Point* best = nullptr;
+		float best_dist = 0.0f;
+
+		auto consider = [&](const Point& p) {
+			float dx = p.x - x;
+			float dy = p.y - y;
+			float dist = dx * dx + dy * dy;
+			if (!best || dist < best_dist || (dist == best_dist && p.order < best->order)) {
+				best = &p;
+				best_dist = dist;
+			}
+		};
+
+		// a side stops once its gap is strictly farther, so ties still get compared by order
+		bool go_left = true;
+		bool go_right = true;
+		while (go_left || go_right) {
+			if (go_right) {
+				if (right < points.size()) {
+					float dx = points[right].x - x;
+					if (best && dx * dx > best_dist) {
+						go_right = false;
+					} else {
+						consider(points[right++]);
+					}
+				} else {
+					go_right = false;
+				}
+			}
+
+			if (go_left) {
+				if (left > 0) {
+					float dx = x - points[left - 1].x;
+					if (best && dx * dx > best_dist) {
+						go_left = false;
+					} else {
+						consider(points[--left]);
+					}
+				} else {
+					go_left = false;
+				}
+			}
+		}
+
+		*item = best->item;
+		return true;
+	}
+
+	void TargetIndex::FindNearest(const float* x, const float* y, size_t count, uint32_t* items, uint32_t no_item) const {
+		for (size_t i = 0; i < count; i++) {
+			if (!FindNearest(x[i], y[i], &items[i])) {
+				items[i] = no_item;
+			}
+		}
+	}
+
+}
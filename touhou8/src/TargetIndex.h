@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace th {
+
+	// Nearest-point queries over a small set of targets rebuilt every frame,
+	// for homing shots. Points are kept sorted by x and a query walks outwards
+	// from its own x until the horizontal gap alone is past the best match.
+	// Distances are compared squared, there is no sqrt anywhere.
+	class TargetIndex {
+	public:
+		void Clear();
+
+		void Add(uint32_t item, float x, float y);
+
+		void Build();
+
+		bool empty() const { return points.empty(); }
+		size_t size() const { return points.size(); }
+
+		// Item of the nearest point, ties go to the one added first. False when empty.
+		bool FindNearest(float x, float y, uint32_t* item) const;
+
+		// One query per (x[i], y[i]). Queries that found nothing get no_item.
+		void FindNearest(const float* x, const float* y, size_t count, uint32_t* items, uint32_t no_item) const;
+
+	private:
+		struct Point {
+			float x;
+			float y;
+			uint32_t item;
+			uint32_t order;
+		};
+
+		std::vector<Point> points;
+	};
+
+}
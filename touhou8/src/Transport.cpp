@@ -0,0 +1,174 @@
+#include "Transport.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET socket_t;
+#define INVALID_SOCK ((uintptr_t) INVALID_SOCKET)
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int socket_t;
+#define INVALID_SOCK UINTPTR_MAX
+#endif
+
+#include <SDL.h>
+#include <string.h>
+
+#include "utils.h"
+
+namespace th {
+
+	static sockaddr_in LocalAddress(uint16_t port) {
+		sockaddr_in addr{};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = htons(port);
+		return addr;
+	}
+
+	static void CloseSocket(uintptr_t sock) {
+#ifdef _WIN32
+		closesocket((socket_t) sock);
+#else
+		close((socket_t) sock);
+#endif
+	}
+
+	bool UdpTransport::Init(size_t _local_peer, size_t _peer_count, uint16_t _base_port) {
+		Quit();
+
+#ifdef _WIN32
+		WSADATA wsa_data;
+		if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+			LOG("WSAStartup failed.");
+			return false;
+		}
+		socket_t s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (s == INVALID_SOCKET) {
+			LOG("Couldn't create a UDP socket.");
+			WSACleanup();
+			return false;
+		}
+#else
+		socket_t s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (s < 0) {
+			LOG("Couldn't create a UDP socket.");
+			return false;
+		}
+#endif
+		sock = (uintptr_t) s;
+
+		local_peer = _local_peer;
+		peer_count = _peer_count;
+		base_port = _base_port;
+
+		sockaddr_in addr = LocalAddress((uint16_t) (base_port + local_peer));
+		if (bind((socket_t) sock, (const sockaddr*) &addr, sizeof(addr)) != 0) {
+			LOG("Couldn't bind UDP port %d.", base_port + (int) local_peer);
+			Quit();
+			return false;
+		}
+
+#ifdef _WIN32
+		u_long non_blocking = 1;
+		bool blocking_off = ioctlsocket((socket_t) sock, FIONBIO, &non_blocking) == 0;
+#else
+		int flags = fcntl((socket_t) sock, F_GETFL, 0);
+		bool blocking_off = flags != -1 && fcntl((socket_t) sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+		if (!blocking_off) {
+			LOG("Couldn't make the UDP socket non-blocking.");
+			Quit();
+			return false;
+		}
+
+		return true;
+	}
+
+	void UdpTransport::Quit() {
+		if (sock == INVALID_SOCK) return;
+
+		CloseSocket(sock);
+		sock = INVALID_SOCK;
+#ifdef _WIN32
+		WSACleanup();
+#endif
+	}
+
+	void UdpTransport::Send(size_t peer, const void* data, size_t size) {
+		if (sock == INVALID_SOCK || peer >= peer_count || peer == local_peer) return;
+
+		sockaddr_in addr = LocalAddress((uint16_t) (base_port + peer));
+		// a full send buffer drops it, same as the network would
+		sendto((socket_t) sock, (const char*) data, (int) size, 0, (const sockaddr*) &addr, sizeof(addr));
+	}
+
+	size_t UdpTransport::Receive(size_t* peer, void* data, size_t capacity) {
+		if (sock == INVALID_SOCK) return 0;
+
+		for (;;) {
+			sockaddr_in addr{};
+			socklen_t addr_size = sizeof(addr);
+			auto received = recvfrom((socket_t) sock, (char*) data, (int) capacity, 0, (sockaddr*) &addr, &addr_size);
+			if (received <= 0) {
+				// would block, or an ICMP port unreachable from a peer that isn't up yet
+#ifdef _WIN32
+				if (received < 0 && WSAGetLastError() == WSAECONNRESET) continue;
+#endif
+				return 0;
+			}
+
+			// only the session's own ports on loopback
+			int port = ntohs(addr.sin_port);
+			if (addr.sin_addr.s_addr != htonl(INADDR_LOOPBACK)
+				|| port < base_port || port >= base_port + (int) peer_count || port == base_port + (int) local_peer) {
+				continue;
+			}
+
+			*peer = (size_t) (port - base_port);
+			return (size_t) received;
+		}
+	}
+
+	void SimulatedNetwork::Post(size_t from, size_t to, const void* data, size_t size) {
+		if (size > MAX_PACKET_SIZE) return;
+
+		if (loss > 0.0f && random.range(0.0f, 1.0f) < loss) return;
+
+		Packet& packet = in_flight.emplace_back();
+		packet.arrive_ms = now_ms + (double) latency_ms;
+		if (jitter_ms > 0.0f) {
+			packet.arrive_ms += (double) random.range(-jitter_ms, jitter_ms);
+		}
+		packet.from = from;
+		packet.to = to;
+		packet.size = size;
+		memcpy(packet.data, data, size);
+	}
+
+	size_t SimulatedNetwork::Take(size_t to, size_t* from, void* data, size_t capacity) {
+		// the one that arrived first, so jitter reorders
+		size_t found = SIZE_MAX;
+		for (size_t i = 0; i < in_flight.size(); i++) {
+			const Packet& packet = in_flight[i];
+			if (packet.to != to || packet.arrive_ms > now_ms) continue;
+			if (found == SIZE_MAX || packet.arrive_ms < in_flight[found].arrive_ms) found = i;
+		}
+		if (found == SIZE_MAX) return 0;
+
+		Packet& packet = in_flight[found];
+		size_t size = std::min(packet.size, capacity);
+		memcpy(data, packet.data, size);
+		*from = packet.from;
+
+		in_flight[found] = in_flight.back();
+		in_flight.pop_back();
+		return size;
+	}
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "xorshf96.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#define MAX_PACKET_SIZE 512
+
+namespace th {
+
+	// Unreliable, unordered datagrams between the peers of a netplay
+	// session. A peer's number is the player index it plays.
+	class Transport {
+	public:
+		virtual ~Transport() = default;
+
+		virtual void Send(size_t peer, const void* data, size_t size) = 0;
+		// Size of the next packet that arrived, 0 when there is none. Never blocks.
+		virtual size_t Receive(size_t* peer, void* data, size_t capacity) = 0;
+	};
+
+	// UDP on 127.0.0.1, peer i listens on base_port + i. For running a few
+	// copies of the game side by side on one machine.
+	class UdpTransport : public Transport {
+	public:
+		UdpTransport() = default;
+		UdpTransport(const UdpTransport&) = delete;
+		UdpTransport& operator=(const UdpTransport&) = delete;
+		~UdpTransport() { Quit(); }
+
+		bool Init(size_t local_peer, size_t peer_count, uint16_t base_port);
+		void Quit();
+
+		void Send(size_t peer, const void* data, size_t size) override;
+		size_t Receive(size_t* peer, void* data, size_t capacity) override;
+
+	private:
+		uintptr_t sock = UINTPTR_MAX; // SOCKET or int
+		size_t local_peer = 0;
+		size_t peer_count = 0;
+		uint16_t base_port = 0;
+	};
+
+	// Every peer of an in-process session shares one network. Packets
+	// arrive latency +- jitter ms after they were sent, so jitter reorders
+	// them, and a share of them never arrives. Time only moves with
+	// Advance, which makes a run the same every time for the same seed.
+	class SimulatedNetwork {
+	public:
+		float latency_ms = 50.0f;
+		float jitter_ms = 10.0f;
+		float loss = 0.0f; // 0..1
+
+		void Advance(double ms) { now_ms += ms; }
+
+		void Post(size_t from, size_t to, const void* data, size_t size);
+		size_t Take(size_t to, size_t* from, void* data, size_t capacity);
+
+		xorshf96 random;
+
+	private:
+		struct Packet {
+			double arrive_ms;
+			size_t from;
+			size_t to;
+			size_t size;
+			uint8_t data[MAX_PACKET_SIZE];
+		};
+
+		double now_ms = 0.0;
+		std::vector<Packet> in_flight;
+	};
+
+	class SimulatedTransport : public Transport {
+	public:
+		SimulatedTransport(SimulatedNetwork* _network, size_t _peer) : network(_network), peer(_peer) {}
+
+		void Send(size_t to, const void* data, size_t size) override { network->Post(peer, to, data, size); }
+		size_t Receive(size_t* from, void* data, size_t capacity) override { return network->Take(peer, from, data, capacity); }
+
+	private:
+		SimulatedNetwork* network;
+		size_t peer;
+	};
+
+}
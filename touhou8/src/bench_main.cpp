@@ -0,0 +1,385 @@
+// Headless benchmark, built with TH_HEADLESS (see the CMakeLists.txt at the
+// top of the repo). Runs one boss phase on scripted input, or plays back a
+// recorded replay, as fast as it can and reports frames per second and the
+// time each pass of Stage::Update took. Then it times the worst rollback
+// netplay allows: loading a snapshot and simulating --rollback frames again.
+// Every operator new is counted, and the run reports how many happened after
+// the first second, which should be none: the pools live in the arena and
+// Lua in its own heap, both allocated once at Stage::Init.
+//
+// --netplay instead runs 2 to 4 rollback sessions in one process over a
+// simulated network, with latency and jitter in ms and a share of packets
+// lost, and checks that every peer ends on the same state.
+//
+//   touhou8_bench [--phase Boss0_Phase3] [--frames 3600] [--threads 0] [--rollback 8]
+//   touhou8_bench --replay replay.rpy [--threads 0] [--rollback 8]
+//   touhou8_bench --netplay 2 [--latency 50] [--jitter 10] [--loss 0.05] [--phase Boss0_Phase3] [--frames 3600]
+//
+// Run it from touhou8/, the assets are looked up relative to it.
+
+#include "Stage.h"
+#include "Assets.h"
+#include "Game.h"
+#include "Replay.h"
+#include "Rollback.h"
+#include "Transport.h"
+
+#include "utils.h"
+
+#include <atomic>
+#include <float.h>
+#include <new>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+static std::atomic<size_t> heap_allocations;
+
+void* operator new(size_t size) {
+	heap_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* result = malloc(size ? size : 1)) return result;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+	free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+	free(ptr);
+}
+
+namespace th {
+
+	static const char* pass_names[PASS_COUNT] = {"update", "physics", "scripts", "late update", "cleanup"};
+
+	static InputState ScriptedInput(size_t player_index, int frame) {
+		// fire all the time and sway left and right, once a second each way
+		if (player_index == 0) {
+			return INPUT_FIRE | ((frame / 60) % 2 ? INPUT_LEFT : INPUT_RIGHT);
+		}
+
+		// the others change their mind more often, and not in step
+		InputState input = INPUT_FIRE | ((frame / (23 + 11 * (int) player_index)) % 2 ? INPUT_UP : INPUT_DOWN);
+		if ((frame / 37) % 3 == 0) input |= INPUT_FOCUS;
+		return input;
+	}
+
+	// keep the boss in the phase for the whole run
+	static void StartPhase(Stage& stage, int boss_index, int phase_index) {
+		Boss& boss = stage.CreateBoss(boss_index);
+		boss.phase_index = phase_index;
+		stage.StartBossPhase(boss);
+		boss.hp = FLT_MAX;
+		boss.timer = FLT_MAX;
+	}
+
+	static void MeasureRollback(Stage& stage, int rollback_frames) {
+		const int repeats = 20;
+
+		StageSnapshot from;
+		stage.SaveSnapshot(&from, false);
+
+		std::vector<StageSnapshot> snapshots(rollback_frames);
+
+		double total = 0.0;
+		double worst = 0.0;
+		double save_total = 0.0;
+
+		for (int repeat = 0; repeat < repeats; repeat++) {
+			double t = GetTime();
+
+			stage.LoadSnapshot(from);
+			for (int frame = 0; frame < rollback_frames; frame++) {
+				for (size_t i = 0; i < stage.context.player_count; i++) {
+					stage.player_input[i] = ScriptedInput(i, frame);
+				}
+
+				double save_t = GetTime();
+				stage.SaveSnapshot(&snapshots[frame], false);
+				save_total += GetTime() - save_t;
+
+				stage.Update(1.0f);
+			}
+
+			double took = GetTime() - t;
+			total += took;
+			worst = std::max(worst, took);
+		}
+
+		stage.LoadSnapshot(from);
+
+		double frame_ms = 1000.0 / 60.0;
+		double average_ms = total / repeats * 1000.0;
+		LOG("rollback of %d frames: %.3fms, worst %.3fms, %.0f%% of a 60Hz frame",
+			rollback_frames, average_ms, worst * 1000.0, average_ms / frame_ms * 100.0);
+		LOG("snapshot every frame: %.3fms, %zuKb", save_total / (repeats * rollback_frames) * 1000.0, from.data.size() / 1024);
+	}
+
+	static int RunBench(const char* phase_name, const char* replay_name, int frames, size_t thread_count, int rollback_frames) {
+		int boss_index = 0;
+		int phase_index = 0;
+		if (!replay_name && sscanf(phase_name, "Boss%d_Phase%d", &boss_index, &phase_index) != 2) {
+			LOG("--phase wants a name like Boss0_Phase3, got %s", phase_name);
+			return 1;
+		}
+
+		Assets assets;
+		if (!assets.LoadAssets(nullptr)) {
+			LOG("Couldn't load assets, run from the touhou8 folder");
+			return 1;
+		}
+
+		FillDataTables();
+
+		BossData* boss_data = GetBossData(boss_index);
+		if (!(0 <= phase_index && phase_index < boss_data->phase_count)) {
+			LOG("%s has no phase %d", boss_data->name, phase_index);
+			return 1;
+		}
+
+		Options options;
+
+		JobSystem jobs;
+		jobs.Init(thread_count ? thread_count : (size_t) SDL_GetCPUCount());
+
+		SimContext context;
+		context.assets = &assets;
+		context.options = &options;
+		context.jobs = &jobs;
+		context.player_count = 1;
+
+		Replay replay;
+		if (replay_name) {
+			if (!replay.ArmPlayback(replay_name)) {
+				return 1;
+			}
+
+			replay.ApplySettings(options);
+			context.seed = replay.header.stage_seed;
+			context.player_count = replay.header.player_count;
+			std::copy(replay.header.player_character, replay.header.player_character + MAX_PLAYERS, context.player_character);
+			frames = (int) replay.header.frame_count;
+			phase_name = replay_name;
+		}
+
+		Stage stage;
+		stage.Init(context);
+
+		if (replay_name) {
+			replay.Begin(stage, replay.header.game_seed);
+		} else {
+			StartPhase(stage, boss_index, phase_index);
+		}
+
+		double pass_total[PASS_COUNT]{};
+		size_t allocations_from = SIZE_MAX;
+
+		double t = GetTime();
+
+		for (int frame = 0; frame < frames; frame++) {
+			// the first second may still grow the scratch vectors to their working size
+			if (frame == 60) {
+				allocations_from = heap_allocations.load();
+			}
+
+			if (replay_name) {
+				if (!replay.Next(stage.player_input, stage.context.player_count)) {
+					frames = frame;
+					break;
+				}
+			} else {
+				stage.player_input[0] = ScriptedInput(0, frame);
+			}
+			stage.Update(1.0f);
+
+			for (int pass = 0; pass < PASS_COUNT; pass++) {
+				pass_total[pass] += stage.pass_took[pass];
+			}
+		}
+
+		double took = GetTime() - t;
+
+		LOG("%s, %d frames, %zu threads: %.0f frames/s", phase_name, frames, jobs.GetWorkerCount(), (double) frames / took);
+		for (int pass = 0; pass < PASS_COUNT; pass++) {
+			LOG("%-12s %.4fms", pass_names[pass], pass_total[pass] / (double) frames);
+		}
+		LOG("bullets at the end: %zu, lasers: %zu, pickups: %zu", stage.bullets.size(), stage.lazers.size(), stage.pickups.size());
+		if (allocations_from != SIZE_MAX) {
+			LOG("heap allocations after the first second: %zu", heap_allocations.load() - allocations_from);
+		}
+
+		if (rollback_frames > 0) {
+			MeasureRollback(stage, rollback_frames);
+		}
+
+		stage.Quit();
+		jobs.Quit();
+		assets.UnloadAssets();
+
+		return 0;
+	}
+
+
+	// FNV-1a over what the players would see, which unlike a snapshot
+	// doesn't hold pointers that differ between stages
+	static int RunNetplay(const char* phase_name, int frames, size_t thread_count, size_t player_count,
+						  float latency_ms, float jitter_ms, float loss) {
+		int boss_index = 0;
+		int phase_index = 0;
+		if (sscanf(phase_name, "Boss%d_Phase%d", &boss_index, &phase_index) != 2) {
+			LOG("--phase wants a name like Boss0_Phase3, got %s", phase_name);
+			return 1;
+		}
+
+		Assets assets;
+		if (!assets.LoadAssets(nullptr)) {
+			LOG("Couldn't load assets, run from the touhou8 folder");
+			return 1;
+		}
+
+		FillDataTables();
+
+		BossData* boss_data = GetBossData(boss_index);
+		if (!(0 <= phase_index && phase_index < boss_data->phase_count)) {
+			LOG("%s has no phase %d", boss_data->name, phase_index);
+			return 1;
+		}
+
+		Options options;
+
+		// the peers take turns, one job system does
+		JobSystem jobs;
+		jobs.Init(thread_count ? thread_count : (size_t) SDL_GetCPUCount());
+
+		SimContext context;
+		context.assets = &assets;
+		context.options = &options;
+		context.jobs = &jobs;
+		context.player_count = player_count;
+
+		SimulatedNetwork network;
+		network.latency_ms = latency_ms;
+		network.jitter_ms = jitter_ms;
+		network.loss = loss;
+
+		std::optional<Stage> stages[MAX_PLAYERS];
+		std::vector<SimulatedTransport> transports;
+		std::vector<RollbackSession> sessions(player_count);
+		transports.reserve(player_count);
+
+		for (size_t i = 0; i < player_count; i++) {
+			stages[i].emplace();
+			stages[i]->Init(context);
+			StartPhase(*stages[i], boss_index, phase_index);
+
+			transports.emplace_back(&network, i);
+			sessions[i].Init(&*stages[i], &transports[i], i, player_count, 2);
+		}
+
+		double t = GetTime();
+
+		// every peer gets a turn each 60Hz tick, like separate machines would
+		const double tick_ms = 1000.0 / 60.0;
+		uint32_t target = (uint32_t) frames;
+		uint32_t ticks = 0;
+		for (;;) {
+			bool done = true;
+			for (size_t i = 0; i < player_count; i++) {
+				RollbackSession& session = sessions[i];
+				if (session.desynced) {
+					LOG("netplay: player %zu desynced at frame %u", i + 1, session.desync_frame);
+					return 1;
+				}
+				if (session.frame < target) {
+					session.AdvanceFrame(ScriptedInput(i, (int) session.frame));
+					done = false;
+				} else {
+					session.Idle();
+					done &= session.GetConfirmedFrame() >= target;
+				}
+			}
+			if (done) break;
+
+			network.Advance(tick_ms);
+			if (++ticks > target * 100) {
+				LOG("netplay: the peers never caught up, too much loss?");
+				return 1;
+			}
+		}
+
+		double took = GetTime() - t;
+
+		LOG("%s, %zu players, %u frames, %.0fms latency +-%.0fms, %.0f%% loss: %.0f ticks, %.2fs",
+			phase_name, player_count, target, latency_ms, jitter_ms, loss * 100.0f, (double) ticks, took);
+
+		bool in_sync = true;
+		uint64_t first_checksum = stages[0]->GetChecksum();
+		for (size_t i = 0; i < player_count; i++) {
+			const RollbackSession& session = sessions[i];
+			uint64_t checksum = stages[i]->GetChecksum();
+			in_sync &= checksum == first_checksum;
+
+			LOG("player %zu: %u rollbacks, %.1f frames on average, last %.3fms, %u stalls, checksum %016llx",
+				i + 1, session.rollbacks,
+				session.rollbacks ? (double) session.resimulated_frames / (double) session.rollbacks : 0.0,
+				session.last_rollback_ms, session.stalls, (unsigned long long) checksum);
+		}
+		LOG("%s", in_sync ? "in sync" : "DESYNC");
+
+		for (size_t i = 0; i < player_count; i++) {
+			stages[i]->Quit();
+		}
+		jobs.Quit();
+		assets.UnloadAssets();
+
+		return in_sync ? 0 : 1;
+	}
+
+}
+
+int main(int argc, char* argv[]) {
+	const char* phase_name = "Boss0_Phase3";
+	const char* replay_name = nullptr;
+	int frames = 3600;
+	int thread_count = 0;
+	int rollback_frames = ROLLBACK_MAX_FRAMES;
+	int netplay_players = 0;
+	float latency_ms = 50.0f;
+	float jitter_ms = 10.0f;
+	float loss = 0.0f;
+
+	for (int i = 1; i < argc; i++) {
+		bool has_value = i + 1 < argc;
+		if (has_value && strcmp(argv[i], "--phase") == 0) {
+			phase_name = argv[++i];
+		} else if (has_value && strcmp(argv[i], "--replay") == 0) {
+			replay_name = argv[++i];
+		} else if (has_value && strcmp(argv[i], "--frames") == 0) {
+			frames = std::max(th::StrToInt(argv[++i], frames), 1);
+		} else if (has_value && strcmp(argv[i], "--threads") == 0) {
+			thread_count = std::max(th::StrToInt(argv[++i], thread_count), 0);
+		} else if (has_value && strcmp(argv[i], "--rollback") == 0) {
+			rollback_frames = std::max(th::StrToInt(argv[++i], rollback_frames), 0);
+		} else if (has_value && strcmp(argv[i], "--netplay") == 0) {
+			netplay_players = std::clamp(th::StrToInt(argv[++i], 2), 2, MAX_PLAYERS);
+		} else if (has_value && strcmp(argv[i], "--latency") == 0) {
+			latency_ms = std::max((float) atof(argv[++i]), 0.0f);
+		} else if (has_value && strcmp(argv[i], "--jitter") == 0) {
+			jitter_ms = std::max((float) atof(argv[++i]), 0.0f);
+		} else if (has_value && strcmp(argv[i], "--loss") == 0) {
+			loss = std::clamp((float) atof(argv[++i]), 0.0f, 0.9f);
+		} else {
+			LOG("usage: %s [--phase Boss0_Phase3 | --replay file] [--frames 3600] [--threads 0] [--rollback 8]\n"
+				"       %s --netplay 2 [--latency 50] [--jitter 10] [--loss 0] [--phase Boss0_Phase3] [--frames 3600]",
+				argv[0], argv[0]);
+			return 1;
+		}
+	}
+
+	if (netplay_players > 0) {
+		return th::RunNetplay(phase_name, frames, (size_t) thread_count, (size_t) netplay_players, latency_ms, jitter_ms, loss);
+	}
+
+	return th::RunBench(phase_name, replay_name, frames, (size_t) thread_count, rollback_frames);
+}
@@ -2,12 +2,10 @@
 
 namespace th {
 
-	static void cirno_draw_spellcard_background(float delta, float spellcard_bg_alpha) {
-		auto& assets = Assets::GetInstance();
-		auto& stage = Stage::GetInstance();
-		auto& game = Game::GetInstance();
+	static void cirno_draw_spellcard_background(Stage& stage, float delta, float spellcard_bg_alpha) {
+		Assets& assets = *stage.context.assets;
 
-		SDL_Renderer* renderer = game.renderer;
+		SDL_Renderer* renderer = stage.context.renderer;
 		float time = stage.time;
 
 		SDL_Texture* texture = assets.FindTexture("CirnoSpellcardBG");
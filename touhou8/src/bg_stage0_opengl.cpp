@@ -7,11 +7,9 @@ namespace th {
 
 	static PFNGLUSEPROGRAMOBJECTARBPROC glUseProgramObjectARB = nullptr;
 
-	void stage0_draw_background(float delta) {
-		auto& assets = Assets::GetInstance();
-		auto& game = Game::GetInstance();
-		auto& stage = Stage::GetInstance();
-		SDL_Renderer* renderer = game.renderer;
+	void stage0_draw_background(Stage& stage, float delta) {
+		Assets& assets = *stage.context.assets;
+		SDL_Renderer* renderer = stage.context.renderer;
 
 		if (!glUseProgramObjectARB) {
 			glUseProgramObjectARB = (PFNGLUSEPROGRAMOBJECTARBPROC) SDL_GL_GetProcAddress("glUseProgramObjectARB");
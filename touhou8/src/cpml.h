@@ -76,20 +76,147 @@ namespace cpml {
 		return res;
 	}
 
+	// Squared distance from a point to an oriented box. (axis_x, axis_y) is the
+	// unit vector along the box's length, the width goes across it.
+	// The clamps are written the way min/max work in SSE, so the collision
+	// kernels round and handle NaN the same on every path.
+	inline float point_vs_box_dist_sqr(float x, float y, float box_x, float box_y, float axis_x, float axis_y, float half_width, float half_length) {
+		// the point in the box's frame
+		float dx = x - box_x;
+		float dy = y - box_y;
+		float along  = dx * axis_x + dy * axis_y;
+		float across = dx * axis_y - dy * axis_x;
+
+		float closest_across = std::min(std::max(across, -half_width), half_width);
+		float closest_along  = std::min(std::max(along,  -half_length), half_length);
+
+		float du = closest_across - across;
+		float dv = closest_along  - along;
+		return du * du + dv * dv;
+	}
+
+	// rect_w goes across rect_dir, rect_h along it. The same test the laser box kernels do.
 	inline bool circle_vs_rotated_rect(float circle_x, float circle_y, float circle_radius, float rect_center_x, float rect_center_y, float rect_w, float rect_h, float rect_dir) {
-		float dx = circle_x - rect_center_x;
-		float dy = circle_y - rect_center_y;
+		float dist_sqr = point_vs_box_dist_sqr(circle_x, circle_y, rect_center_x, rect_center_y,
+											   dcos(rect_dir), -dsin(rect_dir), rect_w / 2.0f, rect_h / 2.0f);
+		return dist_sqr < circle_radius * circle_radius;
+	}
+
+	// First t in [0, 1] at which a point starting at (x, y) and moving by (vx, vy)
+	// gets closer than radius to the origin.
+	inline bool point_vs_circle_toi(float x, float y, float vx, float vy, float radius, float* t) {
+		float c = sqr(x) + sqr(y) - sqr(radius);
+		if (c < 0.0f) {
+			*t = 0.0f;
+			return true;
+		}
+
+		float a = sqr(vx) + sqr(vy);
+		float b = x * vx + y * vy; // half of the usual b
+		if (a == 0.0f || b >= 0.0f) return false;
+
+		float disc = sqr(b) - a * c;
+		if (disc < 0.0f) return false;
+
+		float result = (-b - sqrtf(disc)) / a;
+		if (result > 1.0f) return false;
+
+		*t = std::max(result, 0.0f);
+		return true;
+	}
+
+	// Distance covered in time t from speed spd under constant acceleration acc,
+	// moved the way the integrated movement does: explicit Euler steps of h,
+	// position before speed, the speed clamped at 0. t is a whole number of
+	// steps. h = 0 is the exact integral, never behind the steps when acc >= 0.
+	inline float accel_distance(float spd, float acc, float t, float h) {
+		if (acc < 0.0f) {
+			// the steps that still start with some speed
+			float moving = (h > 0.0f) ? ceilf(spd / (-acc * h)) * h : spd / -acc;
+			t = std::min(t, moving);
+		}
+		return spd * t + 0.5f * acc * t * (t - h);
+	}
+
+	inline float accel_speed(float spd, float acc, float t) {
+		return std::max(spd + acc * t, 0.0f);
+	}
+
+	// Inverse of accel_distance, INFINITY if the distance is never covered.
+	inline float accel_time(float spd, float acc, float dist, float h) {
+		if (dist <= 0.0f) return 0.0f;
+
+		if (acc < 0.0f && dist >= accel_distance(spd, acc, INFINITY, h)) {
+			return INFINITY;
+		}
+
+		// the steps follow the exact integral of a speed half a step lower
+		spd -= 0.5f * acc * h;
 
-		float x_rotated = rect_center_x - (dx * dsin(rect_dir)) - (dy * dcos(rect_dir));
-		float y_rotated = rect_center_y + (dx * dcos(rect_dir)) - (dy * dsin(rect_dir));
+		float disc = spd * spd + 2.0f * acc * dist;
+		if (disc < 0.0f) return INFINITY;
 
-		float x_closest = std::clamp(x_rotated, rect_center_x - rect_w / 2.0f, rect_center_x + rect_w / 2.0f);
-		float y_closest = std::clamp(y_rotated, rect_center_y - rect_h / 2.0f, rect_center_y + rect_h / 2.0f);
+		// the other form of the quadratic formula, no cancellation when acc is small
+		float denom = spd + sqrtf(disc);
+		if (denom <= 0.0f) return INFINITY;
+
+		return 2.0f * dist / denom;
+	}
+
+	inline float point_vs_rect_dist_sqr(float x, float y, float half_w, float half_h) {
+		float dx = x - std::clamp(x, -half_w, half_w);
+		float dy = y - std::clamp(y, -half_h, half_h);
+		return sqr(dx) + sqr(dy);
+	}
+
+	// First t in [0, 1] at which a point moving like above is inside the box
+	// [-half_w, half_w] x [-half_h, half_h], by clipping the path against both slabs.
+	inline bool point_vs_box_toi(float x, float y, float vx, float vy, float half_w, float half_h, float* t) {
+		float t_enter = 0.0f;
+		float t_exit = 1.0f;
+
+		auto clip = [&](float p, float v, float h) {
+			if (v == 0.0f) return -h <= p && p <= h;
+			float t1 = (-h - p) / v;
+			float t2 = ( h - p) / v;
+			if (t1 > t2) std::swap(t1, t2);
+			t_enter = std::max(t_enter, t1);
+			t_exit = std::min(t_exit, t2);
+			return t_enter <= t_exit;
+		};
+
+		if (!clip(x, vx, half_w) || !clip(y, vy, half_h)) return false;
+
+		*t = t_enter;
+		return true;
+	}
+
+	// Same for the rectangle [-half_w, half_w] x [-half_h, half_h].
+	// Closer than radius to the rectangle is the rectangle grown by radius with
+	// rounded corners: two boxes, one widened and one lengthened, and a circle
+	// at each corner. The first contact is the earliest entry into any of them.
+	inline bool point_vs_rect_toi(float x, float y, float vx, float vy, float half_w, float half_h, float radius, float* t) {
+		if (point_vs_rect_dist_sqr(x, y, half_w, half_h) < sqr(radius)) {
+			*t = 0.0f;
+			return true;
+		}
+
+		float result = INFINITY;
+		float part;
+
+		if (point_vs_box_toi(x, y, vx, vy, half_w + radius, half_h, &part)) result = std::min(result, part);
+		if (point_vs_box_toi(x, y, vx, vy, half_w, half_h + radius, &part)) result = std::min(result, part);
+
+		for (float corner_x : {-half_w, half_w}) {
+			for (float corner_y : {-half_h, half_h}) {
+				if (point_vs_circle_toi(x - corner_x, y - corner_y, vx, vy, radius, &part)) result = std::min(result, part);
+			}
+		}
 
-		dx = x_closest - x_rotated;
-		dy = y_closest - y_rotated;
+		if (result > 1.0f) return false;
 
-		return (sqr(dx) + sqr(dy)) < sqr(circle_radius);
+		*t = result;
+		return true;
 	}
 
 }
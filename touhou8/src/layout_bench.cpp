@@ -0,0 +1,189 @@
+// The synthetic benchmark behind the BulletPool layout change: the move,
+// graze/hit test and cull passes over the old 104 byte Bullet objects
+// against the same passes over BulletPool style arrays. Needs nothing but
+// cpml.h, see the touhou8_layout_bench target in the top CMakeLists.txt.
+//
+//   touhou8_layout_bench [--frames 200]
+//
+// "trig" moves bullets with lengthdir_x/y like MoveBullets did before the
+// dir_x/dir_y cache, "no trig" leaves the trig out so only memory traffic
+// is left.
+
+#include "cpml.h"
+
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define SUBSTEPS 5
+#define CULL_MARGIN 50.0f
+
+namespace th {
+
+	// the Bullet object as it was, field for field
+	struct OldObject {
+		uint32_t full_id;
+		uint32_t flags;
+		float x;
+		float y;
+		float spd;
+		float dir;
+		float acc;
+		float radius;
+		void* sprite;
+		float frame_index;
+		float xscale = 1.0f;
+		float yscale = 1.0f;
+		float angle;
+		uint8_t color[4]{255, 255, 255, 255};
+	};
+
+	struct OldBullet : OldObject {
+		uint8_t type;
+		float lazer_data[5];
+		float lifetime;
+		float lifespan = 3600.0f;
+		uint32_t grazed_by;
+		int coroutine = -1;
+		int update_callback = -1;
+	};
+
+	struct Arrays {
+		std::vector<float> x;
+		std::vector<float> y;
+		std::vector<float> spd;
+		std::vector<float> dir;
+		std::vector<float> acc;
+		std::vector<float> radius;
+		std::vector<float> lifetime;
+	};
+
+	static bool InBounds(float x, float y) {
+		return -CULL_MARGIN <= x && x < 384.0f + CULL_MARGIN && -CULL_MARGIN <= y && y < 448.0f + CULL_MARGIN;
+	}
+
+	static volatile int sink;
+
+	static double Millis(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+		return std::chrono::duration<double, std::milli>(to - from).count();
+	}
+
+	static void Run(size_t count, int frames, bool trig) {
+		std::vector<OldBullet> objects(count);
+		Arrays arrays;
+		for (std::vector<float>* array : {&arrays.x, &arrays.y, &arrays.spd, &arrays.dir, &arrays.acc, &arrays.radius, &arrays.lifetime}) {
+			array->resize(count);
+		}
+
+		srand(1);
+		for (size_t i = 0; i < count; i++) {
+			float x = (float) (rand() % 384);
+			float y = (float) (rand() % 448);
+			float spd = (float) (rand() % 100) / 50.0f;
+			float dir = (float) (rand() % 360);
+
+			OldBullet& b = objects[i];
+			b.x = x; b.y = y; b.spd = spd; b.dir = dir; b.acc = 0.0f; b.radius = 3.0f;
+			arrays.x[i] = x; arrays.y[i] = y; arrays.spd[i] = spd; arrays.dir[i] = dir; arrays.acc[i] = 0.0f; arrays.radius[i] = 3.0f;
+		}
+
+		const float px = 192.0f;
+		const float py = 384.0f;
+		const float step = 1.0f / (float) SUBSTEPS;
+		int hits = 0;
+
+		auto t0 = std::chrono::steady_clock::now();
+
+		for (int frame = 0; frame < frames; frame++) {
+			for (int substep = 0; substep < SUBSTEPS; substep++) {
+				for (OldBullet& b : objects) {
+					if (trig) {
+						b.x += cpml::lengthdir_x(b.spd, b.dir) * step;
+						b.y += cpml::lengthdir_y(b.spd, b.dir) * step;
+					} else {
+						b.x += b.spd * step;
+						b.y += b.dir * 1e-6f;
+					}
+					b.spd = std::max(b.spd + b.acc * step, 0.0f);
+				}
+				for (OldBullet& b : objects) {
+					hits += cpml::circle_vs_circle(px, py, 16.0f, b.x, b.y, b.radius);
+					hits += cpml::circle_vs_circle(px, py, 2.0f, b.x, b.y, b.radius);
+				}
+			}
+			for (OldBullet& b : objects) {
+				if (!InBounds(b.x, b.y)) {
+					b.x = 192.0f;
+					b.y = 100.0f;
+				}
+				b.lifetime += 1.0f;
+			}
+		}
+
+		auto t1 = std::chrono::steady_clock::now();
+
+		for (int frame = 0; frame < frames; frame++) {
+			for (int substep = 0; substep < SUBSTEPS; substep++) {
+				float* x = arrays.x.data();
+				float* y = arrays.y.data();
+				float* spd = arrays.spd.data();
+				const float* dir = arrays.dir.data();
+				const float* acc = arrays.acc.data();
+				for (size_t i = 0; i < count; i++) {
+					if (trig) {
+						x[i] += cpml::lengthdir_x(spd[i], dir[i]) * step;
+						y[i] += cpml::lengthdir_y(spd[i], dir[i]) * step;
+					} else {
+						x[i] += spd[i] * step;
+						y[i] += dir[i] * 1e-6f;
+					}
+					spd[i] = std::max(spd[i] + acc[i] * step, 0.0f);
+				}
+				const float* radius = arrays.radius.data();
+				for (size_t i = 0; i < count; i++) {
+					hits += cpml::circle_vs_circle(px, py, 16.0f, x[i], y[i], radius[i]);
+					hits += cpml::circle_vs_circle(px, py, 2.0f, x[i], y[i], radius[i]);
+				}
+			}
+			for (size_t i = 0; i < count; i++) {
+				if (!InBounds(arrays.x[i], arrays.y[i])) {
+					arrays.x[i] = 192.0f;
+					arrays.y[i] = 100.0f;
+				}
+				arrays.lifetime[i] += 1.0f;
+			}
+		}
+
+		auto t2 = std::chrono::steady_clock::now();
+		sink = hits;
+
+		printf("%-7s %6zu bullets: objects %.3fms/frame, arrays %.3fms/frame\n", trig ? "trig" : "no trig", count,
+			   Millis(t0, t1) / frames, Millis(t1, t2) / frames);
+	}
+
+}
+
+int main(int argc, char* argv[]) {
+	int frames = 200;
+
+	for (int i = 1; i < argc; i++) {
+		if (i + 1 < argc && strcmp(argv[i], "--frames") == 0) {
+			frames = std::max(atoi(argv[++i]), 1);
+		} else {
+			printf("usage: %s [--frames 200]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	printf("sizeof(old Bullet) = %zu\n", sizeof(th::OldBullet));
+	for (bool trig : {true, false}) {
+		for (size_t count : {10000, 50000}) {
+			th::Run(count, frames, trig);
+		}
+	}
+
+	return 0;
+}
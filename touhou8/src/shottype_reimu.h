@@ -1,15 +1,14 @@
 namespace th {
 
-	static PlayerBullet& reimu_shoot_card(float x, float y, float dir, float dmg) {
-		auto& stage = Stage::GetInstance();
-		auto& assets = Assets::GetInstance();
+	static PlayerBullet& reimu_shoot_card(Stage& stage, float x, float y, float dir, float dmg) {
+		Assets& assets = *stage.context.assets;
 
 		PlayerBullet& result = stage.CreatePlayerBullet();
 
 		result.x = x;
 		result.y = y;
 		result.spd = 16.0f;
-		result.dir = dir;
+		stage.SetDir(result, dir);
 		result.radius = 12.0f;
 		result.sprite = assets.FindSprite("reimu_card");
 		result.dmg = dmg;
@@ -18,16 +17,15 @@ namespace th {
 		return result;
 	}
 
-	static PlayerBullet& reimu_shoot_orb(float x, float y, float dir, float dmg) {
-		auto& stage = Stage::GetInstance();
-		auto& assets = Assets::GetInstance();
+	static PlayerBullet& reimu_shoot_orb(Stage& stage, float x, float y, float dir, float dmg) {
+		Assets& assets = *stage.context.assets;
 
 		PlayerBullet& result = stage.CreatePlayerBullet();
 
 		result.x = x;
 		result.y = y;
 		result.spd = 12.0f;
-		result.dir = dir;
+		stage.SetDir(result, dir);
 		result.radius = 12.0f;
 		result.sprite = assets.FindSprite("reimu_orb_shot");
 		result.dmg = dmg;
@@ -36,13 +34,10 @@ namespace th {
 		return result;
 	}
 
-	static void reimu_shot_type(size_t player_index, float delta) {
-		auto& stage = Stage::GetInstance();
-		auto& scene = GameScene::GetInstance();
-
+	static void reimu_shot_type(Stage& stage, size_t player_index, float delta) {
 		Player& player = stage.players[player_index];
 		InputState input = stage.player_input[player_index];
-		Stats& stats = scene.stats[player_index];
+		Stats& stats = stage.stats[player_index];
 
 		player.reimu.fire_timer += delta;
 		while (player.reimu.fire_timer >= 4.0f) {
@@ -88,7 +83,7 @@ namespace th {
 							int shot_count = 1;
 							float card_dmg = card_dps / shots_per_sec / (float)shot_count;
 
-							reimu_shoot_card(player.x, player.y - 10.0f, 90.0f, card_dmg);
+							reimu_shoot_card(stage, player.x, player.y - 10.0f, 90.0f, card_dmg);
 							break;
 						}
 						case 1: {
@@ -96,7 +91,7 @@ namespace th {
 							float card_dmg = card_dps / shots_per_sec / (float)shot_count;
 
 							for (int i = 0; i < shot_count; i++) {
-								reimu_shoot_card(player.x - 8.0f + (float)i * 16.0f, player.y - 10.0f, 90.0f, card_dmg);
+								reimu_shoot_card(stage, player.x - 8.0f + (float)i * 16.0f, player.y - 10.0f, 90.0f, card_dmg);
 							}
 							break;
 						}
@@ -105,7 +100,7 @@ namespace th {
 							float card_dmg = card_dps / shots_per_sec / (float)shot_count;
 
 							for (int i = 0; i < shot_count; i++) {
-								reimu_shoot_card(player.x, player.y - 10.0f, 90.0f - 5.0f + (float)i * 5.0f, card_dmg);
+								reimu_shoot_card(stage, player.x, player.y - 10.0f, 90.0f - 5.0f + (float)i * 5.0f, card_dmg);
 							}
 							break;
 						}
@@ -114,7 +109,7 @@ namespace th {
 							float card_dmg = card_dps / shots_per_sec / (float)shot_count;
 
 							for (int i = 0; i < shot_count; i++) {
-								reimu_shoot_card(player.x, player.y - 10.0f, 90.0f - 7.5f + (float)i * 5.0f, card_dmg);
+								reimu_shoot_card(stage, player.x, player.y - 10.0f, 90.0f - 7.5f + (float)i * 5.0f, card_dmg);
 							}
 							break;
 						}
@@ -134,7 +129,7 @@ namespace th {
 
 							if (frame % 4 == 0) {
 								for (int i = 0; i < shot_count; i++) {
-									reimu_shoot_orb(player.x, player.y, 90.0f + 70.0f * ((i == 0) ? -1.0f : 1.0f), orb_dmg);
+									reimu_shoot_orb(stage, player.x, player.y, 90.0f + 70.0f * ((i == 0) ? -1.0f : 1.0f), orb_dmg);
 								}
 							}
 							break;
@@ -146,8 +141,8 @@ namespace th {
 
 							if (frame % 4 == 0) {
 								for (int i = 0; i < 2; i++) {
-									reimu_shoot_orb(player.x, player.y, 90.0f + 50.0f * ((i == 0) ? -1.0f : 1.0f), orb_dmg);
-									reimu_shoot_orb(player.x, player.y, 90.0f + 70.0f * ((i == 0) ? -1.0f : 1.0f), orb_dmg);
+									reimu_shoot_orb(stage, player.x, player.y, 90.0f + 50.0f * ((i == 0) ? -1.0f : 1.0f), orb_dmg);
+									reimu_shoot_orb(stage, player.x, player.y, 90.0f + 70.0f * ((i == 0) ? -1.0f : 1.0f), orb_dmg);
 								}
 							}
 							break;
@@ -160,7 +155,7 @@ namespace th {
 							float off = 45.0f + 15.0f * (float)(frame % 3);
 
 							for (int i = 0; i < shot_count; i++) {
-								reimu_shoot_orb(player.x, player.y, 90.0f + ((i == 0) ? -off : off), orb_dmg);
+								reimu_shoot_orb(stage, player.x, player.y, 90.0f + ((i == 0) ? -off : off), orb_dmg);
 							}
 							break;
 						}
@@ -172,7 +167,7 @@ namespace th {
 							float off = 30.0f + 15.0f * (float)(frame % 4);
 
 							for (int i = 0; i < shot_count; i++) {
-								reimu_shoot_orb(player.x, player.y, 90.0f + ((i == 0) ? -off : off), orb_dmg);
+								reimu_shoot_orb(stage, player.x, player.y, 90.0f + ((i == 0) ? -off : off), orb_dmg);
 							}
 							break;
 						}
@@ -194,7 +189,7 @@ namespace th {
 		//}
 	}
 
-	static void reimu_bomb(size_t player_index) {
+	static void reimu_bomb(Stage& /*stage*/, size_t /*player_index*/) {
 
 	}
 
@@ -10,21 +10,21 @@
 #define TH_LINE_STRING TH_STRINGIZE(__LINE__)
 
 #define LOG(fmt, ...) \
-	SDL_Log(fmt, __VA_ARGS__)
+	SDL_Log(fmt, ##__VA_ARGS__)
 
 #define LOG_NO_LINE(fmt, ...) \
-	SDL_LogMessage(SDL_LOG_CATEGORY_CUSTOM, SDL_LOG_PRIORITY_INFO, fmt, __VA_ARGS__)
+	SDL_LogMessage(SDL_LOG_CATEGORY_CUSTOM, SDL_LOG_PRIORITY_INFO, fmt, ##__VA_ARGS__)
 
 #define LOG_FILE(fmt, ...) \
 	do { \
 		char file[] = __FILE__; \
 		std::string_view view(file, sizeof(file)); \
 		size_t pos = view.rfind('\\') + 1; \
-		SDL_Log("%s:" TH_LINE_STRING ": " fmt, file + pos, __VA_ARGS__); \
+		SDL_Log("%s:" TH_LINE_STRING ": " fmt, file + pos, ##__VA_ARGS__); \
 	} while (0)
 
 #define LOG_FUNC(fmt, ...) \
-	SDL_Log(__FUNCTION__ ": " fmt, __VA_ARGS__)
+	SDL_Log("%s: " fmt, __FUNCTION__, ##__VA_ARGS__)
 
 namespace th {
 
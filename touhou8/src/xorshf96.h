@@ -1,20 +1,22 @@
 #pragma once
 
+#include <stdint.h>
+
 namespace th {
 
 	class xorshf96 {
 	public:
-		xorshf96(unsigned long x=123456789, unsigned long y=362436069, unsigned long z=521288629)
+		xorshf96(uint32_t x=123456789, uint32_t y=362436069, uint32_t z=521288629)
 			: x(x), y(y), z(z) {}
 
-		void seed(unsigned long x=123456789, unsigned long y=362436069, unsigned long z=521288629) {
+		void seed(uint32_t x=123456789, uint32_t y=362436069, uint32_t z=521288629) {
 			this->x = x;
 			this->y = y;
 			this->z = z;
 		}
 
-		unsigned long operator()() {
-			unsigned long t;
+		uint32_t operator()() {
+			uint32_t t;
 
 			x ^= x << 16;
 			x ^= x >> 5;
@@ -29,7 +31,7 @@ namespace th {
 		}
 
 		float range(float a, float b) {
-			float r = (float)(*this)() / (float)ULONG_MAX;
+			float r = (float)(*this)() / (float)UINT32_MAX;
 			float range = b - a;
 			r = a + fmodf(range * r, range);
 			return r;
@@ -43,7 +45,7 @@ namespace th {
 		}
 
 	private:
-		unsigned long x, y, z;
+		uint32_t x, y, z;
 	};
 
 }
@@ -0,0 +1,144 @@
+#include "tests.h"
+
+#include "Game.h"
+
+namespace th {
+
+	static size_t LiveBullets(const BulletPool& pool) {
+		size_t result = 0;
+		for (size_t i = 0; i < pool.size(); i++) {
+			if (!(pool.flags[i] & OBJECT_FLAG_DEAD)) result++;
+		}
+		return result;
+	}
+
+	// merged pickups count for all of them
+	static size_t ScorePickups(const Stage& stage) {
+		size_t result = 0;
+		for (size_t i = 0; i < stage.pickups.size(); i++) {
+			if (stage.pickups.type[i] == PICKUP_SCORE && !(stage.pickups.flags[i] & OBJECT_FLAG_DEAD)) {
+				result += stage.pickups.count[i];
+			}
+		}
+		return result;
+	}
+
+	static size_t CanceledBullets(const BulletPool& pool) {
+		size_t result = 0;
+		for (size_t i = 0; i < pool.size(); i++) {
+			if (pool.flags[i] & OBJECT_FLAG_CANCELED) result++;
+		}
+		return result;
+	}
+
+	// Every bullet and laser alive when the phase ends turns into exactly one
+	// score pickup, none of them moves off or times out while it waits for
+	// the wave.
+	static void CheckCancelWave(int cancel_wave_frames, size_t pickup_merge_threshold) {
+		Options options;
+		Stage stage;
+		stage.Init(MakeTestContext(options));
+		stage.cancel_wave_frames = cancel_wave_frames;
+		stage.pickup_merge_threshold = pickup_merge_threshold;
+		StartTestPhase(stage);
+
+		for (int frame = 0; frame < 300; frame++) {
+			stage.player_input[0] = TestInput(0, frame);
+			stage.Update(1.0f);
+		}
+
+		size_t canceled = LiveBullets(stage.bullets) + LiveBullets(stage.lazers)
+			+ LiveBullets(stage.bullet_spawns) + LiveBullets(stage.lazer_spawns);
+		size_t pickups_before = ScorePickups(stage);
+		uint32_t overflows_before = stage.pool_stats[POOL_PICKUPS].overflows;
+		CHECK(canceled > 100);
+
+		// out of the way, so nothing gets collected while we count
+		Player& player = stage.players[0];
+		player.state = PlayerState::Appearing;
+		player.timer = 10000.0f;
+
+		stage.EndBossPhase(stage.bosses[0]);
+
+		// twice as long as the wave takes, and still moving the whole time
+		for (int frame = 0; frame < 2 * cancel_wave_frames + 2; frame++) {
+			stage.player_input[0] = 0;
+			stage.Update(1.0f);
+		}
+
+		CHECK(CanceledBullets(stage.bullets) == 0);
+		CHECK(CanceledBullets(stage.lazers) == 0);
+		CHECK(stage.pool_stats[POOL_PICKUPS].overflows == overflows_before);
+		CHECK(ScorePickups(stage) == pickups_before + canceled);
+
+		stage.Quit();
+	}
+
+	static size_t LivePickups(const Stage& stage) {
+		size_t result = 0;
+		for (size_t i = 0; i < stage.pickups.size(); i++) {
+			if (!(stage.pickups.flags[i] & OBJECT_FLAG_DEAD)) result++;
+		}
+		return result;
+	}
+
+	// The phase end pickups go through the pickup budget like any other,
+	// there are more bullets than room here.
+	static void CheckCancelBudget(int cancel_wave_frames, OverflowPolicy policy) {
+		Options options;
+		Stage stage;
+		stage.Init(MakeTestContext(options));
+		stage.cancel_wave_frames = cancel_wave_frames;
+		StartTestPhase(stage);
+
+		for (int frame = 0; frame < 300; frame++) {
+			stage.player_input[0] = TestInput(0, frame);
+			stage.Update(1.0f);
+		}
+
+		size_t budget = LivePickups(stage) + 50;
+		options.pool_budgets[POOL_PICKUPS] = {budget, policy};
+		CHECK(LiveBullets(stage.bullets) + LiveBullets(stage.lazers) > 100);
+
+		Player& player = stage.players[0];
+		player.state = PlayerState::Appearing;
+		player.timer = 10000.0f;
+
+		stage.EndBossPhase(stage.bosses[0]);
+
+		for (int frame = 0; frame < 2 * cancel_wave_frames + 2; frame++) {
+			stage.player_input[0] = 0;
+			stage.Update(1.0f);
+			CHECK(LivePickups(stage) <= budget);
+		}
+
+		CHECK(CanceledBullets(stage.bullets) == 0);
+		CHECK(CanceledBullets(stage.lazers) == 0);
+		CHECK(LivePickups(stage) == budget);
+
+		stage.Quit();
+	}
+
+	TEST(cancel_wave_pickups) {
+		CheckCancelWave(30, 0);
+	}
+
+	TEST(cancel_wave_pickups_merged) {
+		CheckCancelWave(30, 100);
+	}
+
+	TEST(cancel_at_once_pickups) {
+		CheckCancelWave(0, 0);
+	}
+
+	TEST(cancel_pickups_refused_over_budget) {
+		CheckCancelBudget(30, OVERFLOW_REFUSE);
+		CheckCancelBudget(0, OVERFLOW_REFUSE);
+	}
+
+	TEST(cancel_pickups_recycled_over_budget) {
+		CheckCancelBudget(30, OVERFLOW_RECYCLE_OLDEST);
+		CheckCancelBudget(0, OVERFLOW_RECYCLE_FARTHEST);
+	}
+
+}
@@ -0,0 +1,65 @@
+#include "tests.h"
+
+#include "Game.h"
+
+namespace th {
+
+	// A bullet and a rect right on the player, created in the given order.
+	// Whichever came first grazes and takes the hit, the other one doesn't
+	// even graze, whatever pool it is in and whichever collision path runs.
+	static void CheckFirstCreatedHits(bool lazer_first, bool broadphase, bool swept) {
+		Options options;
+		Stage stage;
+		stage.Init(MakeTestContext(options));
+		stage.collision_broadphase = broadphase;
+		stage.swept_collision = swept;
+
+		Player& player = stage.players[0];
+		player.state = PlayerState::Normal;
+		player.iframes = 0.0f;
+
+		for (int k = 0; k < 2; k++) {
+			if ((k == 0) == lazer_first) {
+				BulletPool& pool = stage.lazer_spawns;
+				size_t i = stage.CreateLazer();
+				pool.x[i] = player.x;
+				pool.y[i] = player.y;
+				pool.lazer_thickness[i] = 8.0f;
+				pool.lazer_target_length[i] = 8.0f;
+				pool.lazer_length[i] = 8.0f;
+				pool.type[i] = ProjectileType::Rect;
+				stage.SetDir(pool, i, 0.0f);
+			} else {
+				BulletPool& pool = stage.bullet_spawns;
+				size_t i = stage.CreateBullet();
+				pool.x[i] = player.x;
+				pool.y[i] = player.y;
+				pool.radius[i] = 4.0f;
+				stage.SetDir(pool, i, 0.0f);
+			}
+		}
+
+		stage.player_input[0] = 0;
+		stage.Update(1.0f);
+
+		CHECK(player.state == PlayerState::Dying);
+		CHECK(stage.stats[0].graze == 1);
+
+		BulletPool& left = lazer_first ? stage.bullets : stage.lazers;
+		CHECK(stage.bullets.size() + stage.lazers.size() == 1);
+		CHECK(left.size() == 1 && left.grazed_by[0] == 0);
+
+		stage.Quit();
+	}
+
+	TEST(collision_first_created_hits) {
+		for (bool lazer_first : {false, true}) {
+			for (bool broadphase : {false, true}) {
+				for (bool swept : {false, true}) {
+					CheckFirstCreatedHits(lazer_first, broadphase, swept);
+				}
+			}
+		}
+	}
+
+}
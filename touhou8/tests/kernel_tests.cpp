@@ -0,0 +1,223 @@
+#include "tests.h"
+
+#include "Kernels.h"
+#include "Objects.h"
+#include "cpml.h"
+
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+// not a multiple of any vector width, so every path runs its scalar tail too
+#define KERNEL_TEST_COUNT 1003
+
+namespace th {
+
+	// Bullets all over and around the play area, some of them dead, analytic
+	// or canceled, lasers still growing, and a few NaN positions and speeds.
+	struct KernelInput {
+		std::vector<float> x, y, spd, dir_x, dir_y, acc, timer, time, lifetime, lifespan;
+		std::vector<float> axis_x, axis_y, half_width, half_length, radius, hsp, vsp;
+		std::vector<uint32_t> flags;
+		std::vector<int32_t> homing;
+	};
+
+	static float RandomFloat(uint32_t& state, float lo, float hi) {
+		state = state * 1664525u + 1013904223u;
+		return lo + (hi - lo) * (float) (state >> 8) / (float) (1u << 24);
+	}
+
+	static KernelInput MakeKernelInput() {
+		KernelInput in;
+		uint32_t state = 12345;
+		size_t n = KERNEL_TEST_COUNT;
+
+		for (std::vector<float>* v : {&in.x, &in.y, &in.spd, &in.dir_x, &in.dir_y, &in.acc, &in.timer, &in.time,
+									  &in.lifetime, &in.lifespan, &in.axis_x, &in.axis_y, &in.half_width,
+									  &in.half_length, &in.radius, &in.hsp, &in.vsp}) {
+			v->resize(n);
+		}
+		in.flags.resize(n);
+		in.homing.resize(n);
+
+		for (size_t i = 0; i < n; i++) {
+			in.x[i] = RandomFloat(state, -80.0f, 464.0f);
+			in.y[i] = RandomFloat(state, -80.0f, 528.0f);
+			in.spd[i] = RandomFloat(state, 0.0f, 6.0f);
+			float dir = RandomFloat(state, 0.0f, 6.2831853f);
+			in.dir_x[i] = cosf(dir);
+			in.dir_y[i] = -sinf(dir);
+			in.acc[i] = RandomFloat(state, -0.5f, 0.2f);
+			in.timer[i] = RandomFloat(state, 0.0f, 30.0f);
+			in.time[i] = (i % 3 == 0) ? RandomFloat(state, 0.0f, 30.0f) : 0.0f;
+			in.lifetime[i] = RandomFloat(state, 0.0f, 600.0f);
+			in.lifespan[i] = (i % 5 == 0) ? RandomFloat(state, 0.0f, 600.0f) : 0.0f;
+			float angle = RandomFloat(state, 0.0f, 6.2831853f);
+			in.axis_x[i] = cosf(angle);
+			in.axis_y[i] = sinf(angle);
+			in.half_width[i] = RandomFloat(state, 0.5f, 8.0f);
+			in.half_length[i] = RandomFloat(state, 0.5f, 64.0f);
+			in.radius[i] = RandomFloat(state, 1.0f, 12.0f);
+			in.hsp[i] = RandomFloat(state, -3.0f, 3.0f);
+			in.vsp[i] = RandomFloat(state, -3.0f, 3.0f);
+			in.homing[i] = (i % 4 == 0) ? (int32_t) (i % 3) : -1;
+
+			static const uint32_t flag_choices[] = {0, 0, 0, OBJECT_FLAG_DEAD, OBJECT_FLAG_ANALYTIC, OBJECT_FLAG_CANCELED};
+			in.flags[i] = flag_choices[i % 6];
+		}
+
+		for (size_t i = 7; i < n; i += 97) {
+			in.x[i] = NAN;
+			in.spd[i - 1] = NAN;
+		}
+
+		// near the player, so the collision bits aren't all zero
+		for (size_t i = 0; i < n; i += 9) {
+			in.x[i] = 192.0f + RandomFloat(state, -20.0f, 20.0f);
+			in.y[i] = 400.0f + RandomFloat(state, -20.0f, 20.0f);
+		}
+
+		return in;
+	}
+
+	struct KernelOutput {
+		KernelInput state;
+		std::vector<uint32_t> circle_graze, circle_hit, box_graze, box_hit;
+	};
+
+	static KernelOutput RunKernels(const KernelInput& in) {
+		KernelOutput out;
+		out.state = in;
+		KernelInput& s = out.state;
+		size_t n = KERNEL_TEST_COUNT;
+		size_t words = (n + 31) / 32;
+
+		for (int frame = 0; frame < 4; frame++) {
+			MoveBulletsKernel(s.x.data(), s.y.data(), s.spd.data(), s.dir_x.data(), s.dir_y.data(), s.acc.data(),
+							  s.timer.data(), s.time.data(), s.flags.data(), n, 1.0f);
+			CullBulletsKernel(s.x.data(), s.y.data(), s.lifetime.data(), s.lifespan.data(), s.flags.data(), n, 1.0f,
+							  -32.0f, -32.0f, 416.0f, 480.0f);
+		}
+
+		out.circle_graze.assign(words, 0);
+		out.circle_hit.assign(words, 0);
+		CollideCirclesKernel(192.0f, 400.0f, 16.0f, 2.0f, s.x.data(), s.y.data(), s.radius.data(), n,
+							 out.circle_graze.data(), out.circle_hit.data());
+
+		out.box_graze.assign(words, 0);
+		out.box_hit.assign(words, 0);
+		CollideBoxesKernel(192.0f, 400.0f, 16.0f, 2.0f, s.x.data(), s.y.data(), s.axis_x.data(), s.axis_y.data(),
+						   s.half_width.data(), s.half_length.data(), n, out.box_graze.data(), out.box_hit.data());
+
+		float target_x[3] = {192.0f, 100.0f, 300.0f};
+		float target_y[3] = {400.0f, 420.0f, 380.0f};
+		UpdatePickupsKernel(s.x.data(), s.y.data(), s.hsp.data(), s.vsp.data(), s.homing.data(), n,
+							target_x, target_y, 3, 8.0f, 0.025f, 2.0f, 1.0f);
+
+		return out;
+	}
+
+	// bit for bit, NaNs included
+	static bool SameBits(const std::vector<float>& a, const std::vector<float>& b) {
+		return a.size() == b.size() && memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+	}
+
+	TEST(kernels_match_scalar) {
+		KernelPath old_path = GetKernelPath();
+		KernelInput in = MakeKernelInput();
+
+		SetKernelPath(KERNEL_PATH_SCALAR);
+		KernelOutput reference = RunKernels(in);
+
+		// the player is in the thick of it
+		bool any_hit = false;
+		for (uint32_t word : reference.circle_graze) any_hit |= word != 0;
+		CHECK(any_hit);
+
+		for (int path = KERNEL_PATH_SCALAR + 1; path < KERNEL_PATH_COUNT; path++) {
+			if (!IsKernelPathSupported((KernelPath) path)) {
+				LOG("%s: not supported, skipped", GetKernelPathName((KernelPath) path));
+				continue;
+			}
+
+			SetKernelPath((KernelPath) path);
+			KernelOutput out = RunKernels(in);
+
+			const KernelInput& a = out.state;
+			const KernelInput& b = reference.state;
+			CHECK(SameBits(a.x, b.x));
+			CHECK(SameBits(a.y, b.y));
+			CHECK(SameBits(a.spd, b.spd));
+			CHECK(SameBits(a.lifetime, b.lifetime));
+			CHECK(a.flags == b.flags);
+			CHECK(SameBits(a.hsp, b.hsp));
+			CHECK(SameBits(a.vsp, b.vsp));
+			CHECK(out.circle_graze == reference.circle_graze);
+			CHECK(out.circle_hit == reference.circle_hit);
+			CHECK(out.box_graze == reference.box_graze);
+			CHECK(out.box_hit == reference.box_hit);
+		}
+
+		SetKernelPath(old_path);
+	}
+
+	TEST(kernels_leave_still_bullets) {
+		KernelPath old_path = GetKernelPath();
+		KernelInput in = MakeKernelInput();
+
+		for (int path = 0; path < KERNEL_PATH_COUNT; path++) {
+			if (!IsKernelPathSupported((KernelPath) path)) continue;
+
+			SetKernelPath((KernelPath) path);
+			KernelOutput out = RunKernels(in);
+
+			// analytic and canceled bullets don't move, dead ones stay dead
+			for (size_t i = 0; i < KERNEL_TEST_COUNT; i++) {
+				if (in.flags[i] & (OBJECT_FLAG_ANALYTIC | OBJECT_FLAG_CANCELED)) {
+					CHECK(memcmp(&out.state.y[i], &in.y[i], sizeof(float)) == 0);
+				}
+				if (in.flags[i] & OBJECT_FLAG_DEAD) {
+					CHECK(out.state.flags[i] & OBJECT_FLAG_DEAD);
+				}
+			}
+		}
+
+		SetKernelPath(old_path);
+	}
+
+	// Script-less bullets move in closed form, and have to land where the
+	// steps put the scripted ones, at any step count.
+	TEST(analytic_matches_kernel) {
+		KernelInput in = MakeKernelInput();
+		size_t n = KERNEL_TEST_COUNT;
+
+		for (int substeps : {1, 3, 5}) {
+			float h = 1.0f / (float) substeps;
+			std::vector<float> x = in.x, y = in.y, spd = in.spd;
+			std::vector<uint32_t> flags(n, 0);
+
+			float t = 0.0f;
+			for (int step = 0; step < 120 * substeps; step++) {
+				MoveBulletsKernel(x.data(), y.data(), spd.data(), in.dir_x.data(), in.dir_y.data(), in.acc.data(),
+								  nullptr, nullptr, flags.data(), n, h);
+				t += h;
+			}
+
+			for (size_t i = 0; i < n; i++) {
+				if (!isfinite(in.x[i]) || !isfinite(in.y[i]) || !(in.spd[i] >= 0.0f)) continue;
+
+				float dist = cpml::accel_distance(in.spd[i], in.acc[i], t, h);
+				float tolerance = 0.01f + 0.001f * fabsf(dist);
+				CHECK(fabsf(in.x[i] + in.dir_x[i] * dist - x[i]) < tolerance);
+				CHECK(fabsf(in.y[i] + in.dir_y[i] * dist - y[i]) < tolerance);
+				CHECK(fabsf(cpml::accel_speed(in.spd[i], in.acc[i], t) - spd[i]) < 0.01f);
+
+				// and the time back from the distance, the ones that stopped never get further
+				if (dist > 1.0f && spd[i] > 0.0f) {
+					CHECK(cpml::accel_time(in.spd[i], in.acc[i], dist, h) <= t + 0.01f);
+				}
+			}
+		}
+	}
+
+}
@@ -0,0 +1,143 @@
+#include "tests.h"
+
+#include "Game.h"
+#include "Replay.h"
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#define REPLAY_TEST_FRAMES 600
+
+namespace th {
+
+	static std::string TestReplayPath(const char* name) {
+		return (std::filesystem::temp_directory_path() / name).string();
+	}
+
+	// Records a run from Stage::Init with a few settings off their defaults,
+	// and returns the checksum it ended on.
+	static uint64_t RecordTestReplay(const std::string& path) {
+		Options options;
+		options.starting_lives = 5;
+		options.stage_arena_size = 16 * 1024 * 1024;
+
+		Replay replay;
+		replay.ArmRecording(path.c_str());
+
+		Stage stage;
+		stage.Init(MakeTestContext(options, 987654321));
+		stage.physics_substeps = 3;
+		stage.swept_collision = !stage.swept_collision;
+		stage.cancel_wave_frames = 7;
+
+		replay.Begin(stage, 42);
+		for (int frame = 0; frame < REPLAY_TEST_FRAMES; frame++) {
+			stage.player_input[0] = TestInput(0, frame);
+			replay.Record(stage.player_input, stage.context.player_count);
+			stage.Update(1.0f);
+		}
+		replay.Stop();
+
+		uint64_t checksum = stage.GetChecksum();
+		stage.Quit();
+		return checksum;
+	}
+
+	TEST(replay_round_trip) {
+		std::string path = TestReplayPath("touhou8_test.rpy");
+		uint64_t recorded = RecordTestReplay(path);
+
+		Replay replay;
+		CHECK(replay.ArmPlayback(path.c_str()));
+
+		const ReplayHeader& header = replay.header;
+		CHECK(header.game_seed == 42);
+		CHECK(header.stage_seed == 987654321);
+		CHECK(header.player_count == 1);
+		CHECK(header.starting_lives == 5);
+		CHECK(header.stage_arena_size == 16 * 1024 * 1024);
+		CHECK(header.physics_substeps == 3);
+		CHECK(header.cancel_wave_frames == 7);
+		CHECK(header.frame_count == REPLAY_TEST_FRAMES);
+		CHECK(header.script_hash == HashScripts(GetTestAssets()));
+
+		// the way the game plays one back
+		Options options;
+		replay.ApplySettings(options);
+		CHECK(options.starting_lives == 5);
+
+		Stage stage;
+		stage.Init(MakeTestContext(options, header.stage_seed));
+		replay.Begin(stage, header.game_seed);
+		CHECK(stage.physics_substeps == 3);
+		CHECK(stage.cancel_wave_frames == 7);
+
+		while (replay.Next(stage.player_input, stage.context.player_count)) {
+			stage.Update(1.0f);
+		}
+
+		CHECK(replay.frame == REPLAY_TEST_FRAMES);
+		CHECK(stage.GetChecksum() == recorded);
+
+		stage.Quit();
+
+		// the player's own options come back with the end of the playback
+		replay.Stop();
+		CHECK(options.starting_lives == Options{}.starting_lives);
+		CHECK(options.stage_arena_size == Options{}.stage_arena_size);
+		std::filesystem::remove(path);
+	}
+
+	TEST(replay_refuses_bad_files) {
+		std::string path = TestReplayPath("touhou8_test.rpy");
+		std::string bad_path = TestReplayPath("touhou8_test_bad.rpy");
+		RecordTestReplay(path);
+
+		size_t size = 0;
+		uint8_t* data = (uint8_t*) SDL_LoadFile(path.c_str(), &size);
+		CHECK(data != nullptr);
+		if (!data) return;
+		std::vector<uint8_t> good(data, data + size);
+		SDL_free(data);
+
+		auto refuses = [&bad_path](const std::vector<uint8_t>& bytes) {
+			SDL_RWops* file = SDL_RWFromFile(bad_path.c_str(), "wb");
+			SDL_RWwrite(file, bytes.data(), 1, bytes.size());
+			SDL_RWclose(file);
+
+			Replay replay;
+			return !replay.ArmPlayback(bad_path.c_str()) && replay.mode == REPLAY_OFF;
+		};
+
+		// magic, version, two seeds, then the player count
+		const size_t player_count_at = 16;
+		const size_t arena_size_at = player_count_at + 4 + 1 + 4;
+
+		std::vector<uint8_t> bytes = good;
+		CHECK(!refuses(bytes));
+
+		bytes.resize(good.size() - 1);
+		CHECK(refuses(bytes));
+
+		bytes = good;
+		bytes[0] ^= 0xFF;
+		CHECK(refuses(bytes));
+
+		bytes = good;
+		bytes[player_count_at] = 0;
+		CHECK(refuses(bytes));
+
+		bytes = good;
+		bytes[player_count_at] = MAX_PLAYERS + 1;
+		CHECK(refuses(bytes));
+
+		bytes = good;
+		bytes[arena_size_at + 7] = 0x40; // 4 exabytes and change
+		CHECK(refuses(bytes));
+
+		std::filesystem::remove(path);
+		std::filesystem::remove(bad_path);
+	}
+
+}
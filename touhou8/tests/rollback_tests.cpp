@@ -0,0 +1,136 @@
+#include "tests.h"
+
+#include "Game.h"
+#include "Rollback.h"
+#include "Transport.h"
+
+#include <optional>
+
+#define ROLLBACK_TEST_FRAMES 600
+#define ROLLBACK_TEST_DELAY 2
+
+namespace th {
+
+	struct TestSession {
+		Options options;
+		SimulatedNetwork network;
+		std::optional<Stage> stages[MAX_PLAYERS];
+		std::optional<SimulatedTransport> transports[MAX_PLAYERS];
+		RollbackSession sessions[MAX_PLAYERS];
+		size_t player_count = 0;
+
+		TestSession(size_t _player_count, float latency_ms, float jitter_ms, float loss) {
+			player_count = _player_count;
+			network.latency_ms = latency_ms;
+			network.jitter_ms = jitter_ms;
+			network.loss = loss;
+
+			for (size_t i = 0; i < player_count; i++) {
+				SimContext context = MakeTestContext(options);
+				context.player_count = player_count;
+
+				stages[i].emplace();
+				stages[i]->Init(context);
+				StartTestPhase(*stages[i]);
+
+				transports[i].emplace(&network, i);
+				sessions[i].Init(&*stages[i], &*transports[i], i, player_count, ROLLBACK_TEST_DELAY);
+			}
+		}
+
+		~TestSession() {
+			for (size_t i = 0; i < player_count; i++) {
+				stages[i]->Quit();
+			}
+		}
+
+		// Every peer gets a turn each 60Hz tick until all of them have every
+		// input up to frames, or one desyncs. False if they never got there.
+		bool Run(uint32_t frames) {
+			for (uint32_t ticks = 0; ticks < frames * 100; ticks++) {
+				bool done = true;
+				for (size_t i = 0; i < player_count; i++) {
+					RollbackSession& session = sessions[i];
+					if (session.desynced) return true;
+
+					if (session.frame < frames) {
+						session.AdvanceFrame(TestInput(i, (int) session.frame));
+						done = false;
+					} else {
+						session.Idle();
+						done &= session.GetConfirmedFrame() >= frames;
+					}
+				}
+				if (done) return true;
+
+				network.Advance(1000.0 / 60.0);
+			}
+			return false;
+		}
+	};
+
+	// The same phase stepped with every input known up front: the local
+	// input of each frame lands ROLLBACK_TEST_DELAY frames later.
+	static uint64_t KnownInputChecksum(size_t player_count, uint32_t frames) {
+		Options options;
+		SimContext context = MakeTestContext(options);
+		context.player_count = player_count;
+
+		Stage stage;
+		stage.Init(context);
+		StartTestPhase(stage);
+
+		for (uint32_t frame = 0; frame < frames; frame++) {
+			for (size_t i = 0; i < player_count; i++) {
+				stage.player_input[i] = (frame >= ROLLBACK_TEST_DELAY) ? TestInput(i, (int) (frame - ROLLBACK_TEST_DELAY)) : 0;
+			}
+			stage.Update(1.0f);
+		}
+
+		uint64_t checksum = stage.GetChecksum();
+		stage.Quit();
+		return checksum;
+	}
+
+	TEST(rollback_matches_known_inputs) {
+		const size_t player_count = 3;
+		uint64_t expected = KnownInputChecksum(player_count, ROLLBACK_TEST_FRAMES);
+
+		TestSession test(player_count, 80.0f, 20.0f, 0.1f);
+		CHECK(test.Run(ROLLBACK_TEST_FRAMES));
+
+		uint32_t rollbacks = 0;
+		for (size_t i = 0; i < player_count; i++) {
+			const RollbackSession& session = test.sessions[i];
+			CHECK(!session.desynced);
+			CHECK(session.frame == ROLLBACK_TEST_FRAMES);
+			CHECK(test.stages[i]->GetChecksum() == expected);
+			rollbacks += session.rollbacks;
+		}
+
+		// or it didn't test much
+		CHECK(rollbacks > 0);
+	}
+
+	TEST(rollback_detects_desync) {
+		TestSession test(2, 50.0f, 10.0f, 0.0f);
+		CHECK(test.Run(100));
+		CHECK(!test.sessions[0].desynced && !test.sessions[1].desynced);
+
+		// a setting the snapshots don't hold, so rollbacks don't undo it
+		test.stages[1]->physics_substeps++;
+
+		CHECK(test.Run(ROLLBACK_TEST_FRAMES));
+		for (size_t i = 0; i < 2; i++) {
+			RollbackSession& session = test.sessions[i];
+			CHECK(session.desynced);
+			CHECK(session.desync_frame > 100 && session.desync_frame <= 100 + 2 * ROLLBACK_CHECKSUM_INTERVAL);
+
+			// over for good
+			uint32_t frame = session.frame;
+			CHECK(!session.AdvanceFrame(0));
+			CHECK(session.frame == frame);
+		}
+	}
+
+}
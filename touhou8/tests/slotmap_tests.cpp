@@ -0,0 +1,144 @@
+#include "tests.h"
+
+#include "SlotMap.h"
+#include "Snapshot.h"
+
+namespace th {
+
+	TEST(slotmap_lookup) {
+		SlotMap slots{TYPE_BULLET};
+
+		full_instance_id a = slots.Alloc(3);
+		full_instance_id b = slots.Alloc(7);
+		CHECK(a != b);
+		CHECK(INSTANCE_ID_GET_TYPE(a) == TYPE_BULLET);
+
+		uint32_t dense_index = 0;
+		CHECK(slots.Lookup(a, &dense_index) && dense_index == 3);
+		CHECK(slots.Lookup(b, &dense_index) && dense_index == 7);
+
+		slots.Move(b, 1);
+		CHECK(slots.Lookup(b, &dense_index) && dense_index == 1);
+
+		// same index and generation, another type
+		full_instance_id other = MAKE_INSTANCE_ID(INSTANCE_ID_GET_INDEX(a), INSTANCE_ID_GET_GENERATION(a), TYPE_LAZER);
+		CHECK(!slots.Lookup(other, &dense_index));
+		CHECK(!slots.Lookup(NULL_INSTANCE_ID, &dense_index));
+	}
+
+	TEST(slotmap_reuse_is_stale) {
+		SlotMap slots{TYPE_ENEMY};
+
+		full_instance_id old_id = slots.Alloc(0);
+		slots.Free(old_id);
+
+		uint32_t dense_index = 0;
+		CHECK(!slots.Lookup(old_id, &dense_index));
+
+		// the slot comes back with the next generation
+		full_instance_id new_id = slots.Alloc(5);
+		CHECK(INSTANCE_ID_GET_INDEX(new_id) == INSTANCE_ID_GET_INDEX(old_id));
+		CHECK(INSTANCE_ID_GET_GENERATION(new_id) != INSTANCE_ID_GET_GENERATION(old_id));
+		CHECK(slots.GetSlotCount() == 1);
+
+		CHECK(!slots.Lookup(old_id, &dense_index));
+		CHECK(slots.Lookup(new_id, &dense_index) && dense_index == 5);
+
+		// a stale handle can't free or move what reused its slot
+		slots.Free(old_id);
+		slots.Move(old_id, 9);
+		CHECK(slots.Lookup(new_id, &dense_index) && dense_index == 5);
+
+		slots.FreeAll();
+		CHECK(!slots.Lookup(new_id, &dense_index));
+	}
+
+	TEST(slotmap_reuse_oldest_first) {
+		SlotMap slots{TYPE_BULLET};
+
+		full_instance_id a = slots.Alloc(0);
+		full_instance_id b = slots.Alloc(1);
+		full_instance_id c = slots.Alloc(2);
+		slots.Free(b);
+		slots.Free(a);
+		slots.Free(c);
+
+		CHECK(INSTANCE_ID_GET_INDEX(slots.Alloc(0)) == INSTANCE_ID_GET_INDEX(b));
+		CHECK(INSTANCE_ID_GET_INDEX(slots.Alloc(0)) == INSTANCE_ID_GET_INDEX(a));
+		CHECK(INSTANCE_ID_GET_INDEX(slots.Alloc(0)) == INSTANCE_ID_GET_INDEX(c));
+		CHECK(slots.GetSlotCount() == 3);
+	}
+
+	TEST(slotmap_wraparound) {
+		SlotMap slots{TYPE_BULLET};
+
+		// one slot through every generation it has
+		full_instance_id first = slots.Alloc(0);
+		full_instance_id id = first;
+		for (uint32_t generation = 0; generation < _GENERATION_PART_MASK; generation++) {
+			slots.Free(id);
+			id = slots.Alloc(0);
+			CHECK(INSTANCE_ID_GET_INDEX(id) == INSTANCE_ID_GET_INDEX(first));
+		}
+		CHECK(INSTANCE_ID_GET_GENERATION(id) == _GENERATION_PART_MASK);
+
+		// retired instead of going back to generation 0
+		slots.Free(id);
+		full_instance_id next = slots.Alloc(7);
+		CHECK(INSTANCE_ID_GET_INDEX(next) != INSTANCE_ID_GET_INDEX(first));
+		CHECK(slots.GetSlotCount() == 2);
+
+		uint32_t dense_index = 0;
+		CHECK(!slots.Lookup(first, &dense_index));
+		CHECK(!slots.Lookup(id, &dense_index));
+		CHECK(slots.Lookup(next, &dense_index) && dense_index == 7);
+
+		// and stays that way through a FreeAll
+		slots.FreeAll();
+		CHECK(slots.Alloc(0) == MAKE_INSTANCE_ID(INSTANCE_ID_GET_INDEX(next), 1, TYPE_BULLET));
+		CHECK(!slots.Lookup(first, &dense_index));
+	}
+
+	TEST(slotmap_full) {
+		SlotMap slots{TYPE_BULLET};
+		slots.Reserve(_INDEX_PART_MASK + 1);
+
+		full_instance_id last = NULL_INSTANCE_ID;
+		for (uint32_t i = 0; i <= _INDEX_PART_MASK; i++) {
+			CHECK(!slots.Full());
+			last = slots.Alloc(i);
+		}
+		CHECK(last != NULL_INSTANCE_ID);
+		CHECK(slots.Full());
+		CHECK(slots.Alloc(0) == NULL_INSTANCE_ID);
+
+		slots.Free(last);
+		CHECK(!slots.Full());
+		CHECK(slots.Alloc(0) != NULL_INSTANCE_ID);
+	}
+
+	TEST(slotmap_snapshot) {
+		SlotMap slots{TYPE_LAZER};
+		full_instance_id kept = slots.Alloc(2);
+		full_instance_id freed = slots.Alloc(4);
+		slots.Free(freed);
+
+		SnapshotWriter writer;
+		slots.Save(writer);
+
+		full_instance_id later = slots.Alloc(6);
+
+		SnapshotReader reader(writer.data.data(), writer.data.size());
+		slots.Load(reader);
+		CHECK(reader.ok);
+
+		uint32_t dense_index = 0;
+		CHECK(slots.Lookup(kept, &dense_index) && dense_index == 2);
+		CHECK(!slots.Lookup(freed, &dense_index));
+		CHECK(!slots.Lookup(later, &dense_index));
+
+		// hands out the same id again, so a resimulation gets the same ones
+		CHECK(slots.Alloc(6) == later);
+	}
+
+}
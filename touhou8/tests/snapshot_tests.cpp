@@ -0,0 +1,109 @@
+#include "tests.h"
+
+#include "Game.h"
+#include "Snapshot.h"
+
+namespace th {
+
+	// checksum after frames more frames of TestInput, starting at first_frame
+	static uint64_t StepTestStage(Stage& stage, int first_frame, int frames) {
+		for (int frame = first_frame; frame < first_frame + frames; frame++) {
+			stage.player_input[0] = TestInput(0, frame);
+			stage.Update(1.0f);
+		}
+		return stage.GetChecksum();
+	}
+
+	TEST(snapshot_round_trip) {
+		Options options;
+		Stage stage;
+		stage.Init(MakeTestContext(options));
+		StartTestPhase(stage);
+		StepTestStage(stage, 0, 300);
+		CHECK(stage.bullets.size() > 0);
+
+		for (bool compress : {false, true}) {
+			StageSnapshot snapshot;
+			stage.SaveSnapshot(&snapshot, compress);
+			CHECK(snapshot.compressed == compress);
+			uint64_t at_save = stage.GetChecksum();
+			size_t bullets_at_save = stage.bullets.size();
+
+			uint64_t first = StepTestStage(stage, 300, 120);
+			CHECK(first != at_save);
+
+			// the same inputs from the snapshot end in the same place
+			CHECK(stage.LoadSnapshot(snapshot));
+			CHECK(stage.GetChecksum() == at_save);
+			CHECK(stage.bullets.size() == bullets_at_save);
+			CHECK(StepTestStage(stage, 300, 120) == first);
+
+			// and so does loading it twice
+			CHECK(stage.LoadSnapshot(snapshot));
+			CHECK(StepTestStage(stage, 300, 120) == first);
+		}
+
+		stage.Quit();
+	}
+
+	TEST(snapshot_refuses_bad_blobs) {
+		Options options;
+		Stage stage;
+		stage.Init(MakeTestContext(options));
+		StartTestPhase(stage);
+		StepTestStage(stage, 0, 120);
+
+		StageSnapshot good;
+		stage.SaveSnapshot(&good, false);
+		StageSnapshot compressed;
+		stage.SaveSnapshot(&compressed, true);
+
+		uint64_t live = StepTestStage(stage, 120, 30);
+		size_t live_bullets = stage.bullets.size();
+
+		// none of these may change anything
+		auto refused = [&](const StageSnapshot& snapshot) {
+			bool loaded = stage.LoadSnapshot(snapshot);
+			return !loaded && stage.GetChecksum() == live && stage.bullets.size() == live_bullets;
+		};
+
+		StageSnapshot bad = good;
+		bad.data.resize(good.data.size() / 2);
+		bad.raw_size = bad.data.size();
+		CHECK(refused(bad));
+
+		bad = good;
+		bad.data.pop_back();
+		bad.raw_size = bad.data.size();
+		CHECK(refused(bad));
+
+		bad = good;
+		bad.data.back() ^= 0xFF;
+		CHECK(refused(bad));
+
+		bad = good;
+		bad.data[0] ^= 0xFF;
+		CHECK(refused(bad));
+
+		bad = compressed;
+		bad.data.resize(bad.data.size() / 2);
+		CHECK(refused(bad));
+
+		CHECK(refused(StageSnapshot{}));
+
+		// a snapshot of another stage
+		Stage other;
+		other.Init(MakeTestContext(options));
+		StageSnapshot theirs;
+		other.SaveSnapshot(&theirs, false);
+		CHECK(refused(theirs));
+		other.Quit();
+
+		// the good one still loads after all that
+		CHECK(stage.LoadSnapshot(good));
+		CHECK(StepTestStage(stage, 120, 30) == live);
+
+		stage.Quit();
+	}
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+// A test is a function registered under a name with TEST. CHECK logs the
+// failing condition and marks the test failed, the test goes on. The
+// touhou8_tests executable runs the test named on its command line, or all
+// of them, see tests_main.cpp.
+
+#include <SDL.h>
+
+#include "Stage.h"
+
+#include "utils.h"
+
+namespace th {
+
+	struct Options;
+
+	typedef void (*TestFunc)();
+
+	struct TestCase {
+		const char* name;
+		TestFunc func;
+		TestCase* next;
+	};
+
+	// registers at static init, in no particular order
+	struct TestRegistrar {
+		TestRegistrar(TestCase* test);
+	};
+
+	extern bool test_failed;
+
+	// The assets and data tables, loaded by the first test that asks and
+	// kept for the rest of the run.
+	Assets& GetTestAssets();
+
+	// One player on the test assets with options, stepping inline. Stages
+	// made from it can't Update at the same time.
+	SimContext MakeTestContext(const Options& options, uint32_t seed = 123456789);
+
+	// a boss in Boss0_Phase3 that never dies or times out, so there's
+	// plenty on screen
+	void StartTestPhase(Stage& stage);
+
+	// fires all the time and sways left and right, once a second each way,
+	// the others up and down and not in step
+	InputState TestInput(size_t player_index, int frame);
+
+}
+
+#define TEST(name) \
+	static void test_##name(); \
+	static th::TestCase test_case_##name{#name, test_##name, nullptr}; \
+	static th::TestRegistrar test_registrar_##name{&test_case_##name}; \
+	static void test_##name()
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			LOG("%s:%d: CHECK(%s) failed", __FILE__, __LINE__, #cond); \
+			th::test_failed = true; \
+		} \
+	} while (0)
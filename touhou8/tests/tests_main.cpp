@@ -0,0 +1,95 @@
+// Runs the test named on the command line, or every test when there is
+// none. Each add_test in the CMakeLists.txt at the top of the repo runs
+// one, from touhou8/ since some of them load the assets.
+//
+//   touhou8_tests [name]
+
+#include "tests.h"
+
+#include "Assets.h"
+#include "GameData.h"
+#include "JobSystem.h"
+
+#include <float.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace th {
+
+	bool test_failed = false;
+
+	static TestCase* first_test = nullptr;
+
+	TestRegistrar::TestRegistrar(TestCase* test) {
+		test->next = first_test;
+		first_test = test;
+	}
+
+	Assets& GetTestAssets() {
+		static Assets assets;
+		static bool loaded = false;
+		if (!loaded) {
+			if (!assets.LoadAssets(nullptr)) {
+				LOG("Couldn't load assets, run from the touhou8 folder");
+				exit(1);
+			}
+			FillDataTables();
+			loaded = true;
+		}
+		return assets;
+	}
+
+	SimContext MakeTestContext(const Options& options, uint32_t seed) {
+		static JobSystem jobs; // one worker, the calling thread
+
+		SimContext context;
+		context.assets = &GetTestAssets();
+		context.options = &options;
+		context.jobs = &jobs;
+		context.seed = seed;
+		context.player_count = 1;
+		return context;
+	}
+
+	void StartTestPhase(Stage& stage) {
+		Boss& boss = stage.CreateBoss(0);
+		boss.phase_index = 3;
+		stage.StartBossPhase(boss);
+		boss.hp = FLT_MAX;
+		boss.timer = FLT_MAX;
+	}
+
+	InputState TestInput(size_t player_index, int frame) {
+		if (player_index == 0) {
+			return INPUT_FIRE | ((frame / 60) % 2 ? INPUT_LEFT : INPUT_RIGHT);
+		}
+		return INPUT_FIRE | ((frame / (23 + 11 * (int) player_index)) % 2 ? INPUT_UP : INPUT_DOWN);
+	}
+
+}
+
+int main(int argc, char* argv[]) {
+	using namespace th;
+
+	const char* only = (argc > 1) ? argv[1] : nullptr;
+
+	int ran = 0;
+	int failed = 0;
+	for (TestCase* test = first_test; test; test = test->next) {
+		if (only && strcmp(only, test->name) != 0) continue;
+
+		test_failed = false;
+		test->func();
+		LOG("%s: %s", test->name, test_failed ? "FAILED" : "ok");
+
+		ran++;
+		failed += test_failed;
+	}
+
+	if (ran == 0) {
+		LOG("No test named %s", only ? only : "anything");
+		return 1;
+	}
+
+	return failed ? 1 : 0;
+}